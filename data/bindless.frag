@@ -0,0 +1,62 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec2 inUV;
+
+// Material features, set per pipeline variant through VkSpecializationInfo
+layout (constant_id = 0) const bool USE_VERTEX_COLOR = true;
+layout (constant_id = 1) const bool USE_ALPHA_TEST = false;
+layout (constant_id = 3) const bool USE_TEXTURE = false;
+
+// BindlessMaterialData in src/bindless.h
+struct MaterialData
+{
+	vec4 baseColor;
+	float alphaCutoff;
+	uint texture;
+	uint padding0;
+	uint padding1;
+};
+
+// The material table is buffer slot 0 (BINDLESS_MATERIAL_TABLE)
+layout (set = 0, binding = 0) readonly buffer MaterialTable
+{
+	MaterialData materials[];
+} materialTables[];
+
+// Streamed textures, the slot of a texture never changes while it lives
+layout (set = 0, binding = 1) uniform sampler2D textures[];
+
+layout (push_constant) uniform DrawParams
+{
+	uint materialIndex;
+	uint sceneBuffer;
+} draw;
+
+layout (location = 0) out vec4 outFragColor;
+
+void main() 
+{
+  MaterialData material = materialTables[0].materials[draw.materialIndex];
+
+  // the vertex colors cover as much as their brightest channel, which
+  // cuts the darker middle of the triangle out for the alpha test
+  vec4 color = USE_VERTEX_COLOR ? vec4(inColor, max(inColor.r, max(inColor.g, inColor.b))) : material.baseColor;
+
+  // the index is the same for the whole draw, no nonuniformEXT needed
+  if (USE_TEXTURE)
+  {
+    color *= texture(textures[material.texture], inUV);
+  }
+
+  if (USE_ALPHA_TEST && color.a < material.alphaCutoff)
+  {
+    discard;
+  }
+
+  outFragColor = color;
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inColor;
+layout (location = 2) in vec2 inUV;
+// per instance, from the vertex buffer at MATERIAL_INSTANCE_BIND_ID
+layout (location = 3) in mat4 inInstance;
+
+// Every buffer is a slot of the storage buffer array at binding 0,
+// the scene uniforms are one of them
+layout (set = 0, binding = 0) readonly buffer SceneBuffer
+{
+	mat4 projectionMatrix;
+	mat4 modelMatrix;
+	mat4 viewMatrix;
+} sceneBuffers[];
+
+layout (push_constant) uniform DrawParams
+{
+	uint materialIndex;
+	uint sceneBuffer;
+} draw;
+
+layout (location = 0) out vec3 outColor;
+layout (location = 1) out vec2 outUV;
+
+out gl_PerVertex 
+{
+    vec4 gl_Position;   
+};
+
+
+void main() 
+{
+	outColor = inColor;
+	outUV = inUV;
+
+	mat4 projectionMatrix = sceneBuffers[draw.sceneBuffer].projectionMatrix;
+	mat4 viewMatrix = sceneBuffers[draw.sceneBuffer].viewMatrix;
+
+	gl_Position = projectionMatrix * viewMatrix * inInstance * vec4(inPos, 1.0);
+}
\ No newline at end of file
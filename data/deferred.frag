@@ -0,0 +1,107 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Lights one pixel of the G-buffer with the lights of its cluster. The
+// G-buffer and depth are input attachments, only the pixel's own values
+// can be read, which keeps them in tile memory on tiled GPUs
+
+layout (input_attachment_index = 0, binding = 0) uniform subpassInput inAlbedo;
+layout (input_attachment_index = 1, binding = 1) uniform subpassInput inNormal;
+layout (input_attachment_index = 2, binding = 2) uniform subpassInput inDepth;
+
+// must match LIGHT_MAX_PER_CLUSTER in src/lighting.h
+const uint MAX_LIGHTS_PER_CLUSTER = 127;
+
+// light that reaches everything, as in triangle.frag
+const vec3 AMBIENT_LIGHT = vec3(0.08);
+
+struct Light
+{
+	vec4 positionRange;
+	vec4 colorCosOuter;
+	vec4 directionCosInner;
+};
+
+struct LightCluster
+{
+	uint count;
+	uint lights[MAX_LIGHTS_PER_CLUSTER];
+};
+
+// The same buffers as bindings 1 to 3 of the forward pass
+layout (std430, binding = 3) readonly buffer ClusterGrid
+{
+	uvec4 gridSize;
+	vec4 sliceParams;	// tile width and height in pixels, slice scale and bias
+} grid;
+
+layout (std430, binding = 4) readonly buffer ViewLights
+{
+	Light lights[];
+};
+
+layout (std430, binding = 5) readonly buffer LightClusters
+{
+	LightCluster clusters[];
+};
+
+layout (push_constant) uniform LightingParams
+{
+	mat4 inverseProjection;
+	vec2 viewportSize;
+	uint lit;
+} params;
+
+layout (location = 0) out vec4 outFragColor;
+
+void main() 
+{
+	vec4 albedo = subpassLoad(inAlbedo);
+	float depth = subpassLoad(inDepth).r;
+
+	// the background holds the clear color, nothing to light
+	if (params.lit == 0 || depth >= 1.0)
+	{
+		outFragColor = albedo;
+		return;
+	}
+
+	vec3 normal = normalize(subpassLoad(inNormal).xyz * 2.0 - 1.0);
+
+	// the view space position from the depth of the pixel
+	vec4 ndc = vec4(gl_FragCoord.xy / params.viewportSize * 2.0 - 1.0, depth, 1.0);
+	vec4 view = params.inverseProjection * ndc;
+	vec3 viewPos = view.xyz / view.w;
+
+	uvec3 cell;
+	cell.xy = min(uvec2(gl_FragCoord.xy / grid.sliceParams.xy), grid.gridSize.xy - 1);
+	cell.z = uint(clamp(log(-viewPos.z) * grid.sliceParams.z + grid.sliceParams.w, 0.0, float(grid.gridSize.z - 1)));
+	uint cluster = cell.x + (cell.y + cell.z * grid.gridSize.y) * grid.gridSize.x;
+
+	vec3 lit = AMBIENT_LIGHT;
+	uint count = clusters[cluster].count;
+	for (uint i = 0; i < count; i++)
+	{
+		Light light = lights[clusters[cluster].lights[i]];
+
+		vec3 toLight = light.positionRange.xyz - viewPos;
+		float distance = length(toLight);
+		toLight /= max(distance, 1e-4);
+
+		// smooth falloff that reaches zero at the range
+		float falloff = clamp(1.0 - pow(distance / light.positionRange.w, 2.0), 0.0, 1.0);
+		falloff *= falloff;
+
+		float spot = 1.0;
+		if (light.colorCosOuter.w >= -1.0)
+		{
+			spot = smoothstep(light.colorCosOuter.w, light.directionCosInner.w, dot(-toLight, light.directionCosInner.xyz));
+		}
+
+		lit += light.colorCosOuter.rgb * max(dot(normal, toLight), 0.0) * falloff * spot;
+	}
+
+	outFragColor = vec4(albedo.rgb * lit, albedo.a);
+}
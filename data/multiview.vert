@@ -0,0 +1,44 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_EXT_multiview : enable
+
+// triangle.vert for the multiview render pass. It runs once per view and
+// takes the matrices of gl_ViewIndex, the rest is the same
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inColor;
+// the instance's world transform, as in triangle.vert
+layout (location = 3) in mat4 inInstance;
+
+// must match MULTIVIEW_MAX_VIEWS in src/multiview.h
+const int MAX_VIEWS = 6;
+
+layout (binding = 0) uniform UBO 
+{
+	mat4 projectionMatrix;
+	mat4 modelMatrix;
+	mat4 viewMatrix;
+	mat4 viewMatrices[MAX_VIEWS];
+	mat4 projectionMatrices[MAX_VIEWS];
+} ubo;
+
+layout (location = 0) out vec3 outColor;
+layout (location = 1) out vec3 outViewPos;
+
+out gl_PerVertex 
+{
+    vec4 gl_Position;   
+};
+
+
+void main() 
+{
+	outColor = inColor;
+
+	vec4 viewPos = ubo.viewMatrices[gl_ViewIndex] * inInstance * vec4(inPos, 1.0);
+	outViewPos = viewPos.xyz;
+
+	gl_Position = ubo.projectionMatrices[gl_ViewIndex] * viewPos;
+}
@@ -4,10 +4,131 @@
 #extension GL_ARB_shading_language_420pack : enable
 
 layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec3 inViewPos;
+
+// Material features, set per pipeline variant through VkSpecializationInfo
+layout (constant_id = 0) const bool USE_VERTEX_COLOR = true;
+layout (constant_id = 1) const bool USE_ALPHA_TEST = false;
+layout (constant_id = 4) const bool USE_LIGHTING = false;
+layout (constant_id = 5) const bool WRITE_GBUFFER = false;
+
+layout (push_constant) uniform MaterialParams
+{
+	vec4 baseColor;
+	float alphaCutoff;
+} material;
+
+// must match LIGHT_MAX_PER_CLUSTER in src/lighting.h
+const uint MAX_LIGHTS_PER_CLUSTER = 127;
+
+// light that reaches everything, so unlit parts don't go black
+const vec3 AMBIENT_LIGHT = vec3(0.08);
+
+struct Light
+{
+	vec4 positionRange;
+	vec4 colorCosOuter;
+	vec4 directionCosInner;
+};
+
+struct LightCluster
+{
+	uint count;
+	uint lights[MAX_LIGHTS_PER_CLUSTER];
+};
+
+// The clusters and their lights, listed by data/lightbin.comp every frame.
+// Only the grid parameters at the start of the grid buffer are read here
+layout (std430, binding = 1) readonly buffer ClusterGrid
+{
+	uvec4 gridSize;
+	vec4 sliceParams;	// tile width and height in pixels, slice scale and bias
+} grid;
+
+layout (std430, binding = 2) readonly buffer ViewLights
+{
+	Light lights[];
+};
+
+layout (std430, binding = 3) readonly buffer LightClusters
+{
+	LightCluster clusters[];
+};
 
 layout (location = 0) out vec4 outFragColor;
+// the view space normal of the G-buffer, only written in deferred mode
+layout (location = 1) out vec4 outNormal;
+
+// faceted normal, turned towards the eye since both sides are drawn
+vec3 facetNormal()
+{
+	vec3 normal = normalize(cross(dFdx(inViewPos), dFdy(inViewPos)));
+	if (dot(normal, inViewPos) > 0.0)
+	{
+		normal = -normal;
+	}
+	return normal;
+}
+
+// Only the lights listed for the cluster the fragment is in
+vec3 shadeClustered(vec3 albedo)
+{
+	vec3 normal = facetNormal();
+
+	uvec3 cell;
+	cell.xy = min(uvec2(gl_FragCoord.xy / grid.sliceParams.xy), grid.gridSize.xy - 1);
+	cell.z = uint(clamp(log(-inViewPos.z) * grid.sliceParams.z + grid.sliceParams.w, 0.0, float(grid.gridSize.z - 1)));
+	uint cluster = cell.x + (cell.y + cell.z * grid.gridSize.y) * grid.gridSize.x;
+
+	vec3 lit = AMBIENT_LIGHT;
+	uint count = clusters[cluster].count;
+	for (uint i = 0; i < count; i++)
+	{
+		Light light = lights[clusters[cluster].lights[i]];
+
+		vec3 toLight = light.positionRange.xyz - inViewPos;
+		float distance = length(toLight);
+		toLight /= max(distance, 1e-4);
+
+		// smooth falloff that reaches zero at the range
+		float falloff = clamp(1.0 - pow(distance / light.positionRange.w, 2.0), 0.0, 1.0);
+		falloff *= falloff;
+
+		float spot = 1.0;
+		if (light.colorCosOuter.w >= -1.0)
+		{
+			spot = smoothstep(light.colorCosOuter.w, light.directionCosInner.w, dot(-toLight, light.directionCosInner.xyz));
+		}
+
+		lit += light.colorCosOuter.rgb * max(dot(normal, toLight), 0.0) * falloff * spot;
+	}
+
+	return albedo * lit;
+}
 
 void main() 
 {
-  outFragColor = vec4(inColor, 1.0);
-}
\ No newline at end of file
+  // the vertex colors cover as much as their brightest channel, which
+  // cuts the darker middle of the triangle out for the alpha test
+  vec4 color = USE_VERTEX_COLOR ? vec4(inColor, max(inColor.r, max(inColor.g, inColor.b))) : material.baseColor;
+
+  if (USE_ALPHA_TEST && color.a < material.alphaCutoff)
+  {
+    discard;
+  }
+
+  // data/deferred.frag lights the G-buffer later on
+  if (WRITE_GBUFFER)
+  {
+    outFragColor = color;
+    outNormal = vec4(facetNormal() * 0.5 + 0.5, 0.0);
+    return;
+  }
+
+  if (USE_LIGHTING)
+  {
+    color.rgb = shadeClustered(color.rgb);
+  }
+
+  outFragColor = color;
+}
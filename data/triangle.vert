@@ -5,6 +5,9 @@
 
 layout (location = 0) in vec3 inPos;
 layout (location = 1) in vec3 inColor;
+// World transform of the instance, the model's with the instance's place
+// below it. MATERIAL_INSTANCE_BIND_ID in src/material.h
+layout (location = 3) in mat4 inInstance;
 
 layout (binding = 0) uniform UBO 
 {
@@ -14,6 +17,8 @@ layout (binding = 0) uniform UBO
 } ubo;
 
 layout (location = 0) out vec3 outColor;
+// for the lights, which are in view space
+layout (location = 1) out vec3 outViewPos;
 
 out gl_PerVertex 
 {
@@ -24,5 +29,9 @@ out gl_PerVertex
 void main() 
 {
 	outColor = inColor;
-	gl_Position = ubo.projectionMatrix * ubo.viewMatrix * ubo.modelMatrix * vec4(inPos.xyz, 1.0);
-}
+
+	vec4 viewPos = ubo.viewMatrix * inInstance * vec4(inPos, 1.0);
+	outViewPos = viewPos.xyz;
+
+	gl_Position = ubo.projectionMatrix * viewPos;
+}
\ No newline at end of file
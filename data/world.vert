@@ -0,0 +1,43 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// triangle.vert for the objects of the streamed world cells. Each instance
+// is one object of the object buffer, which places the mesh in the world
+// instead of the model matrix
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inColor;
+// WorldObject in src/world.h, position and scale
+layout (location = 3) in vec4 inObject;
+
+layout (binding = 0) uniform UBO
+{
+	mat4 projectionMatrix;
+	mat4 modelMatrix;
+	mat4 viewMatrix;
+} ubo;
+
+layout (location = 0) out vec3 outColor;
+// for the lights, which are in view space
+layout (location = 1) out vec3 outViewPos;
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+
+void main()
+{
+	outColor = inColor;
+
+	// objects past the end of a cell are zero and collapse to a point
+	vec3 pos = inPos * inObject.w + inObject.xyz;
+
+	vec4 viewPos = ubo.viewMatrix * vec4(pos, 1.0);
+	outViewPos = viewPos.xyz;
+
+	gl_Position = ubo.projectionMatrix * viewPos;
+}
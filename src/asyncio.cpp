@@ -0,0 +1,482 @@
+/*
+    Asynchronous file reads, batched through io_uring or spread over reader threads
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define ASYNC_IO_HAS_RING 1
+#endif
+
+FileData::~FileData()
+{
+    if (mapping != nullptr)
+    {
+        munmap(mapping, size);
+    }
+}
+
+static void completeRead(FileRead *read, bool ok)
+{
+    AsyncIo &asyncIo = g_app.asyncIo;
+
+    if (read->fd >= 0)
+    {
+        close(read->fd);
+        read->fd = -1;
+    }
+
+    read->file->ok = ok;
+    if (!ok && !read->file->missing)
+    {
+        printf("Could not read %s\n", read->path.c_str());
+    }
+
+    FileDataPtr file = read->file;
+    if (read->callback != nullptr)
+    {
+        read->callback(read->path.c_str(), file, read->userData);
+    }
+    read->promise.set_value(file);
+
+    {
+        std::lock_guard<std::mutex> guard(asyncIo.lock);
+        asyncIo.completedReads++;
+    }
+
+    delete read;
+}
+
+// Opens the file and sets up its FileData. Returns false when the read is
+// already complete: the file couldn't be opened, was empty or was mapped
+static bool openFileRead(FileRead *read)
+{
+    read->file = std::make_shared<FileData>();
+    read->offset = 0;
+
+    read->fd = open(read->path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (read->fd < 0)
+    {
+        read->file->missing = (errno == ENOENT);
+        completeRead(read, false);
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(read->fd, &fileStat) != 0)
+    {
+        completeRead(read, false);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(fileStat.st_size);
+    read->file->size = size;
+
+    if (size == 0)
+    {
+        completeRead(read, true);
+        return false;
+    }
+
+    if (size >= ASYNC_IO_MAP_SIZE)
+    {
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, read->fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            completeRead(read, false);
+            return false;
+        }
+
+        read->file->mapping = mapping;
+        read->file->data = static_cast<const uint8_t*>(mapping);
+        completeRead(read, true);
+        return false;
+    }
+
+    read->file->buffer.resize(size);
+    read->file->data = read->file->buffer.data();
+    return true;
+}
+
+static void readWithPread(FileRead *read)
+{
+    if (!openFileRead(read))
+    {
+        return;
+    }
+
+    FileData &file = *read->file;
+    while (read->offset < file.size)
+    {
+        ssize_t result = pread(read->fd, &file.buffer[read->offset], file.size - read->offset, static_cast<off_t>(read->offset));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            break;
+        }
+        read->offset += static_cast<size_t>(result);
+    }
+
+    // a file that got shorter while it was read ends where the reads did
+    file.size = read->offset;
+    completeRead(read, read->offset > 0 || file.buffer.empty());
+}
+
+static void readerThread()
+{
+    AsyncIo &asyncIo = g_app.asyncIo;
+
+    for (;;)
+    {
+        FileRead *read;
+        {
+            std::unique_lock<std::mutex> guard(asyncIo.lock);
+            asyncIo.wake.wait(guard, [&] { return asyncIo.stop || !asyncIo.queued.empty(); });
+            if (asyncIo.queued.empty())
+            {
+                return;
+            }
+
+            read = asyncIo.queued.front();
+            asyncIo.queued.erase(asyncIo.queued.begin());
+        }
+
+        readWithPread(read);
+    }
+}
+
+#ifdef ASYNC_IO_HAS_RING
+
+static int ioUringSetup(uint32_t entries, struct io_uring_params *params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int ioUringEnter(int fd, uint32_t toSubmit, uint32_t minComplete, uint32_t flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+static bool initRing()
+{
+    AsyncIo &asyncIo = g_app.asyncIo;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    // not there on old kernels, or blocked by seccomp in containers
+    asyncIo.ringFd = ioUringSetup(ASYNC_IO_QUEUE_DEPTH, &params);
+    if (asyncIo.ringFd < 0)
+    {
+        return false;
+    }
+
+    asyncIo.submissions.mappingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    asyncIo.submissions.mapping = mmap(nullptr, asyncIo.submissions.mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, asyncIo.ringFd, IORING_OFF_SQ_RING);
+
+    asyncIo.completions.mappingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    asyncIo.completions.mapping = mmap(nullptr, asyncIo.completions.mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, asyncIo.ringFd, IORING_OFF_CQ_RING);
+
+    asyncIo.submissionEntriesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    asyncIo.submissionEntries = mmap(nullptr, asyncIo.submissionEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, asyncIo.ringFd, IORING_OFF_SQES);
+
+    if (asyncIo.submissions.mapping == MAP_FAILED || asyncIo.completions.mapping == MAP_FAILED || asyncIo.submissionEntries == MAP_FAILED)
+    {
+        printf("Could not map the io_uring rings\n");
+        return false;
+    }
+
+    uint8_t *submissionRing = static_cast<uint8_t*>(asyncIo.submissions.mapping);
+    asyncIo.submissions.head = reinterpret_cast<uint32_t*>(submissionRing + params.sq_off.head);
+    asyncIo.submissions.tail = reinterpret_cast<uint32_t*>(submissionRing + params.sq_off.tail);
+    asyncIo.submissions.mask = reinterpret_cast<uint32_t*>(submissionRing + params.sq_off.ring_mask);
+    asyncIo.submissions.array = reinterpret_cast<uint32_t*>(submissionRing + params.sq_off.array);
+
+    uint8_t *completionRing = static_cast<uint8_t*>(asyncIo.completions.mapping);
+    asyncIo.completions.head = reinterpret_cast<uint32_t*>(completionRing + params.cq_off.head);
+    asyncIo.completions.tail = reinterpret_cast<uint32_t*>(completionRing + params.cq_off.tail);
+    asyncIo.completions.mask = reinterpret_cast<uint32_t*>(completionRing + params.cq_off.ring_mask);
+    asyncIo.completions.entries = completionRing + params.cq_off.cqes;
+
+    asyncIo.entryCount = params.sq_entries;
+
+    return true;
+}
+
+static void destroyRing()
+{
+    AsyncIo &asyncIo = g_app.asyncIo;
+
+    if (asyncIo.submissionEntries != nullptr && asyncIo.submissionEntries != MAP_FAILED)
+    {
+        munmap(asyncIo.submissionEntries, asyncIo.submissionEntriesSize);
+    }
+    if (asyncIo.completions.mapping != nullptr && asyncIo.completions.mapping != MAP_FAILED)
+    {
+        munmap(asyncIo.completions.mapping, asyncIo.completions.mappingSize);
+    }
+    if (asyncIo.submissions.mapping != nullptr && asyncIo.submissions.mapping != MAP_FAILED)
+    {
+        munmap(asyncIo.submissions.mapping, asyncIo.submissions.mappingSize);
+    }
+    if (asyncIo.ringFd >= 0)
+    {
+        close(asyncIo.ringFd);
+    }
+
+    asyncIo.submissionEntries = nullptr;
+    asyncIo.completions.mapping = nullptr;
+    asyncIo.submissions.mapping = nullptr;
+    asyncIo.ringFd = -1;
+}
+
+// Queues a read of what is left of the file, submitted with the next io_uring_enter()
+static void pushRingRead(FileRead *read)
+{
+    AsyncIo &asyncIo = g_app.asyncIo;
+
+    read->iov.iov_base = &read->file->buffer[read->offset];
+    read->iov.iov_len = read->file->size - read->offset;
+
+    uint32_t tail = *asyncIo.submissions.tail;
+    uint32_t index = tail & *asyncIo.submissions.mask;
+
+    struct io_uring_sqe *entry = static_cast<struct io_uring_sqe*>(asyncIo.submissionEntries) + index;
+    memset(entry, 0, sizeof(*entry));
+    entry->opcode = IORING_OP_READV;
+    entry->fd = read->fd;
+    entry->off = read->offset;
+    entry->addr = reinterpret_cast<uint64_t>(&read->iov);
+    entry->len = 1;
+    entry->user_data = reinterpret_cast<uint64_t>(read);
+
+    asyncIo.submissions.array[index] = index;
+
+    // the kernel reads the entry once it sees the new tail
+    __atomic_store_n(asyncIo.submissions.tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void ringThread()
+{
+    AsyncIo &asyncIo = g_app.asyncIo;
+
+    uint32_t inFlight = 0;
+    std::vector<FileRead*> batch;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> guard(asyncIo.lock);
+            if (inFlight == 0)
+            {
+                asyncIo.wake.wait(guard, [&] { return asyncIo.stop || !asyncIo.queued.empty(); });
+                if (asyncIo.queued.empty())
+                {
+                    return;
+                }
+            }
+
+            // everything that fits in the ring goes out with one system call
+            size_t count = std::min<size_t>(asyncIo.queued.size(), asyncIo.entryCount - inFlight);
+            batch.assign(asyncIo.queued.begin(), asyncIo.queued.begin() + count);
+            asyncIo.queued.erase(asyncIo.queued.begin(), asyncIo.queued.begin() + count);
+        }
+
+        uint32_t toSubmit = 0;
+        for (FileRead *read : batch)
+        {
+            if (openFileRead(read))
+            {
+                pushRingRead(read);
+                toSubmit++;
+            }
+        }
+        inFlight += toSubmit;
+
+        if (inFlight == 0)
+        {
+            continue;
+        }
+
+        // Submits the batch and waits for at least one completion. Reads
+        // queued meanwhile wait for it, small files complete quickly
+        int result = ioUringEnter(asyncIo.ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS);
+        if (result < 0 && errno != EINTR && errno != EBUSY)
+        {
+            printf("io_uring_enter failed: %s\n", strerror(errno));
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(asyncIo.lock);
+            asyncIo.submitCalls++;
+        }
+
+        uint32_t head = *asyncIo.completions.head;
+        uint32_t tail = __atomic_load_n(asyncIo.completions.tail, __ATOMIC_ACQUIRE);
+        uint32_t resubmit = 0;
+
+        for (; head != tail; head++)
+        {
+            const struct io_uring_cqe *completion = static_cast<const struct io_uring_cqe*>(asyncIo.completions.entries) + (head & *asyncIo.completions.mask);
+            FileRead *read = reinterpret_cast<FileRead*>(completion->user_data);
+            int bytes = completion->res;
+            inFlight--;
+
+            if (bytes == -EINTR || bytes == -EAGAIN)
+            {
+                pushRingRead(read);
+                resubmit++;
+                continue;
+            }
+
+            if (bytes > 0)
+            {
+                read->offset += static_cast<size_t>(bytes);
+                if (read->offset < read->file->size)
+                {
+                    // short read, the rest goes out with the next submit
+                    pushRingRead(read);
+                    resubmit++;
+                    continue;
+                }
+            }
+
+            bool ok = bytes >= 0 && read->offset > 0;
+            read->file->size = read->offset;
+            completeRead(read, ok);
+        }
+
+        __atomic_store_n(asyncIo.completions.head, head, __ATOMIC_RELEASE);
+
+        if (resubmit > 0)
+        {
+            ioUringEnter(asyncIo.ringFd, resubmit, 0, 0);
+            inFlight += resubmit;
+        }
+    }
+}
+
+#endif // ASYNC_IO_HAS_RING
+
+bool initAsyncIo()
+{
+    AsyncIo &asyncIo = g_app.asyncIo;
+
+#ifdef ASYNC_IO_HAS_RING
+    asyncIo.ring = initRing();
+    if (!asyncIo.ring)
+    {
+        destroyRing();
+    }
+#endif
+
+    if (asyncIo.ring)
+    {
+#ifdef ASYNC_IO_HAS_RING
+        asyncIo.threads.push_back(std::thread(ringThread));
+        printf("Async I/O: io_uring with %u entries\n", asyncIo.entryCount);
+#endif
+    }
+    else
+    {
+        for (uint32_t i = 0; i < ASYNC_IO_THREADS; i++)
+        {
+            asyncIo.threads.push_back(std::thread(readerThread));
+        }
+        printf("Async I/O: %u reader threads\n", ASYNC_IO_THREADS);
+    }
+
+    return true;
+}
+
+std::shared_future<FileDataPtr> readFileAsync(const char* path, FileReadCallback callback, void* userData)
+{
+    AsyncIo &asyncIo = g_app.asyncIo;
+
+    FileRead *read = new FileRead();
+    read->path = path;
+    read->callback = callback;
+    read->userData = userData;
+    read->fd = -1;
+
+    std::shared_future<FileDataPtr> future = read->promise.get_future().share();
+
+    {
+        std::lock_guard<std::mutex> guard(asyncIo.lock);
+
+        if (callback == nullptr)
+        {
+            auto prefetched = asyncIo.prefetched.find(read->path);
+            if (prefetched != asyncIo.prefetched.end())
+            {
+                future = prefetched->second;
+                asyncIo.prefetched.erase(prefetched);
+                delete read;
+                return future;
+            }
+        }
+
+        if (!asyncIo.threads.empty() && !asyncIo.stop)
+        {
+            asyncIo.queued.push_back(read);
+            asyncIo.wake.notify_one();
+            return future;
+        }
+    }
+
+    readWithPread(read);
+    return future;
+}
+
+void prefetchFile(const char* path)
+{
+    AsyncIo &asyncIo = g_app.asyncIo;
+
+    std::shared_future<FileDataPtr> future = readFileAsync(path);
+
+    std::lock_guard<std::mutex> guard(asyncIo.lock);
+    asyncIo.prefetched[path] = future;
+}
+
+void destroyAsyncIo()
+{
+    AsyncIo &asyncIo = g_app.asyncIo;
+
+    // queued reads are finished first, nobody waits on a future forever
+    {
+        std::lock_guard<std::mutex> guard(asyncIo.lock);
+        asyncIo.stop = true;
+        asyncIo.prefetched.clear();
+    }
+    asyncIo.wake.notify_all();
+
+    for (std::thread &thread : asyncIo.threads)
+    {
+        thread.join();
+    }
+    asyncIo.threads.clear();
+
+#ifdef ASYNC_IO_HAS_RING
+    if (asyncIo.ring)
+    {
+        destroyRing();
+        asyncIo.ring = false;
+    }
+#endif
+
+    printf("Async I/O: %llu reads, %llu submits\n", (unsigned long long)asyncIo.completedReads, (unsigned long long)asyncIo.submitCalls);
+}
@@ -0,0 +1,116 @@
+#ifndef __ASYNCIO_H__
+#define __ASYNCIO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Reads submitted to the ring at once
+const uint32_t ASYNC_IO_QUEUE_DEPTH = 64;
+
+// Reader threads when io_uring is not available
+const uint32_t ASYNC_IO_THREADS = 4;
+
+// Files this large are mapped instead of read, their pages come in as they are touched
+const size_t ASYNC_IO_MAP_SIZE = 16 * 1024 * 1024;
+
+// Contents of a file. Valid as long as the object lives, shared by
+// everything that asked for the file
+struct FileData
+{
+    bool ok = false;
+    bool missing = false;     // the file doesn't exist, not reported by the service
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    // one of the two holds the bytes
+    std::vector<uint8_t> buffer;
+    void* mapping = nullptr;
+
+    ~FileData();
+};
+typedef std::shared_ptr<const FileData> FileDataPtr;
+
+// Runs on the I/O thread that completed the read, before the future is ready
+typedef void (*FileReadCallback)(const char* path, const FileDataPtr &file, void* userData);
+
+struct FileRead
+{
+    std::string path;
+    FileReadCallback callback;
+    void* userData;
+    std::promise<FileDataPtr> promise;
+
+    // set up by the I/O thread
+    int fd;
+    std::shared_ptr<FileData> file;
+    size_t offset;
+    struct iovec iov;     // what is left to read, the ring reads through it
+};
+
+// File reads done off the calling thread. With io_uring one thread submits
+// every queued read in one go and reaps the completions. Without it, a few
+// threads open and pread the files themselves. Large files are mapped
+// in both cases
+struct AsyncIo
+{
+    bool ring = false;
+
+    int ringFd = -1;
+    struct {
+        void* mapping;
+        size_t mappingSize;
+        uint32_t* head;
+        uint32_t* tail;
+        uint32_t* mask;
+        uint32_t* array;
+    } submissions;
+    struct {
+        void* mapping;
+        size_t mappingSize;
+        uint32_t* head;
+        uint32_t* tail;
+        uint32_t* mask;
+        void* entries;
+    } completions;
+    void* submissionEntries = nullptr;
+    size_t submissionEntriesSize = 0;
+    uint32_t entryCount = 0;
+
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stop = false;
+
+    std::vector<FileRead*> queued;
+
+    // reads asked for ahead of their loaders, taken by the first readFileAsync() of the path
+    std::unordered_map<std::string, std::shared_future<FileDataPtr>> prefetched;
+
+    uint64_t completedReads = 0;
+    uint64_t submitCalls = 0;
+};
+
+bool initAsyncIo();
+
+// Queues a read of the whole file. The callback, if any, runs when the
+// read has completed and before the future becomes ready. Reads the file
+// on the calling thread when the service isn't running
+std::shared_future<FileDataPtr> readFileAsync(const char* path, FileReadCallback callback = nullptr, void* userData = nullptr);
+
+// Starts reading a file a loader will ask for later. The read is taken
+// over by the first readFileAsync() of the path that has no callback
+void prefetchFile(const char* path);
+
+void destroyAsyncIo();
+
+#endif //__ASYNCIO_H__
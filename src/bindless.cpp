@@ -0,0 +1,370 @@
+/*
+    Bindless resources in update after bind descriptor arrays (VK_EXT_descriptor_indexing)
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <cstring>
+#include <algorithm>
+
+bool getBindlessFeatures(VkPhysicalDevice gpu, VkPhysicalDeviceFeatures2KHR &enabledFeatures, VkPhysicalDeviceDescriptorIndexingFeaturesEXT &enabledIndexingFeatures)
+{
+    if (!deviceExtensionEnabled(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) || !deviceExtensionEnabled(VK_KHR_MAINTENANCE3_EXTENSION_NAME))
+    {
+        return false;
+    }
+
+    // only there when initVKInstance() could enable VK_KHR_get_physical_device_properties2
+    PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(g_app.instance, "vkGetPhysicalDeviceFeatures2KHR");
+    PFN_vkGetPhysicalDeviceProperties2KHR getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(g_app.instance, "vkGetPhysicalDeviceProperties2KHR");
+    if (getFeatures2 == nullptr || getProperties2 == nullptr)
+    {
+        return false;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported = {};
+    supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+    VkPhysicalDeviceFeatures2KHR features = {};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &supported;
+    getFeatures2(gpu, &features);
+
+    // Slots are written while the command buffers that bind the set are
+    // pending, which takes update after bind and update unused while pending.
+    // Shaders index the arrays with per draw values, dynamically uniform indexing
+    if (!features.features.shaderStorageBufferArrayDynamicIndexing ||
+        !features.features.shaderSampledImageArrayDynamicIndexing ||
+        !supported.runtimeDescriptorArray ||
+        !supported.descriptorBindingPartiallyBound ||
+        !supported.descriptorBindingUpdateUnusedWhilePending ||
+        !supported.descriptorBindingStorageBufferUpdateAfterBind ||
+        !supported.descriptorBindingSampledImageUpdateAfterBind)
+    {
+        return false;
+    }
+
+    memset(&enabledIndexingFeatures, 0, sizeof(enabledIndexingFeatures));
+    enabledIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    enabledIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+    enabledIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+    enabledIndexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    enabledIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+    enabledIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+
+    memset(&enabledFeatures, 0, sizeof(enabledFeatures));
+    enabledFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    enabledFeatures.pNext = &enabledIndexingFeatures;
+    enabledFeatures.features.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+    enabledFeatures.features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT limits = {};
+    limits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+
+    VkPhysicalDeviceProperties2KHR properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &limits;
+    getProperties2(gpu, &properties);
+
+    BindlessResources &bindless = g_app.bindless;
+    bindless.buffers.capacity = std::min({ BINDLESS_MAX_BUFFERS, limits.maxDescriptorSetUpdateAfterBindStorageBuffers, limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+    bindless.textures.capacity = std::min({ BINDLESS_MAX_TEXTURES, limits.maxDescriptorSetUpdateAfterBindSampledImages, limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                                            limits.maxDescriptorSetUpdateAfterBindSamplers, limits.maxPerStageDescriptorUpdateAfterBindSamplers });
+    bindless.materials.capacity = BINDLESS_MAX_MATERIALS;
+
+    return (bindless.buffers.capacity > 0 && bindless.textures.capacity > 0);
+}
+
+// the caller holds g_app.bindless.lock
+static uint32_t acquireSlot(BindlessSlots &slots)
+{
+    if (!slots.freeSlots.empty())
+    {
+        uint32_t slot = slots.freeSlots.back();
+        slots.freeSlots.pop_back();
+        return slot;
+    }
+
+    if (slots.used == slots.capacity)
+    {
+        return BINDLESS_INVALID_INDEX;
+    }
+
+    return slots.used++;
+}
+
+static void releaseSlot(BindlessSlots &slots, uint32_t slot)
+{
+    assert(slot < slots.used);
+    slots.freeSlots.push_back(slot);
+}
+
+static void writeBindlessDescriptor(uint32_t binding, uint32_t slot, VkDescriptorType type, const VkDescriptorBufferInfo *bufferInfo, const VkDescriptorImageInfo *imageInfo)
+{
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = g_app.bindless.set;
+    write.dstBinding = binding;
+    write.dstArrayElement = slot;
+    write.descriptorCount = 1;
+    write.descriptorType = type;
+    write.pBufferInfo = bufferInfo;
+    write.pImageInfo = imageInfo;
+
+    vkUpdateDescriptorSets(g_app.device, 1, &write, 0, nullptr);
+}
+
+static bool initBindlessSet()
+{
+    BindlessResources &bindless = g_app.bindless;
+
+    VkDescriptorSetLayoutBinding bindings[2] = {};
+    bindings[0].binding = BINDLESS_BINDING_BUFFERS;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[0].descriptorCount = bindless.buffers.capacity;
+    bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[1].binding = BINDLESS_BINDING_TEXTURES;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[1].descriptorCount = bindless.textures.capacity;
+    bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    // slots that were never written are fine as long as no shader reads them
+    VkDescriptorBindingFlagsEXT bindingFlags[2];
+    bindingFlags[0] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+    bindingFlags[1] = bindingFlags[0];
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    bindingFlagsInfo.bindingCount = 2;
+    bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+    // Not made through createDescriptorSetLayout(), update after bind sets
+    // need pools of their own and are never cached
+    VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+    layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutCreateInfo.pNext = &bindingFlagsInfo;
+    layoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    layoutCreateInfo.bindingCount = 2;
+    layoutCreateInfo.pBindings = bindings;
+
+    VkResult result = vkCreateDescriptorSetLayout(g_app.device, &layoutCreateInfo, getHostAllocator(HOST_OBJECT_DESCRIPTOR_SET_LAYOUT), &bindless.layout);
+    assert(result == VK_SUCCESS);
+
+    VkDescriptorPoolSize poolSizes[2];
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[0].descriptorCount = bindless.buffers.capacity;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[1].descriptorCount = bindless.textures.capacity;
+
+    VkDescriptorPoolCreateInfo poolCreateInfo = {};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+    poolCreateInfo.maxSets = 1;
+    poolCreateInfo.poolSizeCount = 2;
+    poolCreateInfo.pPoolSizes = poolSizes;
+
+    result = vkCreateDescriptorPool(g_app.device, &poolCreateInfo, getHostAllocator(HOST_OBJECT_DESCRIPTOR_POOL), &bindless.pool);
+    assert(result == VK_SUCCESS);
+
+    VkDescriptorSetAllocateInfo setAllocateInfo = {};
+    setAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    setAllocateInfo.descriptorPool = bindless.pool;
+    setAllocateInfo.descriptorSetCount = 1;
+    setAllocateInfo.pSetLayouts = &bindless.layout;
+
+    result = vkAllocateDescriptorSets(g_app.device, &setAllocateInfo, &bindless.set);
+    assert(result == VK_SUCCESS);
+
+    // the material index and scene buffer slot of each draw
+    VkPushConstantRange drawPushConstantRange = {};
+    drawPushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    drawPushConstantRange.offset = 0;
+    drawPushConstantRange.size = sizeof(BindlessDrawConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &bindless.layout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &drawPushConstantRange;
+
+    result = vkCreatePipelineLayout(g_app.device, &pipelineLayoutCreateInfo, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT), &bindless.pipelineLayout);
+    assert(result == VK_SUCCESS);
+
+    return true;
+}
+
+static bool initMaterialTable()
+{
+    BindlessResources &bindless = g_app.bindless;
+
+    VkBufferCreateInfo bufferCreateInfo = {};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.size = bindless.materials.capacity * sizeof(BindlessMaterialData);
+    bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    VkResult result = vkCreateBuffer(g_app.device, &bufferCreateInfo, getHostAllocator(HOST_OBJECT_BUFFER), &bindless.materialTable.buffer);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_app.device, bindless.materialTable.buffer, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memAllocInfo.memoryTypeIndex))
+    {
+        printf("No host visible memory for the bindless material table\n");
+        return false;
+    }
+
+    result = allocateDeviceMemory(&memAllocInfo, &bindless.materialTable.memory);
+    assert(result == VK_SUCCESS);
+
+    vkBindBufferMemory(g_app.device, bindless.materialTable.buffer, bindless.materialTable.memory, 0);
+
+    result = vkMapMemory(g_app.device, bindless.materialTable.memory, 0, VK_WHOLE_SIZE, 0, (void **)&bindless.materialTable.mapped);
+    assert(result == VK_SUCCESS);
+
+    VkDescriptorBufferInfo tableInfo = {};
+    tableInfo.buffer = bindless.materialTable.buffer;
+    tableInfo.offset = 0;
+    tableInfo.range = VK_WHOLE_SIZE;
+
+    uint32_t slot = registerBindlessBuffer(tableInfo);
+    assert(slot == BINDLESS_MATERIAL_TABLE);
+
+    return (slot == BINDLESS_MATERIAL_TABLE);
+}
+
+bool initBindless()
+{
+    BindlessResources &bindless = g_app.bindless;
+
+    if (!bindless.enabled)
+    {
+        return true;
+    }
+
+    if (!initBindlessSet() || !initMaterialTable())
+    {
+        return false;
+    }
+
+    // initUniformBuffers() adds storage usage to the scene uniforms in bindless mode
+    for (const VkDescriptorBufferInfo &region : g_app.uniformDataVS.descriptors)
+    {
+        uint32_t sceneBuffer = registerBindlessBuffer(region);
+        if (sceneBuffer == BINDLESS_INVALID_INDEX)
+        {
+            return false;
+        }
+        bindless.sceneBuffers.push_back(sceneBuffer);
+    }
+
+    printf("Bindless mode: %u buffer slots, %u texture slots, %u materials\n", bindless.buffers.capacity, bindless.textures.capacity, bindless.materials.capacity);
+
+    return true;
+}
+
+uint32_t registerBindlessBuffer(const VkDescriptorBufferInfo &bufferInfo)
+{
+    BindlessResources &bindless = g_app.bindless;
+    std::lock_guard<std::mutex> guard(bindless.lock);
+
+    uint32_t slot = acquireSlot(bindless.buffers);
+    if (slot == BINDLESS_INVALID_INDEX)
+    {
+        printf("Out of bindless buffer slots (%u)\n", bindless.buffers.capacity);
+        return slot;
+    }
+
+    writeBindlessDescriptor(BINDLESS_BINDING_BUFFERS, slot, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &bufferInfo, nullptr);
+
+    return slot;
+}
+
+uint32_t registerBindlessTexture(const VkDescriptorImageInfo &imageInfo)
+{
+    BindlessResources &bindless = g_app.bindless;
+    std::lock_guard<std::mutex> guard(bindless.lock);
+
+    uint32_t slot = acquireSlot(bindless.textures);
+    if (slot == BINDLESS_INVALID_INDEX)
+    {
+        printf("Out of bindless texture slots (%u)\n", bindless.textures.capacity);
+        return slot;
+    }
+
+    writeBindlessDescriptor(BINDLESS_BINDING_TEXTURES, slot, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, nullptr, &imageInfo);
+
+    return slot;
+}
+
+void updateBindlessTexture(uint32_t slot, const VkDescriptorImageInfo &imageInfo)
+{
+    // The slot is read by every frame in flight and may only be updated
+    // while none of them uses it. Textures only move when their resident
+    // levels change, so this waits for the frames instead of swapping slots
+    waitForFrame(getRecordingFrame() - 1);
+
+    std::lock_guard<std::mutex> guard(g_app.bindless.lock);
+    writeBindlessDescriptor(BINDLESS_BINDING_TEXTURES, slot, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, nullptr, &imageInfo);
+}
+
+void releaseBindlessBuffer(uint32_t slot)
+{
+    std::lock_guard<std::mutex> guard(g_app.bindless.lock);
+    releaseSlot(g_app.bindless.buffers, slot);
+}
+
+void releaseBindlessTexture(uint32_t slot)
+{
+    std::lock_guard<std::mutex> guard(g_app.bindless.lock);
+    releaseSlot(g_app.bindless.textures, slot);
+}
+
+uint32_t allocateBindlessMaterial()
+{
+    BindlessResources &bindless = g_app.bindless;
+    std::lock_guard<std::mutex> guard(bindless.lock);
+
+    uint32_t index = acquireSlot(bindless.materials);
+    if (index == BINDLESS_INVALID_INDEX)
+    {
+        printf("Out of bindless materials (%u)\n", bindless.materials.capacity);
+    }
+
+    return index;
+}
+
+void releaseBindlessMaterial(uint32_t index)
+{
+    std::lock_guard<std::mutex> guard(g_app.bindless.lock);
+    releaseSlot(g_app.bindless.materials, index);
+}
+
+void bindBindlessSet(VkCommandBuffer cmdBuffer)
+{
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_app.bindless.pipelineLayout, 0, 1, &g_app.bindless.set, 0, nullptr);
+}
+
+void destroyBindless()
+{
+    BindlessResources &bindless = g_app.bindless;
+
+    if (!bindless.enabled)
+    {
+        return;
+    }
+
+    vkUnmapMemory(g_app.device, bindless.materialTable.memory);
+    vkDestroyBuffer(g_app.device, bindless.materialTable.buffer, getHostAllocator(HOST_OBJECT_BUFFER));
+    freeDeviceMemory(bindless.materialTable.memory);
+
+    // the set goes away with its pool
+    vkDestroyPipelineLayout(g_app.device, bindless.pipelineLayout, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT));
+    vkDestroyDescriptorPool(g_app.device, bindless.pool, getHostAllocator(HOST_OBJECT_DESCRIPTOR_POOL));
+    vkDestroyDescriptorSetLayout(g_app.device, bindless.layout, getHostAllocator(HOST_OBJECT_DESCRIPTOR_SET_LAYOUT));
+}
@@ -0,0 +1,113 @@
+#ifndef __BINDLESS_H__
+#define __BINDLESS_H__
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <mutex>
+#include <vector>
+
+// Upper bounds of the global descriptor arrays, lowered to the device
+// limits for update after bind descriptors when bindless mode starts
+const uint32_t BINDLESS_MAX_BUFFERS = 4096;
+const uint32_t BINDLESS_MAX_TEXTURES = 4096;
+const uint32_t BINDLESS_MAX_MATERIALS = 1024;
+
+const uint32_t BINDLESS_INVALID_INDEX = 0xffffffff;
+
+// Bindings of the global set, these must match data/bindless.vert and data/bindless.frag
+enum BindlessBinding
+{
+    BINDLESS_BINDING_BUFFERS  = 0,
+    BINDLESS_BINDING_TEXTURES = 1,
+};
+
+// Buffer slot of the material table, registered before any other buffer
+const uint32_t BINDLESS_MATERIAL_TABLE = 0;
+
+// One entry of the material table, std430 layout of MaterialData in data/bindless.frag
+struct BindlessMaterialData
+{
+    glm::vec4 baseColor;
+    float alphaCutoff;
+    uint32_t texture;       // texture slot, BINDLESS_INVALID_INDEX when untextured
+    uint32_t padding[2];
+};
+
+// Pushed for every draw, matches the DrawParams block of the bindless shaders
+struct BindlessDrawConstants
+{
+    uint32_t materialIndex;
+    uint32_t sceneBuffer;
+};
+
+// Free list over the slots of one descriptor array
+struct BindlessSlots
+{
+    std::vector<uint32_t> freeSlots;
+    uint32_t used = 0;
+    uint32_t capacity = 0;
+};
+
+// Optional bindless mode on VK_EXT_descriptor_indexing. Every buffer and
+// texture gets a slot in one of two large update after bind arrays of a
+// single global set, shaders find their resources through the material
+// index pushed with each draw. The set is bound once per command buffer,
+// switching materials never touches descriptors
+struct BindlessResources
+{
+    // --bindless on the command line, enabled when the device supports it
+    bool requested = false;
+    bool enabled = false;
+
+    std::mutex lock;
+
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    VkDescriptorPool pool = VK_NULL_HANDLE;
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+
+    BindlessSlots buffers;
+    BindlessSlots textures;
+    BindlessSlots materials;
+
+    // persistently mapped, entries are written by initMaterial()
+    struct {
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+        BindlessMaterialData* mapped;
+    } materialTable;
+
+    // buffer slots of the scene uniforms, one per swapchain image
+    std::vector<uint32_t> sceneBuffers;
+};
+
+// Fills in the features bindless mode needs as a chain for VkDeviceCreateInfo::pNext,
+// called by initVKDevice() before the device is created. Returns false when
+// the device lacks any of them
+bool getBindlessFeatures(VkPhysicalDevice gpu, VkPhysicalDeviceFeatures2KHR &enabledFeatures, VkPhysicalDeviceDescriptorIndexingFeaturesEXT &enabledIndexingFeatures);
+
+// Creates the global set and the material table, does nothing when bindless mode is off
+bool initBindless();
+
+// Slots stay valid until released. A released slot may be handed out again
+// right away, so nothing still in flight may read it
+uint32_t registerBindlessBuffer(const VkDescriptorBufferInfo &bufferInfo);
+uint32_t registerBindlessTexture(const VkDescriptorImageInfo &imageInfo);
+void releaseBindlessBuffer(uint32_t slot);
+
+// Points a texture slot at another image, for textures whose image gets
+// replaced. Waits for the frames in flight, which read the slot
+void updateBindlessTexture(uint32_t slot, const VkDescriptorImageInfo &imageInfo);
+void releaseBindlessTexture(uint32_t slot);
+
+uint32_t allocateBindlessMaterial();
+void releaseBindlessMaterial(uint32_t index);
+
+// Binds the global set, once per command buffer
+void bindBindlessSet(VkCommandBuffer cmdBuffer);
+
+void destroyBindless();
+
+#endif //__BINDLESS_H__
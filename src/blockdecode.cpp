@@ -0,0 +1,477 @@
+/*
+    Block compressed texture decoding on the CPU, for formats the device cannot sample
+*/
+
+#include "blockdecode.h"
+
+#include <cstring>
+#include <algorithm>
+
+static inline uint8_t clampByte(int value)
+{
+    return static_cast<uint8_t>(std::min(std::max(value, 0), 255));
+}
+
+static void decodeColor565(uint16_t color, uint8_t rgba[4])
+{
+    uint32_t r = (color >> 11) & 0x1f;
+    uint32_t g = (color >> 5) & 0x3f;
+    uint32_t b = color & 0x1f;
+
+    rgba[0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+    rgba[1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+    rgba[2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+    rgba[3] = 255;
+}
+
+// 4x4 RGBA8 texels of one block, row major
+typedef uint8_t DecodedBlock[16][4];
+
+// BC1 color block, BC2 and BC3 always use the four color mode
+static void decodeBC1Block(const uint8_t *block, bool fourColorOnly, DecodedBlock texels)
+{
+    uint16_t color0 = static_cast<uint16_t>(block[0] | (block[1] << 8));
+    uint16_t color1 = static_cast<uint16_t>(block[2] | (block[3] << 8));
+    uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | (static_cast<uint32_t>(block[7]) << 24);
+
+    uint8_t palette[4][4];
+    decodeColor565(color0, palette[0]);
+    decodeColor565(color1, palette[1]);
+
+    if (color0 > color1 || fourColorOnly)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c]) / 3);
+            palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c]) / 3);
+        }
+        palette[2][3] = 255;
+        palette[3][3] = 255;
+    }
+    else
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = static_cast<uint8_t>((palette[0][c] + palette[1][c]) / 2);
+            palette[3][c] = 0;
+        }
+        palette[2][3] = 255;
+        palette[3][3] = 0;
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        memcpy(texels[i], palette[(indices >> (2 * i)) & 3], 4);
+    }
+}
+
+// BC3 alpha, BC4 and BC5 channels: two endpoints and 3 bit indices
+static void decodeBC4Channel(const uint8_t *block, DecodedBlock texels, int channel)
+{
+    uint8_t values[8];
+    values[0] = block[0];
+    values[1] = block[1];
+
+    if (values[0] > values[1])
+    {
+        for (int i = 2; i < 8; i++)
+        {
+            values[i] = static_cast<uint8_t>(((8 - i) * values[0] + (i - 1) * values[1]) / 7);
+        }
+    }
+    else
+    {
+        for (int i = 2; i < 6; i++)
+        {
+            values[i] = static_cast<uint8_t>(((6 - i) * values[0] + (i - 1) * values[1]) / 5);
+        }
+        values[6] = 0;
+        values[7] = 255;
+    }
+
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        indices |= static_cast<uint64_t>(block[2 + i]) << (8 * i);
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        texels[i][channel] = values[(indices >> (3 * i)) & 7];
+    }
+}
+
+static void decodeBC2Alpha(const uint8_t *block, DecodedBlock texels)
+{
+    for (int i = 0; i < 16; i++)
+    {
+        uint32_t alpha = (block[i / 2] >> ((i & 1) * 4)) & 0xf;
+        texels[i][3] = static_cast<uint8_t>(alpha * 17);
+    }
+}
+
+static const int etcModifiers[8][4] =
+{
+    {  2,   8,  -2,   -8 },
+    {  5,  17,  -5,  -17 },
+    {  9,  29,  -9,  -29 },
+    { 13,  42, -13,  -42 },
+    { 18,  60, -18,  -60 },
+    { 24,  80, -24,  -80 },
+    { 33, 106, -33, -106 },
+    { 47, 183, -47, -183 },
+};
+
+static const int etcDistances[8] = { 3, 6, 11, 16, 23, 32, 41, 64 };
+
+static const int eacModifiers[16][8] =
+{
+    { -3, -6,  -9, -15, 2, 5, 8, 14 },
+    { -3, -7, -10, -13, 2, 6, 9, 12 },
+    { -2, -5,  -8, -13, 1, 4, 7, 12 },
+    { -2, -4,  -6, -13, 1, 3, 5, 12 },
+    { -3, -6,  -8, -12, 2, 5, 7, 11 },
+    { -3, -7,  -9, -11, 2, 6, 8, 10 },
+    { -4, -7,  -8, -11, 3, 6, 7, 10 },
+    { -3, -5,  -8, -11, 2, 4, 7, 10 },
+    { -2, -6,  -8, -10, 1, 5, 7,  9 },
+    { -2, -5,  -8, -10, 1, 4, 7,  9 },
+    { -2, -4,  -8, -10, 1, 3, 7,  9 },
+    { -2, -5,  -7, -10, 1, 4, 6,  9 },
+    { -3, -4,  -7, -10, 2, 3, 6,  9 },
+    { -1, -2,  -3, -10, 0, 1, 2,  9 },
+    { -4, -6,  -8,  -9, 3, 5, 7,  8 },
+    { -3, -5,  -7,  -9, 2, 4, 6,  8 },
+};
+
+static inline uint64_t readBigEndian64(const uint8_t *bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+static inline uint32_t bits(uint64_t value, int high, int low)
+{
+    return static_cast<uint32_t>((value >> low) & ((1ull << (high - low + 1)) - 1));
+}
+
+static inline int extend4(uint32_t value) { return static_cast<int>((value << 4) | value); }
+static inline int extend5(uint32_t value) { return static_cast<int>((value << 3) | (value >> 2)); }
+static inline int extend6(uint32_t value) { return static_cast<int>((value << 2) | (value >> 4)); }
+static inline int extend7(uint32_t value) { return static_cast<int>((value << 1) | (value >> 6)); }
+
+// ETC pixel indices run down the columns, texel i of a decoded block runs along the rows
+static inline uint32_t etcPixelIndex(uint64_t block, int x, int y)
+{
+    int pixel = x * 4 + y;
+    return (bits(block, 16 + pixel, 16 + pixel) << 1) | bits(block, pixel, pixel);
+}
+
+static void decodeEtcPaintColors(uint64_t block, const int paint[4][3], DecodedBlock texels)
+{
+    for (int y = 0; y < 4; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            const int *color = paint[etcPixelIndex(block, x, y)];
+            uint8_t *texel = texels[y * 4 + x];
+            texel[0] = clampByte(color[0]);
+            texel[1] = clampByte(color[1]);
+            texel[2] = clampByte(color[2]);
+            texel[3] = 255;
+        }
+    }
+}
+
+// ETC2 RGB block, ETC1 individual and differential modes plus the T, H and planar modes
+static void decodeEtc2ColorBlock(const uint8_t *bytes, DecodedBlock texels)
+{
+    uint64_t block = readBigEndian64(bytes);
+
+    int base[2][3];
+    bool differential = bits(block, 33, 33) != 0;
+
+    if (differential)
+    {
+        int r = static_cast<int>(bits(block, 63, 59));
+        int g = static_cast<int>(bits(block, 55, 51));
+        int b = static_cast<int>(bits(block, 47, 43));
+        int dr = static_cast<int>(bits(block, 58, 56) << 29) >> 29;
+        int dg = static_cast<int>(bits(block, 50, 48) << 29) >> 29;
+        int db = static_cast<int>(bits(block, 42, 40) << 29) >> 29;
+
+        // T mode
+        if (r + dr < 0 || r + dr > 31)
+        {
+            int c1[3] = { extend4((bits(block, 60, 59) << 2) | bits(block, 57, 56)), extend4(bits(block, 55, 52)), extend4(bits(block, 51, 48)) };
+            int c2[3] = { extend4(bits(block, 47, 44)), extend4(bits(block, 43, 40)), extend4(bits(block, 39, 36)) };
+            int d = etcDistances[(bits(block, 35, 34) << 1) | bits(block, 32, 32)];
+
+            int paint[4][3];
+            for (int c = 0; c < 3; c++)
+            {
+                paint[0][c] = c1[c];
+                paint[1][c] = c2[c] + d;
+                paint[2][c] = c2[c];
+                paint[3][c] = c2[c] - d;
+            }
+            decodeEtcPaintColors(block, paint, texels);
+            return;
+        }
+
+        // H mode
+        if (g + dg < 0 || g + dg > 31)
+        {
+            uint32_t r1 = bits(block, 62, 59);
+            uint32_t g1 = (bits(block, 58, 56) << 1) | bits(block, 52, 52);
+            uint32_t b1 = (bits(block, 51, 51) << 3) | bits(block, 49, 47);
+            uint32_t r2 = bits(block, 46, 43);
+            uint32_t g2 = bits(block, 42, 39);
+            uint32_t b2 = bits(block, 38, 35);
+
+            uint32_t ordering = (((r1 << 8) | (g1 << 4) | b1) >= ((r2 << 8) | (g2 << 4) | b2)) ? 1 : 0;
+            int d = etcDistances[(bits(block, 34, 34) << 2) | (bits(block, 32, 32) << 1) | ordering];
+
+            int c1[3] = { extend4(r1), extend4(g1), extend4(b1) };
+            int c2[3] = { extend4(r2), extend4(g2), extend4(b2) };
+
+            int paint[4][3];
+            for (int c = 0; c < 3; c++)
+            {
+                paint[0][c] = c1[c] + d;
+                paint[1][c] = c1[c] - d;
+                paint[2][c] = c2[c] + d;
+                paint[3][c] = c2[c] - d;
+            }
+            decodeEtcPaintColors(block, paint, texels);
+            return;
+        }
+
+        // planar mode, a gradient between three colors
+        if (b + db < 0 || b + db > 31)
+        {
+            int origin[3] = { extend6(bits(block, 62, 57)),
+                              extend7((bits(block, 56, 56) << 6) | bits(block, 54, 49)),
+                              extend6((bits(block, 48, 48) << 5) | (bits(block, 44, 43) << 3) | bits(block, 41, 39)) };
+            int horizontal[3] = { extend6((bits(block, 38, 34) << 1) | bits(block, 32, 32)),
+                                  extend7(bits(block, 31, 25)),
+                                  extend6(bits(block, 24, 19)) };
+            int vertical[3] = { extend6(bits(block, 18, 13)),
+                                extend7(bits(block, 12, 6)),
+                                extend6(bits(block, 5, 0)) };
+
+            for (int y = 0; y < 4; y++)
+            {
+                for (int x = 0; x < 4; x++)
+                {
+                    uint8_t *texel = texels[y * 4 + x];
+                    for (int c = 0; c < 3; c++)
+                    {
+                        texel[c] = clampByte((x * (horizontal[c] - origin[c]) + y * (vertical[c] - origin[c]) + 4 * origin[c] + 2) >> 2);
+                    }
+                    texel[3] = 255;
+                }
+            }
+            return;
+        }
+
+        base[0][0] = extend5(r);
+        base[0][1] = extend5(g);
+        base[0][2] = extend5(b);
+        base[1][0] = extend5(r + dr);
+        base[1][1] = extend5(g + dg);
+        base[1][2] = extend5(b + db);
+    }
+    else
+    {
+        base[0][0] = extend4(bits(block, 63, 60));
+        base[1][0] = extend4(bits(block, 59, 56));
+        base[0][1] = extend4(bits(block, 55, 52));
+        base[1][1] = extend4(bits(block, 51, 48));
+        base[0][2] = extend4(bits(block, 47, 44));
+        base[1][2] = extend4(bits(block, 43, 40));
+    }
+
+    const int *modifiers[2] = { etcModifiers[bits(block, 39, 37)], etcModifiers[bits(block, 36, 34)] };
+    bool flip = bits(block, 32, 32) != 0;
+
+    for (int y = 0; y < 4; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            // two 2x4 sub blocks side by side, or two 4x2 ones on top of each other when flipped
+            int subBlock = flip ? (y >= 2) : (x >= 2);
+            int modifier = modifiers[subBlock][etcPixelIndex(block, x, y)];
+
+            uint8_t *texel = texels[y * 4 + x];
+            for (int c = 0; c < 3; c++)
+            {
+                texel[c] = clampByte(base[subBlock][c] + modifier);
+            }
+            texel[3] = 255;
+        }
+    }
+}
+
+static void decodeEacAlphaBlock(const uint8_t *bytes, DecodedBlock texels)
+{
+    uint64_t block = readBigEndian64(bytes);
+
+    int base = static_cast<int>(bits(block, 63, 56));
+    int multiplier = static_cast<int>(bits(block, 55, 52));
+    const int *modifiers = eacModifiers[bits(block, 51, 48)];
+
+    for (int x = 0; x < 4; x++)
+    {
+        for (int y = 0; y < 4; y++)
+        {
+            int pixel = x * 4 + y;
+            uint32_t index = bits(block, 47 - 3 * pixel, 45 - 3 * pixel);
+            texels[y * 4 + x][3] = clampByte(base + modifiers[index] * multiplier);
+        }
+    }
+}
+
+static uint32_t blockBytes(VkFormat format)
+{
+    switch (format)
+    {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+            return 8;
+        case VK_FORMAT_BC2_UNORM_BLOCK:
+        case VK_FORMAT_BC2_SRGB_BLOCK:
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+bool canDecodeBlockFormat(VkFormat format)
+{
+    return blockBytes(format) != 0;
+}
+
+VkFormat blockDecodeFormat(VkFormat format)
+{
+    switch (format)
+    {
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        case VK_FORMAT_BC2_SRGB_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+            return VK_FORMAT_R8G8B8A8_SRGB;
+        default:
+            return VK_FORMAT_R8G8B8A8_UNORM;
+    }
+}
+
+static void decodeBlock(VkFormat format, const uint8_t *block, DecodedBlock texels)
+{
+    switch (format)
+    {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+            decodeBC1Block(block, false, texels);
+            // the RGB variants have no transparent texels
+            for (int i = 0; i < 16; i++)
+            {
+                texels[i][3] = 255;
+            }
+            break;
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+            decodeBC1Block(block, false, texels);
+            break;
+        case VK_FORMAT_BC2_UNORM_BLOCK:
+        case VK_FORMAT_BC2_SRGB_BLOCK:
+            decodeBC1Block(block + 8, true, texels);
+            decodeBC2Alpha(block, texels);
+            break;
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+            decodeBC1Block(block + 8, true, texels);
+            decodeBC4Channel(block, texels, 3);
+            break;
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+            memset(texels, 0, sizeof(DecodedBlock));
+            decodeBC4Channel(block, texels, 0);
+            for (int i = 0; i < 16; i++)
+            {
+                texels[i][3] = 255;
+            }
+            break;
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+            memset(texels, 0, sizeof(DecodedBlock));
+            decodeBC4Channel(block, texels, 0);
+            decodeBC4Channel(block + 8, texels, 1);
+            for (int i = 0; i < 16; i++)
+            {
+                texels[i][3] = 255;
+            }
+            break;
+        case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+            decodeEtc2ColorBlock(block, texels);
+            break;
+        case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+            // the alpha block comes first
+            decodeEtc2ColorBlock(block + 8, texels);
+            decodeEacAlphaBlock(block, texels);
+            break;
+        default:
+            break;
+    }
+}
+
+bool decodeBlockTexture(VkFormat format, const uint8_t *blocks, uint32_t width, uint32_t height, uint8_t *rgba)
+{
+    uint32_t bytesPerBlock = blockBytes(format);
+    if (bytesPerBlock == 0)
+    {
+        return false;
+    }
+
+    uint32_t blocksX = (width + 3) / 4;
+    uint32_t blocksY = (height + 3) / 4;
+
+    DecodedBlock texels;
+
+    for (uint32_t blockY = 0; blockY < blocksY; blockY++)
+    {
+        for (uint32_t blockX = 0; blockX < blocksX; blockX++)
+        {
+            decodeBlock(format, blocks, texels);
+            blocks += bytesPerBlock;
+
+            // blocks on the right and bottom edge may hang over the level
+            uint32_t columns = std::min(4u, width - blockX * 4);
+            uint32_t rows = std::min(4u, height - blockY * 4);
+
+            for (uint32_t y = 0; y < rows; y++)
+            {
+                uint8_t *dst = rgba + ((blockY * 4 + y) * width + blockX * 4) * 4;
+                memcpy(dst, texels[y * 4], columns * 4);
+            }
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,20 @@
+#ifndef __BLOCKDECODE_H__
+#define __BLOCKDECODE_H__
+
+#include <vulkan/vulkan.h>
+
+#include <stdint.h>
+
+// CPU decoders for block compressed formats the device cannot sample.
+// Covers BC1 to BC5 and the ETC2 RGB and RGBA formats, BC6H, BC7 and the
+// ETC2 punch through formats have no decoder
+
+bool canDecodeBlockFormat(VkFormat format);
+
+// RGBA8 format the decoded texels are in, keeping the sRGB encoding of the source
+VkFormat blockDecodeFormat(VkFormat format);
+
+// Decodes one level of width x height texels into tightly packed RGBA8
+bool decodeBlockTexture(VkFormat format, const uint8_t *blocks, uint32_t width, uint32_t height, uint8_t *rgba);
+
+#endif //__BLOCKDECODE_H__
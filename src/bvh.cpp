@@ -0,0 +1,607 @@
+/*
+    Bounding volume hierarchy over object bounds, binned SAH build with refitting and tree rotations
+*/
+
+#include "bvh.h"
+
+#include <assert.h>
+#include <float.h>
+#include <algorithm>
+
+static float surfaceArea(const glm::vec3 &min, const glm::vec3 &max)
+{
+    glm::vec3 extent = max - min;
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static float surfaceArea(const BvhNode &node)
+{
+    return surfaceArea(node.min, node.max);
+}
+
+static void growBounds(glm::vec3 &min, glm::vec3 &max, const BvhBounds &bounds)
+{
+    min = glm::min(min, bounds.min);
+    max = glm::max(max, bounds.max);
+}
+
+static void emptyBounds(glm::vec3 &min, glm::vec3 &max)
+{
+    min = glm::vec3(FLT_MAX);
+    max = glm::vec3(-FLT_MAX);
+}
+
+static void fitLeaf(Bvh &bvh, BvhNode &node)
+{
+    emptyBounds(node.min, node.max);
+    for (uint32_t i = node.first; i < node.first + node.count; i++)
+    {
+        growBounds(node.min, node.max, bvh.objectBounds[bvh.objectIndices[i]]);
+    }
+}
+
+static void fitInterior(Bvh &bvh, BvhNode &node)
+{
+    const BvhNode &left = bvh.nodes[node.first];
+    const BvhNode &right = bvh.nodes[node.first + 1];
+    node.min = glm::min(left.min, right.min);
+    node.max = glm::max(left.max, right.max);
+}
+
+// The parent links below a node, after its record was moved to index
+static void adoptChildren(Bvh &bvh, uint32_t index)
+{
+    const BvhNode &node = bvh.nodes[index];
+    if (node.count == 0)
+    {
+        bvh.parents[node.first] = index;
+        bvh.parents[node.first + 1] = index;
+    }
+    else
+    {
+        for (uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+            bvh.objectLeaves[bvh.objectIndices[i]] = index;
+        }
+    }
+}
+
+struct BvhBin
+{
+    glm::vec3 min;
+    glm::vec3 max;
+    uint32_t count;
+};
+
+struct BvhBuildTask
+{
+    uint32_t node;
+    uint32_t begin;
+    uint32_t end;
+};
+
+void buildBvh(Bvh &bvh, const BvhBounds *bounds, uint32_t count)
+{
+    bvh.nodes.clear();
+    bvh.parents.clear();
+    bvh.dirtyLeaves.clear();
+    bvh.objectBounds.assign(bounds, bounds + count);
+    bvh.objectLeaves.assign(count, BVH_INVALID);
+    bvh.objectIndices.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        bvh.objectIndices[i] = i;
+    }
+
+    if (count == 0)
+    {
+        bvh.nodeDirty.clear();
+        return;
+    }
+
+    std::vector<glm::vec3> centroids(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        centroids[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+    }
+
+    // a binary tree with at least one object per leaf has fewer than 2n nodes
+    bvh.nodes.reserve(2 * count);
+    bvh.parents.reserve(2 * count);
+
+    BvhNode root = {};
+    bvh.nodes.push_back(root);
+    bvh.parents.push_back(BVH_INVALID);
+
+    std::vector<BvhBuildTask> tasks;
+    tasks.push_back({ 0, 0, count });
+
+    while (!tasks.empty())
+    {
+        BvhBuildTask task = tasks.back();
+        tasks.pop_back();
+
+        uint32_t objectCount = task.end - task.begin;
+
+        glm::vec3 nodeMin, nodeMax, centroidMin, centroidMax;
+        emptyBounds(nodeMin, nodeMax);
+        emptyBounds(centroidMin, centroidMax);
+        for (uint32_t i = task.begin; i < task.end; i++)
+        {
+            uint32_t object = bvh.objectIndices[i];
+            growBounds(nodeMin, nodeMax, bounds[object]);
+            centroidMin = glm::min(centroidMin, centroids[object]);
+            centroidMax = glm::max(centroidMax, centroids[object]);
+        }
+
+        bvh.nodes[task.node].min = nodeMin;
+        bvh.nodes[task.node].max = nodeMax;
+
+        // Binned SAH: the cost of a split is the chance of visiting each
+        // side, by surface area, times the objects it holds
+        float bestCost = FLT_MAX;
+        int bestAxis = -1;
+        uint32_t bestBin = 0;
+
+        for (int axis = 0; axis < 3 && objectCount > 1; axis++)
+        {
+            float extent = centroidMax[axis] - centroidMin[axis];
+            if (extent <= 0.0f)
+            {
+                continue;
+            }
+            float binScale = BVH_SAH_BINS / extent;
+
+            BvhBin bins[BVH_SAH_BINS];
+            for (BvhBin &bin : bins)
+            {
+                emptyBounds(bin.min, bin.max);
+                bin.count = 0;
+            }
+
+            for (uint32_t i = task.begin; i < task.end; i++)
+            {
+                uint32_t object = bvh.objectIndices[i];
+                uint32_t bin = std::min(static_cast<uint32_t>((centroids[object][axis] - centroidMin[axis]) * binScale), BVH_SAH_BINS - 1);
+                growBounds(bins[bin].min, bins[bin].max, bounds[object]);
+                bins[bin].count++;
+            }
+
+            // areas and counts left of each boundary, swept from both ends
+            float leftAreas[BVH_SAH_BINS - 1];
+            uint32_t leftCounts[BVH_SAH_BINS - 1];
+            glm::vec3 sweepMin, sweepMax;
+            emptyBounds(sweepMin, sweepMax);
+            uint32_t sweepCount = 0;
+            for (uint32_t i = 0; i < BVH_SAH_BINS - 1; i++)
+            {
+                if (bins[i].count > 0)
+                {
+                    sweepMin = glm::min(sweepMin, bins[i].min);
+                    sweepMax = glm::max(sweepMax, bins[i].max);
+                }
+                sweepCount += bins[i].count;
+                leftAreas[i] = sweepCount > 0 ? surfaceArea(sweepMin, sweepMax) : 0.0f;
+                leftCounts[i] = sweepCount;
+            }
+
+            emptyBounds(sweepMin, sweepMax);
+            sweepCount = 0;
+            for (uint32_t i = BVH_SAH_BINS - 1; i > 0; i--)
+            {
+                if (bins[i].count > 0)
+                {
+                    sweepMin = glm::min(sweepMin, bins[i].min);
+                    sweepMax = glm::max(sweepMax, bins[i].max);
+                }
+                sweepCount += bins[i].count;
+
+                if (sweepCount == 0 || leftCounts[i - 1] == 0)
+                {
+                    continue;
+                }
+
+                float cost = leftAreas[i - 1] * leftCounts[i - 1] + surfaceArea(sweepMin, sweepMax) * sweepCount;
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = i;
+                }
+            }
+        }
+
+        float nodeArea = surfaceArea(nodeMin, nodeMax);
+        float splitCost = BVH_TRAVERSAL_COST + (nodeArea > 0.0f ? bestCost / nodeArea : 0.0f);
+
+        bool makeLeaf = objectCount <= BVH_MAX_LEAF_OBJECTS && (bestAxis < 0 || splitCost >= static_cast<float>(objectCount));
+        if (objectCount == 1 || makeLeaf)
+        {
+            BvhNode &leaf = bvh.nodes[task.node];
+            leaf.first = task.begin;
+            leaf.count = objectCount;
+            for (uint32_t i = task.begin; i < task.end; i++)
+            {
+                bvh.objectLeaves[bvh.objectIndices[i]] = task.node;
+            }
+            continue;
+        }
+
+        uint32_t middle;
+        if (bestAxis >= 0)
+        {
+            float binScale = BVH_SAH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+            uint32_t *split = std::partition(&bvh.objectIndices[task.begin], &bvh.objectIndices[0] + task.end, [&](uint32_t object)
+            {
+                uint32_t bin = std::min(static_cast<uint32_t>((centroids[object][bestAxis] - centroidMin[bestAxis]) * binScale), BVH_SAH_BINS - 1);
+                return bin < bestBin;
+            });
+            middle = static_cast<uint32_t>(split - &bvh.objectIndices[0]);
+        }
+        else
+        {
+            // all centroids in one place, any split is as good as the next
+            middle = task.begin + objectCount / 2;
+        }
+
+        uint32_t left = static_cast<uint32_t>(bvh.nodes.size());
+        BvhNode child = {};
+        bvh.nodes.push_back(child);
+        bvh.nodes.push_back(child);
+        bvh.parents.push_back(task.node);
+        bvh.parents.push_back(task.node);
+
+        bvh.nodes[task.node].first = left;
+        bvh.nodes[task.node].count = 0;
+
+        tasks.push_back({ left, task.begin, middle });
+        tasks.push_back({ left + 1, middle, task.end });
+    }
+
+    bvh.nodeDirty.assign(bvh.nodes.size(), 0);
+}
+
+void updateBvhObject(Bvh &bvh, uint32_t object, const BvhBounds &bounds)
+{
+    assert(object < bvh.objectBounds.size());
+
+    bvh.objectBounds[object] = bounds;
+
+    uint32_t leaf = bvh.objectLeaves[object];
+    if (!bvh.nodeDirty[leaf])
+    {
+        bvh.nodeDirty[leaf] = 1;
+        bvh.dirtyLeaves.push_back(leaf);
+    }
+}
+
+// Swapping a child of the node with a grandchild below its sibling keeps
+// the node's own bounds, only the sibling's bounds change. Takes the swap
+// that shrinks the sibling the most, if any does
+static void rotateNode(Bvh &bvh, uint32_t index)
+{
+    const BvhNode &node = bvh.nodes[index];
+    if (node.count != 0)
+    {
+        return;
+    }
+
+    uint32_t bestChild = BVH_INVALID;
+    uint32_t bestGrandchild = BVH_INVALID;
+    float bestArea = 0.0f;
+
+    for (uint32_t side = 0; side < 2; side++)
+    {
+        uint32_t child = node.first + side;
+        uint32_t sibling = node.first + 1 - side;
+        const BvhNode &siblingNode = bvh.nodes[sibling];
+        if (siblingNode.count != 0)
+        {
+            continue;
+        }
+
+        float siblingArea = surfaceArea(siblingNode);
+
+        for (uint32_t grandSide = 0; grandSide < 2; grandSide++)
+        {
+            // the child takes the place of one grandchild, next to the other
+            const BvhNode &kept = bvh.nodes[siblingNode.first + 1 - grandSide];
+            const BvhNode &moved = bvh.nodes[child];
+            float area = surfaceArea(glm::min(kept.min, moved.min), glm::max(kept.max, moved.max));
+
+            if (siblingArea - area > bestArea)
+            {
+                bestArea = siblingArea - area;
+                bestChild = child;
+                bestGrandchild = siblingNode.first + grandSide;
+            }
+        }
+    }
+
+    if (bestChild == BVH_INVALID)
+    {
+        return;
+    }
+
+    std::swap(bvh.nodes[bestChild], bvh.nodes[bestGrandchild]);
+    adoptChildren(bvh, bestChild);
+    adoptChildren(bvh, bestGrandchild);
+
+    fitInterior(bvh, bvh.nodes[bvh.parents[bestGrandchild]]);
+
+    bvh.rotations++;
+}
+
+void refitBvh(Bvh &bvh)
+{
+    // interior nodes whose bounds changed, lowest first along each path
+    std::vector<uint32_t> &touched = bvh.stack;
+    touched.clear();
+
+    for (uint32_t leaf : bvh.dirtyLeaves)
+    {
+        fitLeaf(bvh, bvh.nodes[leaf]);
+
+        for (uint32_t index = bvh.parents[leaf]; index != BVH_INVALID; index = bvh.parents[index])
+        {
+            BvhNode &node = bvh.nodes[index];
+            glm::vec3 oldMin = node.min;
+            glm::vec3 oldMax = node.max;
+            fitInterior(bvh, node);
+
+            if (!bvh.nodeDirty[index])
+            {
+                bvh.nodeDirty[index] = 1;
+                touched.push_back(index);
+            }
+
+            if (oldMin == node.min && oldMax == node.max)
+            {
+                break;
+            }
+        }
+    }
+
+    // Rotations go after the refit, they rely on the bounds below being
+    // right. None changes the bounds of the node it is done at
+    for (uint32_t index : touched)
+    {
+        rotateNode(bvh, index);
+    }
+
+    for (uint32_t leaf : bvh.dirtyLeaves)
+    {
+        bvh.nodeDirty[leaf] = 0;
+    }
+    for (uint32_t index : touched)
+    {
+        bvh.nodeDirty[index] = 0;
+    }
+
+    bvh.dirtyLeaves.clear();
+    touched.clear();
+}
+
+// Planes in the mask are tested, the bits of planes the bounds are fully inside of are cleared.
+// Returns false when the bounds are outside of one
+static bool clipToFrustum(const glm::vec3 &min, const glm::vec3 &max, const glm::vec4 planes[6], uint32_t &mask)
+{
+    for (uint32_t i = 0; i < 6; i++)
+    {
+        if (!(mask & (1 << i)))
+        {
+            continue;
+        }
+
+        const glm::vec4 &plane = planes[i];
+
+        // the corners farthest along and against the plane normal
+        glm::vec3 far(plane.x > 0.0f ? max.x : min.x, plane.y > 0.0f ? max.y : min.y, plane.z > 0.0f ? max.z : min.z);
+        glm::vec3 near(plane.x > 0.0f ? min.x : max.x, plane.y > 0.0f ? min.y : max.y, plane.z > 0.0f ? min.z : max.z);
+
+        if (plane.x * far.x + plane.y * far.y + plane.z * far.z + plane.w < 0.0f)
+        {
+            return false;
+        }
+        if (plane.x * near.x + plane.y * near.y + plane.z * near.z + plane.w >= 0.0f)
+        {
+            mask &= ~(1 << i);
+        }
+    }
+
+    return true;
+}
+
+void queryBvhFrustum(Bvh &bvh, const glm::vec4 planes[6], std::vector<uint32_t> &objects)
+{
+    if (bvh.nodes.empty())
+    {
+        return;
+    }
+
+    // node and plane mask pairs. Below a node that is inside a plane that
+    // plane is no longer tested, below one inside all of them nothing is
+    std::vector<uint32_t> &stack = bvh.stack;
+    stack.clear();
+    stack.push_back(0);
+    stack.push_back(0x3f);
+
+    while (!stack.empty())
+    {
+        uint32_t mask = stack.back();
+        stack.pop_back();
+        const BvhNode &node = bvh.nodes[stack.back()];
+        stack.pop_back();
+
+        if (mask != 0 && !clipToFrustum(node.min, node.max, planes, mask))
+        {
+            continue;
+        }
+
+        if (node.count == 0)
+        {
+            stack.push_back(node.first + 1);
+            stack.push_back(mask);
+            stack.push_back(node.first);
+            stack.push_back(mask);
+            continue;
+        }
+
+        for (uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+            uint32_t object = bvh.objectIndices[i];
+            uint32_t objectMask = mask;
+            if (mask == 0 || clipToFrustum(bvh.objectBounds[object].min, bvh.objectBounds[object].max, planes, objectMask))
+            {
+                objects.push_back(object);
+            }
+        }
+    }
+}
+
+static bool touchesSphere(const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &center, float radiusSquared)
+{
+    glm::vec3 offset = glm::max(min - center, glm::vec3(0.0f)) + glm::max(center - max, glm::vec3(0.0f));
+    return glm::dot(offset, offset) <= radiusSquared;
+}
+
+void queryBvhSphere(Bvh &bvh, const glm::vec3 &center, float radius, std::vector<uint32_t> &objects)
+{
+    if (bvh.nodes.empty())
+    {
+        return;
+    }
+
+    float radiusSquared = radius * radius;
+
+    std::vector<uint32_t> &stack = bvh.stack;
+    stack.clear();
+    stack.push_back(0);
+
+    while (!stack.empty())
+    {
+        const BvhNode &node = bvh.nodes[stack.back()];
+        stack.pop_back();
+
+        if (!touchesSphere(node.min, node.max, center, radiusSquared))
+        {
+            continue;
+        }
+
+        if (node.count == 0)
+        {
+            stack.push_back(node.first + 1);
+            stack.push_back(node.first);
+            continue;
+        }
+
+        for (uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+            uint32_t object = bvh.objectIndices[i];
+            if (touchesSphere(bvh.objectBounds[object].min, bvh.objectBounds[object].max, center, radiusSquared))
+            {
+                objects.push_back(object);
+            }
+        }
+    }
+}
+
+// Slab test, returns the entry distance or FLT_MAX for a miss
+static float intersectRay(const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance)
+{
+    glm::vec3 t0 = (min - origin) * inverseDirection;
+    glm::vec3 t1 = (max - origin) * inverseDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+
+    return enter <= exit ? enter : FLT_MAX;
+}
+
+uint32_t queryBvhRay(Bvh &bvh, const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, float *hitDistance)
+{
+    if (bvh.nodes.empty())
+    {
+        return BVH_INVALID;
+    }
+
+    // axis parallel rays get infinities, which the slab test handles
+    glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+    uint32_t hit = BVH_INVALID;
+    float nearest = maxDistance;
+
+    std::vector<uint32_t> &stack = bvh.stack;
+    stack.clear();
+    stack.push_back(0);
+
+    while (!stack.empty())
+    {
+        const BvhNode &node = bvh.nodes[stack.back()];
+        stack.pop_back();
+
+        if (intersectRay(node.min, node.max, origin, inverseDirection, nearest) == FLT_MAX)
+        {
+            continue;
+        }
+
+        if (node.count == 0)
+        {
+            // the nearer child is popped first, so hits in it cut the other one short
+            const BvhNode &left = bvh.nodes[node.first];
+            const BvhNode &right = bvh.nodes[node.first + 1];
+            float leftDistance = intersectRay(left.min, left.max, origin, inverseDirection, nearest);
+            float rightDistance = intersectRay(right.min, right.max, origin, inverseDirection, nearest);
+
+            uint32_t nearChild = leftDistance <= rightDistance ? node.first : node.first + 1;
+            uint32_t farChild = leftDistance <= rightDistance ? node.first + 1 : node.first;
+
+            if (std::max(leftDistance, rightDistance) != FLT_MAX)
+            {
+                stack.push_back(farChild);
+            }
+            if (std::min(leftDistance, rightDistance) != FLT_MAX)
+            {
+                stack.push_back(nearChild);
+            }
+            continue;
+        }
+
+        for (uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+            uint32_t object = bvh.objectIndices[i];
+            float distance = intersectRay(bvh.objectBounds[object].min, bvh.objectBounds[object].max, origin, inverseDirection, nearest);
+            if (distance < nearest || (distance == nearest && hit == BVH_INVALID))
+            {
+                nearest = distance;
+                hit = object;
+            }
+        }
+    }
+
+    if (hit != BVH_INVALID && hitDistance != nullptr)
+    {
+        *hitDistance = nearest;
+    }
+
+    return hit;
+}
+
+float getBvhCost(const Bvh &bvh)
+{
+    if (bvh.nodes.empty())
+    {
+        return 0.0f;
+    }
+
+    double cost = 0.0;
+    for (const BvhNode &node : bvh.nodes)
+    {
+        cost += surfaceArea(node) * (node.count == 0 ? BVH_TRAVERSAL_COST : static_cast<float>(node.count));
+    }
+
+    float rootArea = surfaceArea(bvh.nodes[0]);
+    return rootArea > 0.0f ? static_cast<float>(cost / rootArea) : 0.0f;
+}
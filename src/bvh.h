@@ -0,0 +1,84 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Objects per leaf, leaves are only split further when the SAH says it pays
+const uint32_t BVH_MAX_LEAF_OBJECTS = 4;
+
+// Centroid bins per axis the SAH build evaluates splits at
+const uint32_t BVH_SAH_BINS = 16;
+
+// Relative cost of visiting a node against testing one object, for the SAH
+const float BVH_TRAVERSAL_COST = 1.0f;
+
+const uint32_t BVH_INVALID = 0xffffffff;
+
+struct BvhBounds
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// 32 bytes, two to a cache line. The children of an interior node are
+// next to each other at first and first + 1, a leaf holds count object
+// indices from first on in Bvh::objectIndices
+struct BvhNode
+{
+    glm::vec3 min;
+    uint32_t first;
+    glm::vec3 max;
+    uint32_t count;   // 0 for interior nodes
+};
+
+// Bounding volume hierarchy over object bounds. Built once with binned
+// SAH, then kept up to date as objects move: moved objects refit their
+// leaves and the nodes above them, and those nodes try a tree rotation
+// that lowers the SAH cost, so the tree doesn't fall apart over time
+struct Bvh
+{
+    // node 0 is the root, the rest are allocated in sibling pairs
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> parents;
+
+    std::vector<uint32_t> objectIndices;
+    std::vector<BvhBounds> objectBounds;
+    std::vector<uint32_t> objectLeaves;
+
+    // leaves with objects that moved since the last refit
+    std::vector<uint32_t> dirtyLeaves;
+    std::vector<uint8_t> nodeDirty;
+
+    // query stack, kept so queries don't allocate
+    std::vector<uint32_t> stack;
+
+    uint32_t rotations = 0;
+};
+
+void buildBvh(Bvh &bvh, const BvhBounds *bounds, uint32_t count);
+
+// Object bounds take effect with the next refitBvh()
+void updateBvhObject(Bvh &bvh, uint32_t object, const BvhBounds &bounds);
+
+void refitBvh(Bvh &bvh);
+
+// Objects whose bounds are on the inner side of all planes, a plane being
+// (normal, distance) with normal pointing inwards. The order is the tree's
+void queryBvhFrustum(Bvh &bvh, const glm::vec4 planes[6], std::vector<uint32_t> &objects);
+
+// Objects whose bounds touch the sphere
+void queryBvhSphere(Bvh &bvh, const glm::vec3 &center, float radius, std::vector<uint32_t> &objects);
+
+// The object whose bounds the ray enters first within maxDistance, or
+// BVH_INVALID. The direction doesn't need to be normalized, distances are
+// in multiples of it
+uint32_t queryBvhRay(Bvh &bvh, const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, float *hitDistance);
+
+// Surface area heuristic cost of the tree, relative to its root
+float getBvhCost(const Bvh &bvh);
+
+#endif //__BVH_H__
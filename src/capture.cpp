@@ -0,0 +1,386 @@
+/*
+    Frame capture for offline replay, see src/captureformat.h for the file layout
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <cstring>
+
+static void writeChunk(CaptureChunkType type, const void* data, size_t size, const void* extra = nullptr, size_t extraSize = 0, const void* extra2 = nullptr, size_t extra2Size = 0)
+{
+    FILE* file = g_app.capture.file;
+
+    CaptureChunkHeader header;
+    header.type = type;
+    header.size = static_cast<uint32_t>(size + extraSize + extra2Size);
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(data, size, 1, file);
+    if (extraSize > 0)
+    {
+        fwrite(extra, extraSize, 1, file);
+    }
+    if (extra2Size > 0)
+    {
+        fwrite(extra2, extra2Size, 1, file);
+    }
+}
+
+static uint32_t captureShader(const char* fileName, VkShaderStageFlagBits stage)
+{
+    FrameCapture &capture = g_app.capture;
+
+    auto written = capture.shaderIds.find(fileName);
+    if (written != capture.shaderIds.end())
+    {
+        return written->second;
+    }
+
+    std::string source;
+    {
+        std::lock_guard<std::mutex> guard(g_app.shaderSourceLock);
+        auto preloaded = g_app.shaderSources.find(fileName);
+        source = (preloaded != g_app.shaderSources.end()) ? preloaded->second : readTextFile(fileName);
+    }
+
+    // stored as the source text, the replay tool wraps it the same way loadShaderGLSL() does
+    CaptureShader shader = {};
+    shader.id = capture.nextId++;
+    shader.stage = stage;
+    shader.format = CAPTURE_SHADER_GLSL;
+    shader.nameLength = static_cast<uint32_t>(strlen(fileName));
+    shader.codeSize = static_cast<uint32_t>(source.size());
+
+    writeChunk(CAPTURE_CHUNK_SHADER, &shader, sizeof(shader), fileName, shader.nameLength, source.data(), source.size());
+
+    capture.shaderIds[fileName] = shader.id;
+
+    return shader.id;
+}
+
+// Copies the buffer into host memory through the setup command buffer and
+// waits for it, the mesh buffers are device local
+static void readBuffer(VkBuffer buffer, VkDeviceSize size, std::vector<uint8_t> &data)
+{
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    VkBuffer readback = VK_NULL_HANDLE;
+    VkResult result = vkCreateBuffer(g_app.device, &bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), &readback);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_app.device, readback, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memAllocInfo.memoryTypeIndex);
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    result = allocateDeviceMemory(&memAllocInfo, &memory);
+    assert(result == VK_SUCCESS);
+    vkBindBufferMemory(g_app.device, readback, memory, 0);
+
+    VkCommandBuffer setupCmdBuffer = beginSetupCommands();
+
+    VkBufferCopy region = { 0, 0, size };
+    vkCmdCopyBuffer(setupCmdBuffer, buffer, readback, 1, &region);
+
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(setupCmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    endSetupCommands();
+    flushSetupCommands();
+
+    void *mapped;
+    result = vkMapMemory(g_app.device, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+    assert(result == VK_SUCCESS);
+
+    data.resize(static_cast<size_t>(size));
+    memcpy(data.data(), mapped, data.size());
+
+    vkUnmapMemory(g_app.device, memory);
+    vkDestroyBuffer(g_app.device, readback, getHostAllocator(HOST_OBJECT_BUFFER));
+    freeDeviceMemory(memory);
+}
+
+static uint32_t captureBuffer(VkBuffer buffer, VkDeviceSize size, VkBufferUsageFlags usage)
+{
+    FrameCapture &capture = g_app.capture;
+
+    auto written = capture.bufferIds.find(buffer);
+    if (written != capture.bufferIds.end())
+    {
+        return written->second;
+    }
+
+    std::vector<uint8_t> data;
+    readBuffer(buffer, size, data);
+
+    CaptureBuffer captured = {};
+    captured.id = capture.nextId++;
+    captured.usage = usage;
+    captured.size = size;
+
+    writeChunk(CAPTURE_CHUNK_BUFFER, &captured, sizeof(captured), data.data(), data.size());
+
+    capture.bufferIds[buffer] = captured.id;
+
+    return captured.id;
+}
+
+static uint32_t captureMaterialPipeline(const Material &material)
+{
+    FrameCapture &capture = g_app.capture;
+
+    auto written = capture.pipelineIds.find(material.pipeline);
+    if (written != capture.pipelineIds.end())
+    {
+        return written->second;
+    }
+
+    // fixed function state matches createMaterialPipeline()
+    CapturePipeline pipeline = {};
+    pipeline.id = capture.nextId++;
+    pipeline.vertexShader = captureShader("data/triangle.vert", VK_SHADER_STAGE_VERTEX_BIT);
+    pipeline.fragmentShader = captureShader("data/triangle.frag", VK_SHADER_STAGE_FRAGMENT_BIT);
+    pipeline.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    pipeline.cullMode = VK_CULL_MODE_NONE;
+    pipeline.depthTest = VK_TRUE;
+    pipeline.pushConstantSize = sizeof(MaterialPushConstants);
+
+    std::vector<VkVertexInputBindingDescription> bindings;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+    getMaterialVertexInput(material.features, bindings, attributes);
+
+    assert(attributes.size() <= CAPTURE_MAX_VERTEX_ATTRIBUTES);
+    for (const VkVertexInputBindingDescription &binding : bindings)
+    {
+        if (binding.binding == MATERIAL_INSTANCE_BIND_ID)
+        {
+            pipeline.instanceStride = binding.stride;
+        }
+        else
+        {
+            pipeline.vertexStride = binding.stride;
+        }
+    }
+    pipeline.attributeCount = static_cast<uint32_t>(attributes.size());
+    for (uint32_t i = 0; i < pipeline.attributeCount; i++)
+    {
+        pipeline.attributes[i].binding = (attributes[i].binding == MATERIAL_INSTANCE_BIND_ID) ? 1 : 0;
+        pipeline.attributes[i].location = attributes[i].location;
+        pipeline.attributes[i].format = attributes[i].format;
+        pipeline.attributes[i].offset = attributes[i].offset;
+    }
+
+    VkBool32 constants[MATERIAL_CONSTANT_COUNT];
+    getMaterialConstants(material.features, constants);
+    pipeline.specConstantCount = MATERIAL_CONSTANT_COUNT;
+    for (uint32_t i = 0; i < MATERIAL_CONSTANT_COUNT; i++)
+    {
+        pipeline.specConstants[i] = constants[i];
+    }
+
+    writeChunk(CAPTURE_CHUNK_PIPELINE, &pipeline, sizeof(pipeline));
+
+    capture.pipelineIds[material.pipeline] = pipeline.id;
+
+    return pipeline.id;
+}
+
+static bool beginCaptureFile()
+{
+    FrameCapture &capture = g_app.capture;
+
+    // the capture format only knows the descriptor set layout of the default mode
+    if (g_app.bindless.enabled)
+    {
+        printf("Frame capture is not supported in bindless mode\n");
+        return false;
+    }
+
+    // lit materials read the light buffers, which the replay has no bindings for
+    if (g_app.lighting.enabled && g_app.lighting.lightCount > 0)
+    {
+        printf("Frame capture is not supported with --lights\n");
+        return false;
+    }
+
+    // the replay draws in one subpass, the lighting subpass would be missing
+    if (g_app.deferred.enabled)
+    {
+        printf("Frame capture is not supported in deferred mode\n");
+        return false;
+    }
+
+    // the views are drawn with their own vertex shader and a view mask
+    if (g_app.multiview.enabled)
+    {
+        printf("Frame capture is not supported with --views\n");
+        return false;
+    }
+
+    // the world objects come from a second vertex buffer the capture format has no place for
+    if (g_app.world.drawn)
+    {
+        printf("Frame capture is not supported with --world\n");
+        return false;
+    }
+
+    // the characters are drawn from the vertices the skinning stage writes every frame
+    if (g_app.skinning.characterCount > 0)
+    {
+        printf("Frame capture is not supported with --skinning\n");
+        return false;
+    }
+
+    capture.file = fopen(capture.path.c_str(), "wb");
+    if (capture.file == nullptr)
+    {
+        printf("Could not open capture file %s\n", capture.path.c_str());
+        return false;
+    }
+
+    // the frame count is patched in when the capture is finished
+    CaptureFileHeader header = {};
+    header.magic = CAPTURE_MAGIC;
+    header.version = CAPTURE_VERSION;
+    header.width = SCREEN_WIDTH;
+    header.height = SCREEN_HEIGHT;
+    header.colorFormat = g_app.colorFormat;
+    header.depthFormat = g_app.depth.format;
+    header.frameCount = 0;
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        header.clearColor[i] = clear_color.float32[i];
+    }
+
+    fwrite(&header, sizeof(header), 1, capture.file);
+
+    capture.framesWritten = 0;
+    capture.nextId = 1;
+    capture.shaderIds.clear();
+    capture.bufferIds.clear();
+    capture.pipelineIds.clear();
+
+    printf("Capturing %u frames to %s\n", capture.framesRequested, capture.path.c_str());
+
+    return true;
+}
+
+static void endCaptureFile()
+{
+    FrameCapture &capture = g_app.capture;
+
+    long fileSize = ftell(capture.file);
+
+    fseek(capture.file, offsetof(CaptureFileHeader, frameCount), SEEK_SET);
+    fwrite(&capture.framesWritten, sizeof(uint32_t), 1, capture.file);
+    fclose(capture.file);
+
+    printf("Captured %u frames to %s (%ld bytes)\n", capture.framesWritten, capture.path.c_str(), fileSize);
+
+    capture.file = nullptr;
+    capture.framesRequested = 0;
+}
+
+void requestFrameCapture(const char* path, uint32_t frameCount)
+{
+    FrameCapture &capture = g_app.capture;
+
+    // a capture that is already running keeps going
+    if (capture.file != nullptr || frameCount == 0)
+    {
+        return;
+    }
+
+    capture.path = path;
+    capture.framesRequested = frameCount;
+}
+
+void captureFrame(uint32_t imageIndex)
+{
+    FrameCapture &capture = g_app.capture;
+
+    if (capture.framesRequested == 0)
+    {
+        return;
+    }
+
+    if (capture.file == nullptr && !beginCaptureFile())
+    {
+        capture.framesRequested = 0;
+        return;
+    }
+
+    // resources are written the first time a frame uses them
+    uint32_t pipeline = captureMaterialPipeline(g_app.material);
+    uint32_t vertexBuffer = captureBuffer(g_app.vertices.buffer, g_app.vertices.size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    uint32_t indexBuffer = captureBuffer(g_app.indices.buffer, g_app.indices.size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    uint32_t uniformBuffer = captureBuffer(g_app.uniformDataVS.buffer, g_app.uniformDataVS.regionSize * g_app.swapchainImageCount, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+    VkDeviceSize instanceRegionSize = sizeof(glm::mat4) * g_app.instanceEntities.size();
+    uint32_t instanceBuffer = captureBuffer(g_app.instanceTransforms.buffer, instanceRegionSize * g_app.swapchainImageCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+
+    CaptureFrameBegin frameBegin;
+    frameBegin.frameIndex = capture.framesWritten;
+    frameBegin.frameMs = static_cast<float>(g_app.frameStats.frameMs);
+    writeChunk(CAPTURE_CHUNK_FRAME_BEGIN, &frameBegin, sizeof(frameBegin));
+
+    // updateUniformBuffers() writes the whole block every frame
+    CaptureBufferUpdate update = {};
+    update.id = uniformBuffer;
+    update.offset = 0;
+    update.size = sizeof(g_app.uboVS);
+    writeChunk(CAPTURE_CHUNK_BUFFER_UPDATE, &update, sizeof(update), &g_app.uboVS, sizeof(g_app.uboVS));
+
+    // and cullScene() the world transforms of the image's instances, which
+    // the replay draws from the start of the buffer
+    update.id = instanceBuffer;
+    update.size = instanceRegionSize;
+    writeChunk(CAPTURE_CHUNK_BUFFER_UPDATE, &update, sizeof(update), &g_app.instanceTransforms.mapped[imageIndex * g_app.instanceEntities.size()], static_cast<size_t>(instanceRegionSize));
+
+    MaterialPushConstants pushConstants = getMaterialPushConstants(g_app.material);
+    static_assert(sizeof(pushConstants) <= CAPTURE_MAX_PUSH_CONSTANTS, "material push constants don't fit in a captured draw");
+
+    // The indirect draws cullScene() wrote for the image, as the draw
+    // command buffer of the image submitted them. The CPU wrote them, so
+    // they are read from the mapping and not from the device
+    const VkDrawIndexedIndirectCommand *indirect = &g_app.occlusion.indirect.mapped[(imageIndex * SCENE_DRAW_LIST_COUNT + SCENE_DRAWS_INSTANCES) * OCCLUSION_MAX_DRAWS];
+    for (uint32_t i = 0; i < OCCLUSION_MAX_DRAWS; i++)
+    {
+        if (indirect[i].instanceCount == 0)
+        {
+            continue;
+        }
+
+        CaptureDraw draw = {};
+        draw.pipeline = pipeline;
+        draw.vertexBuffer = vertexBuffer;
+        draw.instanceBuffer = instanceBuffer;
+        draw.indexBuffer = indexBuffer;
+        draw.uniformBuffer = uniformBuffer;
+        draw.indexCount = indirect[i].indexCount;
+        draw.instanceCount = indirect[i].instanceCount;
+        draw.firstIndex = indirect[i].firstIndex;
+        draw.vertexOffset = indirect[i].vertexOffset;
+        draw.firstInstance = indirect[i].firstInstance;
+        draw.pushConstantSize = sizeof(pushConstants);
+        memcpy(draw.pushConstants, &pushConstants, sizeof(pushConstants));
+        writeChunk(CAPTURE_CHUNK_DRAW, &draw, sizeof(draw));
+    }
+
+    writeChunk(CAPTURE_CHUNK_FRAME_END, &frameBegin.frameIndex, sizeof(frameBegin.frameIndex));
+
+    if (++capture.framesWritten == capture.framesRequested)
+    {
+        endCaptureFile();
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <vulkan/vulkan.h>
+
+#include <stdio.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "captureformat.h"
+
+// Writes the renderer level work of a number of frames to a file that
+// tools/replay can re-execute without a window. Resources are written
+// once when the capture starts, every frame then adds its buffer updates
+// and draws. The overlay is not part of the capture
+struct FrameCapture
+{
+    std::string path;
+    uint32_t framesRequested = 0;
+    uint32_t framesWritten = 0;
+
+    FILE* file = nullptr;
+
+    // capture ids of the objects already written to the file
+    uint32_t nextId = 1;
+    std::unordered_map<std::string, uint32_t> shaderIds;
+    std::unordered_map<VkBuffer, uint32_t> bufferIds;
+    std::unordered_map<VkPipeline, uint32_t> pipelineIds;
+};
+
+// Starts capturing with the next rendered frame
+void requestFrameCapture(const char* path, uint32_t frameCount);
+
+// Called by render() once the frame drawing this swapchain image has been submitted
+void captureFrame(uint32_t imageIndex);
+
+#endif //__CAPTURE_H__
@@ -0,0 +1,136 @@
+#ifndef __CAPTUREFORMAT_H__
+#define __CAPTUREFORMAT_H__
+
+#include <stdint.h>
+
+// Binary layout of a frame capture, shared by the app (src/capture.cpp)
+// and the replay tool (tools/replay). A file is a CaptureFileHeader
+// followed by chunks, each a CaptureChunkHeader and its payload.
+// Resource chunks come first, then every frame as FRAME_BEGIN, buffer
+// updates, draws and FRAME_END. All values are little endian
+
+const uint32_t CAPTURE_MAGIC = 0x50414356; // "VCAP"
+const uint32_t CAPTURE_VERSION = 3;
+
+const uint32_t CAPTURE_MAX_VERTEX_ATTRIBUTES = 8;
+const uint32_t CAPTURE_MAX_SPEC_CONSTANTS = 8;
+const uint32_t CAPTURE_MAX_PUSH_CONSTANTS = 128;
+
+enum CaptureChunkType
+{
+    CAPTURE_CHUNK_SHADER        = 1,
+    CAPTURE_CHUNK_BUFFER        = 2,
+    CAPTURE_CHUNK_PIPELINE      = 3,
+    CAPTURE_CHUNK_FRAME_BEGIN   = 4,
+    CAPTURE_CHUNK_BUFFER_UPDATE = 5,
+    CAPTURE_CHUNK_DRAW          = 6,
+    CAPTURE_CHUNK_FRAME_END     = 7,
+};
+
+enum CaptureShaderFormat
+{
+    // GLSL source behind the SPIR-V magic number, see loadShaderGLSL()
+    CAPTURE_SHADER_GLSL = 0,
+    CAPTURE_SHADER_SPIRV = 1,
+};
+
+struct CaptureFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t colorFormat;       // VkFormat
+    uint32_t depthFormat;       // VkFormat
+    uint32_t frameCount;
+    float clearColor[4];
+};
+
+struct CaptureChunkHeader
+{
+    uint32_t type;              // CaptureChunkType
+    uint32_t size;              // payload size in bytes, not counting this header
+};
+
+// followed by nameLength bytes of name and codeSize bytes of code
+struct CaptureShader
+{
+    uint32_t id;
+    uint32_t stage;             // VkShaderStageFlagBits
+    uint32_t format;            // CaptureShaderFormat
+    uint32_t nameLength;
+    uint32_t codeSize;
+};
+
+// followed by size bytes of initial contents
+struct CaptureBuffer
+{
+    uint32_t id;
+    uint32_t usage;             // VkBufferUsageFlags
+    uint64_t size;
+};
+
+struct CaptureVertexAttribute
+{
+    uint32_t binding;           // 0 per vertex, 1 per instance
+    uint32_t location;
+    uint32_t format;            // VkFormat
+    uint32_t offset;
+};
+
+// Every captured pipeline uses the renderer's layout: a uniform buffer
+// at set 0 binding 0 and fragment push constants
+struct CapturePipeline
+{
+    uint32_t id;
+    uint32_t vertexShader;
+    uint32_t fragmentShader;
+
+    uint32_t topology;          // VkPrimitiveTopology
+    uint32_t cullMode;          // VkCullModeFlags
+    uint32_t depthTest;
+    uint32_t pushConstantSize;
+
+    uint32_t vertexStride;
+    uint32_t instanceStride;    // 0 without a per instance binding
+    uint32_t attributeCount;
+    CaptureVertexAttribute attributes[CAPTURE_MAX_VERTEX_ATTRIBUTES];
+
+    // VkBool32 values for constant ids 0 to specConstantCount - 1
+    uint32_t specConstantCount;
+    uint32_t specConstants[CAPTURE_MAX_SPEC_CONSTANTS];
+};
+
+struct CaptureFrameBegin
+{
+    uint32_t frameIndex;
+    float frameMs;              // frame time in the captured session
+};
+
+// followed by size bytes written at offset
+struct CaptureBufferUpdate
+{
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// indexed draw with 32 bit indices, one per indirect draw the frame submitted
+struct CaptureDraw
+{
+    uint32_t pipeline;
+    uint32_t vertexBuffer;
+    uint32_t instanceBuffer;    // bound at offset 0 to binding 1
+    uint32_t indexBuffer;
+    uint32_t uniformBuffer;
+    uint32_t indexCount;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t firstInstance;
+    uint32_t pushConstantSize;
+    uint8_t pushConstants[CAPTURE_MAX_PUSH_CONSTANTS];
+};
+
+#endif //__CAPTUREFORMAT_H__
@@ -0,0 +1,420 @@
+/*
+    Deferred shading with a transient G-buffer read back as subpass input attachments
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <string.h>
+
+static bool createGBufferImage(VkFormat format, GBufferImage &target)
+{
+    DeferredShading &deferred = g_app.deferred;
+
+    // Only ever an attachment within the render pass, so the image can be
+    // transient and never needs memory outside of tile storage
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = format;
+    imageInfo.extent = { SCREEN_WIDTH, SCREEN_HEIGHT, 1 };
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkResult result = vkCreateImage(g_app.device, &imageInfo, getHostAllocator(HOST_OBJECT_IMAGE), &target.image);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(g_app.device, target.image, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+
+    // desktop GPUs have no lazily allocated memory and back it like any other image
+    bool lazy = memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, &memAllocInfo.memoryTypeIndex);
+    if (!lazy && !memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memAllocInfo.memoryTypeIndex))
+    {
+        return false;
+    }
+    deferred.lazilyAllocated = lazy;
+
+    result = allocateDeviceMemory(&memAllocInfo, &target.memory);
+    assert(result == VK_SUCCESS);
+
+    result = vkBindImageMemory(g_app.device, target.image, target.memory, 0);
+    assert(result == VK_SUCCESS);
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = target.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+    result = vkCreateImageView(g_app.device, &viewInfo, getHostAllocator(HOST_OBJECT_IMAGE_VIEW), &target.view);
+
+    return (result == VK_SUCCESS);
+}
+
+static void destroyGBufferImage(GBufferImage &target)
+{
+    if (target.image == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    evictCachedDescriptorSets((uint64_t)target.view);
+    vkDestroyImageView(g_app.device, target.view, getHostAllocator(HOST_OBJECT_IMAGE_VIEW));
+    vkDestroyImage(g_app.device, target.image, getHostAllocator(HOST_OBJECT_IMAGE));
+    freeDeviceMemory(target.memory);
+
+    target = GBufferImage();
+}
+
+bool initGBuffer()
+{
+    DeferredShading &deferred = g_app.deferred;
+
+    if (!deferred.enabled)
+    {
+        return true;
+    }
+
+    if (!createGBufferImage(DEFERRED_ALBEDO_FORMAT, deferred.albedo) ||
+        !createGBufferImage(DEFERRED_NORMAL_FORMAT, deferred.normal))
+    {
+        printf("Deferred: could not allocate the G-buffer\n");
+        return false;
+    }
+
+    // the lighting subpass reads depth through a view without the stencil aspect
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = g_app.depth.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = g_app.depth.format;
+    viewInfo.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+    VkResult result = vkCreateImageView(g_app.device, &viewInfo, getHostAllocator(HOST_OBJECT_IMAGE_VIEW), &deferred.depthInputView);
+    assert(result == VK_SUCCESS);
+
+    printf("Deferred: G-buffer of %ux%u in %s memory\n", SCREEN_WIDTH, SCREEN_HEIGHT, deferred.lazilyAllocated ? "lazily allocated" : "device local");
+
+    return (result == VK_SUCCESS);
+}
+
+bool createDeferredRenderPass(VkFormat colorFormat, VkFormat depthFormat, VkRenderPass *renderPass)
+{
+    VkAttachmentDescription attachmentDescription[DEFERRED_ATTACHMENT_COUNT] = {};
+
+    attachmentDescription[DEFERRED_ATTACHMENT_COLOR].format = colorFormat;
+    attachmentDescription[DEFERRED_ATTACHMENT_COLOR].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachmentDescription[DEFERRED_ATTACHMENT_COLOR].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachmentDescription[DEFERRED_ATTACHMENT_COLOR].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachmentDescription[DEFERRED_ATTACHMENT_COLOR].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachmentDescription[DEFERRED_ATTACHMENT_COLOR].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachmentDescription[DEFERRED_ATTACHMENT_COLOR].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachmentDescription[DEFERRED_ATTACHMENT_COLOR].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    // kept for the depth pyramid, as in the forward pass
+    attachmentDescription[DEFERRED_ATTACHMENT_DEPTH].format = depthFormat;
+    attachmentDescription[DEFERRED_ATTACHMENT_DEPTH].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachmentDescription[DEFERRED_ATTACHMENT_DEPTH].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachmentDescription[DEFERRED_ATTACHMENT_DEPTH].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachmentDescription[DEFERRED_ATTACHMENT_DEPTH].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachmentDescription[DEFERRED_ATTACHMENT_DEPTH].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachmentDescription[DEFERRED_ATTACHMENT_DEPTH].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    attachmentDescription[DEFERRED_ATTACHMENT_DEPTH].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    // The G-buffer lives and dies inside the pass: cleared on load, its
+    // contents thrown away at the end instead of written out
+    const VkFormat gBufferFormats[2] = { DEFERRED_ALBEDO_FORMAT, DEFERRED_NORMAL_FORMAT };
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        VkAttachmentDescription &attachment = attachmentDescription[DEFERRED_ATTACHMENT_ALBEDO + i];
+        attachment.format = gBufferFormats[i];
+        attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+
+    VkAttachmentReference gBufferReferences[2];
+    gBufferReferences[0] = { DEFERRED_ATTACHMENT_ALBEDO, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+    gBufferReferences[1] = { DEFERRED_ATTACHMENT_NORMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+    VkAttachmentReference depthReference = { DEFERRED_ATTACHMENT_DEPTH, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+    // input attachment indices of data/deferred.frag
+    VkAttachmentReference inputReferences[3];
+    inputReferences[0] = { DEFERRED_ATTACHMENT_ALBEDO, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    inputReferences[1] = { DEFERRED_ATTACHMENT_NORMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    inputReferences[2] = { DEFERRED_ATTACHMENT_DEPTH, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+
+    VkAttachmentReference colorReference = { DEFERRED_ATTACHMENT_COLOR, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+    VkSubpassDescription subpassDescriptions[2] = {};
+
+    subpassDescriptions[DEFERRED_GEOMETRY_SUBPASS].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpassDescriptions[DEFERRED_GEOMETRY_SUBPASS].colorAttachmentCount = 2;
+    subpassDescriptions[DEFERRED_GEOMETRY_SUBPASS].pColorAttachments = gBufferReferences;
+    subpassDescriptions[DEFERRED_GEOMETRY_SUBPASS].pDepthStencilAttachment = &depthReference;
+
+    subpassDescriptions[DEFERRED_LIGHTING_SUBPASS].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpassDescriptions[DEFERRED_LIGHTING_SUBPASS].inputAttachmentCount = 3;
+    subpassDescriptions[DEFERRED_LIGHTING_SUBPASS].pInputAttachments = inputReferences;
+    subpassDescriptions[DEFERRED_LIGHTING_SUBPASS].colorAttachmentCount = 1;
+    subpassDescriptions[DEFERRED_LIGHTING_SUBPASS].pColorAttachments = &colorReference;
+
+    // A pixel is only ever read by the lighting fragment of the same
+    // pixel, so the dependency is by region and the G-buffer never has to
+    // leave the tile between the subpasses
+    VkSubpassDependency dependencies[2] = {};
+    dependencies[0].srcSubpass = DEFERRED_GEOMETRY_SUBPASS;
+    dependencies[0].dstSubpass = DEFERRED_LIGHTING_SUBPASS;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+    dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+    // the G-buffer and depth of the frame before may still be in use
+    dependencies[1] = getPreviousFrameDependency();
+
+    VkRenderPassCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    info.attachmentCount = DEFERRED_ATTACHMENT_COUNT;
+    info.pAttachments = attachmentDescription;
+    info.subpassCount = 2;
+    info.pSubpasses = subpassDescriptions;
+    info.dependencyCount = 2;
+    info.pDependencies = dependencies;
+
+    return (vkCreateRenderPass(g_app.device, &info, getHostAllocator(HOST_OBJECT_RENDER_PASS), renderPass) == VK_SUCCESS);
+}
+
+static bool initDeferredPipeline()
+{
+    DeferredShading &deferred = g_app.deferred;
+
+    // the triangle covering the screen is made up in the vertex shader
+    VkPipelineVertexInputStateCreateInfo inputState = {};
+    inputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
+    inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkPipelineRasterizationStateCreateInfo rasterizationState = {};
+    rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizationState.cullMode = VK_CULL_MODE_NONE;
+    rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizationState.lineWidth = 1.0f;
+
+    VkPipelineColorBlendAttachmentState blendAttachmentState = {};
+    blendAttachmentState.colorWriteMask = 0xf;
+    blendAttachmentState.blendEnable = VK_FALSE;
+
+    VkPipelineColorBlendStateCreateInfo colorBlendState = {};
+    colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlendState.attachmentCount = 1;
+    colorBlendState.pAttachments = &blendAttachmentState;
+
+    VkPipelineViewportStateCreateInfo viewportState = {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    VkDynamicState dynamicStateEnables[2] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.pDynamicStates = dynamicStateEnables;
+    dynamicState.dynamicStateCount = 2;
+
+    // the subpass has no depth attachment, depth is an input
+    VkPipelineDepthStencilStateCreateInfo depthStencilState = {};
+    depthStencilState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencilState.depthTestEnable = VK_FALSE;
+    depthStencilState.depthWriteEnable = VK_FALSE;
+    depthStencilState.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+
+    VkPipelineMultisampleStateCreateInfo multisampleState = {};
+    multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = loadShaderGLSL("data/deferred.vert", VK_SHADER_STAGE_VERTEX_BIT);
+    shaderStages[0].pName = "main";
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = loadShaderGLSL("data/deferred.frag", VK_SHADER_STAGE_FRAGMENT_BIT);
+    shaderStages[1].pName = "main";
+
+    if (shaderStages[0].module == VK_NULL_HANDLE || shaderStages[1].module == VK_NULL_HANDLE)
+    {
+        return false;
+    }
+
+    VkGraphicsPipelineCreateInfo gfxPipelineCreateInfo = {};
+    gfxPipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    gfxPipelineCreateInfo.layout = deferred.pipelineLayout;
+    gfxPipelineCreateInfo.renderPass = g_app.renderPass;
+    gfxPipelineCreateInfo.subpass = DEFERRED_LIGHTING_SUBPASS;
+    gfxPipelineCreateInfo.stageCount = 2;
+    gfxPipelineCreateInfo.pStages = shaderStages;
+    gfxPipelineCreateInfo.pVertexInputState = &inputState;
+    gfxPipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+    gfxPipelineCreateInfo.pRasterizationState = &rasterizationState;
+    gfxPipelineCreateInfo.pColorBlendState = &colorBlendState;
+    gfxPipelineCreateInfo.pMultisampleState = &multisampleState;
+    gfxPipelineCreateInfo.pViewportState = &viewportState;
+    gfxPipelineCreateInfo.pDepthStencilState = &depthStencilState;
+    gfxPipelineCreateInfo.pDynamicState = &dynamicState;
+
+    VkResult result = vkCreateGraphicsPipelines(g_app.device, g_app.pipelineCache, 1, &gfxPipelineCreateInfo, getHostAllocator(HOST_OBJECT_PIPELINE), &deferred.pipeline);
+    assert(result == VK_SUCCESS);
+
+    // the modules are not needed once the pipeline exists
+    vkDestroyShaderModule(g_app.device, shaderStages[0].module, getHostAllocator(HOST_OBJECT_SHADER_MODULE));
+    vkDestroyShaderModule(g_app.device, shaderStages[1].module, getHostAllocator(HOST_OBJECT_SHADER_MODULE));
+
+    return (result == VK_SUCCESS);
+}
+
+bool initDeferredLighting()
+{
+    DeferredShading &deferred = g_app.deferred;
+
+    if (!deferred.enabled)
+    {
+        return true;
+    }
+
+    // the albedo, normal and depth of the pixel, then the clustered lights
+    VkDescriptorSetLayoutBinding bindings[6] = {};
+    for (uint32_t i = 0; i < 6; i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = (i < 3) ? VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    }
+
+    deferred.descriptorSetLayout = createDescriptorSetLayout(bindings, 6);
+
+    DescriptorResource resources[6];
+    memset(resources, 0, sizeof(resources));
+
+    resources[0].image.imageView = deferred.albedo.view;
+    resources[0].image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    resources[1].image.imageView = deferred.normal.view;
+    resources[1].image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    resources[2].image.imageView = deferred.depthInputView;
+    resources[2].image.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+    VkDescriptorBufferInfo lightingResources[3];
+    getLightingResources(lightingResources);
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        resources[i + 3].buffer = lightingResources[i];
+    }
+
+    deferred.descriptorSet = getCachedDescriptorSet(deferred.descriptorSetLayout, resources);
+    if (deferred.descriptorSet == VK_NULL_HANDLE)
+    {
+        return false;
+    }
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(DeferredPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &deferred.descriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    VkResult result = vkCreatePipelineLayout(g_app.device, &pipelineLayoutCreateInfo, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT), &deferred.pipelineLayout);
+    assert(result == VK_SUCCESS);
+
+    if (!initDeferredPipeline())
+    {
+        printf("Deferred: could not create the lighting pipeline\n");
+        return false;
+    }
+
+    return true;
+}
+
+uint32_t getOverlaySubpass()
+{
+    return g_app.deferred.enabled ? DEFERRED_LIGHTING_SUBPASS : 0;
+}
+
+void recordDeferredLighting(VkCommandBuffer cmdBuffer)
+{
+    DeferredShading &deferred = g_app.deferred;
+
+    if (!deferred.enabled)
+    {
+        return;
+    }
+
+    vkCmdNextSubpass(cmdBuffer, VK_SUBPASS_CONTENTS_INLINE);
+
+    // The projection is fixed once the command buffers are recorded,
+    // without lights the albedo goes through unlit as in forward mode
+    DeferredPushConstants pushConstants;
+    pushConstants.inverseProjection = glm::inverse(g_app.uboVS.projectionMatrix);
+    pushConstants.viewportSize[0] = static_cast<float>(SCREEN_WIDTH);
+    pushConstants.viewportSize[1] = static_cast<float>(SCREEN_HEIGHT);
+    pushConstants.lit = (g_app.lighting.lightCount > 0) ? 1 : 0;
+
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, deferred.pipeline);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, deferred.pipelineLayout, 0, 1, &deferred.descriptorSet, 0, nullptr);
+    vkCmdPushConstants(cmdBuffer, deferred.pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+
+    vkCmdDraw(cmdBuffer, 3, 1, 0, 0);
+}
+
+void destroyDeferredShading()
+{
+    DeferredShading &deferred = g_app.deferred;
+
+    if (deferred.pipeline != VK_NULL_HANDLE)
+    {
+        vkDestroyPipeline(g_app.device, deferred.pipeline, getHostAllocator(HOST_OBJECT_PIPELINE));
+        deferred.pipeline = VK_NULL_HANDLE;
+    }
+    if (deferred.pipelineLayout != VK_NULL_HANDLE)
+    {
+        vkDestroyPipelineLayout(g_app.device, deferred.pipelineLayout, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT));
+        deferred.pipelineLayout = VK_NULL_HANDLE;
+    }
+
+    if (deferred.depthInputView != VK_NULL_HANDLE)
+    {
+        evictCachedDescriptorSets((uint64_t)deferred.depthInputView);
+        vkDestroyImageView(g_app.device, deferred.depthInputView, getHostAllocator(HOST_OBJECT_IMAGE_VIEW));
+        deferred.depthInputView = VK_NULL_HANDLE;
+    }
+
+    destroyGBufferImage(deferred.normal);
+    destroyGBufferImage(deferred.albedo);
+}
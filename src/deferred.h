@@ -0,0 +1,90 @@
+#ifndef __DEFERRED_H__
+#define __DEFERRED_H__
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+
+// G-buffer formats: the albedo, and the view space normal scaled to 0..1
+const VkFormat DEFERRED_ALBEDO_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+const VkFormat DEFERRED_NORMAL_FORMAT = VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+
+// Attachments of the deferred render pass, the swapchain image and the
+// depth buffer come first as in the forward pass
+enum DeferredAttachment
+{
+    DEFERRED_ATTACHMENT_COLOR  = 0,
+    DEFERRED_ATTACHMENT_DEPTH  = 1,
+    DEFERRED_ATTACHMENT_ALBEDO = 2,
+    DEFERRED_ATTACHMENT_NORMAL = 3,
+    DEFERRED_ATTACHMENT_COUNT
+};
+
+// The geometry subpass fills the G-buffer, the lighting subpass reads it
+// back as input attachments and draws the overlay on top
+const uint32_t DEFERRED_GEOMETRY_SUBPASS = 0;
+const uint32_t DEFERRED_LIGHTING_SUBPASS = 1;
+
+// Matching the LightingParams block in data/deferred.frag
+struct DeferredPushConstants
+{
+    glm::mat4 inverseProjection;
+    float viewportSize[2];
+    uint32_t lit;
+};
+
+struct GBufferImage
+{
+    VkImage image = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+};
+
+// Deferred shading in one render pass. The material pipelines write albedo
+// and normals in the first subpass and a full screen triangle lights every
+// pixel once from the clustered light lists in the second, reading the
+// G-buffer and depth of its own pixel as input attachments. The G-buffer
+// is cleared on load and never stored, so on tiled GPUs it stays in tile
+// memory and its images can be lazily allocated, without backing memory
+struct DeferredShading
+{
+    // --deferred, enabled unless the device runs in bindless mode
+    bool requested = false;
+    bool enabled = false;
+
+    GBufferImage albedo;
+    GBufferImage normal;
+
+    // the depth aspect alone, the depth buffer view also names stencil
+    VkImageView depthInputView = VK_NULL_HANDLE;
+
+    // the G-buffer got memory that is only committed when a tile spills
+    bool lazilyAllocated = false;
+
+    VkDescriptorSetLayout descriptorSetLayout;      // the layout and set belong to the descriptor allocator
+    VkDescriptorSet descriptorSet;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+};
+
+// Creates the G-buffer images, before the framebuffers that use them
+bool initGBuffer();
+
+// The two subpass render pass of deferred mode
+bool createDeferredRenderPass(VkFormat colorFormat, VkFormat depthFormat, VkRenderPass *renderPass);
+
+// Pipeline and descriptor set of the lighting subpass
+bool initDeferredLighting();
+
+// Subpass the overlay is drawn in
+uint32_t getOverlaySubpass();
+
+// Moves on to the lighting subpass and lights every pixel, inside the
+// scene render pass after the geometry is drawn
+void recordDeferredLighting(VkCommandBuffer cmdBuffer);
+
+void destroyDeferredShading();
+
+#endif //__DEFERRED_H__
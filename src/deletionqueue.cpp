@@ -0,0 +1,249 @@
+/*
+    Objects released while frames are in flight, destroyed once the frame fences say the GPU is done with them
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <algorithm>
+
+bool initDeletionQueue()
+{
+    DeletionQueue &queue = g_app.deletionQueue;
+
+    // one fence per swapchain image, the GPU can't be further behind than that
+    queue.fenceCount = std::min(std::max(g_app.swapchainImageCount, 1u), MAX_FRAME_FENCES);
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    for (uint32_t i = 0; i < queue.fenceCount; i++)
+    {
+        VkResult result = vkCreateFence(g_app.device, &fenceInfo, getHostAllocator(HOST_OBJECT_FENCE), &queue.fences[i]);
+        assert(result == VK_SUCCESS);
+        if (result != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        queue.fenceFrames[i] = 0;
+    }
+
+    return true;
+}
+
+uint64_t getRecordingFrame()
+{
+    return g_app.deletionQueue.submittedFrame + 1;
+}
+
+uint32_t getRecordingSlot()
+{
+    return static_cast<uint32_t>(getRecordingFrame() % g_app.deletionQueue.fenceCount);
+}
+
+bool isFrameComplete(uint64_t frame)
+{
+    return frame <= g_app.deletionQueue.completedFrame;
+}
+
+void waitForFrame(uint64_t frame)
+{
+    DeletionQueue &queue = g_app.deletionQueue;
+
+    assert(frame <= queue.submittedFrame);
+    if (frame <= queue.completedFrame)
+    {
+        return;
+    }
+
+    // A frame's fence is only reused after the frame has finished, so an
+    // unfinished frame still has one. Wait for the earliest that covers it
+    uint32_t slot = queue.fenceCount;
+    for (uint32_t i = 0; i < queue.fenceCount; i++)
+    {
+        if (queue.fenceFrames[i] >= frame && (slot == queue.fenceCount || queue.fenceFrames[i] < queue.fenceFrames[slot]))
+        {
+            slot = i;
+        }
+    }
+    assert(slot < queue.fenceCount);
+
+    VkResult result = vkWaitForFences(g_app.device, 1, &queue.fences[slot], VK_TRUE, UINT64_MAX);
+    assert(result == VK_SUCCESS);
+    (void)result;
+
+    // the queue finishes frames in order
+    queue.completedFrame = queue.fenceFrames[slot];
+}
+
+void beginFrameRecording()
+{
+    DeletionQueue &queue = g_app.deletionQueue;
+
+    // the frame fenceCount frames back, usually finished already
+    waitForFrame(queue.fenceFrames[getRecordingSlot()]);
+}
+
+VkFence beginFrameSubmit()
+{
+    DeletionQueue &queue = g_app.deletionQueue;
+
+    uint64_t frame = queue.submittedFrame + 1;
+    uint32_t slot = getRecordingSlot();
+
+    // The frame that last signalled this fence has to finish before it is
+    // reused, beginFrameRecording() has usually waited for it already
+    if (queue.fenceFrames[slot] > queue.completedFrame)
+    {
+        VkResult result = vkWaitForFences(g_app.device, 1, &queue.fences[slot], VK_TRUE, UINT64_MAX);
+        assert(result == VK_SUCCESS);
+        queue.completedFrame = queue.fenceFrames[slot];
+    }
+
+    vkResetFences(g_app.device, 1, &queue.fences[slot]);
+
+    queue.fenceFrames[slot] = frame;
+    queue.submittedFrame = frame;
+
+    return queue.fences[slot];
+}
+
+static void deferDeletion(DeletionType type, uint64_t handle, void (*callback)(void*), void* userData)
+{
+    DeletionQueue &queue = g_app.deletionQueue;
+
+    PendingDeletion deletion;
+    deletion.type = type;
+    deletion.handle = handle;
+    deletion.callback = callback;
+    deletion.userData = userData;
+
+    std::lock_guard<std::mutex> guard(queue.lock);
+    deletion.frame = queue.submittedFrame + 1;
+    queue.pending.push_back(deletion);
+}
+
+// Null handles are dropped here, so owners can release whatever they have
+#define DEFER_HANDLE(type, handle) \
+    if ((handle) != VK_NULL_HANDLE) { deferDeletion(type, (uint64_t)(handle), nullptr, nullptr); }
+
+void deferDestroyBuffer(VkBuffer buffer)                    { DEFER_HANDLE(DELETE_BUFFER, buffer); }
+void deferDestroyImage(VkImage image)                       { DEFER_HANDLE(DELETE_IMAGE, image); }
+void deferDestroyImageView(VkImageView view)                { DEFER_HANDLE(DELETE_IMAGE_VIEW, view); }
+void deferDestroySampler(VkSampler sampler)                 { DEFER_HANDLE(DELETE_SAMPLER, sampler); }
+void deferFreeMemory(VkDeviceMemory memory)                 { DEFER_HANDLE(DELETE_MEMORY, memory); }
+void deferDestroyPipeline(VkPipeline pipeline)              { DEFER_HANDLE(DELETE_PIPELINE, pipeline); }
+void deferDestroyPipelineLayout(VkPipelineLayout layout)    { DEFER_HANDLE(DELETE_PIPELINE_LAYOUT, layout); }
+void deferDestroyShaderModule(VkShaderModule module)        { DEFER_HANDLE(DELETE_SHADER_MODULE, module); }
+void deferDestroyFramebuffer(VkFramebuffer framebuffer)     { DEFER_HANDLE(DELETE_FRAMEBUFFER, framebuffer); }
+void deferDestroyDescriptorPool(VkDescriptorPool pool)      { DEFER_HANDLE(DELETE_DESCRIPTOR_POOL, pool); }
+void deferDestroyCommandPool(VkCommandPool pool)            { DEFER_HANDLE(DELETE_COMMAND_POOL, pool); }
+
+#undef DEFER_HANDLE
+
+void deferCallback(void (*callback)(void* userData), void* userData)
+{
+    deferDeletion(DELETE_CALLBACK, 0, callback, userData);
+}
+
+static void destroyPendingObject(const PendingDeletion &deletion)
+{
+    VkDevice device = g_app.device;
+
+    switch (deletion.type)
+    {
+        case DELETE_BUFFER:             evictCachedDescriptorSets(deletion.handle);
+                                        vkDestroyBuffer(device, (VkBuffer)deletion.handle, getHostAllocator(HOST_OBJECT_BUFFER)); break;
+        case DELETE_IMAGE:              vkDestroyImage(device, (VkImage)deletion.handle, getHostAllocator(HOST_OBJECT_IMAGE)); break;
+        case DELETE_IMAGE_VIEW:         evictCachedDescriptorSets(deletion.handle);
+                                        vkDestroyImageView(device, (VkImageView)deletion.handle, getHostAllocator(HOST_OBJECT_IMAGE_VIEW)); break;
+        case DELETE_SAMPLER:            vkDestroySampler(device, (VkSampler)deletion.handle, getHostAllocator(HOST_OBJECT_SAMPLER)); break;
+        case DELETE_MEMORY:             freeDeviceMemory((VkDeviceMemory)deletion.handle); break;
+        case DELETE_PIPELINE:           vkDestroyPipeline(device, (VkPipeline)deletion.handle, getHostAllocator(HOST_OBJECT_PIPELINE)); break;
+        case DELETE_PIPELINE_LAYOUT:    vkDestroyPipelineLayout(device, (VkPipelineLayout)deletion.handle, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT)); break;
+        case DELETE_SHADER_MODULE:      vkDestroyShaderModule(device, (VkShaderModule)deletion.handle, getHostAllocator(HOST_OBJECT_SHADER_MODULE)); break;
+        case DELETE_FRAMEBUFFER:        vkDestroyFramebuffer(device, (VkFramebuffer)deletion.handle, getHostAllocator(HOST_OBJECT_FRAMEBUFFER)); break;
+        case DELETE_DESCRIPTOR_POOL:    vkDestroyDescriptorPool(device, (VkDescriptorPool)deletion.handle, getHostAllocator(HOST_OBJECT_DESCRIPTOR_POOL)); break;
+        case DELETE_COMMAND_POOL:       vkDestroyCommandPool(device, (VkCommandPool)deletion.handle, getHostAllocator(HOST_OBJECT_COMMAND_POOL)); break;
+        case DELETE_CALLBACK:           deletion.callback(deletion.userData); break;
+    }
+}
+
+// Destroys the pending objects of finished frames in the order they were released
+static void destroyCompletedDeletions()
+{
+    DeletionQueue &queue = g_app.deletionQueue;
+
+    std::vector<PendingDeletion> completed;
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+
+        auto finished = std::stable_partition(queue.pending.begin(), queue.pending.end(),
+                                              [&queue](const PendingDeletion &deletion) { return deletion.frame <= queue.completedFrame; });
+
+        completed.assign(queue.pending.begin(), finished);
+        queue.pending.erase(queue.pending.begin(), finished);
+    }
+
+    // without the lock, callbacks may release more objects
+    for (const PendingDeletion &deletion : completed)
+    {
+        destroyPendingObject(deletion);
+    }
+
+    queue.destroyedObjects += completed.size();
+}
+
+void collectDeletions()
+{
+    DeletionQueue &queue = g_app.deletionQueue;
+
+    for (uint32_t i = 0; i < queue.fenceCount; i++)
+    {
+        if (queue.fenceFrames[i] > queue.completedFrame && vkGetFenceStatus(g_app.device, queue.fences[i]) == VK_SUCCESS)
+        {
+            // the queue finishes frames in order
+            queue.completedFrame = std::max(queue.completedFrame, queue.fenceFrames[i]);
+        }
+    }
+
+    destroyCompletedDeletions();
+}
+
+void flushDeletions()
+{
+    DeletionQueue &queue = g_app.deletionQueue;
+
+    for (uint32_t i = 0; i < queue.fenceCount; i++)
+    {
+        if (queue.fenceFrames[i] > queue.completedFrame)
+        {
+            VkResult result = vkWaitForFences(g_app.device, 1, &queue.fences[i], VK_TRUE, UINT64_MAX);
+            assert(result == VK_SUCCESS);
+            (void)result;
+        }
+    }
+
+    // objects released after the last submit aren't used by any frame either
+    queue.completedFrame = queue.submittedFrame + 1;
+
+    // callbacks may release more objects, which are destroyed in the same flush
+    while (!queue.pending.empty())
+    {
+        destroyCompletedDeletions();
+    }
+}
+
+void destroyDeletionQueue()
+{
+    DeletionQueue &queue = g_app.deletionQueue;
+
+    assert(queue.pending.empty());
+
+    for (uint32_t i = 0; i < queue.fenceCount; i++)
+    {
+        vkDestroyFence(g_app.device, queue.fences[i], getHostAllocator(HOST_OBJECT_FENCE));
+    }
+    queue.fenceCount = 0;
+}
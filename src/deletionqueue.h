@@ -0,0 +1,104 @@
+#ifndef __DELETIONQUEUE_H__
+#define __DELETIONQUEUE_H__
+
+#include <vulkan/vulkan.h>
+
+#include <mutex>
+#include <vector>
+
+// Frames that may be queued on the GPU at once, one fence each
+const uint32_t MAX_FRAME_FENCES = 4;
+
+enum DeletionType
+{
+    DELETE_BUFFER,
+    DELETE_IMAGE,
+    DELETE_IMAGE_VIEW,
+    DELETE_SAMPLER,
+    DELETE_MEMORY,
+    DELETE_PIPELINE,
+    DELETE_PIPELINE_LAYOUT,
+    DELETE_SHADER_MODULE,
+    DELETE_FRAMEBUFFER,
+    DELETE_DESCRIPTOR_POOL,
+    DELETE_COMMAND_POOL,
+    DELETE_CALLBACK,
+};
+
+// One released object, destroyed once the frame it was released in has finished
+struct PendingDeletion
+{
+    DeletionType type;
+    uint64_t frame;
+
+    // any non-dispatchable handle
+    uint64_t handle;
+
+    void (*callback)(void* userData);
+    void* userData;
+};
+
+// Every frame submit signals a fence. Frames are numbered from 1, an
+// object released while frame N is being recorded may be used by it and
+// by anything submitted before, so it waits for frame N's fence
+struct DeletionQueue
+{
+    VkFence fences[MAX_FRAME_FENCES];
+    uint64_t fenceFrames[MAX_FRAME_FENCES];
+    uint32_t fenceCount = 0;
+
+    uint64_t submittedFrame = 0;
+    uint64_t completedFrame = 0;
+
+    // objects may be released from the init threads and the render thread
+    std::mutex lock;
+    std::vector<PendingDeletion> pending;
+
+    uint64_t destroyedObjects = 0;
+};
+
+bool initDeletionQueue();
+
+// The frame whose fence covers work recorded from now on
+uint64_t getRecordingFrame();
+// Fence slot the recording frame signals, whatever is kept once per frame
+// in flight is indexed by it
+uint32_t getRecordingSlot();
+bool isFrameComplete(uint64_t frame);
+
+// Blocks until the GPU has finished the given frame
+void waitForFrame(uint64_t frame);
+
+// Called by render() before the frame records anything. Waits for the
+// frame that last signalled the recording frame's fence, after which
+// everything kept for its slot is free to be written again
+void beginFrameRecording();
+
+// Fence to pass to the submit of the frame being recorded. Waits when the
+// GPU is still on the frame that last used the same fence
+VkFence beginFrameSubmit();
+
+// Destroyed once the GPU is done with the frame being recorded
+void deferDestroyBuffer(VkBuffer buffer);
+void deferDestroyImage(VkImage image);
+void deferDestroyImageView(VkImageView view);
+void deferDestroySampler(VkSampler sampler);
+void deferFreeMemory(VkDeviceMemory memory);
+void deferDestroyPipeline(VkPipeline pipeline);
+void deferDestroyPipelineLayout(VkPipelineLayout layout);
+void deferDestroyShaderModule(VkShaderModule module);
+void deferDestroyFramebuffer(VkFramebuffer framebuffer);
+void deferDestroyDescriptorPool(VkDescriptorPool pool);
+void deferDestroyCommandPool(VkCommandPool pool);
+void deferCallback(void (*callback)(void* userData), void* userData);
+
+// Called by render() at the start of a frame. Reads the fences without
+// waiting and destroys what the finished frames released
+void collectDeletions();
+
+// Shutdown, waits for every frame and destroys all pending objects
+void flushDeletions();
+
+void destroyDeletionQueue();
+
+#endif //__DELETIONQUEUE_H__
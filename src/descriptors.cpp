@@ -0,0 +1,386 @@
+/*
+    Descriptor set allocation from growable pool chains, with a cache for sets that never change
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <cstring>
+#include <algorithm>
+
+// Descriptors of each type per set in a new pool. Pools are shared by
+// all layouts, so this is a guess at the average set
+static const struct { VkDescriptorType type; float perSet; } descriptorPoolRatios[] =
+{
+    { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         2.0f },
+    { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f },
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         1.0f },
+    { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2.0f },
+    { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,          1.0f },
+    { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,          0.5f },
+    { VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,       0.25f },
+};
+
+bool initDescriptorAllocators()
+{
+    DescriptorManager &descriptors = g_app.descriptors;
+
+    if (deviceExtensionEnabled(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME))
+    {
+        descriptors.createUpdateTemplate = (PFN_vkCreateDescriptorUpdateTemplateKHR)vkGetDeviceProcAddr(g_app.device, "vkCreateDescriptorUpdateTemplateKHR");
+        descriptors.destroyUpdateTemplate = (PFN_vkDestroyDescriptorUpdateTemplateKHR)vkGetDeviceProcAddr(g_app.device, "vkDestroyDescriptorUpdateTemplateKHR");
+        descriptors.updateWithTemplate = (PFN_vkUpdateDescriptorSetWithTemplateKHR)vkGetDeviceProcAddr(g_app.device, "vkUpdateDescriptorSetWithTemplateKHR");
+    }
+
+    if (descriptors.updateWithTemplate == nullptr)
+    {
+        printf("VK_KHR_descriptor_update_template is not available, descriptor sets are written with vkUpdateDescriptorSets\n");
+    }
+
+    return true;
+}
+
+static VkDescriptorPool createDescriptorPool(uint32_t maxSets)
+{
+    VkDescriptorPoolSize poolSizes[sizeof(descriptorPoolRatios) / sizeof(descriptorPoolRatios[0])];
+    uint32_t poolSizeCount = 0;
+
+    for (const auto &ratio : descriptorPoolRatios)
+    {
+        poolSizes[poolSizeCount].type = ratio.type;
+        poolSizes[poolSizeCount].descriptorCount = std::max(static_cast<uint32_t>(ratio.perSet * maxSets), 1u);
+        poolSizeCount++;
+    }
+
+    // cached sets are freed one by one when their resources go away
+    VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+    descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    descriptorPoolInfo.maxSets = maxSets;
+    descriptorPoolInfo.poolSizeCount = poolSizeCount;
+    descriptorPoolInfo.pPoolSizes = poolSizes;
+
+    VkDescriptorPool pool = VK_NULL_HANDLE;
+    VkResult result = vkCreateDescriptorPool(g_app.device, &descriptorPoolInfo, getHostAllocator(HOST_OBJECT_DESCRIPTOR_POOL), &pool);
+    assert(result == VK_SUCCESS);
+
+    g_app.descriptors.poolCount++;
+
+    return pool;
+}
+
+// the caller holds g_app.descriptors.lock
+static void nextDescriptorPool(DescriptorAllocator &allocator)
+{
+    if (!allocator.freePools.empty())
+    {
+        allocator.currentPool = allocator.freePools.back();
+        allocator.freePools.pop_back();
+    }
+    else
+    {
+        allocator.currentPool = createDescriptorPool(allocator.nextPoolSets);
+        allocator.nextPoolSets = std::min(allocator.nextPoolSets * 2, DESCRIPTOR_POOL_MAX_SETS);
+    }
+
+    allocator.usedPools.push_back(allocator.currentPool);
+}
+
+static VkDescriptorSet allocateDescriptorSetLocked(DescriptorAllocator &allocator, VkDescriptorSetLayout layout)
+{
+    if (allocator.currentPool == VK_NULL_HANDLE)
+    {
+        nextDescriptorPool(allocator);
+    }
+
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
+    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocateInfo.descriptorPool = allocator.currentPool;
+    descriptorSetAllocateInfo.descriptorSetCount = 1;
+    descriptorSetAllocateInfo.pSetLayouts = &layout;
+
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    VkResult result = vkAllocateDescriptorSets(g_app.device, &descriptorSetAllocateInfo, &set);
+
+    // The pool is full, or too fragmented for this layout. It stays in
+    // the chain until the next reset and allocation moves on to a new one
+    if (result == VK_ERROR_OUT_OF_POOL_MEMORY_KHR || result == VK_ERROR_FRAGMENTED_POOL)
+    {
+        nextDescriptorPool(allocator);
+
+        descriptorSetAllocateInfo.descriptorPool = allocator.currentPool;
+        result = vkAllocateDescriptorSets(g_app.device, &descriptorSetAllocateInfo, &set);
+    }
+
+    assert(result == VK_SUCCESS);
+
+    return set;
+}
+
+VkDescriptorSet allocateDescriptorSet(DescriptorAllocator &allocator, VkDescriptorSetLayout layout)
+{
+    std::lock_guard<std::mutex> guard(g_app.descriptors.lock);
+    return allocateDescriptorSetLocked(allocator, layout);
+}
+
+void resetDescriptorAllocator(DescriptorAllocator &allocator)
+{
+    std::lock_guard<std::mutex> guard(g_app.descriptors.lock);
+
+    // one call per pool however many sets were allocated from it
+    for (VkDescriptorPool pool : allocator.usedPools)
+    {
+        vkResetDescriptorPool(g_app.device, pool, 0);
+        allocator.freePools.push_back(pool);
+    }
+
+    allocator.usedPools.clear();
+    allocator.currentPool = VK_NULL_HANDLE;
+}
+
+static bool isImageDescriptor(VkDescriptorType type)
+{
+    return type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER ||
+           type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE ||
+           type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE ||
+           type == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT ||
+           type == VK_DESCRIPTOR_TYPE_SAMPLER;
+}
+
+VkDescriptorSetLayout createDescriptorSetLayout(const VkDescriptorSetLayoutBinding *bindings, uint32_t bindingCount)
+{
+    DescriptorManager &descriptors = g_app.descriptors;
+
+    VkDescriptorSetLayoutCreateInfo descSetCreateInfo = {};
+    descSetCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descSetCreateInfo.bindingCount = bindingCount;
+    descSetCreateInfo.pBindings = bindings;
+
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    VkResult result = vkCreateDescriptorSetLayout(g_app.device, &descSetCreateInfo, getHostAllocator(HOST_OBJECT_DESCRIPTOR_SET_LAYOUT), &layout);
+    assert(result == VK_SUCCESS);
+
+    DescriptorLayoutInfo info;
+    info.bindings.assign(bindings, bindings + bindingCount);
+
+    // DescriptorResource entries are packed binding after binding
+    std::vector<VkDescriptorUpdateTemplateEntryKHR> entries(bindingCount);
+    for (uint32_t i = 0; i < bindingCount; i++)
+    {
+        bool imageBinding = isImageDescriptor(bindings[i].descriptorType);
+
+        entries[i].dstBinding = bindings[i].binding;
+        entries[i].dstArrayElement = 0;
+        entries[i].descriptorCount = bindings[i].descriptorCount;
+        entries[i].descriptorType = bindings[i].descriptorType;
+        entries[i].offset = info.resourceCount * sizeof(DescriptorResource) +
+                            (imageBinding ? offsetof(DescriptorResource, image) : offsetof(DescriptorResource, buffer));
+        entries[i].stride = sizeof(DescriptorResource);
+
+        info.resourceCount += bindings[i].descriptorCount;
+    }
+
+    if (descriptors.createUpdateTemplate != nullptr)
+    {
+        VkDescriptorUpdateTemplateCreateInfoKHR templateInfo = {};
+        templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO_KHR;
+        templateInfo.descriptorUpdateEntryCount = bindingCount;
+        templateInfo.pDescriptorUpdateEntries = entries.data();
+        templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR;
+        templateInfo.descriptorSetLayout = layout;
+
+        result = descriptors.createUpdateTemplate(g_app.device, &templateInfo, getHostAllocator(HOST_OBJECT_DESCRIPTOR_UPDATE_TEMPLATE), &info.updateTemplate);
+        assert(result == VK_SUCCESS);
+    }
+
+    std::lock_guard<std::mutex> guard(descriptors.lock);
+    descriptors.layouts[layout] = info;
+
+    return layout;
+}
+
+// the caller holds g_app.descriptors.lock
+static void writeDescriptorSetLocked(VkDescriptorSet set, const DescriptorLayoutInfo &info, const DescriptorResource *resources)
+{
+    DescriptorManager &descriptors = g_app.descriptors;
+
+    // one call for the whole set, the driver reads the resources straight from the array
+    if (info.updateTemplate != VK_NULL_HANDLE)
+    {
+        descriptors.updateWithTemplate(g_app.device, set, info.updateTemplate, resources);
+        return;
+    }
+
+    std::vector<VkWriteDescriptorSet> writes(info.bindings.size());
+    uint32_t resourceIndex = 0;
+
+    for (size_t i = 0; i < info.bindings.size(); i++)
+    {
+        const VkDescriptorSetLayoutBinding &binding = info.bindings[i];
+
+        // The resources of a binding are contiguous, but not as an array of
+        // VkDescriptorBufferInfo, so bindings with more than one
+        // descriptor need the update templates
+        assert(binding.descriptorCount == 1);
+
+        writes[i] = {};
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = set;
+        writes[i].dstBinding = binding.binding;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = binding.descriptorType;
+        writes[i].pBufferInfo = &resources[resourceIndex].buffer;
+        writes[i].pImageInfo = &resources[resourceIndex].image;
+
+        resourceIndex += binding.descriptorCount;
+    }
+
+    vkUpdateDescriptorSets(g_app.device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void writeDescriptorSet(VkDescriptorSet set, VkDescriptorSetLayout layout, const DescriptorResource *resources)
+{
+    std::lock_guard<std::mutex> guard(g_app.descriptors.lock);
+
+    auto info = g_app.descriptors.layouts.find(layout);
+    assert(info != g_app.descriptors.layouts.end());
+
+    writeDescriptorSetLocked(set, info->second, resources);
+}
+
+static uint64_t hashDescriptorSet(VkDescriptorSetLayout layout, const DescriptorResource *resources, uint32_t resourceCount)
+{
+    // FNV-1a over the layout handle and the raw resource structs
+    uint64_t hash = 14695981039346656037ull;
+
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&layout);
+    for (size_t i = 0; i < sizeof(layout); i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    bytes = reinterpret_cast<const uint8_t*>(resources);
+    for (size_t i = 0; i < resourceCount * sizeof(DescriptorResource); i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+VkDescriptorSet getCachedDescriptorSet(VkDescriptorSetLayout layout, const DescriptorResource *resources)
+{
+    DescriptorManager &descriptors = g_app.descriptors;
+
+    std::lock_guard<std::mutex> guard(descriptors.lock);
+
+    auto info = descriptors.layouts.find(layout);
+    assert(info != descriptors.layouts.end());
+
+    uint32_t resourceCount = info->second.resourceCount;
+    uint64_t hash = hashDescriptorSet(layout, resources, resourceCount);
+
+    // Resources are compared byte for byte, callers zero initialize them so
+    // padding and the unused part of the union compare equal
+    auto range = descriptors.cache.equal_range(hash);
+    for (auto cached = range.first; cached != range.second; ++cached)
+    {
+        if (cached->second.layout == layout &&
+            memcmp(cached->second.resources.data(), resources, resourceCount * sizeof(DescriptorResource)) == 0)
+        {
+            descriptors.cacheHits++;
+            return cached->second.set;
+        }
+    }
+
+    descriptors.cacheMisses++;
+
+    CachedDescriptorSet cached;
+    cached.layout = layout;
+    cached.resources.assign(resources, resources + resourceCount);
+    cached.set = allocateDescriptorSetLocked(descriptors.staticAllocator, layout);
+    cached.pool = descriptors.staticAllocator.currentPool;
+
+    writeDescriptorSetLocked(cached.set, info->second, resources);
+
+    descriptors.cache.insert(std::make_pair(hash, cached));
+
+    return cached.set;
+}
+
+void evictCachedDescriptorSets(uint64_t handle)
+{
+    DescriptorManager &descriptors = g_app.descriptors;
+
+    if (handle == 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(descriptors.lock);
+
+    // The cache holds a few dozen sets, a scan is cheaper than keeping an
+    // index from every resource to its sets
+    for (auto cached = descriptors.cache.begin(); cached != descriptors.cache.end();)
+    {
+        const DescriptorLayoutInfo &info = descriptors.layouts[cached->second.layout];
+        const DescriptorResource *resource = cached->second.resources.data();
+
+        // the sampler of an image binding shares its bytes with the buffer
+        // of a buffer binding, so only the field the binding uses is compared
+        bool uses = false;
+        for (const VkDescriptorSetLayoutBinding &binding : info.bindings)
+        {
+            for (uint32_t i = 0; i < binding.descriptorCount; i++, resource++)
+            {
+                uint64_t used = isImageDescriptor(binding.descriptorType) ? (uint64_t)resource->image.imageView : (uint64_t)resource->buffer.buffer;
+                uses = uses || (used == handle);
+            }
+        }
+
+        if (!uses)
+        {
+            ++cached;
+            continue;
+        }
+
+        vkFreeDescriptorSets(g_app.device, cached->second.pool, 1, &cached->second.set);
+        cached = descriptors.cache.erase(cached);
+    }
+}
+
+static void destroyDescriptorAllocator(DescriptorAllocator &allocator)
+{
+    for (VkDescriptorPool pool : allocator.usedPools)
+    {
+        vkDestroyDescriptorPool(g_app.device, pool, getHostAllocator(HOST_OBJECT_DESCRIPTOR_POOL));
+    }
+    for (VkDescriptorPool pool : allocator.freePools)
+    {
+        vkDestroyDescriptorPool(g_app.device, pool, getHostAllocator(HOST_OBJECT_DESCRIPTOR_POOL));
+    }
+
+    allocator.usedPools.clear();
+    allocator.freePools.clear();
+    allocator.currentPool = VK_NULL_HANDLE;
+}
+
+void destroyDescriptorAllocators()
+{
+    DescriptorManager &descriptors = g_app.descriptors;
+
+    printf("Descriptor sets: %u pools, %u cached sets, %u cache hits\n", descriptors.poolCount, descriptors.cacheMisses, descriptors.cacheHits);
+
+    destroyDescriptorAllocator(descriptors.staticAllocator);
+    descriptors.cache.clear();
+
+    for (auto &layout : descriptors.layouts)
+    {
+        if (layout.second.updateTemplate != VK_NULL_HANDLE)
+        {
+            descriptors.destroyUpdateTemplate(g_app.device, layout.second.updateTemplate, getHostAllocator(HOST_OBJECT_DESCRIPTOR_UPDATE_TEMPLATE));
+        }
+        vkDestroyDescriptorSetLayout(g_app.device, layout.first, getHostAllocator(HOST_OBJECT_DESCRIPTOR_SET_LAYOUT));
+    }
+    descriptors.layouts.clear();
+}
@@ -0,0 +1,95 @@
+#ifndef __DESCRIPTORS_H__
+#define __DESCRIPTORS_H__
+
+#include <vulkan/vulkan.h>
+
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+// Sets per pool of the first pool an allocator creates, every further pool doubles it
+const uint32_t DESCRIPTOR_POOL_INITIAL_SETS = 64;
+const uint32_t DESCRIPTOR_POOL_MAX_SETS = 4096;
+
+// One resource for one binding of a set. Sets are written from arrays of
+// these through descriptor update templates, so the layout of this struct
+// is part of every template
+struct DescriptorResource
+{
+    union {
+        VkDescriptorBufferInfo buffer;
+        VkDescriptorImageInfo image;
+    };
+};
+
+// Chain of descriptor pools. Allocation moves on to a new, larger pool
+// when the current one runs out, reset() recycles all of them at once
+struct DescriptorAllocator
+{
+    std::vector<VkDescriptorPool> usedPools;
+    std::vector<VkDescriptorPool> freePools;
+    VkDescriptorPool currentPool = VK_NULL_HANDLE;
+    uint32_t nextPoolSets = DESCRIPTOR_POOL_INITIAL_SETS;
+};
+
+// Layouts created through createDescriptorSetLayout(), with the update
+// template that writes an array of DescriptorResource into a set
+struct DescriptorLayoutInfo
+{
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    uint32_t resourceCount = 0;
+    VkDescriptorUpdateTemplateKHR updateTemplate = VK_NULL_HANDLE;
+};
+
+struct CachedDescriptorSet
+{
+    VkDescriptorSetLayout layout;
+    std::vector<DescriptorResource> resources;
+    VkDescriptorPool pool;
+    VkDescriptorSet set;
+};
+
+struct DescriptorManager
+{
+    std::mutex lock;
+
+    // VK_KHR_descriptor_update_template, sets are written with vkUpdateDescriptorSets without it
+    PFN_vkCreateDescriptorUpdateTemplateKHR createUpdateTemplate = nullptr;
+    PFN_vkDestroyDescriptorUpdateTemplateKHR destroyUpdateTemplate = nullptr;
+    PFN_vkUpdateDescriptorSetWithTemplateKHR updateWithTemplate = nullptr;
+
+    std::unordered_map<VkDescriptorSetLayout, DescriptorLayoutInfo> layouts;
+
+    // Sets that never change, shared by everything that binds the same
+    // resources with the same layout
+    DescriptorAllocator staticAllocator;
+    std::unordered_multimap<uint64_t, CachedDescriptorSet> cache;
+
+    uint32_t poolCount = 0;
+    uint32_t cacheHits = 0;
+    uint32_t cacheMisses = 0;
+};
+
+bool initDescriptorAllocators();
+
+VkDescriptorSetLayout createDescriptorSetLayout(const VkDescriptorSetLayoutBinding *bindings, uint32_t bindingCount);
+
+VkDescriptorSet allocateDescriptorSet(DescriptorAllocator &allocator, VkDescriptorSetLayout layout);
+
+void resetDescriptorAllocator(DescriptorAllocator &allocator);
+
+// Writes the resources of every binding, descriptorCount of them per binding
+// in the order the bindings were given to createDescriptorSetLayout()
+void writeDescriptorSet(VkDescriptorSet set, VkDescriptorSetLayout layout, const DescriptorResource *resources);
+
+// Returns the set with these resources, allocating and writing it the first time
+VkDescriptorSet getCachedDescriptorSet(VkDescriptorSetLayout layout, const DescriptorResource *resources);
+
+// Frees the cached sets that refer to this buffer or image view. Called
+// right before the resource is destroyed, when no submitted frame uses it
+// and so none of its sets either
+void evictCachedDescriptorSets(uint64_t handle);
+
+void destroyDescriptorAllocators();
+
+#endif //__DESCRIPTORS_H__
@@ -0,0 +1,788 @@
+/*
+    Block suballocation of device memory with budget tracking and an incremental defragmenter
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <cstring>
+#include <algorithm>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// First fit, the free ranges of a block are few
+static bool allocateFromBlock(MemoryBlock &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset)
+{
+    for (size_t i = 0; i < block.freeRanges.size(); i++)
+    {
+        MemoryRange &range = block.freeRanges[i];
+
+        VkDeviceSize start = alignUp(range.offset, alignment);
+        if (start + size > range.offset + range.size)
+        {
+            continue;
+        }
+
+        VkDeviceSize end = start + size;
+        VkDeviceSize rangeEnd = range.offset + range.size;
+
+        // the alignment gap before the allocation stays free
+        if (start > range.offset)
+        {
+            range.size = start - range.offset;
+            if (end < rangeEnd)
+            {
+                MemoryRange tail = { end, rangeEnd - end };
+                block.freeRanges.insert(block.freeRanges.begin() + i + 1, tail);
+            }
+        }
+        else if (end < rangeEnd)
+        {
+            range.offset = end;
+            range.size = rangeEnd - end;
+        }
+        else
+        {
+            block.freeRanges.erase(block.freeRanges.begin() + i);
+        }
+
+        block.usedBytes += size;
+        block.allocationCount++;
+        *offset = start;
+        return true;
+    }
+
+    return false;
+}
+
+static void freeToBlock(MemoryBlock &block, const MemoryRange &freed)
+{
+    auto next = std::lower_bound(block.freeRanges.begin(), block.freeRanges.end(), freed,
+                                 [](const MemoryRange &a, const MemoryRange &b) { return a.offset < b.offset; });
+    auto inserted = block.freeRanges.insert(next, freed);
+
+    // merge with the following range, then with the previous one
+    auto following = inserted + 1;
+    if (following != block.freeRanges.end() && inserted->offset + inserted->size == following->offset)
+    {
+        inserted->size += following->size;
+        inserted = block.freeRanges.erase(following) - 1;
+    }
+    if (inserted != block.freeRanges.begin())
+    {
+        auto previous = inserted - 1;
+        if (previous->offset + previous->size == inserted->offset)
+        {
+            previous->size += inserted->size;
+            block.freeRanges.erase(inserted);
+        }
+    }
+
+    block.usedBytes -= freed.size;
+    block.allocationCount--;
+}
+
+static VkDeviceSize blockFreeBytes(const MemoryBlock &block)
+{
+    return block.size - block.usedBytes;
+}
+
+// Places a range in a block of the memory type, the fullest blocks first so
+// the emptier ones drain. excludeBlock is the block the defragmenter is emptying,
+// which also may not grow the number of blocks. Called with the lock held
+static bool allocateRange(const VkMemoryRequirements &memReqs, VkMemoryPropertyFlags properties, uint32_t excludeBlock,
+                          uint32_t *blockIndex, MemoryRange *range)
+{
+    DeviceMemoryManager &memory = g_app.deviceMemory;
+
+    uint32_t memoryType;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, properties, &memoryType))
+    {
+        return false;
+    }
+
+    // Buffers and images share blocks, keeping every allocation on the
+    // granularity keeps linear and optimal resources off the same page
+    VkDeviceSize alignment = std::max(memReqs.alignment, g_app.gpuProps.limits.bufferImageGranularity);
+    VkDeviceSize size = alignUp(memReqs.size, alignment);
+
+    std::vector<uint32_t> candidates;
+    for (uint32_t i = 0; i < memory.blocks.size(); i++)
+    {
+        const MemoryBlock &block = memory.blocks[i];
+        if (i != excludeBlock && block.memory != VK_NULL_HANDLE && block.memoryType == memoryType && blockFreeBytes(block) >= size)
+        {
+            candidates.push_back(i);
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [&memory](uint32_t a, uint32_t b) {
+        return memory.blocks[a].usedBytes > memory.blocks[b].usedBytes;
+    });
+
+    for (uint32_t candidate : candidates)
+    {
+        if (allocateFromBlock(memory.blocks[candidate], size, alignment, &range->offset))
+        {
+            *blockIndex = candidate;
+            range->size = size;
+            return true;
+        }
+    }
+
+    if (excludeBlock != 0xffffffff)
+    {
+        return false;
+    }
+
+    MemoryBlock block;
+    block.size = std::max(MEMORY_BLOCK_SIZE, size);
+    block.memoryType = memoryType;
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = block.size;
+    memAllocInfo.memoryTypeIndex = memoryType;
+
+    if (allocateDeviceMemory(&memAllocInfo, &block.memory) != VK_SUCCESS)
+    {
+        printf("Could not allocate a %llu byte memory block\n", static_cast<unsigned long long>(block.size));
+        return false;
+    }
+
+    MemoryRange whole = { 0, block.size };
+    block.freeRanges.push_back(whole);
+
+    // slots of freed blocks are reused, block indices stay stable
+    uint32_t index = 0;
+    while (index < memory.blocks.size() && memory.blocks[index].memory != VK_NULL_HANDLE)
+    {
+        index++;
+    }
+    if (index == memory.blocks.size())
+    {
+        memory.blocks.push_back(block);
+    }
+    else
+    {
+        memory.blocks[index] = block;
+    }
+
+    bool allocated = allocateFromBlock(memory.blocks[index], size, alignment, &range->offset);
+    assert(allocated);
+
+    *blockIndex = index;
+    range->size = size;
+    return true;
+}
+
+static AllocationHandle addAllocation(const ManagedAllocation &allocation)
+{
+    DeviceMemoryManager &memory = g_app.deviceMemory;
+
+    if (!memory.freeHandles.empty())
+    {
+        AllocationHandle handle = memory.freeHandles.back();
+        memory.freeHandles.pop_back();
+        memory.allocations[handle] = allocation;
+        return handle;
+    }
+
+    memory.allocations.push_back(allocation);
+    return static_cast<AllocationHandle>(memory.allocations.size() - 1);
+}
+
+AllocationHandle createManagedBuffer(const VkBufferCreateInfo &bufferInfo, VkMemoryPropertyFlags properties,
+                                     AllocationMovedCallback moved, void* userData)
+{
+    DeviceMemoryManager &memory = g_app.deviceMemory;
+
+    assert(bufferInfo.pNext == nullptr && bufferInfo.sharingMode == VK_SHARING_MODE_EXCLUSIVE);
+
+    ManagedAllocation allocation;
+    allocation.live = true;
+    allocation.bufferInfo = bufferInfo;
+    // the defragmenter copies the contents over
+    allocation.bufferInfo.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    allocation.moved = moved;
+    allocation.userData = userData;
+
+    VkResult result = vkCreateBuffer(g_app.device, &allocation.bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), &allocation.buffer);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_app.device, allocation.buffer, &memReqs);
+
+    std::lock_guard<std::mutex> guard(memory.lock);
+
+    MemoryRange range;
+    if (!allocateRange(memReqs, properties, 0xffffffff, &allocation.block, &range))
+    {
+        vkDestroyBuffer(g_app.device, allocation.buffer, getHostAllocator(HOST_OBJECT_BUFFER));
+        return INVALID_ALLOCATION;
+    }
+
+    allocation.offset = range.offset;
+    allocation.size = range.size;
+    vkBindBufferMemory(g_app.device, allocation.buffer, memory.blocks[allocation.block].memory, allocation.offset);
+
+    return addAllocation(allocation);
+}
+
+AllocationHandle createManagedImage(const VkImageCreateInfo &imageInfo, VkMemoryPropertyFlags properties, VkImageLayout imageLayout,
+                                    AllocationMovedCallback moved, void* userData)
+{
+    DeviceMemoryManager &memory = g_app.deviceMemory;
+
+    assert(imageInfo.pNext == nullptr && imageInfo.sharingMode == VK_SHARING_MODE_EXCLUSIVE);
+    assert(imageInfo.tiling == VK_IMAGE_TILING_OPTIMAL);
+
+    ManagedAllocation allocation;
+    allocation.live = true;
+    allocation.imageInfo = imageInfo;
+    allocation.imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    allocation.imageLayout = imageLayout;
+    allocation.moved = moved;
+    allocation.userData = userData;
+
+    VkResult result = vkCreateImage(g_app.device, &allocation.imageInfo, getHostAllocator(HOST_OBJECT_IMAGE), &allocation.image);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(g_app.device, allocation.image, &memReqs);
+
+    std::lock_guard<std::mutex> guard(memory.lock);
+
+    MemoryRange range;
+    if (!allocateRange(memReqs, properties, 0xffffffff, &allocation.block, &range))
+    {
+        vkDestroyImage(g_app.device, allocation.image, getHostAllocator(HOST_OBJECT_IMAGE));
+        return INVALID_ALLOCATION;
+    }
+
+    allocation.offset = range.offset;
+    allocation.size = range.size;
+    vkBindImageMemory(g_app.device, allocation.image, memory.blocks[allocation.block].memory, allocation.offset);
+
+    return addAllocation(allocation);
+}
+
+VkBuffer getManagedBuffer(AllocationHandle handle)
+{
+    std::lock_guard<std::mutex> guard(g_app.deviceMemory.lock);
+    return g_app.deviceMemory.allocations[handle].buffer;
+}
+
+VkImage getManagedImage(AllocationHandle handle)
+{
+    std::lock_guard<std::mutex> guard(g_app.deviceMemory.lock);
+    return g_app.deviceMemory.allocations[handle].image;
+}
+
+VkDeviceSize getManagedAllocationSize(AllocationHandle handle)
+{
+    std::lock_guard<std::mutex> guard(g_app.deviceMemory.lock);
+    return g_app.deviceMemory.allocations[handle].size;
+}
+
+void setManagedImageLayout(AllocationHandle handle, VkImageLayout imageLayout)
+{
+    std::lock_guard<std::mutex> guard(g_app.deviceMemory.lock);
+    g_app.deviceMemory.allocations[handle].imageLayout = imageLayout;
+}
+
+// Called with the lock held
+static void retireAllocationObjects(const ManagedAllocation &allocation)
+{
+    RetiredAllocation retired;
+    retired.buffer = allocation.buffer;
+    retired.image = allocation.image;
+    retired.block = allocation.block;
+    retired.range.offset = allocation.offset;
+    retired.range.size = allocation.size;
+    retired.frame = getRecordingFrame();
+
+    g_app.deviceMemory.retired.push_back(retired);
+}
+
+void destroyManagedAllocation(AllocationHandle handle)
+{
+    if (handle == INVALID_ALLOCATION)
+    {
+        return;
+    }
+
+    DeviceMemoryManager &memory = g_app.deviceMemory;
+    std::lock_guard<std::mutex> guard(memory.lock);
+
+    ManagedAllocation &allocation = memory.allocations[handle];
+    assert(allocation.live);
+
+    retireAllocationObjects(allocation);
+
+    allocation = ManagedAllocation();
+    memory.freeHandles.push_back(handle);
+}
+
+void registerMemoryPressureCallback(MemoryPressureCallback callback, void* userData)
+{
+    DeviceMemoryManager &memory = g_app.deviceMemory;
+
+    assert(memory.pressureCallbackCount < MEMORY_MAX_PRESSURE_CALLBACKS);
+    memory.pressureCallbacks[memory.pressureCallbackCount].callback = callback;
+    memory.pressureCallbacks[memory.pressureCallbackCount].userData = userData;
+    memory.pressureCallbackCount++;
+}
+
+MemoryPressure getMemoryPressure()
+{
+    const DeviceMemoryManager &memory = g_app.deviceMemory;
+
+    MemoryPressure pressure = MEMORY_PRESSURE_NONE;
+    for (uint32_t i = 0; i < g_app.memoryProperties.memoryHeapCount; i++)
+    {
+        pressure = std::max(pressure, memory.heaps[i].pressure);
+    }
+    return pressure;
+}
+
+static void updateHeapBudgets()
+{
+    DeviceMemoryManager &memory = g_app.deviceMemory;
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+    budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    if (memory.budgetExtension)
+    {
+        VkPhysicalDeviceMemoryProperties2KHR memoryProperties = {};
+        memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        memoryProperties.pNext = &budgetProperties;
+        memory.getMemoryProperties2(g_app.gpu[0], &memoryProperties);
+    }
+
+    for (uint32_t i = 0; i < g_app.memoryProperties.memoryHeapCount; i++)
+    {
+        MemoryHeapBudget &heap = memory.heaps[i];
+
+        // the extension accounts for everything the process has on the heap,
+        // our own accounting only for what went through allocateDeviceMemory()
+        if (memory.budgetExtension)
+        {
+            heap.budget = budgetProperties.heapBudget[i];
+            heap.usage = budgetProperties.heapUsage[i];
+        }
+        else
+        {
+            std::lock_guard<std::mutex> guard(g_app.memoryStats.lock);
+            heap.budget = static_cast<VkDeviceSize>(g_app.memoryProperties.memoryHeaps[i].size * MEMORY_HEAP_BUDGET_SHARE);
+            heap.usage = g_app.memoryStats.heapUsage[i];
+        }
+    }
+}
+
+static void raiseMemoryPressure()
+{
+    DeviceMemoryManager &memory = g_app.deviceMemory;
+
+    for (uint32_t i = 0; i < g_app.memoryProperties.memoryHeapCount; i++)
+    {
+        MemoryHeapBudget &heap = memory.heaps[i];
+
+        MemoryPressure pressure = MEMORY_PRESSURE_NONE;
+        if (heap.usage >= heap.budget * MEMORY_CRITICAL_USAGE)
+        {
+            pressure = MEMORY_PRESSURE_CRITICAL;
+        }
+        else if (heap.usage >= heap.budget * MEMORY_WARNING_USAGE)
+        {
+            pressure = MEMORY_PRESSURE_WARNING;
+        }
+
+        if (pressure == heap.pressure)
+        {
+            continue;
+        }
+
+        printf("Memory heap %u: %llu of %llu MB used, pressure %d\n", i,
+               static_cast<unsigned long long>(heap.usage / (1024 * 1024)),
+               static_cast<unsigned long long>(heap.budget / (1024 * 1024)), pressure);
+
+        heap.pressure = pressure;
+        for (uint32_t c = 0; c < memory.pressureCallbackCount; c++)
+        {
+            memory.pressureCallbacks[c].callback(i, pressure, memory.pressureCallbacks[c].userData);
+        }
+    }
+}
+
+// The block worth emptying: the least occupied one whose allocations fit
+// into the other blocks of its type. Called with the lock held
+static uint32_t findDefragmentBlock()
+{
+    DeviceMemoryManager &memory = g_app.deviceMemory;
+
+    uint32_t best = 0xffffffff;
+    float bestOccupancy = MEMORY_DEFRAG_OCCUPANCY;
+
+    for (uint32_t i = 0; i < memory.blocks.size(); i++)
+    {
+        const MemoryBlock &block = memory.blocks[i];
+
+        // a block larger than the block size holds a single resource
+        if (block.memory == VK_NULL_HANDLE || block.allocationCount == 0 || block.size > MEMORY_BLOCK_SIZE)
+        {
+            continue;
+        }
+
+        float occupancy = static_cast<float>(block.usedBytes) / block.size;
+        if (occupancy >= bestOccupancy)
+        {
+            continue;
+        }
+
+        VkDeviceSize spareBytes = 0;
+        for (uint32_t j = 0; j < memory.blocks.size(); j++)
+        {
+            const MemoryBlock &other = memory.blocks[j];
+            if (j != i && other.memory != VK_NULL_HANDLE && other.memoryType == block.memoryType)
+            {
+                spareBytes += blockFreeBytes(other);
+            }
+        }
+
+        if (spareBytes >= block.usedBytes)
+        {
+            best = i;
+            bestOccupancy = occupancy;
+        }
+    }
+
+    return best;
+}
+
+// The frames in flight may still use the resources, the barriers order the
+// moves after all they submitted. Only the layouts in between frames matter
+static void recordMoveCommands(VkCommandBuffer cmdBuffer, const ManagedAllocation &from, const ManagedAllocation &to)
+{
+    if (from.buffer != VK_NULL_HANDLE)
+    {
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        VkBufferCopy copyRegion = { 0, 0, from.bufferInfo.size };
+        vkCmdCopyBuffer(cmdBuffer, from.buffer, to.buffer, 1, &copyRegion);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        return;
+    }
+
+    // an image that was never written has nothing to copy
+    if (from.imageLayout == VK_IMAGE_LAYOUT_UNDEFINED)
+    {
+        return;
+    }
+
+    const VkImageCreateInfo &imageInfo = from.imageInfo;
+
+    VkImageMemoryBarrier barriers[2] = {};
+    for (VkImageMemoryBarrier &barrier : barriers)
+    {
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, imageInfo.mipLevels, 0, imageInfo.arrayLayers };
+    }
+
+    // the old image is thrown away afterwards, it is left in the transfer layout
+    barriers[0].image = from.image;
+    barriers[0].oldLayout = from.imageLayout;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    barriers[1].image = to.image;
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].srcAccessMask = 0;
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+    std::vector<VkImageCopy> copyRegions;
+    for (uint32_t level = 0; level < imageInfo.mipLevels; level++)
+    {
+        VkImageCopy copyRegion = {};
+        copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, imageInfo.arrayLayers };
+        copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, imageInfo.arrayLayers };
+        copyRegion.extent.width = std::max(imageInfo.extent.width >> level, 1u);
+        copyRegion.extent.height = std::max(imageInfo.extent.height >> level, 1u);
+        copyRegion.extent.depth = std::max(imageInfo.extent.depth >> level, 1u);
+        copyRegions.push_back(copyRegion);
+    }
+
+    vkCmdCopyImage(cmdBuffer, from.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, to.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+
+    VkImageMemoryBarrier barrier = barriers[1];
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = from.imageLayout;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+// Moves allocations out of the emptiest block into the others, up to the
+// per frame limit. Returns the handles of the moved allocations. Called
+// with the lock held
+static std::vector<AllocationHandle> defragmentStep(VkCommandBuffer cmdBuffer)
+{
+    DeviceMemoryManager &memory = g_app.deviceMemory;
+
+    std::vector<AllocationHandle> moved;
+
+    uint32_t source = findDefragmentBlock();
+    if (source == 0xffffffff)
+    {
+        return moved;
+    }
+
+    const MemoryBlock &sourceBlock = memory.blocks[source];
+    VkMemoryPropertyFlags properties = g_app.memoryProperties.memoryTypes[sourceBlock.memoryType].propertyFlags;
+
+    VkDeviceSize movedBytes = 0;
+
+    for (AllocationHandle handle = 0; handle < memory.allocations.size() && movedBytes < MEMORY_DEFRAG_BYTES_PER_FRAME; handle++)
+    {
+        ManagedAllocation &allocation = memory.allocations[handle];
+        if (!allocation.live || allocation.block != source)
+        {
+            continue;
+        }
+
+        ManagedAllocation copy = allocation;
+        VkMemoryRequirements memReqs;
+
+        if (allocation.buffer != VK_NULL_HANDLE)
+        {
+            VkResult result = vkCreateBuffer(g_app.device, &copy.bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), &copy.buffer);
+            assert(result == VK_SUCCESS);
+            vkGetBufferMemoryRequirements(g_app.device, copy.buffer, &memReqs);
+        }
+        else
+        {
+            VkResult result = vkCreateImage(g_app.device, &copy.imageInfo, getHostAllocator(HOST_OBJECT_IMAGE), &copy.image);
+            assert(result == VK_SUCCESS);
+            vkGetImageMemoryRequirements(g_app.device, copy.image, &memReqs);
+        }
+
+        MemoryRange range;
+        if (!allocateRange(memReqs, properties, source, &copy.block, &range))
+        {
+            // the other blocks are too fragmented for this one, try again next frame
+            if (copy.buffer != VK_NULL_HANDLE)
+            {
+                vkDestroyBuffer(g_app.device, copy.buffer, getHostAllocator(HOST_OBJECT_BUFFER));
+            }
+            else
+            {
+                vkDestroyImage(g_app.device, copy.image, getHostAllocator(HOST_OBJECT_IMAGE));
+            }
+            break;
+        }
+
+        copy.offset = range.offset;
+        copy.size = range.size;
+
+        if (copy.buffer != VK_NULL_HANDLE)
+        {
+            vkBindBufferMemory(g_app.device, copy.buffer, memory.blocks[copy.block].memory, copy.offset);
+        }
+        else
+        {
+            vkBindImageMemory(g_app.device, copy.image, memory.blocks[copy.block].memory, copy.offset);
+        }
+
+        recordMoveCommands(cmdBuffer, allocation, copy);
+
+        retireAllocationObjects(allocation);
+        allocation = copy;
+
+        moved.push_back(handle);
+        movedBytes += copy.size;
+    }
+
+    memory.movedAllocations += static_cast<uint32_t>(moved.size());
+    memory.movedBytes += movedBytes;
+
+    return moved;
+}
+
+void updateDeviceMemory()
+{
+    DeviceMemoryManager &memory = g_app.deviceMemory;
+
+    std::vector<AllocationHandle> moved;
+    bool recorded = false;
+
+    {
+        std::lock_guard<std::mutex> guard(memory.lock);
+
+        // Moved objects are read by the copies submitted ahead of their
+        // frame, the frame fence covers those as well
+        auto destroyed = std::partition(memory.retired.begin(), memory.retired.end(),
+                                        [](const RetiredAllocation &retired) { return !isFrameComplete(retired.frame); });
+
+        for (auto retired = destroyed; retired != memory.retired.end(); ++retired)
+        {
+            if (retired->buffer != VK_NULL_HANDLE)
+            {
+                vkDestroyBuffer(g_app.device, retired->buffer, getHostAllocator(HOST_OBJECT_BUFFER));
+            }
+            if (retired->image != VK_NULL_HANDLE)
+            {
+                vkDestroyImage(g_app.device, retired->image, getHostAllocator(HOST_OBJECT_IMAGE));
+            }
+            freeToBlock(memory.blocks[retired->block], retired->range);
+        }
+        memory.retired.erase(destroyed, memory.retired.end());
+
+        // Empty blocks go back to the driver, one per memory type is kept
+        // so a texture changing size doesn't allocate a block every time
+        for (uint32_t i = 0; i < memory.blocks.size(); i++)
+        {
+            MemoryBlock &block = memory.blocks[i];
+            if (block.memory == VK_NULL_HANDLE || block.allocationCount > 0)
+            {
+                continue;
+            }
+
+            bool otherBlock = false;
+            for (uint32_t j = 0; j < memory.blocks.size() && !otherBlock; j++)
+            {
+                otherBlock = (j != i && memory.blocks[j].memory != VK_NULL_HANDLE && memory.blocks[j].memoryType == block.memoryType);
+            }
+
+            if (otherBlock || block.size > MEMORY_BLOCK_SIZE)
+            {
+                freeDeviceMemory(block.memory);
+                block = MemoryBlock();
+                memory.freedBlocks++;
+            }
+        }
+
+        if (findDefragmentBlock() != 0xffffffff)
+        {
+            memory.cmdBuffer = beginFrameCommandBuffer();
+
+            moved = defragmentStep(memory.cmdBuffer);
+
+            VkResult result = vkEndCommandBuffer(memory.cmdBuffer);
+            assert(result == VK_SUCCESS);
+
+            recorded = true;
+        }
+    }
+
+    if (recorded)
+    {
+        // Same queue as the frame, the barriers at the end of the copies
+        // order them before the draws that use the moved resources
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &memory.cmdBuffer;
+
+        VkResult result = vkQueueSubmit(g_app.queue, 1, &submitInfo, VK_NULL_HANDLE);
+        assert(result == VK_SUCCESS);
+    }
+
+    // Users look up the new resources through their handles, the callbacks
+    // run without the lock so they can create and destroy allocations
+    for (AllocationHandle handle : moved)
+    {
+        AllocationMovedCallback callback;
+        void* userData;
+        {
+            std::lock_guard<std::mutex> guard(memory.lock);
+            callback = memory.allocations[handle].moved;
+            userData = memory.allocations[handle].userData;
+        }
+
+        if (callback != nullptr)
+        {
+            callback(handle, userData);
+        }
+    }
+
+    updateHeapBudgets();
+    raiseMemoryPressure();
+}
+
+bool initDeviceMemory()
+{
+    DeviceMemoryManager &memory = g_app.deviceMemory;
+
+    // VK_EXT_memory_budget is queried through VK_KHR_get_physical_device_properties2
+    if (deviceExtensionEnabled(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+    {
+        memory.getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(g_app.instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+        memory.budgetExtension = (memory.getMemoryProperties2 != nullptr);
+    }
+
+    for (uint32_t i = 0; i < VK_MAX_MEMORY_HEAPS; i++)
+    {
+        memory.heaps[i].budget = 0;
+        memory.heaps[i].usage = 0;
+        memory.heaps[i].pressure = MEMORY_PRESSURE_NONE;
+    }
+
+    updateHeapBudgets();
+
+    printf("Device memory: %u heaps, budget from %s\n", g_app.memoryProperties.memoryHeapCount,
+           memory.budgetExtension ? "VK_EXT_memory_budget" : "heap sizes");
+
+    return true;
+}
+
+void destroyDeviceMemory()
+{
+    DeviceMemoryManager &memory = g_app.deviceMemory;
+
+    // owners destroy their allocations before this, the queue is idle
+    for (const RetiredAllocation &retired : memory.retired)
+    {
+        if (retired.buffer != VK_NULL_HANDLE)
+        {
+            vkDestroyBuffer(g_app.device, retired.buffer, getHostAllocator(HOST_OBJECT_BUFFER));
+        }
+        if (retired.image != VK_NULL_HANDLE)
+        {
+            vkDestroyImage(g_app.device, retired.image, getHostAllocator(HOST_OBJECT_IMAGE));
+        }
+    }
+    memory.retired.clear();
+
+    for (const ManagedAllocation &allocation : memory.allocations)
+    {
+        assert(!allocation.live);
+        (void)allocation;
+    }
+    memory.allocations.clear();
+    memory.freeHandles.clear();
+
+    for (MemoryBlock &block : memory.blocks)
+    {
+        freeDeviceMemory(block.memory);
+    }
+    memory.blocks.clear();
+}
@@ -0,0 +1,159 @@
+#ifndef __DEVICEMEMORY_H__
+#define __DEVICEMEMORY_H__
+
+#include <vulkan/vulkan.h>
+
+#include <mutex>
+#include <vector>
+
+// Managed resources are suballocated from blocks of this size, larger ones get a block of their own
+const VkDeviceSize MEMORY_BLOCK_SIZE = 32 * 1024 * 1024;
+
+// Bytes the defragmenter moves per frame
+const VkDeviceSize MEMORY_DEFRAG_BYTES_PER_FRAME = 4 * 1024 * 1024;
+
+// Blocks less full than this are emptied into the others when they have room
+const float MEMORY_DEFRAG_OCCUPANCY = 0.5f;
+
+// Share of a heap's budget at which pressure is raised
+const float MEMORY_WARNING_USAGE = 0.8f;
+const float MEMORY_CRITICAL_USAGE = 0.95f;
+
+// Without VK_EXT_memory_budget a heap is assumed to have this share of its size to spare
+const float MEMORY_HEAP_BUDGET_SHARE = 0.8f;
+
+const uint32_t MEMORY_MAX_PRESSURE_CALLBACKS = 8;
+
+typedef uint32_t AllocationHandle;
+const AllocationHandle INVALID_ALLOCATION = 0xffffffff;
+
+enum MemoryPressure
+{
+    MEMORY_PRESSURE_NONE,
+    MEMORY_PRESSURE_WARNING,
+    MEMORY_PRESSURE_CRITICAL,
+};
+
+// Called on the render thread whenever the pressure of a heap changes
+typedef void (*MemoryPressureCallback)(uint32_t heapIndex, MemoryPressure pressure, void* userData);
+
+// Called after the defragmenter moved a resource, the handle has the new
+// image or buffer. The old one stays valid until the next frame
+typedef void (*AllocationMovedCallback)(AllocationHandle handle, void* userData);
+
+struct MemoryRange
+{
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
+
+struct MemoryBlock
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint32_t memoryType = 0;
+
+    // sorted by offset, neighbours are merged
+    std::vector<MemoryRange> freeRanges;
+    VkDeviceSize usedBytes = 0;
+    uint32_t allocationCount = 0;
+};
+
+// A buffer or image bound to a range of a block. The create info is kept
+// so the defragmenter can make a copy of the resource somewhere else
+struct ManagedAllocation
+{
+    bool live = false;
+
+    uint32_t block;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkBufferCreateInfo bufferInfo;
+
+    VkImage image = VK_NULL_HANDLE;
+    VkImageCreateInfo imageInfo;
+    // layout all levels are in between frames, users that change it call setManagedImageLayout()
+    VkImageLayout imageLayout;
+
+    AllocationMovedCallback moved;
+    void* userData;
+};
+
+// Objects replaced by a move or freed by their user, destroyed by
+// updateDeviceMemory() once the frame they were retired in has finished
+struct RetiredAllocation
+{
+    VkBuffer buffer;
+    VkImage image;
+    uint32_t block;
+    MemoryRange range;
+    uint64_t frame;
+};
+
+struct MemoryHeapBudget
+{
+    VkDeviceSize budget;
+    VkDeviceSize usage;
+    MemoryPressure pressure;
+};
+
+struct DeviceMemoryManager
+{
+    // guards blocks and allocations, managed resources may be created on the init threads
+    std::mutex lock;
+    std::vector<MemoryBlock> blocks;
+    std::vector<ManagedAllocation> allocations;
+    std::vector<AllocationHandle> freeHandles;
+    std::vector<RetiredAllocation> retired;
+
+    // budget and usage per heap, from VK_EXT_memory_budget when the device has it
+    bool budgetExtension = false;
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+    MemoryHeapBudget heaps[VK_MAX_MEMORY_HEAPS];
+
+    struct {
+        MemoryPressureCallback callback;
+        void* userData;
+    } pressureCallbacks[MEMORY_MAX_PRESSURE_CALLBACKS];
+    uint32_t pressureCallbackCount = 0;
+
+    // copies of the defragmenter, submitted ahead of the frame
+    VkCommandBuffer cmdBuffer;
+
+    uint32_t movedAllocations = 0;
+    VkDeviceSize movedBytes = 0;
+    uint32_t freedBlocks = 0;
+};
+
+bool initDeviceMemory();
+
+// Creates a resource in a block of a memory type with the given properties.
+// Managed resources are never mapped, the defragmenter may move them to
+// another block. imageLayout is the layout the user keeps the image in
+// between frames
+AllocationHandle createManagedBuffer(const VkBufferCreateInfo &bufferInfo, VkMemoryPropertyFlags properties,
+                                     AllocationMovedCallback moved, void* userData);
+AllocationHandle createManagedImage(const VkImageCreateInfo &imageInfo, VkMemoryPropertyFlags properties, VkImageLayout imageLayout,
+                                    AllocationMovedCallback moved, void* userData);
+
+VkBuffer getManagedBuffer(AllocationHandle handle);
+VkImage getManagedImage(AllocationHandle handle);
+VkDeviceSize getManagedAllocationSize(AllocationHandle handle);
+void setManagedImageLayout(AllocationHandle handle, VkImageLayout imageLayout);
+
+// The resource is destroyed once the frames that may use it are done
+void destroyManagedAllocation(AllocationHandle handle);
+
+void registerMemoryPressureCallback(MemoryPressureCallback callback, void* userData);
+MemoryPressure getMemoryPressure();
+
+// Called by render() once per frame. Destroys what finished frames retired,
+// frees empty blocks, updates the heap budgets and raises pressure
+// callbacks, then moves a few MB out of the emptiest block
+void updateDeviceMemory();
+
+void destroyDeviceMemory();
+
+#endif //__DEVICEMEMORY_H__
@@ -0,0 +1,135 @@
+/*
+    Transient command pools per frame fence and recording thread, reset in one call instead of per command buffer
+*/
+
+#include "main.h"
+
+#include <assert.h>
+
+static const uint32_t NO_FRAME_THREAD = 0xffffffff;
+
+static thread_local uint32_t t_frameThread = NO_FRAME_THREAD;
+
+bool initFrameCommands()
+{
+    FrameCommands &commands = g_app.frameCommands;
+
+    commands.threadCount = 0;
+
+    VkCommandPoolCreateInfo cmdPoolInfo = {};
+    cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmdPoolInfo.queueFamilyIndex = g_app.graphicsQueueFamilyIndex;
+    cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    // same slots as the frame fences
+    for (uint32_t slot = 0; slot < g_app.deletionQueue.fenceCount; slot++)
+    {
+        for (uint32_t thread = 0; thread < FRAME_COMMAND_MAX_THREADS; thread++)
+        {
+            VkResult result = vkCreateCommandPool(g_app.device, &cmdPoolInfo, getHostAllocator(HOST_OBJECT_COMMAND_POOL), &commands.pools[slot][thread].pool);
+            assert(result == VK_SUCCESS);
+            if (result != VK_SUCCESS)
+            {
+                return false;
+            }
+        }
+
+        commands.poolFrames[slot] = 0;
+    }
+
+    return true;
+}
+
+void beginFrameCommands()
+{
+    FrameCommands &commands = g_app.frameCommands;
+
+    // The pools of a slot only hold command buffers of the frames that
+    // signal its fence, beginFrameRecording() waited for the last of them
+    uint64_t frame = getRecordingFrame();
+    commands.slot = getRecordingSlot();
+    assert(isFrameComplete(g_app.deletionQueue.fenceFrames[commands.slot]));
+
+    if (commands.poolFrames[commands.slot] == frame)
+    {
+        return;
+    }
+
+    for (uint32_t thread = 0; thread < FRAME_COMMAND_MAX_THREADS; thread++)
+    {
+        FrameCommandPool &pool = commands.pools[commands.slot][thread];
+        if (pool.usedBuffers > 0)
+        {
+            vkResetCommandPool(g_app.device, pool.pool, 0);
+            pool.usedBuffers = 0;
+            commands.poolResets++;
+        }
+    }
+
+    commands.poolFrames[commands.slot] = frame;
+}
+
+VkCommandBuffer beginFrameCommandBuffer()
+{
+    FrameCommands &commands = g_app.frameCommands;
+
+    if (t_frameThread == NO_FRAME_THREAD)
+    {
+        t_frameThread = commands.threadCount++;
+    }
+    assert(t_frameThread < FRAME_COMMAND_MAX_THREADS);
+
+    // Only between beginFrameCommands() and the frame's submit, so the
+    // command buffer is covered by the fence of the pool's slot
+    assert(commands.poolFrames[commands.slot] == getRecordingFrame());
+
+    // only the calling thread uses this pool, no lock needed
+    FrameCommandPool &pool = commands.pools[commands.slot][t_frameThread];
+
+    if (pool.usedBuffers == pool.buffers.size())
+    {
+        VkCommandBufferAllocateInfo cmdBufferAllocInfo = {};
+        cmdBufferAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmdBufferAllocInfo.commandPool = pool.pool;
+        cmdBufferAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmdBufferAllocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer cmdBuffer;
+        VkResult result = vkAllocateCommandBuffers(g_app.device, &cmdBufferAllocInfo, &cmdBuffer);
+        assert(result == VK_SUCCESS);
+        (void)result;
+
+        pool.buffers.push_back(cmdBuffer);
+        commands.allocatedBuffers++;
+    }
+
+    VkCommandBuffer cmdBuffer = pool.buffers[pool.usedBuffers++];
+
+    VkCommandBufferBeginInfo cmdBufferInfo = {};
+    cmdBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cmdBufferInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VkResult result = vkBeginCommandBuffer(cmdBuffer, &cmdBufferInfo);
+    assert(result == VK_SUCCESS);
+    (void)result;
+
+    return cmdBuffer;
+}
+
+void destroyFrameCommands()
+{
+    FrameCommands &commands = g_app.frameCommands;
+
+    // command buffers go with their pools
+    for (uint32_t slot = 0; slot < MAX_FRAME_FENCES; slot++)
+    {
+        for (uint32_t thread = 0; thread < FRAME_COMMAND_MAX_THREADS; thread++)
+        {
+            FrameCommandPool &pool = commands.pools[slot][thread];
+            deferDestroyCommandPool(pool.pool);
+            pool.pool = VK_NULL_HANDLE;
+            pool.buffers.clear();
+            pool.usedBuffers = 0;
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef __FRAMECOMMANDS_H__
+#define __FRAMECOMMANDS_H__
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <vector>
+
+#include "deletionqueue.h"
+
+// Threads that may record frame commands, each gets pools of its own
+const uint32_t FRAME_COMMAND_MAX_THREADS = 4;
+
+// Transient pool of one thread for one frame fence. Its command buffers
+// are handed out in order and all come back with a single pool reset
+struct FrameCommandPool
+{
+    VkCommandPool pool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> buffers;
+    uint32_t usedBuffers = 0;
+};
+
+// Command buffers recorded and submitted within one frame. The pools of a
+// fence slot are reset once beginFrameRecording() has waited for the frame
+// that last signalled its fence, so after the first few frames nothing is
+// allocated
+struct FrameCommands
+{
+    FrameCommandPool pools[MAX_FRAME_FENCES][FRAME_COMMAND_MAX_THREADS];
+    uint64_t poolFrames[MAX_FRAME_FENCES];
+    uint32_t slot = 0;
+
+    std::atomic<uint32_t> threadCount;
+
+    uint32_t allocatedBuffers = 0;
+    uint64_t poolResets = 0;
+};
+
+bool initFrameCommands();
+
+// Called by render() after beginFrameRecording() and before anything
+// records frame commands
+void beginFrameCommands();
+
+// A command buffer of the calling thread's pool, already begun for one
+// submit. It has to be submitted before the frame's draws are
+VkCommandBuffer beginFrameCommandBuffer();
+
+void destroyFrameCommands();
+
+#endif //__FRAMECOMMANDS_H__
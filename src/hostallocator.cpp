@@ -0,0 +1,453 @@
+/*
+    Host memory of the driver through VkAllocationCallbacks, from thread local size class pools and counted per object type and scope
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+static const size_t HOST_BLOCK_ALIGNMENT = 16;
+static const size_t HOST_MIN_BLOCK_SIZE = 32;
+static const uint8_t HOST_LARGE_BLOCK = 0xff;
+
+// Just before every pointer handed to the driver, it tells where the block
+// goes back to and what to count the free as
+struct HostBlockHeader
+{
+    uint64_t size;          // as requested
+    HostThreadCache* owner; // the cache the block was carved from, none for large blocks
+    uint32_t offset;        // from the start of the block to the pointer
+    uint8_t sizeClass;
+    uint8_t type;
+    uint8_t scope;
+    uint8_t padding[9];
+};
+
+static_assert(sizeof(HostBlockHeader) % HOST_BLOCK_ALIGNMENT == 0, "the header keeps the blocks aligned");
+
+static const char* const s_objectTypeNames[HOST_OBJECT_TYPE_COUNT] =
+{
+    "instance", "device", "surface", "swapchain", "device memory", "buffer", "image", "image view",
+    "sampler", "shader module", "pipeline cache", "pipeline", "pipeline layout", "set layout",
+    "descriptor pool", "update template", "render pass", "framebuffer", "command pool", "fence",
+    "semaphore", "query pool"
+};
+
+static const char* const s_scopeNames[HOST_SCOPE_COUNT] = { "command", "object", "cache", "device", "instance" };
+
+static thread_local HostThreadCache* t_hostCache = nullptr;
+
+static HostThreadCache* getThreadCache()
+{
+    if (t_hostCache == nullptr)
+    {
+        // zero initialized, free lists and counters included
+        t_hostCache = new HostThreadCache();
+
+        std::lock_guard<std::mutex> guard(g_app.hostAllocator.lock);
+        g_app.hostAllocator.threads.push_back(t_hostCache);
+    }
+
+    return t_hostCache;
+}
+
+static size_t getBlockSize(uint8_t sizeClass)
+{
+    return HOST_MIN_BLOCK_SIZE << sizeClass;
+}
+
+static HostBlockHeader* getHeader(void* memory)
+{
+    return reinterpret_cast<HostBlockHeader*>(static_cast<char*>(memory) - sizeof(HostBlockHeader));
+}
+
+static char* allocateBlock(HostThreadCache* cache, uint8_t sizeClass)
+{
+    // blocks other threads gave back, all of them at once
+    HostFreeBlock* &freeList = cache->freeLists[sizeClass];
+    if (freeList == nullptr)
+    {
+        freeList = cache->remoteFreeLists[sizeClass].exchange(nullptr, std::memory_order_acquire);
+    }
+
+    if (freeList != nullptr)
+    {
+        HostFreeBlock* block = freeList;
+        freeList = block->next;
+        return reinterpret_cast<char*>(block);
+    }
+
+    // carve from the current chunk, what is left of a chunk too small for
+    // the block is given up
+    size_t blockSize = getBlockSize(sizeClass);
+    if (cache->chunkCursor == nullptr || static_cast<size_t>(cache->chunkEnd - cache->chunkCursor) < blockSize)
+    {
+        char* chunk = static_cast<char*>(malloc(HOST_POOL_CHUNK_SIZE + HOST_BLOCK_ALIGNMENT));
+        if (chunk == nullptr)
+        {
+            return nullptr;
+        }
+
+        uintptr_t aligned = (reinterpret_cast<uintptr_t>(chunk) + HOST_BLOCK_ALIGNMENT - 1) & ~(HOST_BLOCK_ALIGNMENT - 1);
+        cache->chunkCursor = reinterpret_cast<char*>(aligned);
+        cache->chunkEnd = cache->chunkCursor + HOST_POOL_CHUNK_SIZE;
+        cache->chunkBytes.fetch_add(HOST_POOL_CHUNK_SIZE + HOST_BLOCK_ALIGNMENT, std::memory_order_relaxed);
+    }
+
+    char* block = cache->chunkCursor;
+    cache->chunkCursor += blockSize;
+    return block;
+}
+
+// A block with its header filled in, not counted
+static void* allocateMemory(HostThreadCache* cache, HostObjectType type, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    assert(scope < HOST_SCOPE_COUNT);
+    assert((alignment & (alignment - 1)) == 0);
+
+    // room for the header and for moving the pointer up to the alignment
+    alignment = std::max(alignment, HOST_BLOCK_ALIGNMENT);
+    size_t required = size + sizeof(HostBlockHeader) + (alignment - HOST_BLOCK_ALIGNMENT);
+
+    uint8_t sizeClass = 0;
+    while (sizeClass < HOST_SIZE_CLASS_COUNT && getBlockSize(sizeClass) < required)
+    {
+        sizeClass++;
+    }
+
+    char* block = nullptr;
+    if (sizeClass < HOST_SIZE_CLASS_COUNT)
+    {
+        block = allocateBlock(cache, sizeClass);
+    }
+    else
+    {
+        sizeClass = HOST_LARGE_BLOCK;
+        block = static_cast<char*>(malloc(required + HOST_BLOCK_ALIGNMENT));
+        cache->largeAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (block == nullptr)
+    {
+        return nullptr;
+    }
+
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(block) + sizeof(HostBlockHeader) + alignment - 1) & ~(alignment - 1);
+    char* memory = reinterpret_cast<char*>(aligned);
+
+    HostBlockHeader* header = getHeader(memory);
+    header->size = size;
+    header->owner = (sizeClass == HOST_LARGE_BLOCK) ? nullptr : cache;
+    header->offset = static_cast<uint32_t>(memory - block);
+    header->sizeClass = sizeClass;
+    header->type = static_cast<uint8_t>(type);
+    header->scope = static_cast<uint8_t>(scope);
+
+    return memory;
+}
+
+// Gives the block back to the cache it came from, not counted
+static void releaseMemory(HostThreadCache* cache, void* memory)
+{
+    HostBlockHeader* header = getHeader(memory);
+    char* block = static_cast<char*>(memory) - header->offset;
+
+    if (header->sizeClass == HOST_LARGE_BLOCK)
+    {
+        free(block);
+        return;
+    }
+
+    HostFreeBlock* freeBlock = reinterpret_cast<HostFreeBlock*>(block);
+    HostThreadCache* owner = header->owner;
+    if (owner == cache)
+    {
+        freeBlock->next = cache->freeLists[header->sizeClass];
+        cache->freeLists[header->sizeClass] = freeBlock;
+        return;
+    }
+
+    // Objects are often destroyed on another thread than the one that made
+    // them, the render thread releases what the streaming threads create.
+    // The block goes back to its owner, or that thread would keep carving
+    // chunks while the freeing thread's lists only grow
+    std::atomic<HostFreeBlock*> &remoteList = owner->remoteFreeLists[header->sizeClass];
+    freeBlock->next = remoteList.load(std::memory_order_relaxed);
+    while (!remoteList.compare_exchange_weak(freeBlock->next, freeBlock, std::memory_order_release, std::memory_order_relaxed))
+    {
+    }
+}
+
+static void* hostAllocate(HostObjectType type, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    HostThreadCache* cache = getThreadCache();
+
+    void* memory = allocateMemory(cache, type, size, alignment, scope);
+    if (memory == nullptr)
+    {
+        return nullptr;
+    }
+
+    HostAllocationStats &stats = cache->stats[type][scope];
+    stats.allocations.fetch_add(1, std::memory_order_relaxed);
+    stats.bytes.fetch_add(size, std::memory_order_relaxed);
+    stats.liveBytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+
+    return memory;
+}
+
+static void hostFree(void* memory)
+{
+    if (memory == nullptr)
+    {
+        return;
+    }
+
+    HostThreadCache* cache = getThreadCache();
+    HostBlockHeader* header = getHeader(memory);
+
+    // counted as the object type and scope it was allocated for
+    HostAllocationStats &stats = cache->stats[header->type][header->scope];
+    stats.frees.fetch_add(1, std::memory_order_relaxed);
+    stats.liveBytes.fetch_sub(static_cast<int64_t>(header->size), std::memory_order_relaxed);
+
+    releaseMemory(cache, memory);
+}
+
+static VKAPI_ATTR void* VKAPI_CALL hostAllocationCallback(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    HostObjectType type = static_cast<HostObjectType>(reinterpret_cast<uintptr_t>(userData));
+    return hostAllocate(type, size, alignment, scope);
+}
+
+static VKAPI_ATTR void* VKAPI_CALL hostReallocationCallback(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    if (original == nullptr)
+    {
+        return hostAllocationCallback(userData, size, alignment, scope);
+    }
+
+    if (size == 0)
+    {
+        hostFree(original);
+        return nullptr;
+    }
+
+    HostThreadCache* cache = getThreadCache();
+    HostBlockHeader* header = getHeader(original);
+    size_t originalSize = static_cast<size_t>(header->size);
+
+    // counted once, as a reallocation, whether or not the block moves
+    HostAllocationStats &stats = cache->stats[header->type][header->scope];
+
+    // grows or shrinks in place while the block has room for it
+    void* memory = original;
+    if (header->sizeClass != HOST_LARGE_BLOCK && (reinterpret_cast<uintptr_t>(original) & (alignment - 1)) == 0 &&
+        size <= getBlockSize(header->sizeClass) - header->offset)
+    {
+        header->size = size;
+    }
+    else
+    {
+        memory = allocateMemory(cache, static_cast<HostObjectType>(header->type), size, alignment, static_cast<VkSystemAllocationScope>(header->scope));
+        if (memory == nullptr)
+        {
+            // the original stays valid when reallocation fails
+            return nullptr;
+        }
+
+        memcpy(memory, original, std::min(originalSize, size));
+        releaseMemory(cache, original);
+    }
+
+    stats.reallocations.fetch_add(1, std::memory_order_relaxed);
+    stats.bytes.fetch_add(size > originalSize ? size - originalSize : 0, std::memory_order_relaxed);
+    stats.liveBytes.fetch_add(static_cast<int64_t>(size) - static_cast<int64_t>(originalSize), std::memory_order_relaxed);
+
+    return memory;
+}
+
+static VKAPI_ATTR void VKAPI_CALL hostFreeCallback(void* userData, void* memory)
+{
+    (void)userData;
+    hostFree(memory);
+}
+
+static VKAPI_ATTR void VKAPI_CALL hostInternalAllocationCallback(void* userData, size_t size, VkInternalAllocationType allocationType, VkSystemAllocationScope scope)
+{
+    (void)userData;
+    (void)allocationType;
+
+    HostAllocationStats &stats = getThreadCache()->internalStats[scope];
+    stats.allocations.fetch_add(1, std::memory_order_relaxed);
+    stats.bytes.fetch_add(size, std::memory_order_relaxed);
+    stats.liveBytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+}
+
+static VKAPI_ATTR void VKAPI_CALL hostInternalFreeCallback(void* userData, size_t size, VkInternalAllocationType allocationType, VkSystemAllocationScope scope)
+{
+    (void)userData;
+    (void)allocationType;
+
+    HostAllocationStats &stats = getThreadCache()->internalStats[scope];
+    stats.frees.fetch_add(1, std::memory_order_relaxed);
+    stats.liveBytes.fetch_sub(static_cast<int64_t>(size), std::memory_order_relaxed);
+}
+
+bool initHostAllocator()
+{
+    HostAllocator &allocator = g_app.hostAllocator;
+
+    for (uint32_t type = 0; type < HOST_OBJECT_TYPE_COUNT; type++)
+    {
+        VkAllocationCallbacks &callbacks = allocator.callbacks[type];
+        callbacks.pUserData = reinterpret_cast<void*>(static_cast<uintptr_t>(type));
+        callbacks.pfnAllocation = hostAllocationCallback;
+        callbacks.pfnReallocation = hostReallocationCallback;
+        callbacks.pfnFree = hostFreeCallback;
+        callbacks.pfnInternalAllocation = hostInternalAllocationCallback;
+        callbacks.pfnInternalFree = hostInternalFreeCallback;
+    }
+
+    allocator.initialized = true;
+
+    return true;
+}
+
+const VkAllocationCallbacks* getHostAllocator(HostObjectType type)
+{
+    HostAllocator &allocator = g_app.hostAllocator;
+
+    if (!allocator.enabled)
+    {
+        return nullptr;
+    }
+
+    assert(allocator.initialized);
+    return &allocator.callbacks[type];
+}
+
+struct HostStatsTotal
+{
+    uint64_t allocations = 0;
+    uint64_t reallocations = 0;
+    uint64_t frees = 0;
+    uint64_t bytes = 0;
+    int64_t liveBytes = 0;
+};
+
+static void addStats(HostStatsTotal &total, const HostAllocationStats &stats)
+{
+    total.allocations += stats.allocations.load(std::memory_order_relaxed);
+    total.reallocations += stats.reallocations.load(std::memory_order_relaxed);
+    total.frees += stats.frees.load(std::memory_order_relaxed);
+    total.bytes += stats.bytes.load(std::memory_order_relaxed);
+    total.liveBytes += stats.liveBytes.load(std::memory_order_relaxed);
+}
+
+void printHostAllocatorReport()
+{
+    HostAllocator &allocator = g_app.hostAllocator;
+
+    if (!allocator.enabled)
+    {
+        printf("Host allocations: driver allocator, no statistics with --system-allocator\n");
+        return;
+    }
+
+    HostStatsTotal types[HOST_OBJECT_TYPE_COUNT];
+    HostStatsTotal scopes[HOST_SCOPE_COUNT];
+    HostStatsTotal internal[HOST_SCOPE_COUNT];
+    uint64_t chunkBytes = 0;
+    uint64_t largeAllocations = 0;
+    size_t threadCount = 0;
+
+    {
+        std::lock_guard<std::mutex> guard(allocator.lock);
+
+        threadCount = allocator.threads.size();
+        for (const HostThreadCache* cache : allocator.threads)
+        {
+            for (uint32_t type = 0; type < HOST_OBJECT_TYPE_COUNT; type++)
+            {
+                for (uint32_t scope = 0; scope < HOST_SCOPE_COUNT; scope++)
+                {
+                    addStats(types[type], cache->stats[type][scope]);
+                    addStats(scopes[scope], cache->stats[type][scope]);
+                }
+            }
+
+            for (uint32_t scope = 0; scope < HOST_SCOPE_COUNT; scope++)
+            {
+                addStats(internal[scope], cache->internalStats[scope]);
+            }
+
+            chunkBytes += cache->chunkBytes.load(std::memory_order_relaxed);
+            largeAllocations += cache->largeAllocations.load(std::memory_order_relaxed);
+        }
+    }
+
+    printf("Host allocations: %zu threads, %llu KB of pool chunks, %llu allocations over %zu KB from malloc\n", threadCount,
+        static_cast<unsigned long long>(chunkBytes / 1024), static_cast<unsigned long long>(largeAllocations),
+        getBlockSize(HOST_SIZE_CLASS_COUNT - 1) / 1024);
+
+    printf("    %-18s %10s %10s %10s %10s %10s\n", "scope", "allocs", "reallocs", "frees", "total KB", "live KB");
+    for (uint32_t scope = 0; scope < HOST_SCOPE_COUNT; scope++)
+    {
+        const HostStatsTotal &total = scopes[scope];
+        printf("    %-18s %10llu %10llu %10llu %10.1f %10.1f\n", s_scopeNames[scope],
+            static_cast<unsigned long long>(total.allocations), static_cast<unsigned long long>(total.reallocations),
+            static_cast<unsigned long long>(total.frees), total.bytes / 1024.0, total.liveBytes / 1024.0);
+    }
+
+    for (uint32_t scope = 0; scope < HOST_SCOPE_COUNT; scope++)
+    {
+        const HostStatsTotal &total = internal[scope];
+        if (total.allocations > 0)
+        {
+            printf("    %-18s %10llu %10s %10llu %10.1f %10.1f\n", (std::string("internal ") + s_scopeNames[scope]).c_str(),
+                static_cast<unsigned long long>(total.allocations), "-", static_cast<unsigned long long>(total.frees),
+                total.bytes / 1024.0, total.liveBytes / 1024.0);
+        }
+    }
+
+    // the types that cost the most host memory first, then the most calls
+    std::vector<uint32_t> order;
+    for (uint32_t type = 0; type < HOST_OBJECT_TYPE_COUNT; type++)
+    {
+        if (types[type].allocations > 0)
+        {
+            order.push_back(type);
+        }
+    }
+
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+    {
+        if (types[a].bytes != types[b].bytes)
+        {
+            return types[a].bytes > types[b].bytes;
+        }
+        return types[a].allocations > types[b].allocations;
+    });
+
+    printf("    %-18s %10s %10s %10s %10s %10s\n", "object type", "allocs", "reallocs", "frees", "total KB", "live KB");
+    for (uint32_t type : order)
+    {
+        const HostStatsTotal &total = types[type];
+        printf("    %-18s %10llu %10llu %10llu %10.1f %10.1f\n", s_objectTypeNames[type],
+            static_cast<unsigned long long>(total.allocations), static_cast<unsigned long long>(total.reallocations),
+            static_cast<unsigned long long>(total.frees), total.bytes / 1024.0, total.liveBytes / 1024.0);
+    }
+
+    if (!order.empty())
+    {
+        uint32_t mostCalls = *std::max_element(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+        {
+            return types[a].allocations + types[a].reallocations < types[b].allocations + types[b].reallocations;
+        });
+        printf("    most allocation calls: %s\n", s_objectTypeNames[mostCalls]);
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef __HOSTALLOCATOR_H__
+#define __HOSTALLOCATOR_H__
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Object types the host allocations are counted by. The driver only tells
+// the scope of an allocation, so every create and destroy call passes the
+// callbacks of the type it makes
+enum HostObjectType
+{
+    HOST_OBJECT_INSTANCE = 0,
+    HOST_OBJECT_DEVICE,
+    HOST_OBJECT_SURFACE,
+    HOST_OBJECT_SWAPCHAIN,
+    HOST_OBJECT_DEVICE_MEMORY,
+    HOST_OBJECT_BUFFER,
+    HOST_OBJECT_IMAGE,
+    HOST_OBJECT_IMAGE_VIEW,
+    HOST_OBJECT_SAMPLER,
+    HOST_OBJECT_SHADER_MODULE,
+    HOST_OBJECT_PIPELINE_CACHE,
+    HOST_OBJECT_PIPELINE,
+    HOST_OBJECT_PIPELINE_LAYOUT,
+    HOST_OBJECT_DESCRIPTOR_SET_LAYOUT,
+    HOST_OBJECT_DESCRIPTOR_POOL,
+    HOST_OBJECT_DESCRIPTOR_UPDATE_TEMPLATE,
+    HOST_OBJECT_RENDER_PASS,
+    HOST_OBJECT_FRAMEBUFFER,
+    HOST_OBJECT_COMMAND_POOL,
+    HOST_OBJECT_FENCE,
+    HOST_OBJECT_SEMAPHORE,
+    HOST_OBJECT_QUERY_POOL,
+    HOST_OBJECT_TYPE_COUNT
+};
+
+// VK_SYSTEM_ALLOCATION_SCOPE_COMMAND up to _INSTANCE
+const uint32_t HOST_SCOPE_COUNT = 5;
+
+// Blocks of 32 bytes up to 4 KB come from the thread caches, larger ones
+// straight from malloc. The 32 byte header is part of the block
+const uint32_t HOST_SIZE_CLASS_COUNT = 8;
+const size_t HOST_POOL_CHUNK_SIZE = 64 * 1024;
+
+struct HostAllocationStats
+{
+    std::atomic<uint64_t> allocations;
+    std::atomic<uint64_t> reallocations;
+    std::atomic<uint64_t> frees;
+    std::atomic<uint64_t> bytes;        // requested, summed over every allocation
+    std::atomic<int64_t> liveBytes;     // may go below zero on a thread freeing what others allocated
+};
+
+struct HostFreeBlock
+{
+    HostFreeBlock* next;
+};
+
+// Free lists and counters of one thread. A block goes back to the cache it
+// was carved from: the owner puts it on its own lists, other threads push it
+// onto the owner's remote lists, which the owner takes over once its own run
+// dry. No call takes a lock. The caches are never released, the report reads
+// the counters of threads that are gone
+struct HostThreadCache
+{
+    HostFreeBlock* freeLists[HOST_SIZE_CLASS_COUNT];
+    std::atomic<HostFreeBlock*> remoteFreeLists[HOST_SIZE_CLASS_COUNT];
+    char* chunkCursor;
+    char* chunkEnd;
+
+    HostAllocationStats stats[HOST_OBJECT_TYPE_COUNT][HOST_SCOPE_COUNT];
+    // driver memory it only reports through the internal notifications
+    HostAllocationStats internalStats[HOST_SCOPE_COUNT];
+
+    std::atomic<uint64_t> chunkBytes;
+    std::atomic<uint64_t> largeAllocations;
+};
+
+// Host memory of the driver, through VkAllocationCallbacks. Each object type
+// has callbacks of its own that only differ in pUserData
+struct HostAllocator
+{
+    // cleared by --system-allocator, the driver then uses its own allocator
+    bool enabled = true;
+
+    VkAllocationCallbacks callbacks[HOST_OBJECT_TYPE_COUNT];
+    bool initialized = false;
+
+    std::mutex lock;
+    std::vector<HostThreadCache*> threads;
+};
+
+// Before the instance is created
+bool initHostAllocator();
+
+// The callbacks to create and destroy objects of a type with, nullptr with
+// --system-allocator. An object has to be destroyed with the same type
+const VkAllocationCallbacks* getHostAllocator(HostObjectType type);
+
+// Host memory by scope and object type, the most expensive types first
+void printHostAllocatorReport();
+
+#endif //__HOSTALLOCATOR_H__
@@ -0,0 +1,674 @@
+/*
+    Performance overlay drawn with a glyph atlas in one draw call
+*/
+
+#include "main.h"
+
+#include <stdio.h>
+#include <assert.h>
+#include <cstring>
+#include <algorithm>
+
+// atlas layout: 16 x 5 cells of 8 x 8 texels, ASCII 32 to 95 followed by a solid cell for bars and backgrounds
+const uint32_t HUD_ATLAS_COLUMNS = 16;
+const uint32_t HUD_ATLAS_ROWS = 5;
+const uint32_t HUD_ATLAS_CELL = 8;
+const uint32_t HUD_ATLAS_WIDTH = HUD_ATLAS_COLUMNS * HUD_ATLAS_CELL;
+const uint32_t HUD_ATLAS_HEIGHT = HUD_ATLAS_ROWS * HUD_ATLAS_CELL;
+const uint32_t HUD_GLYPH_WIDTH = 5;
+const uint32_t HUD_GLYPH_HEIGHT = 7;
+const uint32_t HUD_FIRST_GLYPH = 32;
+const uint32_t HUD_GLYPH_COUNT = 64;
+const uint32_t HUD_SOLID_CELL = HUD_GLYPH_COUNT;
+
+// on screen size, in pixels
+const float HUD_SCALE = 2.0f;
+const float HUD_ADVANCE = (HUD_GLYPH_WIDTH + 1) * HUD_SCALE;
+const float HUD_LINE_HEIGHT = (HUD_GLYPH_HEIGHT + 2) * HUD_SCALE;
+const float HUD_MARGIN = 8.0f;
+const float HUD_GRAPH_HEIGHT = 60.0f;
+// frame time at the top of the graph
+const float HUD_GRAPH_MAX_MS = 33.3f;
+const double HUD_TEXT_INTERVAL_MS = 250.0;
+
+// 5 x 7 glyphs, one byte per row with the leftmost pixel in bit 4
+static const uint8_t hudFont[HUD_GLYPH_COUNT][HUD_GLYPH_HEIGHT] =
+{
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ' '
+    { 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04 }, // '!'
+    { 0x0a, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '"'
+    { 0x0a, 0x0a, 0x1f, 0x0a, 0x1f, 0x0a, 0x0a }, // '#'
+    { 0x04, 0x0f, 0x14, 0x0e, 0x05, 0x1e, 0x04 }, // '$'
+    { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 }, // '%'
+    { 0x0c, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0d }, // '&'
+    { 0x04, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00 }, // "'"
+    { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 }, // '('
+    { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 }, // ')'
+    { 0x00, 0x04, 0x15, 0x0e, 0x15, 0x04, 0x00 }, // '*'
+    { 0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00 }, // '+'
+    { 0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08 }, // ','
+    { 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 }, // '-'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c }, // '.'
+    { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 }, // '/'
+    { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e }, // '0'
+    { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e }, // '1'
+    { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f }, // '2'
+    { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e }, // '3'
+    { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 }, // '4'
+    { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e }, // '5'
+    { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e }, // '6'
+    { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 }, // '7'
+    { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e }, // '8'
+    { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c }, // '9'
+    { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00 }, // ':'
+    { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x04, 0x08 }, // ';'
+    { 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02 }, // '<'
+    { 0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00 }, // '='
+    { 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08 }, // '>'
+    { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 }, // '?'
+    { 0x0e, 0x11, 0x01, 0x0d, 0x15, 0x15, 0x0e }, // '@'
+    { 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 }, // 'A'
+    { 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e }, // 'B'
+    { 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e }, // 'C'
+    { 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c }, // 'D'
+    { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f }, // 'E'
+    { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 }, // 'F'
+    { 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f }, // 'G'
+    { 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 }, // 'H'
+    { 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e }, // 'I'
+    { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c }, // 'J'
+    { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, // 'K'
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f }, // 'L'
+    { 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 }, // 'M'
+    { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 }, // 'N'
+    { 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e }, // 'O'
+    { 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 }, // 'P'
+    { 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d }, // 'Q'
+    { 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 }, // 'R'
+    { 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e }, // 'S'
+    { 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, // 'T'
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e }, // 'U'
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 }, // 'V'
+    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a }, // 'W'
+    { 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 }, // 'X'
+    { 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04 }, // 'Y'
+    { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f }, // 'Z'
+    { 0x0e, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0e }, // '['
+    { 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00 }, // '\\'
+    { 0x0e, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0e }, // ']'
+    { 0x04, 0x0a, 0x11, 0x00, 0x00, 0x00, 0x00 }, // '^'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f }, // '_'
+
+};
+
+static uint32_t packColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    return r | (g << 8) | (b << 16) | ((uint32_t)a << 24);
+}
+
+static bool createHudBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer *buffer, VkDeviceMemory *memory, void **mapped)
+{
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+
+    VkResult result = vkCreateBuffer(g_app.device, &bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), buffer);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_app.device, *buffer, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memAllocInfo.memoryTypeIndex))
+    {
+        vkDestroyBuffer(g_app.device, *buffer, getHostAllocator(HOST_OBJECT_BUFFER));
+        *buffer = VK_NULL_HANDLE;
+        return false;
+    }
+
+    result = allocateDeviceMemory(&memAllocInfo, memory);
+    assert(result == VK_SUCCESS);
+
+    vkBindBufferMemory(g_app.device, *buffer, *memory, 0);
+
+    // stays mapped for the lifetime of the buffer
+    result = vkMapMemory(g_app.device, *memory, 0, size, 0, mapped);
+
+    return (result == VK_SUCCESS);
+}
+
+static bool initHudAtlas()
+{
+    Hud &hud = g_app.hud;
+
+    // rasterize the font into the atlas
+    std::vector<uint8_t> texels(HUD_ATLAS_WIDTH * HUD_ATLAS_HEIGHT, 0);
+
+    for (uint32_t glyph = 0; glyph <= HUD_SOLID_CELL; glyph++)
+    {
+        uint32_t cellX = (glyph % HUD_ATLAS_COLUMNS) * HUD_ATLAS_CELL;
+        uint32_t cellY = (glyph / HUD_ATLAS_COLUMNS) * HUD_ATLAS_CELL;
+
+        for (uint32_t y = 0; y < HUD_ATLAS_CELL; y++)
+        {
+            for (uint32_t x = 0; x < HUD_ATLAS_CELL; x++)
+            {
+                bool set = (glyph == HUD_SOLID_CELL) ||
+                           (x < HUD_GLYPH_WIDTH && y < HUD_GLYPH_HEIGHT && (hudFont[glyph][y] & (1 << (HUD_GLYPH_WIDTH - 1 - x))));
+
+                texels[(cellY + y) * HUD_ATLAS_WIDTH + cellX + x] = set ? 0xff : 0x00;
+            }
+        }
+    }
+
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingMemory;
+    void *stagingData;
+    if (!createHudBuffer(texels.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &stagingBuffer, &stagingMemory, &stagingData))
+    {
+        return false;
+    }
+    memcpy(stagingData, texels.data(), texels.size());
+    vkUnmapMemory(g_app.device, stagingMemory);
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = VK_FORMAT_R8_UNORM;
+    imageInfo.extent.width = HUD_ATLAS_WIDTH;
+    imageInfo.extent.height = HUD_ATLAS_HEIGHT;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkResult result = vkCreateImage(g_app.device, &imageInfo, getHostAllocator(HOST_OBJECT_IMAGE), &hud.atlas.image);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(g_app.device, hud.atlas.image, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    bool pass = memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memAllocInfo.memoryTypeIndex);
+    assert(pass);
+
+    result = allocateDeviceMemory(&memAllocInfo, &hud.atlas.memory);
+    assert(result == VK_SUCCESS);
+
+    vkBindImageMemory(g_app.device, hud.atlas.image, hud.atlas.memory, 0);
+
+    // the upload is batched with the rest of the one time init work
+    VkCommandBuffer setupCmdBuffer = beginSetupCommands();
+
+    setImageLayout(setupCmdBuffer, hud.atlas.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    VkBufferImageCopy copyRegion = {};
+    copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copyRegion.imageSubresource.mipLevel = 0;
+    copyRegion.imageSubresource.baseArrayLayer = 0;
+    copyRegion.imageSubresource.layerCount = 1;
+    copyRegion.imageExtent = imageInfo.extent;
+
+    vkCmdCopyBufferToImage(setupCmdBuffer, stagingBuffer, hud.atlas.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+    setImageLayout(setupCmdBuffer, hud.atlas.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    endSetupCommands();
+
+    // the setup commands are flushed and waited for before the first frame is done
+    deferDestroyBuffer(stagingBuffer);
+    deferFreeMemory(stagingMemory);
+
+    hud.atlas.view = getImageView(hud.atlas.image, VK_FORMAT_R8_UNORM, 0, 1);
+
+    // nearest filtering keeps the glyphs crisp at integer scales
+    SamplerDesc samplerDesc = { VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE };
+    hud.atlas.sampler = getSampler(samplerDesc);
+
+    return true;
+}
+
+static bool initHudDescriptors()
+{
+    Hud &hud = g_app.hud;
+
+    VkDescriptorSetLayoutBinding atlasBinding = {};
+    atlasBinding.binding = 0;
+    atlasBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    atlasBinding.descriptorCount = 1;
+    atlasBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    hud.descriptorSetLayout = createDescriptorSetLayout(&atlasBinding, 1);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &hud.descriptorSetLayout;
+
+    vkCreatePipelineLayout(g_app.device, &pipelineLayoutCreateInfo, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT), &hud.pipelineLayout);
+
+    DescriptorResource atlasResource;
+    memset(&atlasResource, 0, sizeof(atlasResource));
+    atlasResource.image.sampler = hud.atlas.sampler;
+    atlasResource.image.imageView = hud.atlas.view;
+    atlasResource.image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    hud.descriptorSet = getCachedDescriptorSet(hud.descriptorSetLayout, &atlasResource);
+
+    return (hud.descriptorSet != VK_NULL_HANDLE);
+}
+
+static bool initHudPipeline()
+{
+    Hud &hud = g_app.hud;
+
+    VkVertexInputBindingDescription bindingDescription = {};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(HudVertex);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    VkVertexInputAttributeDescription attributeDescriptions[3];
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[0].offset = offsetof(HudVertex, pos);
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[1].offset = offsetof(HudVertex, uv);
+    attributeDescriptions[2].binding = 0;
+    attributeDescriptions[2].location = 2;
+    attributeDescriptions[2].format = VK_FORMAT_R8G8B8A8_UNORM;
+    attributeDescriptions[2].offset = offsetof(HudVertex, color);
+
+    VkPipelineVertexInputStateCreateInfo inputState = {};
+    inputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    inputState.vertexBindingDescriptionCount = 1;
+    inputState.pVertexBindingDescriptions = &bindingDescription;
+    inputState.vertexAttributeDescriptionCount = 3;
+    inputState.pVertexAttributeDescriptions = attributeDescriptions;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
+    inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkPipelineRasterizationStateCreateInfo rasterizationState = {};
+    rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizationState.cullMode = VK_CULL_MODE_NONE;
+    rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizationState.lineWidth = 1.0f;
+
+    // alpha blended on top of the scene
+    VkPipelineColorBlendAttachmentState blendAttachmentState = {};
+    blendAttachmentState.colorWriteMask = 0xf;
+    blendAttachmentState.blendEnable = VK_TRUE;
+    blendAttachmentState.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    blendAttachmentState.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    blendAttachmentState.colorBlendOp = VK_BLEND_OP_ADD;
+    blendAttachmentState.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    blendAttachmentState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    blendAttachmentState.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    VkPipelineColorBlendStateCreateInfo colorBlendState = {};
+    colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlendState.attachmentCount = 1;
+    colorBlendState.pAttachments = &blendAttachmentState;
+
+    VkPipelineViewportStateCreateInfo viewportState = {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    VkDynamicState dynamicStateEnables[2] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.pDynamicStates = dynamicStateEnables;
+    dynamicState.dynamicStateCount = 2;
+
+    // the overlay is always on top and leaves the depth buffer alone
+    VkPipelineDepthStencilStateCreateInfo depthStencilState = {};
+    depthStencilState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencilState.depthTestEnable = VK_FALSE;
+    depthStencilState.depthWriteEnable = VK_FALSE;
+    depthStencilState.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+
+    VkPipelineMultisampleStateCreateInfo multisampleState = {};
+    multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = loadShaderGLSL("data/hud.vert", VK_SHADER_STAGE_VERTEX_BIT);
+    shaderStages[0].pName = "main";
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = loadShaderGLSL("data/hud.frag", VK_SHADER_STAGE_FRAGMENT_BIT);
+    shaderStages[1].pName = "main";
+
+    VkGraphicsPipelineCreateInfo gfxPipelineCreateInfo = {};
+    gfxPipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    gfxPipelineCreateInfo.layout = hud.pipelineLayout;
+    gfxPipelineCreateInfo.renderPass = g_app.renderPass;
+    gfxPipelineCreateInfo.subpass = getOverlaySubpass();
+    gfxPipelineCreateInfo.stageCount = 2;
+    gfxPipelineCreateInfo.pStages = shaderStages;
+    gfxPipelineCreateInfo.pVertexInputState = &inputState;
+    gfxPipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+    gfxPipelineCreateInfo.pRasterizationState = &rasterizationState;
+    gfxPipelineCreateInfo.pColorBlendState = &colorBlendState;
+    gfxPipelineCreateInfo.pMultisampleState = &multisampleState;
+    gfxPipelineCreateInfo.pViewportState = &viewportState;
+    gfxPipelineCreateInfo.pDepthStencilState = &depthStencilState;
+    gfxPipelineCreateInfo.pDynamicState = &dynamicState;
+
+    VkResult result = vkCreateGraphicsPipelines(g_app.device, g_app.pipelineCache, 1, &gfxPipelineCreateInfo, getHostAllocator(HOST_OBJECT_PIPELINE), &hud.pipeline);
+    assert(result == VK_SUCCESS);
+
+    // the modules are not needed once the pipeline exists
+    vkDestroyShaderModule(g_app.device, shaderStages[0].module, getHostAllocator(HOST_OBJECT_SHADER_MODULE));
+    vkDestroyShaderModule(g_app.device, shaderStages[1].module, getHostAllocator(HOST_OBJECT_SHADER_MODULE));
+
+    return (result == VK_SUCCESS);
+}
+
+bool initHud()
+{
+    Hud &hud = g_app.hud;
+
+    memset(hud.frameTimes, 0, sizeof(hud.frameTimes));
+    hud.text[0] = '\0';
+    hud.textAgeMs = HUD_TEXT_INTERVAL_MS;
+
+    void *mapped;
+    VkDeviceSize vertexBufferSize = sizeof(HudVertex) * HUD_MAX_QUADS * 6 * g_app.swapchainImageCount;
+    if (!createHudBuffer(vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &hud.vertices.buffer, &hud.vertices.memory, &mapped))
+    {
+        return false;
+    }
+    hud.vertices.mapped = static_cast<HudVertex*>(mapped);
+
+    VkDeviceSize indirectBufferSize = sizeof(VkDrawIndirectCommand) * g_app.swapchainImageCount;
+    if (!createHudBuffer(indirectBufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, &hud.indirect.buffer, &hud.indirect.memory, &mapped))
+    {
+        return false;
+    }
+    hud.indirect.mapped = static_cast<VkDrawIndirectCommand*>(mapped);
+
+    // nothing is drawn until the overlay is switched on
+    for (uint32_t i = 0; i < g_app.swapchainImageCount; i++)
+    {
+        hud.indirect.mapped[i].vertexCount = 0;
+        hud.indirect.mapped[i].instanceCount = 1;
+        hud.indirect.mapped[i].firstVertex = i * HUD_MAX_QUADS * 6;
+        hud.indirect.mapped[i].firstInstance = 0;
+    }
+
+    return initHudAtlas() && initHudDescriptors() && initHudPipeline();
+}
+
+void recordHudCommands(VkCommandBuffer cmdBuffer, uint32_t imageIndex)
+{
+    Hud &hud = g_app.hud;
+
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, hud.pipeline);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, hud.pipelineLayout, 0, 1, &hud.descriptorSet, 0, nullptr);
+
+    VkDeviceSize offsets[1] = {0};
+    vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &hud.vertices.buffer, offsets);
+
+    // The vertex count is written by updateHud() every frame, so the
+    // command buffer can be recorded once and the overlay still changes
+    vkCmdDrawIndirect(cmdBuffer, hud.indirect.buffer, imageIndex * sizeof(VkDrawIndirectCommand), 1, sizeof(VkDrawIndirectCommand));
+}
+
+struct HudBuilder
+{
+    HudVertex* vertices;
+    uint32_t quadCount;
+};
+
+static void addQuad(HudBuilder &builder, float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, uint32_t color)
+{
+    if (builder.quadCount >= HUD_MAX_QUADS)
+    {
+        return;
+    }
+
+    // pixels to normalized device coordinates, y points down in Vulkan
+    const float sx = 2.0f / SCREEN_WIDTH;
+    const float sy = 2.0f / SCREEN_HEIGHT;
+    x0 = x0 * sx - 1.0f;
+    x1 = x1 * sx - 1.0f;
+    y0 = y0 * sy - 1.0f;
+    y1 = y1 * sy - 1.0f;
+
+    // written front to back without reading, the memory is write combined on most devices
+    HudVertex* v = builder.vertices + builder.quadCount * 6;
+    v[0] = { { x0, y0 }, { u0, v0 }, color };
+    v[1] = { { x1, y0 }, { u1, v0 }, color };
+    v[2] = { { x1, y1 }, { u1, v1 }, color };
+    v[3] = { { x0, y0 }, { u0, v0 }, color };
+    v[4] = { { x1, y1 }, { u1, v1 }, color };
+    v[5] = { { x0, y1 }, { u0, v1 }, color };
+
+    builder.quadCount++;
+}
+
+static void addSolidQuad(HudBuilder &builder, float x0, float y0, float x1, float y1, uint32_t color)
+{
+    // sample the middle of the solid cell so filtering never reaches a neighbour
+    float u = ((HUD_SOLID_CELL % HUD_ATLAS_COLUMNS) * HUD_ATLAS_CELL + HUD_ATLAS_CELL * 0.5f) / HUD_ATLAS_WIDTH;
+    float v = ((HUD_SOLID_CELL / HUD_ATLAS_COLUMNS) * HUD_ATLAS_CELL + HUD_ATLAS_CELL * 0.5f) / HUD_ATLAS_HEIGHT;
+
+    addQuad(builder, x0, y0, x1, y1, u, v, u, v, color);
+}
+
+// Lines of the overlay text and characters in the longest one, the panel
+// grows with what formatHudText() writes
+static void measureText(const char* text, uint32_t &lines, uint32_t &columns)
+{
+    uint32_t lineLength = 0;
+    lines = 1;
+    columns = 0;
+    for (const char* c = text; *c != '\0'; c++)
+    {
+        if (*c == '\n')
+        {
+            lines++;
+            lineLength = 0;
+            continue;
+        }
+        columns = std::max(columns, ++lineLength);
+    }
+}
+
+static void addText(HudBuilder &builder, float x, float y, const char* text, uint32_t color)
+{
+    float penX = x;
+
+    for (const char* c = text; *c != '\0'; c++)
+    {
+        uint32_t code = static_cast<unsigned char>(*c);
+
+        if (code == '\n')
+        {
+            penX = x;
+            y += HUD_LINE_HEIGHT;
+            continue;
+        }
+
+        // the atlas only has upper case letters
+        if (code >= 'a' && code <= 'z')
+        {
+            code -= 'a' - 'A';
+        }
+
+        if (code != ' ' && code >= HUD_FIRST_GLYPH && code < HUD_FIRST_GLYPH + HUD_GLYPH_COUNT)
+        {
+            uint32_t glyph = code - HUD_FIRST_GLYPH;
+            float u0 = (float)((glyph % HUD_ATLAS_COLUMNS) * HUD_ATLAS_CELL) / HUD_ATLAS_WIDTH;
+            float v0 = (float)((glyph / HUD_ATLAS_COLUMNS) * HUD_ATLAS_CELL) / HUD_ATLAS_HEIGHT;
+            float u1 = u0 + (float)HUD_GLYPH_WIDTH / HUD_ATLAS_WIDTH;
+            float v1 = v0 + (float)HUD_GLYPH_HEIGHT / HUD_ATLAS_HEIGHT;
+
+            addQuad(builder, penX, y, penX + HUD_GLYPH_WIDTH * HUD_SCALE, y + HUD_GLYPH_HEIGHT * HUD_SCALE, u0, v0, u1, v1, color);
+        }
+
+        penX += HUD_ADVANCE;
+    }
+}
+
+static void formatHudText()
+{
+    Hud &hud = g_app.hud;
+
+    VkDeviceSize totalBytes = 0;
+    for (uint32_t i = 0; i < g_app.memoryProperties.memoryHeapCount; i++)
+    {
+        totalBytes += g_app.memoryStats.heapUsage[i];
+    }
+
+    // budget of the device local heap, from VK_EXT_memory_budget when there is one
+    const MemoryHeapBudget *localHeap = &g_app.deviceMemory.heaps[0];
+    for (uint32_t i = 0; i < g_app.memoryProperties.memoryHeapCount; i++)
+    {
+        if (g_app.memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+        {
+            localHeap = &g_app.deviceMemory.heaps[i];
+            break;
+        }
+    }
+
+    char gpuText[32];
+    if (g_app.frameStats.timestampsSupported)
+    {
+        snprintf(gpuText, sizeof(gpuText), "%.2f MS", g_app.frameStats.gpuMs);
+    }
+    else
+    {
+        snprintf(gpuText, sizeof(gpuText), "N/A");
+    }
+
+    snprintf(hud.text, sizeof(hud.text),
+        "FRAME %6.2f MS %5.0f FPS\n"
+        "CPU   %6.2f MS  GPU %s\n"
+        "STALL %6.2f MS  INPUT %.2f MS\n"
+        "DRAWS %u  TRIS %llu\n"
+        "CULL  %u TESTED %u FRUSTUM %u OCCLUDED\n"
+        "MEM   %6.1f MB IN %u ALLOCS\n"
+        "VRAM  %6.1f OF %.1f MB  MOVED %u\n"
+        "HUD   %6.3f MS",
+        g_app.frameStats.frameMs, g_app.frameStats.frameMs > 0.0 ? 1000.0 / g_app.frameStats.frameMs : 0.0,
+        g_app.frameStats.cpuMs, gpuText,
+        g_app.frameStats.stallMs, g_app.renderThread.inputLatencyMs,
+        g_app.frameStats.drawCount, (unsigned long long)g_app.frameStats.triangleCount,
+        g_app.occlusion.stats.tested, g_app.occlusion.stats.frustumRejected, g_app.occlusion.stats.occlusionRejected,
+        totalBytes / (1024.0 * 1024.0), (uint32_t)g_app.memoryStats.allocations.size(),
+        localHeap->usage / (1024.0 * 1024.0), localHeap->budget / (1024.0 * 1024.0), g_app.deviceMemory.movedAllocations,
+        hud.updateMs);
+}
+
+void updateHud(uint32_t imageIndex)
+{
+    Hud &hud = g_app.hud;
+
+    std::chrono::steady_clock::time_point updateStart = std::chrono::steady_clock::now();
+
+    // keep sampling while hidden so the graph is complete when it is switched on
+    hud.frameTimes[hud.frameTimeIndex] = (float)g_app.frameStats.frameMs;
+    hud.frameTimeIndex = (hud.frameTimeIndex + 1) % HUD_GRAPH_SAMPLES;
+
+    VkDrawIndirectCommand &draw = hud.indirect.mapped[imageIndex];
+
+    if (!hud.visible)
+    {
+        draw.vertexCount = 0;
+        return;
+    }
+
+    hud.textAgeMs += g_app.frameStats.frameMs;
+    if (hud.textAgeMs >= HUD_TEXT_INTERVAL_MS)
+    {
+        std::lock_guard<std::mutex> guard(g_app.memoryStats.lock);
+        formatHudText();
+        hud.textAgeMs = 0.0;
+    }
+
+    HudBuilder builder;
+    builder.vertices = hud.vertices.mapped + draw.firstVertex;
+    builder.quadCount = 0;
+
+    uint32_t lineCount = 0;
+    uint32_t columnCount = 0;
+    measureText(hud.text, lineCount, columnCount);
+
+    const float textLines = static_cast<float>(lineCount);
+    const float textColumns = static_cast<float>(columnCount);
+    const float panelWidth = std::max(HUD_GRAPH_SAMPLES * 2.0f, textColumns * HUD_ADVANCE) + HUD_MARGIN * 2.0f;
+    const float graphTop = HUD_MARGIN * 2.0f + textLines * HUD_LINE_HEIGHT;
+    const float panelHeight = graphTop + HUD_GRAPH_HEIGHT + HUD_MARGIN;
+
+    addSolidQuad(builder, 0.0f, 0.0f, panelWidth, panelHeight, packColor(0, 0, 0, 160));
+
+    addText(builder, HUD_MARGIN, HUD_MARGIN, hud.text, packColor(255, 255, 255, 255));
+
+    // frame time graph, oldest sample on the left
+    const float graphBottom = graphTop + HUD_GRAPH_HEIGHT;
+    const float targetY = graphBottom - HUD_GRAPH_HEIGHT * (16.7f / HUD_GRAPH_MAX_MS);
+    addSolidQuad(builder, HUD_MARGIN, targetY, HUD_MARGIN + HUD_GRAPH_SAMPLES * 2.0f, targetY + 1.0f, packColor(255, 255, 255, 96));
+
+    for (uint32_t i = 0; i < HUD_GRAPH_SAMPLES; i++)
+    {
+        float frameMs = hud.frameTimes[(hud.frameTimeIndex + i) % HUD_GRAPH_SAMPLES];
+        float height = HUD_GRAPH_HEIGHT * std::min(frameMs / HUD_GRAPH_MAX_MS, 1.0f);
+
+        uint32_t color = frameMs < 16.7f ? packColor(64, 220, 64, 255) :
+                         frameMs < 33.3f ? packColor(240, 200, 40, 255) :
+                                           packColor(240, 60, 40, 255);
+
+        float x = HUD_MARGIN + i * 2.0f;
+        addSolidQuad(builder, x, graphBottom - height, x + 2.0f, graphBottom, color);
+    }
+
+    draw.vertexCount = builder.quadCount * 6;
+
+    hud.updateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - updateStart).count();
+}
+
+void toggleHud()
+{
+    g_app.hud.visible = !g_app.hud.visible;
+}
+
+void destroyHud()
+{
+    Hud &hud = g_app.hud;
+
+    vkDestroyPipeline(g_app.device, hud.pipeline, getHostAllocator(HOST_OBJECT_PIPELINE));
+    vkDestroyPipelineLayout(g_app.device, hud.pipelineLayout, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT));
+
+    // the sampler belongs to the sampler cache
+    releaseImageViews(hud.atlas.image);
+    vkDestroyImage(g_app.device, hud.atlas.image, getHostAllocator(HOST_OBJECT_IMAGE));
+    freeDeviceMemory(hud.atlas.memory);
+
+    vkUnmapMemory(g_app.device, hud.vertices.memory);
+    vkDestroyBuffer(g_app.device, hud.vertices.buffer, getHostAllocator(HOST_OBJECT_BUFFER));
+    freeDeviceMemory(hud.vertices.memory);
+
+    vkUnmapMemory(g_app.device, hud.indirect.memory);
+    vkDestroyBuffer(g_app.device, hud.indirect.buffer, getHostAllocator(HOST_OBJECT_BUFFER));
+    freeDeviceMemory(hud.indirect.memory);
+}
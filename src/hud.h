@@ -0,0 +1,77 @@
+#ifndef __HUD_H__
+#define __HUD_H__
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+// Number of frame times kept for the frame time graph
+const uint32_t HUD_GRAPH_SAMPLES = 120;
+
+// Upper bound of quads the overlay can emit per frame
+const uint32_t HUD_MAX_QUADS = 1024;
+
+struct HudVertex
+{
+    float pos[2];
+    float uv[2];
+    uint32_t color;
+};
+
+// Performance overlay. All text and graph bars are textured quads from a
+// single glyph atlas written into one host visible vertex buffer, so the
+// whole overlay is one indirect draw at the end of the main render pass
+struct Hud
+{
+    bool visible = false;
+
+    struct {
+        VkImage image;
+        VkDeviceMemory memory;
+        VkImageView view;       // from the image view cache
+        VkSampler sampler;      // from the sampler cache
+    } atlas;
+
+    // One region of vertices and one indirect draw per swapchain image
+    struct {
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+        HudVertex* mapped;
+    } vertices;
+
+    struct {
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+        VkDrawIndirectCommand* mapped;
+    } indirect;
+
+    // the layout and set belong to the descriptor allocator
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorSet descriptorSet;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline pipeline;
+
+    float frameTimes[HUD_GRAPH_SAMPLES];
+    uint32_t frameTimeIndex = 0;
+
+    // text is only reformatted a few times a second, the graph every frame
+    char text[512];
+    double textAgeMs = 0.0;
+
+    // cost of building the overlay on the CPU
+    double updateMs = 0.0;
+};
+
+bool initHud();
+
+// Records the overlay draw, must be called inside the main render pass
+void recordHudCommands(VkCommandBuffer cmdBuffer, uint32_t imageIndex);
+
+// Rebuilds the overlay vertices for the swapchain image about to be submitted
+void updateHud(uint32_t imageIndex);
+
+void toggleHud();
+
+void destroyHud();
+
+#endif //__HUD_H__
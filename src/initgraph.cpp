@@ -0,0 +1,201 @@
+/*
+    Dependency graph for running the init steps on worker threads
+*/
+
+#include "initgraph.h"
+
+#include <stdio.h>
+#include <assert.h>
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+
+typedef std::chrono::steady_clock InitClock;
+
+static double elapsedMs(InitClock::time_point from)
+{
+    return std::chrono::duration<double, std::milli>(InitClock::now() - from).count();
+}
+
+int addInitStep(InitGraph &graph, const char* name, InitStepFunc func, std::initializer_list<int> dependencies)
+{
+    int id = static_cast<int>(graph.steps.size());
+
+    InitStep step;
+    step.name = name;
+    step.func = func;
+    step.dependencies.assign(dependencies.begin(), dependencies.end());
+
+    for (int dependency : step.dependencies)
+    {
+        // steps can only depend on steps that were added before them, so the graph can't have cycles
+        assert(dependency >= 0 && dependency < id);
+        graph.steps[dependency].dependents.push_back(id);
+    }
+
+    graph.steps.push_back(step);
+
+    return id;
+}
+
+bool runInitGraph(InitGraph &graph, uint32_t workerCount)
+{
+    const int stepCount = static_cast<int>(graph.steps.size());
+
+    graph.workerCount = std::max(workerCount, 1u);
+
+    std::mutex lock;
+    std::condition_variable readyCondition;
+    std::deque<int> readySteps;
+    std::vector<int> pendingDependencies(stepCount);
+    int finishedCount = 0;
+    bool failed = false;
+
+    for (int i = 0; i < stepCount; i++)
+    {
+        pendingDependencies[i] = static_cast<int>(graph.steps[i].dependencies.size());
+        if (pendingDependencies[i] == 0)
+        {
+            readySteps.push_back(i);
+        }
+    }
+
+    InitClock::time_point graphStart = InitClock::now();
+
+    auto worker = [&](uint32_t thread)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+
+        while (true)
+        {
+            readyCondition.wait(guard, [&]{ return failed || finishedCount == stepCount || !readySteps.empty(); });
+
+            if (failed || finishedCount == stepCount)
+            {
+                return;
+            }
+
+            int id = readySteps.front();
+            readySteps.pop_front();
+
+            InitStep &step = graph.steps[id];
+            step.thread = thread;
+            step.startMs = elapsedMs(graphStart);
+
+            guard.unlock();
+            bool succeeded = step.func();
+            guard.lock();
+
+            step.durationMs = elapsedMs(graphStart) - step.startMs;
+            step.succeeded = succeeded;
+            finishedCount++;
+
+            if (!succeeded)
+            {
+                printf("Init step '%s' failed\n", step.name);
+                failed = true;
+            }
+            else
+            {
+                for (int dependent : step.dependents)
+                {
+                    if (--pendingDependencies[dependent] == 0)
+                    {
+                        readySteps.push_back(dependent);
+                    }
+                }
+            }
+
+            readyCondition.notify_all();
+        }
+    };
+
+    // the calling thread is worker 0
+    std::vector<std::thread> workers;
+    for (uint32_t i = 1; i < graph.workerCount; i++)
+    {
+        workers.push_back(std::thread(worker, i));
+    }
+
+    worker(0);
+
+    for (std::thread &thread : workers)
+    {
+        thread.join();
+    }
+
+    graph.totalMs = elapsedMs(graphStart);
+
+    return !failed && finishedCount == stepCount;
+}
+
+void printInitReport(const InitGraph &graph)
+{
+    std::vector<int> order;
+    double summedMs = 0.0;
+
+    for (int i = 0; i < static_cast<int>(graph.steps.size()); i++)
+    {
+        if (graph.steps[i].succeeded)
+        {
+            order.push_back(i);
+            summedMs += graph.steps[i].durationMs;
+        }
+    }
+
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return graph.steps[a].startMs < graph.steps[b].startMs; });
+
+    printf("Startup breakdown (%u worker threads)\n", graph.workerCount);
+    printf("    %-24s %10s %10s %8s\n", "step", "start ms", "time ms", "thread");
+
+    for (int id : order)
+    {
+        const InitStep &step = graph.steps[id];
+        printf("    %-24s %10.2f %10.2f %8u\n", step.name, step.startMs, step.durationMs, step.thread);
+    }
+
+    printf("    total %.2f ms wall time, %.2f ms summed step time\n", graph.totalMs, summedMs);
+
+    if (order.empty())
+    {
+        return;
+    }
+
+    // Walk back from the step that finished last, always following the
+    // dependency that finished last. That chain is what bounds the init time
+    int id = order[0];
+    for (int candidate : order)
+    {
+        const InitStep &step = graph.steps[candidate];
+        if (step.startMs + step.durationMs > graph.steps[id].startMs + graph.steps[id].durationMs)
+        {
+            id = candidate;
+        }
+    }
+
+    std::vector<int> criticalPath;
+    while (id >= 0)
+    {
+        criticalPath.push_back(id);
+
+        int next = -1;
+        for (int dependency : graph.steps[id].dependencies)
+        {
+            if (next < 0 || graph.steps[dependency].startMs + graph.steps[dependency].durationMs > graph.steps[next].startMs + graph.steps[next].durationMs)
+            {
+                next = dependency;
+            }
+        }
+        id = next;
+    }
+
+    printf("    critical path:");
+    for (auto it = criticalPath.rbegin(); it != criticalPath.rend(); ++it)
+    {
+        printf(" %s%s", graph.steps[*it].name, (it + 1 == criticalPath.rend()) ? "\n" : " ->");
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef __INITGRAPH_H__
+#define __INITGRAPH_H__
+
+#include <stdint.h>
+
+#include <vector>
+#include <initializer_list>
+
+// An init step is one of the bool initXXX() functions, it returns false on failure
+typedef bool (*InitStepFunc)();
+
+struct InitStep
+{
+    const char*         name;
+    InitStepFunc        func;
+    std::vector<int>    dependencies;
+    std::vector<int>    dependents;
+
+    // filled in by runInitGraph(), relative to the start of the graph
+    double              startMs = 0.0;
+    double              durationMs = 0.0;
+    uint32_t            thread = 0;
+    bool                succeeded = false;
+};
+
+// Init steps and the steps they depend on. Steps without a path between
+// them in the graph can run at the same time on different worker threads
+struct InitGraph
+{
+    std::vector<InitStep> steps;
+
+    uint32_t workerCount = 0;
+    double totalMs = 0.0;
+};
+
+// Adds a step to the graph and returns its id for use as a dependency of later steps
+int addInitStep(InitGraph &graph, const char* name, InitStepFunc func, std::initializer_list<int> dependencies = {});
+
+// Runs every step once all of its dependencies have succeeded. Stops
+// scheduling new steps as soon as one fails. A worker count of 1 runs
+// the steps in order on the calling thread
+bool runInitGraph(InitGraph &graph, uint32_t workerCount);
+
+// Prints the per step timings and the critical path through the graph
+void printInitReport(const InitGraph &graph);
+
+#endif //__INITGRAPH_H__
@@ -0,0 +1,397 @@
+/*
+    Clustered forward lighting, lights binned into froxels in compute
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <string.h>
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+static bool createLightingBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, LightingBuffer &buffer)
+{
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+
+    VkResult result = vkCreateBuffer(g_app.device, &bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), &buffer.buffer);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_app.device, buffer.buffer, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, properties, &memAllocInfo.memoryTypeIndex))
+    {
+        return false;
+    }
+
+    result = allocateDeviceMemory(&memAllocInfo, &buffer.memory);
+    assert(result == VK_SUCCESS);
+
+    vkBindBufferMemory(g_app.device, buffer.buffer, buffer.memory, 0);
+
+    // host visible buffers stay mapped for their lifetime
+    if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        result = vkMapMemory(g_app.device, buffer.memory, 0, size, 0, &buffer.mapped);
+    }
+
+    return (result == VK_SUCCESS);
+}
+
+static void destroyLightingBuffer(LightingBuffer &buffer)
+{
+    if (buffer.buffer == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    if (buffer.mapped != nullptr)
+    {
+        vkUnmapMemory(g_app.device, buffer.memory);
+    }
+    evictCachedDescriptorSets((uint64_t)buffer.buffer);
+    vkDestroyBuffer(g_app.device, buffer.buffer, getHostAllocator(HOST_OBJECT_BUFFER));
+    freeDeviceMemory(buffer.memory);
+
+    buffer = LightingBuffer();
+}
+
+// Point and spot lights of random colors and sizes around the model, the
+// same ones every run
+static void createLights()
+{
+    ClusteredLighting &lighting = g_app.lighting;
+
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> position(-LIGHT_SPREAD, LIGHT_SPREAD);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    lighting.baseLights.resize(lighting.lightCount);
+    lighting.orbitSpeeds.resize(lighting.lightCount);
+
+    for (uint32_t i = 0; i < lighting.lightCount; i++)
+    {
+        GpuLight &light = lighting.baseLights[i];
+        light.position[0] = position(random);
+        light.position[1] = position(random);
+        light.position[2] = position(random);
+        light.range = 0.75f + unit(random) * 1.75f;
+
+        light.color[0] = 0.2f + unit(random) * 0.8f;
+        light.color[1] = 0.2f + unit(random) * 0.8f;
+        light.color[2] = 0.2f + unit(random) * 0.8f;
+
+        // every fourth light is a spot
+        glm::vec3 direction = glm::normalize(glm::vec3(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f) + glm::vec3(0.0f, 0.0f, 1e-3f));
+        light.direction[0] = direction.x;
+        light.direction[1] = direction.y;
+        light.direction[2] = direction.z;
+        light.spotCosOuter = (i % 4 == 3) ? std::cos(glm::radians(35.0f)) : -2.0f;
+        light.spotCosInner = std::cos(glm::radians(25.0f));
+
+        lighting.orbitSpeeds[i] = (unit(random) * 2.0f - 1.0f) * LIGHT_ORBIT_SPEED;
+    }
+}
+
+// The view space box of every froxel. The tiles are cut in framebuffer
+// pixels, their corners are taken back through the projection to rays
+// from the eye, which are cut at the depths of the slice
+static void buildClusterBounds(const glm::mat4 &projectionMatrix)
+{
+    ClusteredLighting &lighting = g_app.lighting;
+
+    // near and far planes of a -1 to 1 depth range perspective
+    float nearPlane = projectionMatrix[3][2] / (projectionMatrix[2][2] - 1.0f);
+    float farPlane = projectionMatrix[3][2] / (projectionMatrix[2][2] + 1.0f);
+    float depthRatio = farPlane / nearPlane;
+
+    LightGridHeader *header = static_cast<LightGridHeader*>(lighting.grid.mapped);
+    header->gridSize[0] = LIGHT_GRID_X;
+    header->gridSize[1] = LIGHT_GRID_Y;
+    header->gridSize[2] = LIGHT_GRID_Z;
+    header->gridSize[3] = 0;
+    header->tileSize[0] = static_cast<float>(SCREEN_WIDTH) / LIGHT_GRID_X;
+    header->tileSize[1] = static_cast<float>(SCREEN_HEIGHT) / LIGHT_GRID_Y;
+    header->sliceScale = LIGHT_GRID_Z / std::log(depthRatio);
+    header->sliceBias = -std::log(nearPlane) * header->sliceScale;
+
+    LightClusterBounds *bounds = reinterpret_cast<LightClusterBounds*>(header + 1);
+    glm::mat4 inverseProjection = glm::inverse(projectionMatrix);
+
+    for (uint32_t y = 0; y < LIGHT_GRID_Y; y++)
+    {
+        for (uint32_t x = 0; x < LIGHT_GRID_X; x++)
+        {
+            glm::vec3 rays[4];
+            for (uint32_t corner = 0; corner < 4; corner++)
+            {
+                float ndcX = static_cast<float>(x + (corner & 1)) / LIGHT_GRID_X * 2.0f - 1.0f;
+                float ndcY = static_cast<float>(y + (corner >> 1)) / LIGHT_GRID_Y * 2.0f - 1.0f;
+                glm::vec4 point = inverseProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+
+                // scaled to a depth of one
+                rays[corner] = glm::vec3(point) / -point.z;
+            }
+
+            for (uint32_t z = 0; z < LIGHT_GRID_Z; z++)
+            {
+                float sliceNear = nearPlane * std::pow(depthRatio, static_cast<float>(z) / LIGHT_GRID_Z);
+                float sliceFar = nearPlane * std::pow(depthRatio, static_cast<float>(z + 1) / LIGHT_GRID_Z);
+
+                glm::vec3 boxMin = rays[0] * sliceNear;
+                glm::vec3 boxMax = boxMin;
+                for (uint32_t corner = 0; corner < 4; corner++)
+                {
+                    boxMin = glm::min(boxMin, glm::min(rays[corner] * sliceNear, rays[corner] * sliceFar));
+                    boxMax = glm::max(boxMax, glm::max(rays[corner] * sliceNear, rays[corner] * sliceFar));
+                }
+
+                LightClusterBounds &cluster = bounds[x + y * LIGHT_GRID_X + z * LIGHT_GRID_X * LIGHT_GRID_Y];
+                cluster.min = glm::vec4(boxMin, 0.0f);
+                cluster.max = glm::vec4(boxMax, 0.0f);
+            }
+        }
+    }
+
+    lighting.gridProjection = projectionMatrix;
+}
+
+static bool initLightBinPipeline()
+{
+    ClusteredLighting &lighting = g_app.lighting;
+
+    VkDescriptorSetLayoutBinding bindings[4] = {};
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    lighting.descriptorSetLayout = createDescriptorSetLayout(bindings, 4);
+
+    // the world space lights are the only binding that changes, one set per frame fence
+    for (uint32_t i = 0; i < g_app.deletionQueue.fenceCount; i++)
+    {
+        DescriptorResource resources[4];
+        memset(resources, 0, sizeof(resources));
+
+        resources[0].buffer = { lighting.grid.buffer, 0, VK_WHOLE_SIZE };
+        resources[1].buffer = { lighting.worldLights[i].buffer, 0, VK_WHOLE_SIZE };
+        resources[2].buffer = { lighting.viewLights.buffer, 0, VK_WHOLE_SIZE };
+        resources[3].buffer = { lighting.clusters.buffer, 0, VK_WHOLE_SIZE };
+
+        lighting.sets[i] = getCachedDescriptorSet(lighting.descriptorSetLayout, resources);
+        if (lighting.sets[i] == VK_NULL_HANDLE)
+        {
+            return false;
+        }
+    }
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(LightBinPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &lighting.descriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    VkResult result = vkCreatePipelineLayout(g_app.device, &pipelineLayoutCreateInfo, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT), &lighting.pipelineLayout);
+    assert(result == VK_SUCCESS);
+
+    lighting.shader = loadShaderGLSL("data/lightbin.comp", VK_SHADER_STAGE_COMPUTE_BIT);
+
+    VkComputePipelineCreateInfo pipelineCreateInfo = {};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCreateInfo.stage.module = lighting.shader;
+    pipelineCreateInfo.stage.pName = "main";
+    pipelineCreateInfo.layout = lighting.pipelineLayout;
+
+    result = vkCreateComputePipelines(g_app.device, g_app.pipelineCache, 1, &pipelineCreateInfo, getHostAllocator(HOST_OBJECT_PIPELINE), &lighting.pipeline);
+    assert(result == VK_SUCCESS);
+
+    return (result == VK_SUCCESS);
+}
+
+bool initLighting()
+{
+    ClusteredLighting &lighting = g_app.lighting;
+
+    // the bindless shaders have no lighting path
+    if (g_app.bindless.enabled)
+    {
+        if (lighting.lightCount > 0)
+        {
+            printf("Lighting: not available in bindless mode, the scene stays unlit\n");
+        }
+        lighting.lightCount = 0;
+        return true;
+    }
+
+    if (lighting.lightCount > LIGHT_MAX_LIGHTS)
+    {
+        printf("Lighting: %u lights asked for, using %u\n", lighting.lightCount, LIGHT_MAX_LIGHTS);
+        lighting.lightCount = LIGHT_MAX_LIGHTS;
+    }
+
+    // The scene descriptor set refers to the buffers whether or not the
+    // material is lit, so they exist even without lights
+    VkDeviceSize lightsSize = std::max(lighting.lightCount, 1u) * sizeof(GpuLight);
+    VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    bool created = createLightingBuffer(sizeof(LightGridHeader) + LIGHT_CLUSTER_COUNT * sizeof(LightClusterBounds), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, lighting.grid) &&
+                   createLightingBuffer(lightsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lighting.viewLights) &&
+                   createLightingBuffer(LIGHT_CLUSTER_COUNT * (LIGHT_MAX_PER_CLUSTER + 1) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lighting.clusters);
+
+    for (uint32_t i = 0; created && i < g_app.deletionQueue.fenceCount; i++)
+    {
+        created = createLightingBuffer(lightsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, lighting.worldLights[i]);
+    }
+
+    if (!created)
+    {
+        printf("Lighting: could not allocate the light buffers\n");
+        return false;
+    }
+
+    // built from the real projection by the first updateLighting()
+    memset(lighting.grid.mapped, 0, sizeof(LightGridHeader));
+    lighting.gridProjection = glm::mat4(0.0f);
+
+    lighting.enabled = true;
+
+    if (lighting.lightCount == 0)
+    {
+        return true;
+    }
+
+    createLights();
+
+    if (!initLightBinPipeline())
+    {
+        return false;
+    }
+
+    printf("Lighting: %u lights binned into %ux%ux%u clusters\n", lighting.lightCount, LIGHT_GRID_X, LIGHT_GRID_Y, LIGHT_GRID_Z);
+
+    return true;
+}
+
+void getLightingResources(VkDescriptorBufferInfo resources[3])
+{
+    ClusteredLighting &lighting = g_app.lighting;
+
+    resources[0] = { lighting.grid.buffer, 0, VK_WHOLE_SIZE };
+    resources[1] = { lighting.viewLights.buffer, 0, VK_WHOLE_SIZE };
+    resources[2] = { lighting.clusters.buffer, 0, VK_WHOLE_SIZE };
+}
+
+void updateLighting(const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix, float time)
+{
+    ClusteredLighting &lighting = g_app.lighting;
+
+    if (!lighting.enabled || lighting.lightCount == 0)
+    {
+        return;
+    }
+
+    // The bounds are read by the binning of the frames in flight, they are
+    // only rebuilt when the projection changes so this waits for them
+    if (projectionMatrix != lighting.gridProjection)
+    {
+        waitForFrame(getRecordingFrame() - 1);
+        buildClusterBounds(projectionMatrix);
+    }
+
+    // the buffer of this fence slot was last read by the frame beginFrameCommands() waited for
+    uint32_t slot = g_app.frameCommands.slot;
+    GpuLight *lights = static_cast<GpuLight*>(lighting.worldLights[slot].mapped);
+
+    for (uint32_t i = 0; i < lighting.lightCount; i++)
+    {
+        const GpuLight &base = lighting.baseLights[i];
+        float angle = time * lighting.orbitSpeeds[i];
+        float c = std::cos(angle), s = std::sin(angle);
+
+        GpuLight light = base;
+        light.position[0] = base.position[0] * c - base.position[2] * s;
+        light.position[2] = base.position[0] * s + base.position[2] * c;
+        light.direction[0] = base.direction[0] * c - base.direction[2] * s;
+        light.direction[2] = base.direction[0] * s + base.direction[2] * c;
+        lights[i] = light;
+    }
+
+    VkCommandBuffer cmdBuffer = beginFrameCommandBuffer();
+
+    LightBinPushConstants pushConstants;
+    pushConstants.viewMatrix = viewMatrix;
+    pushConstants.lightCount = lighting.lightCount;
+
+    // The fragments of the frames still in flight read the lists this
+    // overwrites, the binning waits for them on the GPU only
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lighting.pipeline);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lighting.pipelineLayout, 0, 1, &lighting.sets[slot], 0, nullptr);
+    vkCmdPushConstants(cmdBuffer, lighting.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+
+    // one invocation per cluster, every work group goes through the lights in shared memory
+    vkCmdDispatch(cmdBuffer, (LIGHT_CLUSTER_COUNT + LIGHT_BIN_GROUP_SIZE - 1) / LIGHT_BIN_GROUP_SIZE, 1, 1);
+
+    // The frame's fragments read the lists in a later submission
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    VkResult result = vkEndCommandBuffer(cmdBuffer);
+    assert(result == VK_SUCCESS);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmdBuffer;
+
+    result = vkQueueSubmit(g_app.queue, 1, &submitInfo, VK_NULL_HANDLE);
+    assert(result == VK_SUCCESS);
+    (void)result;
+}
+
+void destroyLighting()
+{
+    ClusteredLighting &lighting = g_app.lighting;
+
+    if (lighting.pipeline != VK_NULL_HANDLE)
+    {
+        vkDestroyPipeline(g_app.device, lighting.pipeline, getHostAllocator(HOST_OBJECT_PIPELINE));
+        vkDestroyPipelineLayout(g_app.device, lighting.pipelineLayout, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT));
+        vkDestroyShaderModule(g_app.device, lighting.shader, getHostAllocator(HOST_OBJECT_SHADER_MODULE));
+        lighting.pipeline = VK_NULL_HANDLE;
+    }
+
+    for (LightingBuffer &lights : lighting.worldLights)
+    {
+        destroyLightingBuffer(lights);
+    }
+    destroyLightingBuffer(lighting.clusters);
+    destroyLightingBuffer(lighting.viewLights);
+    destroyLightingBuffer(lighting.grid);
+
+    lighting.enabled = false;
+}
@@ -0,0 +1,122 @@
+#ifndef __LIGHTING_H__
+#define __LIGHTING_H__
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "deletionqueue.h"
+
+// Froxels of the view: screen tiles, by depth slices that grow
+// exponentially from the near plane to the far plane. These must match
+// the grid data/lightbin.comp and data/triangle.frag are given
+const uint32_t LIGHT_GRID_X = 16;
+const uint32_t LIGHT_GRID_Y = 9;
+const uint32_t LIGHT_GRID_Z = 24;
+const uint32_t LIGHT_CLUSTER_COUNT = LIGHT_GRID_X * LIGHT_GRID_Y * LIGHT_GRID_Z;
+
+// Lights a cluster can list, more are dropped. Must match LightCluster
+// in lightbin.comp and triangle.frag
+const uint32_t LIGHT_MAX_PER_CLUSTER = 127;
+
+const uint32_t LIGHT_MAX_LIGHTS = 16384;
+
+// Invocations per work group, this must match local_size_x in data/lightbin.comp
+const uint32_t LIGHT_BIN_GROUP_SIZE = 64;
+
+// Lights are spread over a box this far around the model in every
+// direction, and orbit the y axis at up to this many radians per second
+const float LIGHT_SPREAD = 8.0f;
+const float LIGHT_ORBIT_SPEED = 0.5f;
+
+// A light as the shaders see it, three vec4s. Spot lights point along
+// direction, point lights have a spotCosOuter below -1
+struct GpuLight
+{
+    float position[3];
+    float range;
+    float color[3];
+    float spotCosOuter;
+    float direction[3];
+    float spotCosInner;
+};
+
+// Start of the cluster grid buffer, followed by the view space bounds of
+// every cluster. The ClusterGrid block in lightbin.comp and triangle.frag
+struct LightGridHeader
+{
+    uint32_t gridSize[4];       // x, y, z, unused
+    float tileSize[2];          // pixels per cluster column and row
+    float sliceScale;           // slice = log(view depth) * sliceScale + sliceBias
+    float sliceBias;
+};
+
+struct LightClusterBounds
+{
+    glm::vec4 min;
+    glm::vec4 max;
+};
+
+// Matching the BinParams block in lightbin.comp
+struct LightBinPushConstants
+{
+    glm::mat4 viewMatrix;
+    uint32_t lightCount;
+};
+
+struct LightingBuffer
+{
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    void* mapped = nullptr;
+};
+
+// Clustered forward lighting. Every frame a compute pass moves the lights
+// into view space and lists the ones touching each froxel of the cluster
+// grid, which is built from the projection matrix. A lit fragment only
+// visits the lights of its own cluster, so its cost follows how many
+// lights are near it rather than how many there are
+struct ClusteredLighting
+{
+    // --lights <count>, the scene is unlit without it
+    uint32_t lightCount = 0;
+
+    // the buffers exist, only outside of bindless mode
+    bool enabled = false;
+
+    // where each light orbits, the world space lights are made from these every frame
+    std::vector<GpuLight> baseLights;
+    std::vector<float> orbitSpeeds;
+
+    LightingBuffer grid;                         // header and cluster bounds, host visible
+    LightingBuffer worldLights[MAX_FRAME_FENCES];
+    LightingBuffer viewLights;                   // written by the binning pass
+    LightingBuffer clusters;                     // light lists, written by the binning pass
+
+    // the projection the cluster bounds were built for
+    glm::mat4 gridProjection;
+
+    VkDescriptorSetLayout descriptorSetLayout;      // the layout and sets belong to the descriptor allocator
+    VkDescriptorSet sets[MAX_FRAME_FENCES];
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkShaderModule shader = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+};
+
+bool initLighting();
+
+// Resources of bindings 1 to 3 of the scene descriptor set: the cluster
+// grid, the view space lights and the light lists
+void getLightingResources(VkDescriptorBufferInfo resources[3]);
+
+// Moves the lights, rebuilds the cluster bounds when the projection
+// changed and submits the binning pass ahead of the frame's draws
+void updateLighting(const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix, float time);
+
+void destroyLighting();
+
+#endif //__LIGHTING_H__
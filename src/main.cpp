@@ -6,19 +6,22 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <fstream>
 
 #include <assert.h>
 #include <limits.h>
 #include <memory>
 
 #include <cstring>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+
+#include "initgraph.h"
 
 /// function forward definitions
-void updateUniformBuffers();
-VkPipelineShaderStageCreateInfo loadShader(std::string filename, VkShaderStageFlagBits shaderStage);
+void updateUniformBuffers(uint32_t imageIndex);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
-VkShaderModule loadShaderGLSL(const char *filename, VkShaderStageFlagBits shaderStage);
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 ///
 
 /// Gloabl params
@@ -28,40 +31,103 @@ const uint32_t VERTEX_BUFFER_BIND_ID = 0;
 ///
 
 ///
-void executeBeginCommandBuffer(uint16_t iBuffer) 
+bool initSetupCommands()
 {
-    /* DEPENDS on init_command_buffer() */
     VkResult result;
- 
+
+    // transient pool, the setup command buffer is recorded once and then recycled
+    VkCommandPoolCreateInfo cmd_pool_info = {};
+    cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmd_pool_info.pNext = NULL;
+    cmd_pool_info.queueFamilyIndex = g_app.graphicsQueueFamilyIndex;
+    cmd_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    result = vkCreateCommandPool(g_app.device, &cmd_pool_info, getHostAllocator(HOST_OBJECT_COMMAND_POOL), &g_app.setup.cmdPool);
+    assert(result == VK_SUCCESS);
+
+    VkCommandBufferAllocateInfo cmd = {};
+    cmd.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmd.pNext = NULL;
+    cmd.commandPool = g_app.setup.cmdPool;
+    cmd.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmd.commandBufferCount = 1;
+
+    result = vkAllocateCommandBuffers(g_app.device, &cmd, &g_app.setup.cmdBuffer);
+    assert(result == VK_SUCCESS);
+
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.pNext = NULL;
+    fence_info.flags = 0;
+
+    result = vkCreateFence(g_app.device, &fence_info, getHostAllocator(HOST_OBJECT_FENCE), &g_app.setup.fence);
+    assert(result == VK_SUCCESS);
+
     VkCommandBufferBeginInfo cmd_buf_info = {};
     cmd_buf_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     cmd_buf_info.pNext = NULL;
-    cmd_buf_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    cmd_buf_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     cmd_buf_info.pInheritanceInfo = NULL;
 
-    result = vkBeginCommandBuffer(g_app.drawCmdBuffers[iBuffer], &cmd_buf_info);
-
+    result = vkBeginCommandBuffer(g_app.setup.cmdBuffer, &cmd_buf_info);
     assert(result == VK_SUCCESS);
-}   
 
-void executeEndCommandBuffer(uint16_t iBuffer) 
-{
-    VkResult result;
+    g_app.setup.recordCount = 0;
 
-    result = vkEndCommandBuffer(g_app.drawCmdBuffers[iBuffer]);
+    return (result == VK_SUCCESS);
+}
 
-    assert(result == VK_SUCCESS);
+VkCommandBuffer beginSetupCommands()
+{
+    g_app.setup.lock.lock();
+    return g_app.setup.cmdBuffer;
 }
 
-void executeQueueCommandBuffer(uint16_t iBuffer) 
+void endSetupCommands()
 {
-    VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &g_app.drawCmdBuffers[iBuffer];
+    g_app.setup.recordCount++;
+    g_app.setup.lock.unlock();
+}
+
+bool flushSetupCommands()
+{
+    std::lock_guard<std::mutex> guard(g_app.setup.lock);
+
+    VkResult result = vkEndCommandBuffer(g_app.setup.cmdBuffer);
+    assert(result == VK_SUCCESS);
+
+    if (g_app.setup.recordCount > 0)
+    {
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &g_app.setup.cmdBuffer;
+
+        result = vkQueueSubmit(g_app.queue, 1, &submitInfo, g_app.setup.fence);
+        assert(result == VK_SUCCESS);
+
+        do
+        {
+            result = vkWaitForFences(g_app.device, 1, &g_app.setup.fence, VK_TRUE, FENCE_TIMEOUT);
+        } while (result == VK_TIMEOUT);
+        assert(result == VK_SUCCESS);
+
+        vkResetFences(g_app.device, 1, &g_app.setup.fence);
+    }
+
+    // recycle the command buffer so later one time work can be batched the same way
+    vkResetCommandPool(g_app.device, g_app.setup.cmdPool, 0);
+
+    VkCommandBufferBeginInfo cmd_buf_info = {};
+    cmd_buf_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cmd_buf_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    result = vkBeginCommandBuffer(g_app.setup.cmdBuffer, &cmd_buf_info);
+    assert(result == VK_SUCCESS);
 
-	vkQueueSubmit(g_app.queue, 1, &submitInfo, 0);
-	vkQueueWaitIdle(g_app.queue);
+    g_app.setup.recordCount = 0;
+
+    return (result == VK_SUCCESS);
 }
 ///
 
@@ -75,7 +141,23 @@ bool initVKInstance()
     bool vkDeviceInitSuccess = false;
 
     unsigned int extCount;
-    const char** extensions = glfwGetRequiredInstanceExtensions(&extCount);
+    const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&extCount);
+    std::vector<const char*> extensions(glfwExtensions, glfwExtensions + extCount);
+
+    // Bindless mode queries the descriptor indexing features and the memory
+    // manager the heap budgets through VK_KHR_get_physical_device_properties2
+    uint32_t instanceExtensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &instanceExtensionCount, nullptr);
+    std::vector<VkExtensionProperties> instanceExtensions(instanceExtensionCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &instanceExtensionCount, instanceExtensions.data());
+
+    for (const VkExtensionProperties &extension : instanceExtensions)
+    {
+        if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+        {
+            extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+        }
+    }
 
     VkInstanceCreateInfo inst_info;
     inst_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -83,10 +165,10 @@ bool initVKInstance()
     inst_info.pApplicationInfo = nullptr;
     inst_info.enabledLayerCount = 0;
     inst_info.ppEnabledLayerNames = nullptr;
-    inst_info.enabledExtensionCount = extCount;
-    inst_info.ppEnabledExtensionNames = extensions;
+    inst_info.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    inst_info.ppEnabledExtensionNames = extensions.data();
 
-    vkDeviceInitSuccess = (vkCreateInstance(&inst_info, nullptr, &g_app.instance) == VK_SUCCESS);
+    vkDeviceInitSuccess = (vkCreateInstance(&inst_info, getHostAllocator(HOST_OBJECT_INSTANCE), &g_app.instance) == VK_SUCCESS);
 
     return vkDeviceInitSuccess;
 }
@@ -106,16 +188,51 @@ bool initWindow()
     }
 
     glfwSetKeyCallback(g_app.window, key_callback);
+    glfwSetMouseButtonCallback(g_app.window, mouse_button_callback);
 
     return (g_app.window != nullptr);
 }
 
 bool initVKSurface()
 {
-    VkResult err = glfwCreateWindowSurface(g_app.instance, g_app.window, NULL, &g_app.renderSurface);
+    VkResult err = glfwCreateWindowSurface(g_app.instance, g_app.window, getHostAllocator(HOST_OBJECT_SURFACE), &g_app.renderSurface);
     return ( err == VK_SUCCESS);
 }
 
+// Device extensions enabled when available, code using them checks deviceExtensionEnabled()
+static const char* optionalDeviceExtensions[] =
+{
+    VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME,
+    VK_KHR_MAINTENANCE3_EXTENSION_NAME,
+    VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+    VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+    VK_KHR_MULTIVIEW_EXTENSION_NAME,
+};
+
+bool deviceExtensionSupported(const char* name)
+{
+    for (const VkExtensionProperties &extension : g_app.deviceExtensions)
+    {
+        if (strcmp(extension.extensionName, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool deviceExtensionEnabled(const char* name)
+{
+    for (const char* extension : g_app.enabledDeviceExtensions)
+    {
+        if (strcmp(extension, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool initVKDevice()
 {
     vkEnumeratePhysicalDevices(g_app.instance, &g_app.gpuCount, nullptr);
@@ -169,6 +286,95 @@ bool initVKDevice()
 
     g_app.graphicsQueueFamilyIndex = graphicsQueueNodeIndex;
 
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(g_app.gpu[0], nullptr, &extensionCount, nullptr);
+    g_app.deviceExtensions.resize(extensionCount);
+    vkEnumerateDeviceExtensionProperties(g_app.gpu[0], nullptr, &extensionCount, g_app.deviceExtensions.data());
+
+    // the swapchain is required, the rest is used when the device has it
+    g_app.enabledDeviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+    for (const char* extension : optionalDeviceExtensions)
+    {
+        if (deviceExtensionSupported(extension))
+        {
+            g_app.enabledDeviceExtensions.push_back(extension);
+        }
+    }
+
+    // bindless mode needs descriptor indexing features enabled on top of the extension
+    VkPhysicalDeviceFeatures2KHR deviceFeatures2 = {};
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {};
+    if (g_app.bindless.requested)
+    {
+        g_app.bindless.enabled = getBindlessFeatures(g_app.gpu[0], deviceFeatures2, descriptorIndexingFeatures);
+        if (!g_app.bindless.enabled)
+        {
+            printf("Bindless mode is not supported by this device, using descriptor sets\n");
+        }
+    }
+
+    // the bindless shaders have no G-buffer output
+    g_app.deferred.enabled = g_app.deferred.requested && !g_app.bindless.enabled;
+    if (g_app.deferred.requested && !g_app.deferred.enabled)
+    {
+        printf("Deferred shading is not available in bindless mode, shading forward\n");
+    }
+
+    // Multiview mode blits its views into the swapchain image, and has a
+    // vertex shader and render pass the bindless and deferred modes lack
+    VkPhysicalDeviceMultiviewFeaturesKHR multiviewFeatures = {};
+    MultiviewTarget &multiview = g_app.multiview;
+    if (multiview.viewCount > 1)
+    {
+        if (multiview.viewCount > MULTIVIEW_MAX_VIEWS)
+        {
+            printf("Multiview: %u views asked for, using %u\n", multiview.viewCount, MULTIVIEW_MAX_VIEWS);
+            multiview.viewCount = MULTIVIEW_MAX_VIEWS;
+        }
+
+        VkSurfaceCapabilitiesKHR surfCapabilities;
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(g_app.gpu[0], g_app.renderSurface, &surfCapabilities);
+
+        if (g_app.bindless.enabled || g_app.deferred.enabled)
+        {
+            printf("Multiview is not available in bindless or deferred mode, drawing one view\n");
+        }
+        else if (!(surfCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+        {
+            printf("Multiview: the swapchain images can't be blitted to, drawing one view\n");
+        }
+        else
+        {
+            multiview.enabled = getMultiviewFeatures(g_app.gpu[0], multiview.viewCount, multiviewFeatures);
+            if (!multiview.enabled)
+            {
+                printf("Multiview with %u views is not supported by this device, drawing one view\n", multiview.viewCount);
+            }
+        }
+    }
+
+    // bindless and multiview mode never both run, either can have the features2 chain
+    if (multiview.enabled)
+    {
+        deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        deviceFeatures2.pNext = &multiviewFeatures;
+    }
+    bool featureChain = g_app.bindless.enabled || multiview.enabled;
+
+    // block compressed textures are uploaded as they are where the device can sample them
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(g_app.gpu[0], &supportedFeatures);
+
+    VkPhysicalDeviceFeatures &enabledFeatures = deviceFeatures2.features;
+    enabledFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+    enabledFeatures.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;
+
+    // the visible runs of instances are drawn with one indirect call where the device allows
+    enabledFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    enabledFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+    g_app.enabledFeatures = enabledFeatures;
+
     float queue_priorities[1] = {1.0};
 
     VkDeviceQueueCreateInfo queueCreateInfo;
@@ -181,19 +387,20 @@ bool initVKDevice()
 
     VkDeviceCreateInfo deviceCreateInfo;
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCreateInfo.pNext = nullptr;
+    deviceCreateInfo.pNext = featureChain ? &deviceFeatures2 : nullptr;
     deviceCreateInfo.flags = 0;
     deviceCreateInfo.queueCreateInfoCount = 1;
     deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
     deviceCreateInfo.enabledLayerCount = 0;
     deviceCreateInfo.ppEnabledLayerNames = nullptr;
-    deviceCreateInfo.enabledExtensionCount = 0;
-    deviceCreateInfo.ppEnabledExtensionNames = nullptr;
-    deviceCreateInfo.pEnabledFeatures = nullptr;
+    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(g_app.enabledDeviceExtensions.size());
+    deviceCreateInfo.ppEnabledExtensionNames = g_app.enabledDeviceExtensions.data();
+    // with the features2 chain the core features are enabled through it
+    deviceCreateInfo.pEnabledFeatures = featureChain ? nullptr : &enabledFeatures;
 
     VkResult result = VK_SUCCESS;
 
-    result = vkCreateDevice(g_app.gpu[0], &deviceCreateInfo, nullptr, &g_app.device);
+    result = vkCreateDevice(g_app.gpu[0], &deviceCreateInfo, getHostAllocator(HOST_OBJECT_DEVICE), &g_app.device);
 
     assert (result == VK_SUCCESS);
 
@@ -202,15 +409,45 @@ bool initVKDevice()
     return true;
 }
 
-void setImageLayout(uint16_t iBuffer, VkImage image,
+// Pipeline stages that perform the given memory accesses
+static VkPipelineStageFlags pipelineStagesForAccess(VkAccessFlags access, VkPipelineStageFlags noAccessStages)
+{
+    VkPipelineStageFlags stages = 0;
+
+    if (access & (VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT))
+    {
+        stages |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+
+    if (access & VK_ACCESS_HOST_WRITE_BIT)
+    {
+        stages |= VK_PIPELINE_STAGE_HOST_BIT;
+    }
+
+    if (access & VK_ACCESS_SHADER_READ_BIT)
+    {
+        stages |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    }
+
+    if (access & VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT)
+    {
+        stages |= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    }
+
+    if (access & VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT)
+    {
+        stages |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    }
+
+    return stages ? stages : noAccessStages;
+}
+
+void setImageLayout(VkCommandBuffer cmdBuffer, VkImage image,
                     VkImageAspectFlags aspectMask,
                     VkImageLayout old_image_layout,
                     VkImageLayout new_image_layout) 
 {
-    /* DEPENDS on info.cmd and info.queue initialized */
-
-    assert(g_app.drawCmdBuffers[iBuffer] != VK_NULL_HANDLE);
-    assert(g_app.queue != VK_NULL_HANDLE);
+    assert(cmdBuffer != VK_NULL_HANDLE);
 
     VkImageMemoryBarrier image_memory_barrier = {};
     image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -269,10 +506,12 @@ void setImageLayout(uint16_t iBuffer, VkImage image,
         image_memory_barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
     }
 
-    VkPipelineStageFlags src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    VkPipelineStageFlags dest_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    // Wait on the stages that made the writes and block the stages that make
+    // the reads, so an upload is finished before the image is sampled
+    VkPipelineStageFlags src_stages = pipelineStagesForAccess(image_memory_barrier.srcAccessMask, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    VkPipelineStageFlags dest_stages = pipelineStagesForAccess(image_memory_barrier.dstAccessMask, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 
-    vkCmdPipelineBarrier(g_app.drawCmdBuffers[iBuffer], src_stages, dest_stages, 0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
+    vkCmdPipelineBarrier(cmdBuffer, src_stages, dest_stages, 0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
 }
 
 bool initVKSwapchain()
@@ -348,6 +587,11 @@ bool initVKSwapchain()
     info.imageFormat = surfaceFormats[0].format;
     info.imageColorSpace = surfaceFormats[0].colorSpace;
     info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    // the views of the multiview pass are blitted in
+    if (g_app.multiview.enabled)
+    {
+        info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    }
     info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
     info.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
     info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
@@ -361,7 +605,7 @@ bool initVKSwapchain()
     info.clipped = true;
     info.oldSwapchain = nullptr;
 
-    result = vkCreateSwapchainKHR(g_app.device, &info, nullptr, &g_app.swapchain);
+    result = vkCreateSwapchainKHR(g_app.device, &info, getHostAllocator(HOST_OBJECT_SWAPCHAIN), &g_app.swapchain);
     assert(result == VK_SUCCESS);
 
     result = vkGetSwapchainImagesKHR(g_app.device, g_app.swapchain, &g_app.swapchainImageCount, nullptr);
@@ -369,6 +613,7 @@ bool initVKSwapchain()
 
     g_app.swapBuffers.resize(g_app.swapchainImageCount);
     g_app.drawCmdBuffers.resize(g_app.swapchainImageCount);
+    g_app.imageFrames.assign(g_app.swapchainImageCount, 0);
 
     std::vector<VkImage> swapchainImages;
     swapchainImages.resize(g_app.swapchainImageCount);
@@ -398,7 +643,7 @@ bool initVKSwapchain()
 
         colorImageView.image = g_app.swapBuffers[i].image;
 
-        result = vkCreateImageView(g_app.device, &colorImageView, NULL, &g_app.swapBuffers[i].view);
+        result = vkCreateImageView(g_app.device, &colorImageView, getHostAllocator(HOST_OBJECT_IMAGE_VIEW), &g_app.swapBuffers[i].view);
         assert(result == VK_SUCCESS);
     }
 
@@ -425,6 +670,42 @@ bool memoryTypeFromProperties(uint32_t typeBits, VkFlags requirements_mask, uint
     return false;
 }
 
+VkResult allocateDeviceMemory(const VkMemoryAllocateInfo *allocateInfo, VkDeviceMemory *memory)
+{
+    VkResult result = vkAllocateMemory(g_app.device, allocateInfo, getHostAllocator(HOST_OBJECT_DEVICE_MEMORY), memory);
+
+    if (result == VK_SUCCESS)
+    {
+        uint32_t heapIndex = g_app.memoryProperties.memoryTypes[allocateInfo->memoryTypeIndex].heapIndex;
+
+        std::lock_guard<std::mutex> guard(g_app.memoryStats.lock);
+        g_app.memoryStats.allocations[*memory] = std::make_pair(allocateInfo->allocationSize, heapIndex);
+        g_app.memoryStats.heapUsage[heapIndex] += allocateInfo->allocationSize;
+    }
+
+    return result;
+}
+
+void freeDeviceMemory(VkDeviceMemory memory)
+{
+    if (memory == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(g_app.memoryStats.lock);
+
+        auto allocation = g_app.memoryStats.allocations.find(memory);
+        assert(allocation != g_app.memoryStats.allocations.end());
+
+        g_app.memoryStats.heapUsage[allocation->second.second] -= allocation->second.first;
+        g_app.memoryStats.allocations.erase(allocation);
+    }
+
+    vkFreeMemory(g_app.device, memory, getHostAllocator(HOST_OBJECT_DEVICE_MEMORY));
+}
+
 bool initVKDepthBuffer()
 {
     VkImageCreateInfo image_info = {};
@@ -457,10 +738,21 @@ bool initVKDepthBuffer()
     image_info.extent.height = SCREEN_HEIGHT;
     image_info.extent.depth = 1;
     image_info.mipLevels = 1;
-    image_info.arrayLayers = 1;
+    // a layer per view in multiview mode
+    image_info.arrayLayers = g_app.multiview.enabled ? g_app.multiview.viewCount : 1;
     image_info.samples = VK_SAMPLE_COUNT_1_BIT;
     image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
     image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    // the occlusion culler reduces it into the depth pyramid
+    if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)
+    {
+        image_info.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+    }
+    // the deferred lighting subpass reads it back as an input attachment
+    if (g_app.deferred.enabled)
+    {
+        image_info.usage |= VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+    }
     image_info.queueFamilyIndexCount = 0;
     image_info.flags = 0;
 
@@ -471,7 +763,7 @@ bool initVKDepthBuffer()
     mem_alloc.memoryTypeIndex = 0;
 
     /* Create image */
-    VkResult result = vkCreateImage(g_app.device, &image_info, NULL, &g_app.depth.image);
+    VkResult result = vkCreateImage(g_app.device, &image_info, getHostAllocator(HOST_OBJECT_IMAGE), &g_app.depth.image);
     assert(result == VK_SUCCESS);
 
     VkMemoryRequirements memReqs;
@@ -483,17 +775,19 @@ bool initVKDepthBuffer()
     assert(pass);
 
     /* Allocate memory */
-    result = vkAllocateMemory(g_app.device, &mem_alloc, NULL, &g_app.depth.memory);
+    result = allocateDeviceMemory(&mem_alloc, &g_app.depth.memory);
     assert(result == VK_SUCCESS);
 
     /* Bind memory */
     result = vkBindImageMemory(g_app.device, g_app.depth.image, g_app.depth.memory, 0);
     assert(result == VK_SUCCESS);
 
-    executeBeginCommandBuffer(0);
+    // The layout transition is batched with the other one time init work
+    // and submitted by flushSetupCommands()
+    VkCommandBuffer setupCmdBuffer = beginSetupCommands();
 
     /* Set the image layout to depth stencil optimal */
-    setImageLayout(0, g_app.depth.image, VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    setImageLayout(setupCmdBuffer, g_app.depth.image, VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 
     VkImageMemoryBarrier imageMemoryBarrier = {};
     imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -504,11 +798,11 @@ bool initVKDepthBuffer()
     imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
     imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, 0, 1, 0, 1 };
+    imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, 0, 1, 0, image_info.arrayLayers };
     imageMemoryBarrier.image = g_app.depth.image;
 
     vkCmdPipelineBarrier(
-			g_app.drawCmdBuffers[0],
+			setupCmdBuffer,
 			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
 			VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
 			0,
@@ -516,10 +810,7 @@ bool initVKDepthBuffer()
 			0, nullptr,
 			1, &imageMemoryBarrier);
 
-
-    executeEndCommandBuffer(0);
-        
-    executeQueueCommandBuffer(0);    
+    endSetupCommands();
             
     /* Create image view */
     VkImageViewCreateInfo view_info = {};
@@ -532,18 +823,48 @@ bool initVKDepthBuffer()
     view_info.subresourceRange.baseMipLevel = 0;
     view_info.subresourceRange.levelCount = 1;
     view_info.subresourceRange.baseArrayLayer = 0;
-    view_info.subresourceRange.layerCount = 1;
-    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.subresourceRange.layerCount = image_info.arrayLayers;
+    view_info.viewType = g_app.multiview.enabled ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
     view_info.flags = 0;
     view_info.image = g_app.depth.image;
-    result = vkCreateImageView(g_app.device, &view_info, NULL, &g_app.depth.view);
+    result = vkCreateImageView(g_app.device, &view_info, getHostAllocator(HOST_OBJECT_IMAGE_VIEW), &g_app.depth.view);
     assert(result == VK_SUCCESS);
 
     return true;
 }
 
+VkSubpassDependency getPreviousFrameDependency()
+{
+    // The depth buffer, the G-buffer and the multiview target are shared by
+    // the frames in flight. Reads of the frame before are the lighting
+    // subpass, the depth pyramid and the copies to the swapchain image
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+                              VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    return dependency;
+}
+
 bool initVKRenderPass()
 {
+    // a G-buffer subpass and a lighting subpass instead of the single forward one
+    if (g_app.deferred.enabled)
+    {
+        return createDeferredRenderPass(g_app.colorFormat, g_app.depth.format, &g_app.renderPass);
+    }
+
+    // every view drawn into its layer of the array target
+    if (g_app.multiview.enabled)
+    {
+        return createMultiviewRenderPass(g_app.colorFormat, g_app.depth.format, &g_app.renderPass);
+    }
+
     VkAttachmentDescription attachmentDescription[2];
     attachmentDescription[0].format = g_app.colorFormat;
     attachmentDescription[0].flags = VK_ATTACHMENT_DESCRIPTION_MAY_ALIAS_BIT;
@@ -559,7 +880,8 @@ bool initVKRenderPass()
     attachmentDescription[1].flags = VK_ATTACHMENT_DESCRIPTION_MAY_ALIAS_BIT;
     attachmentDescription[1].samples = VK_SAMPLE_COUNT_1_BIT;
     attachmentDescription[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachmentDescription[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    // kept for the depth pyramid
+    attachmentDescription[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     attachmentDescription[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     attachmentDescription[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     attachmentDescription[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
@@ -595,19 +917,23 @@ bool initVKRenderPass()
     info.pAttachments = attachmentDescription;
     info.subpassCount = 1;
     info.pSubpasses = &subpassDescription;
-    info.dependencyCount = 0;
-    info.pDependencies = nullptr;
 
-    return (vkCreateRenderPass(g_app.device, &info, nullptr, &g_app.renderPass) == VK_SUCCESS);
+    VkSubpassDependency dependency = getPreviousFrameDependency();
+    info.dependencyCount = 1;
+    info.pDependencies = &dependency;
+
+    return (vkCreateRenderPass(g_app.device, &info, getHostAllocator(HOST_OBJECT_RENDER_PASS), &g_app.renderPass) == VK_SUCCESS);
 }
 
 bool initVKFrameBuffer()
 {
     bool frameBufferCreateSuccess = true;
 
-    VkImageView attachments[BUFFER_COUNT];
+    VkImageView attachments[DEFERRED_ATTACHMENT_COUNT];
 
     attachments[1] = g_app.depth.view; 
+    attachments[2] = g_app.deferred.albedo.view;
+    attachments[3] = g_app.deferred.normal.view;
 
     g_app.framebuffers.resize(g_app.swapchainImageCount);
     assert(g_app.framebuffers.size() > 0);
@@ -616,7 +942,8 @@ bool initVKFrameBuffer()
     fb_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
     fb_info.pNext = nullptr;
     fb_info.renderPass = g_app.renderPass;
-    fb_info.attachmentCount = BUFFER_COUNT;
+    // the G-buffer is shared by all framebuffers, one pass runs at a time
+    fb_info.attachmentCount = g_app.deferred.enabled ? static_cast<uint32_t>(DEFERRED_ATTACHMENT_COUNT) : BUFFER_COUNT;
     fb_info.pAttachments = &attachments[0];
     fb_info.width = SCREEN_WIDTH;
     fb_info.height = SCREEN_HEIGHT;
@@ -624,9 +951,10 @@ bool initVKFrameBuffer()
 
     for (uint32_t i = 0; i < g_app.swapchainImageCount; i++)
     {
-        attachments[0] = g_app.swapBuffers[i].view;
+        // the views are drawn to the array target and blitted to the swapchain image afterwards
+        attachments[0] = g_app.multiview.enabled ? g_app.multiview.colorView : g_app.swapBuffers[i].view;
        
-        frameBufferCreateSuccess &= (vkCreateFramebuffer(g_app.device, &fb_info, nullptr, &g_app.framebuffers[i]) == VK_SUCCESS);
+        frameBufferCreateSuccess &= (vkCreateFramebuffer(g_app.device, &fb_info, getHostAllocator(HOST_OBJECT_FRAMEBUFFER), &g_app.framebuffers[i]) == VK_SUCCESS);
     }
 
     return frameBufferCreateSuccess;
@@ -643,7 +971,7 @@ bool initVKCommandPool()
     cmd_pool_info.queueFamilyIndex = g_app.graphicsQueueFamilyIndex;
     cmd_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
-    result = vkCreateCommandPool(g_app.device, &cmd_pool_info, NULL, &g_app.cmdPool);
+    result = vkCreateCommandPool(g_app.device, &cmd_pool_info, getHostAllocator(HOST_OBJECT_COMMAND_POOL), &g_app.cmdPool);
 
     assert(result == VK_SUCCESS);
 
@@ -662,9 +990,6 @@ bool initVKCommandBuffer()
     cmd.commandBufferCount = g_app.swapchainImageCount;
 
     result = vkAllocateCommandBuffers(g_app.device, &cmd, g_app.drawCmdBuffers.data());
-    
-    cmd.commandBufferCount = 1;
-    result = vkAllocateCommandBuffers(g_app.device, &cmd, &g_app.postPresentCmdBuffer);
 
     assert(result == VK_SUCCESS);
 
@@ -678,92 +1003,160 @@ bool initSemaphores()
     semaphore_create_info.pNext = nullptr;                                    // const void*
     semaphore_create_info.flags = 0;                                          // VkSemaphoreCreateFlags   flags
 
-    if( (vkCreateSemaphore( g_app.device, &semaphore_create_info, nullptr, &g_app.ImageAvailableSemaphore ) != VK_SUCCESS) ||
-        (vkCreateSemaphore( g_app.device, &semaphore_create_info, nullptr, &g_app.RenderingFinishedSemaphore ) != VK_SUCCESS) ) 
+    for (uint32_t slot = 0; slot < g_app.deletionQueue.fenceCount; slot++)
     {
-        return false;
+        if (vkCreateSemaphore( g_app.device, &semaphore_create_info, getHostAllocator(HOST_OBJECT_SEMAPHORE), &g_app.ImageAvailableSemaphores[slot] ) != VK_SUCCESS)
+        {
+            return false;
+        }
+    }
+
+    g_app.RenderingFinishedSemaphores.resize(g_app.swapchainImageCount);
+    for (VkSemaphore &semaphore : g_app.RenderingFinishedSemaphores)
+    {
+        if (vkCreateSemaphore( g_app.device, &semaphore_create_info, getHostAllocator(HOST_OBJECT_SEMAPHORE), &semaphore ) != VK_SUCCESS)
+        {
+            return false;
+        }
     }
 
     return true;
 }
 
-bool initVertexData()
+// Device local buffer filled through a staging buffer, the copy is part of
+// the setup commands and lands before the first frame draws
+static bool createMeshBuffer(const void* contents, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer *buffer, VkDeviceMemory *memory)
 {
-    // vertices
-    struct vertex
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VkBuffer stagingBuffer = VK_NULL_HANDLE;
+    VkResult result = vkCreateBuffer(g_app.device, &bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), &stagingBuffer);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_app.device, stagingBuffer, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+
+    VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memAllocInfo.memoryTypeIndex) ||
+        allocateDeviceMemory(&memAllocInfo, &stagingMemory) != VK_SUCCESS)
     {
-        float veritces[3];
-        float colors[3];
-    };
+        vkDestroyBuffer(g_app.device, stagingBuffer, getHostAllocator(HOST_OBJECT_BUFFER));
+        return false;
+    }
+    vkBindBufferMemory(g_app.device, stagingBuffer, stagingMemory, 0);
+
+    void *mapped;
+    result = vkMapMemory(g_app.device, stagingMemory, 0, VK_WHOLE_SIZE, 0, &mapped);
+    assert(result == VK_SUCCESS);
+    memcpy(mapped, contents, static_cast<size_t>(size));
+    vkUnmapMemory(g_app.device, stagingMemory);
+
+    bufferInfo.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    result = vkCreateBuffer(g_app.device, &bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), buffer);
+    assert(result == VK_SUCCESS);
 
-    std::vector<vertex> triangleVertices = { 
-        { {  1.0f,  1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f } },
-        { { -1.0f,  1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } },
-        { {  0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } }
-    };
+    vkGetBufferMemoryRequirements(g_app.device, *buffer, &memReqs);
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memAllocInfo.memoryTypeIndex) ||
+        allocateDeviceMemory(&memAllocInfo, memory) != VK_SUCCESS)
+    {
+        vkDestroyBuffer(g_app.device, stagingBuffer, getHostAllocator(HOST_OBJECT_BUFFER));
+        freeDeviceMemory(stagingMemory);
+        return false;
+    }
+    vkBindBufferMemory(g_app.device, *buffer, *memory, 0);
 
-    uint32_t vertexBufferSize = triangleVertices.size() * sizeof (vertex);
+    VkCommandBuffer setupCmdBuffer = beginSetupCommands();
 
-    // indices
-    std::vector<uint32_t> triangleIndices = {0, 1, 2};
+    VkBufferCopy region = { 0, 0, size };
+    vkCmdCopyBuffer(setupCmdBuffer, stagingBuffer, *buffer, 1, &region);
 
-    uint32_t indexBufferSize = triangleIndices.size() * sizeof (uint32_t);
-    g_app.indices.count = static_cast<uint32_t>(triangleIndices.size());
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = *buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(setupCmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                         0, 0, nullptr, 1, &barrier, 0, nullptr);
 
-    VkMemoryAllocateInfo mem_alloc = {};
-    mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    endSetupCommands();
 
-    VkMemoryRequirements memReqs;
+    // released once the frame the setup commands are flushed before is done
+    deferDestroyBuffer(stagingBuffer);
+    deferFreeMemory(stagingMemory);
 
-    void *data;
+    return true;
+}
 
-    // [TODO] : Later, Should add the staging path since that is the more optimal solution instead of the host visible solution below
+bool initVertexData()
+{
+    // --mesh replaces the triangle
+    MeshData mesh;
+    if (g_app.meshPath.empty() || !loadMeshFile(g_app.meshPath.c_str(), mesh))
+    {
+        mesh.vertices = {
+            { {  1.0f,  1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 1.0f, 1.0f } },
+            { { -1.0f,  1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 1.0f } },
+            { {  0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.5f, 0.0f } }
+        };
+        mesh.indices = {0, 1, 2};
+    }
 
-    // create host visible memory to put data in
-    VkBufferCreateInfo vertexBufferInfo = {};
+    uint32_t vertexBufferSize = mesh.vertices.size() * sizeof (MeshVertex);
 
-    vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    vertexBufferInfo.size = vertexBufferSize;
-    vertexBufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    g_app.vertices.boundsMin = glm::vec3(mesh.vertices[0].position[0], mesh.vertices[0].position[1], mesh.vertices[0].position[2]);
+    g_app.vertices.boundsMax = g_app.vertices.boundsMin;
+    for (const MeshVertex &v : mesh.vertices)
+    {
+        glm::vec3 pos(v.position[0], v.position[1], v.position[2]);
+        g_app.vertices.boundsMin = glm::min(g_app.vertices.boundsMin, pos);
+        g_app.vertices.boundsMax = glm::max(g_app.vertices.boundsMax, pos);
+    }
 
-    // vertex Buffer
-    // copy data to buffer visible to host
-    vkCreateBuffer(g_app.device, &vertexBufferInfo, nullptr, &g_app.vertices.buffer);
-    vkGetBufferMemoryRequirements(g_app.device, g_app.vertices.buffer, &memReqs);
-    mem_alloc.allocationSize = memReqs.size;
-    memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &mem_alloc.memoryTypeIndex);
-    vkAllocateMemory(g_app.device, &mem_alloc, nullptr, &g_app.vertices.memory);
+    // the skinning stage makes its own copies of the full level
+    if (g_app.skinning.characterCount > 0)
+    {
+        g_app.skinning.mesh = mesh;
+    }
 
-    vkMapMemory(g_app.device, g_app.vertices.memory, 0, mem_alloc.allocationSize, 0, &data);
-    memcpy(data, triangleVertices.data(), vertexBufferSize);
-    vkUnmapMemory(g_app.device, g_app.vertices.memory);
-    vkBindBufferMemory(g_app.device, g_app.vertices.buffer, g_app.vertices.memory, 0);
+    // indices, the simplified levels follow the full mesh in the same buffer
+    g_app.indices.count = static_cast<uint32_t>(mesh.indices.size());
 
-    // index Buffer 
-    VkBufferCreateInfo indexBufferInfo = {};
+    buildMeshLods(mesh.vertices[0].position, sizeof(MeshVertex), mesh.vertices.size(), mesh.indices, g_app.indices.lods);
+    printf("Mesh LODs: %u levels, coarsest %u triangles\n", (uint32_t)g_app.indices.lods.size(), g_app.indices.lods.back().indexCount / 3);
 
-    indexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    indexBufferInfo.size = indexBufferSize;
-    indexBufferInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+    uint32_t indexBufferSize = mesh.indices.size() * sizeof (uint32_t);
 
-    // copy data to buffer visible to host
-    vkCreateBuffer(g_app.device, &indexBufferInfo, nullptr, &g_app.indices.buffer);
-    vkGetBufferMemoryRequirements(g_app.device, g_app.indices.buffer, &memReqs);
-    mem_alloc.allocationSize = memReqs.size;
-    memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &mem_alloc.memoryTypeIndex);
-    vkAllocateMemory(g_app.device, &mem_alloc, nullptr, &g_app.indices.memory);
+    g_app.vertices.size = vertexBufferSize;
+    g_app.indices.size = indexBufferSize;
 
-    vkMapMemory(g_app.device, g_app.indices.memory, 0, mem_alloc.allocationSize, 0, &data);
-    memcpy(data, triangleIndices.data(), indexBufferSize);
-    vkUnmapMemory(g_app.device, g_app.indices.memory);
-    vkBindBufferMemory(g_app.device, g_app.indices.buffer, g_app.indices.memory, 0);
+    // a frame capture copies them out
+    if (!createMeshBuffer(mesh.vertices.data(), vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                          &g_app.vertices.buffer, &g_app.vertices.memory) ||
+        !createMeshBuffer(mesh.indices.data(), indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                          &g_app.indices.buffer, &g_app.indices.memory))
+    {
+        printf("Could not allocate the mesh buffers\n");
+        return false;
+    }
 
     g_app.vertices.bindingDescriptions.resize(1);
     g_app.vertices.bindingDescriptions[0].binding = VERTEX_BUFFER_BIND_ID;
-    g_app.vertices.bindingDescriptions[0].stride = sizeof(vertex);
+    g_app.vertices.bindingDescriptions[0].stride = sizeof(MeshVertex);
     g_app.vertices.bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-    g_app.vertices.attributeDescriptions.resize(2);
+    g_app.vertices.attributeDescriptions.resize(3);
     g_app.vertices.attributeDescriptions[0].binding = VERTEX_BUFFER_BIND_ID;
     g_app.vertices.attributeDescriptions[0].location = 0;
     g_app.vertices.attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
@@ -773,6 +1166,12 @@ bool initVertexData()
     g_app.vertices.attributeDescriptions[1].location = 1;
     g_app.vertices.attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
     g_app.vertices.attributeDescriptions[1].offset = sizeof(float) * 3;
+
+    // texture coordinates, only read by textured materials
+    g_app.vertices.attributeDescriptions[2].binding = VERTEX_BUFFER_BIND_ID;
+    g_app.vertices.attributeDescriptions[2].location = 2;
+    g_app.vertices.attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
+    g_app.vertices.attributeDescriptions[2].offset = sizeof(float) * 6;
     
     g_app.vertices.inputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
     g_app.vertices.inputState.pNext = nullptr;
@@ -787,21 +1186,32 @@ bool initVertexData()
 
 bool initDescriptorSetLayout()
 {
-    VkDescriptorSetLayoutBinding vtxLayoutBinding = {};
+    VkDescriptorSetLayoutBinding layoutBindings[4] = {};
 
-    vtxLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    vtxLayoutBinding.descriptorCount = 1;
-    vtxLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-    vtxLayoutBinding.pImmutableSamplers = nullptr;
+    layoutBindings[0].binding = 0;
+    layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    layoutBindings[0].descriptorCount = 1;
+    layoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    layoutBindings[0].pImmutableSamplers = nullptr;
 
-    VkDescriptorSetLayoutCreateInfo descSetCreateInfo = {};
+    // the cluster grid, the lights and the light lists of each cluster
+    for (uint32_t i = 1; i < 4; i++)
+    {
+        layoutBindings[i].binding = i;
+        layoutBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        layoutBindings[i].descriptorCount = 1;
+        layoutBindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    }
 
-    descSetCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    descSetCreateInfo.pNext = nullptr;
-    descSetCreateInfo.bindingCount = 1;
-    descSetCreateInfo.pBindings = &vtxLayoutBinding;
+    // owned by the descriptor allocator, which also builds its update template
+    g_app.descriptorSetLayout = createDescriptorSetLayout(layoutBindings, g_app.bindless.enabled ? 1 : 4);
 
-    vkCreateDescriptorSetLayout(g_app.device, &descSetCreateInfo, nullptr, &g_app.descriptorSetLayout);
+    // bindless pipelines use the layout of the global set instead
+    if (g_app.bindless.enabled)
+    {
+        g_app.pipelineLayout = g_app.bindless.pipelineLayout;
+        return true;
+    }
 
     VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
 
@@ -810,154 +1220,169 @@ bool initDescriptorSetLayout()
     pipelineLayoutCreateInfo.setLayoutCount = 1;
     pipelineLayoutCreateInfo.pSetLayouts = &g_app.descriptorSetLayout;
 
-    vkCreatePipelineLayout(g_app.device, &pipelineLayoutCreateInfo, nullptr, &g_app.pipelineLayout);
+    // material parameters that do not select a pipeline variant
+    VkPushConstantRange materialPushConstantRange = {};
+    materialPushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    materialPushConstantRange.offset = 0;
+    materialPushConstantRange.size = sizeof(MaterialPushConstants);
+
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &materialPushConstantRange;
+
+    vkCreatePipelineLayout(g_app.device, &pipelineLayoutCreateInfo, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT), &g_app.pipelineLayout);
 
     return true;
 }
 
-bool initDescriptorPool()
+bool initDescriptorSet()
 {
-    std::vector<VkDescriptorPoolSize> descriptorTypes;
+    // in bindless mode the uniforms are a slot of the global set
+    if (g_app.bindless.enabled)
+    {
+        return true;
+    }
 
-    // request one for now
-    descriptorTypes.resize(1);
+    // Sets that never change come from the descriptor set cache, binding
+    // the same buffer again anywhere else returns this same set
+    DescriptorResource resources[4];
+    memset(resources, 0, sizeof(resources));
 
-    descriptorTypes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorTypes[0].descriptorCount = 1;
+    VkDescriptorBufferInfo lightingResources[3];
+    getLightingResources(lightingResources);
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        resources[i + 1].buffer = lightingResources[i];
+    }
 
-    VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
-    descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    descriptorPoolInfo.pNext = nullptr;
-    descriptorPoolInfo.poolSizeCount = 1;
-    descriptorPoolInfo.pPoolSizes = descriptorTypes.data();
-    descriptorPoolInfo.maxSets = 1;
+    // one set per image, only the uniform region differs
+    g_app.descriptorSets.resize(g_app.swapchainImageCount);
+    for (uint32_t i = 0; i < g_app.swapchainImageCount; i++)
+    {
+        resources[0].buffer = g_app.uniformDataVS.descriptors[i];
 
-    vkCreateDescriptorPool(g_app.device, &descriptorPoolInfo, nullptr, &g_app.descriptorPool);
+        g_app.descriptorSets[i] = getCachedDescriptorSet(g_app.descriptorSetLayout, resources);
+        if (g_app.descriptorSets[i] == VK_NULL_HANDLE)
+        {
+            return false;
+        }
+    }
 
     return true;
 }
 
-bool initDescriptorSet()
+bool initPipelines()
 {
-    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
+    // The fixed function state and shader variants live in the material
+    // pipeline cache, the default material keeps the per vertex colors.
+    // --instances and --alpha-test add their features on the command line
+    MaterialFeatureFlags features = MATERIAL_FEATURE_VERTEX_COLOR;
+    features |= g_app.material.features & (MATERIAL_FEATURE_INSTANCED | MATERIAL_FEATURE_ALPHA_TEST);
+
+    // bindless mode can sample textures, the triangle gets a streamed checker
+    // board unless a texture file was given and could be loaded
+    if (g_app.bindless.enabled)
+    {
+        TextureSource source;
+        if (g_app.texturePath.empty() || !loadTextureFile(g_app.texturePath.c_str(), source))
+        {
+            source = createCheckerTextureSource(2048, 0xffffffff, 0xff404040);
+        }
 
-    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    descriptorSetAllocateInfo.descriptorPool = g_app.descriptorPool;
-    descriptorSetAllocateInfo.descriptorSetCount = 1;
-    descriptorSetAllocateInfo.pSetLayouts = &g_app.descriptorSetLayout;
-    
-    vkAllocateDescriptorSets(g_app.device, &descriptorSetAllocateInfo, &g_app.descriptorSet);
+        SamplerDesc samplerDesc = { VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT };
+        g_app.material.texture = createStreamedTexture(source, samplerDesc);
+        features |= MATERIAL_FEATURE_TEXTURED;
+    }
+
+    // --lights shades the default material with the clustered lights, in
+    // deferred mode the lighting subpass does instead. The lights are
+    // binned for the camera alone, so the views of multiview mode are unlit
+    if (g_app.deferred.enabled)
+    {
+        features |= MATERIAL_FEATURE_GBUFFER;
+    }
+    else if (g_app.lighting.lightCount > 0 && !g_app.multiview.enabled)
+    {
+        features |= MATERIAL_FEATURE_LIT;
+    }
 
-    VkWriteDescriptorSet writeDescriptorSet = {};
+    return initMaterial(g_app.material, features);
+} 
 
-    writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writeDescriptorSet.dstSet = g_app.descriptorSet;
-    writeDescriptorSet.descriptorCount = 1;
-    writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    writeDescriptorSet.pBufferInfo = &g_app.uniformDataVS.descriptor;
-    writeDescriptorSet.dstBinding = 0;
+bool initSceneModel()
+{
+    g_app.modelEntity = createEntity(INVALID_ENTITY, glm::mat4());
 
-    vkUpdateDescriptorSets(g_app.device, 1, &writeDescriptorSet, 0, nullptr);
-    
-    return true;
+    return isEntityAlive(g_app.modelEntity);
 }
 
-bool initPipelines()
+// The instance offsets depend on the material features, known once the pipelines are
+bool initSceneInstances()
 {
-    VkGraphicsPipelineCreateInfo gfxPipelineCreateInfo = {};
-    gfxPipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    gfxPipelineCreateInfo.layout = g_app.pipelineLayout;
-    gfxPipelineCreateInfo.renderPass = g_app.renderPass;
-
-    // primitive topology for the pipeline
-    VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
-    inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-
-    // rasterization state
-    VkPipelineRasterizationStateCreateInfo rasterizationState = {};
-    rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
-    rasterizationState.cullMode = VK_CULL_MODE_NONE;
-    rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-    rasterizationState.depthClampEnable = VK_FALSE;
-    rasterizationState.rasterizerDiscardEnable = VK_FALSE;
-    rasterizationState.depthBiasEnable = VK_FALSE;
-    rasterizationState.lineWidth = 1.0f;
-    
-    std::vector<VkPipelineColorBlendAttachmentState> blendAttachmentState;
-    blendAttachmentState.resize(1);
-    blendAttachmentState[0].colorWriteMask = 0xf;
-    blendAttachmentState[0].blendEnable = VK_FALSE;
-    
-    VkPipelineColorBlendStateCreateInfo colorBlendState = {};
-    colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlendState.attachmentCount = 1;
-    colorBlendState.pAttachments = blendAttachmentState.data();
-
-    VkPipelineViewportStateCreateInfo viewportState = {};
-    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewportState.viewportCount = 1;
-    viewportState.scissorCount = 1;
-
-    // enable dynamic states
-    std::vector<VkDynamicState> dynamicStateEnables;
-    dynamicStateEnables.push_back(VK_DYNAMIC_STATE_VIEWPORT);
-    dynamicStateEnables.push_back(VK_DYNAMIC_STATE_SCISSOR);
-    
-    VkPipelineDynamicStateCreateInfo dynamicState = {};
-    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamicState.pDynamicStates = dynamicStateEnables.data();
-    dynamicState.dynamicStateCount = dynamicStateEnables.size();
-
-    VkPipelineDepthStencilStateCreateInfo depthStencilState = {};
-
-    depthStencilState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depthStencilState.depthTestEnable = VK_TRUE;
-    depthStencilState.depthWriteEnable = VK_TRUE;
-    depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
-    depthStencilState.depthBoundsTestEnable = VK_FALSE;
-    depthStencilState.back.failOp = VK_STENCIL_OP_KEEP;
-    depthStencilState.back.passOp = VK_STENCIL_OP_KEEP;
-    depthStencilState.stencilTestEnable = VK_FALSE;
-    depthStencilState.front = depthStencilState.back;
-
-    VkPipelineMultisampleStateCreateInfo multisampleState = {};
-    multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampleState.pSampleMask =  nullptr;
-    multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-
-    std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
-    shaderStages.resize(2);
-    shaderStages[0] = loadShader("data/triangle.vert", VK_SHADER_STAGE_VERTEX_BIT); 
-    shaderStages[1] = loadShader("data/triangle.frag", VK_SHADER_STAGE_FRAGMENT_BIT);
-
-    // assign states to pipeline
-    gfxPipelineCreateInfo.stageCount = shaderStages.size();
-    gfxPipelineCreateInfo.pStages = shaderStages.data();
-    gfxPipelineCreateInfo.pVertexInputState = &g_app.vertices.inputState;
-    gfxPipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
-    gfxPipelineCreateInfo.pRasterizationState = &rasterizationState;
-    gfxPipelineCreateInfo.pColorBlendState = &colorBlendState;
-    gfxPipelineCreateInfo.pMultisampleState = &multisampleState;
-    gfxPipelineCreateInfo.pViewportState = &viewportState;
-    gfxPipelineCreateInfo.pDepthStencilState = &depthStencilState;
-    gfxPipelineCreateInfo.renderPass = g_app.renderPass;
-    gfxPipelineCreateInfo.pDynamicState = &dynamicState;
-
-    vkCreateGraphicsPipelines(g_app.device, g_app.pipelineCache, 1, &gfxPipelineCreateInfo, nullptr, &g_app.pipeline);
+    g_app.instanceEntities.clear();
+    for (uint32_t instance = 0; instance < g_app.material.instanceCount; instance++)
+    {
+        glm::vec3 offset = getMaterialInstanceOffset(g_app.material, instance);
+        g_app.instanceEntities.push_back(createEntity(g_app.modelEntity, glm::translate(glm::mat4(), offset)));
+    }
 
-    return true;
-} 
+    updateScene();
+
+    uint32_t instanceCount = g_app.material.instanceCount;
+
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = sizeof(glm::mat4) * instanceCount * g_app.swapchainImageCount;
+    // a frame capture copies it out
+    bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    vkCreateBuffer(g_app.device, &bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), &g_app.instanceTransforms.buffer);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_app.device, g_app.instanceTransforms.buffer, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memAllocInfo.memoryTypeIndex))
+    {
+        return false;
+    }
+    allocateDeviceMemory(&memAllocInfo, &g_app.instanceTransforms.memory);
+
+    vkBindBufferMemory(g_app.device, g_app.instanceTransforms.buffer, g_app.instanceTransforms.memory, 0);
+
+    // stays mapped, every region starts out with the first transforms
+    VkResult result = vkMapMemory(g_app.device, g_app.instanceTransforms.memory, 0, bufferInfo.size, 0, (void **)&g_app.instanceTransforms.mapped);
+    assert(result == VK_SUCCESS);
+
+    for (uint32_t i = 0; i < g_app.swapchainImageCount; i++)
+    {
+        for (uint32_t instance = 0; instance < instanceCount; instance++)
+        {
+            g_app.instanceTransforms.mapped[i * instanceCount + instance] = getWorldTransform(g_app.instanceEntities[instance]);
+        }
+    }
+
+    return true;
+}
+
+bool initUniformBuffers()
+{
+    // the regions are bound as uniform buffers, or as storage buffers in bindless mode
+    VkDeviceSize alignment = std::max(g_app.gpuProps.limits.minUniformBufferOffsetAlignment, g_app.gpuProps.limits.minStorageBufferOffsetAlignment);
+    g_app.uniformDataVS.regionSize = (sizeof(g_app.uboVS) + alignment - 1) / alignment * alignment;
 
-bool initUniformBuffers()
-{
     VkBufferCreateInfo buffCreateInfo = {};
     buffCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     buffCreateInfo.pNext = nullptr;
-    buffCreateInfo.size = sizeof(g_app.uboVS);
-    buffCreateInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-    vkCreateBuffer(g_app.device, &buffCreateInfo, nullptr, &g_app.uniformDataVS.buffer);
+    buffCreateInfo.size = g_app.uniformDataVS.regionSize * g_app.swapchainImageCount;
+    // a frame capture copies it out
+    buffCreateInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    if (g_app.bindless.enabled)
+    {
+        // the bindless shaders read it from the storage buffer array
+        buffCreateInfo.usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    }
+    vkCreateBuffer(g_app.device, &buffCreateInfo, getHostAllocator(HOST_OBJECT_BUFFER), &g_app.uniformDataVS.buffer);
 
     VkMemoryRequirements memReqs;
     vkGetBufferMemoryRequirements(g_app.device, g_app.uniformDataVS.buffer, &memReqs);
@@ -972,73 +1397,122 @@ bool initUniformBuffers()
     {
         assert(0);
     } 
-    vkAllocateMemory(g_app.device, &memAllocInfo, nullptr, &g_app.uniformDataVS.memory);
+    allocateDeviceMemory(&memAllocInfo, &g_app.uniformDataVS.memory);
 
     vkBindBufferMemory(g_app.device, g_app.uniformDataVS.buffer, g_app.uniformDataVS.memory, 0);
 
-    g_app.uniformDataVS.descriptor.buffer = g_app.uniformDataVS.buffer;
-    g_app.uniformDataVS.descriptor.offset = 0;
-    g_app.uniformDataVS.descriptor.range = sizeof(g_app.uboVS);
+    g_app.uniformDataVS.descriptors.resize(g_app.swapchainImageCount);
+    for (uint32_t i = 0; i < g_app.swapchainImageCount; i++)
+    {
+        g_app.uniformDataVS.descriptors[i].buffer = g_app.uniformDataVS.buffer;
+        g_app.uniformDataVS.descriptors[i].offset = i * g_app.uniformDataVS.regionSize;
+        g_app.uniformDataVS.descriptors[i].range = sizeof(g_app.uboVS);
 
-    // update Unifrom Buffers
-    updateUniformBuffers();    
+        // update Unifrom Buffers
+        updateUniformBuffers(i);
+    }
 
     return true;
 }
 
-void updateUniformBuffers()
+// Writes the uniform region of the image, which the frame that last drew
+// it has finished with
+void updateUniformBuffers(uint32_t imageIndex)
 {
     g_app.uboVS.projectionMatrix = glm::perspective(glm::radians(60.0f), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.1f, 256.0f);
 
-    g_app.uboVS.viewMatrix = glm::translate(glm::mat4(), glm::vec3(0.0f, 0.0f, -3.5f));
+    // the simulation thread advances the rotation and the camera, this only reads its latest state
+    SimulationState simulationState = sampleSimulation();
+    g_app.uboVS.viewMatrix = glm::translate(glm::mat4(), glm::vec3(-simulationState.cameraTravel, 0.0f, -3.5f));
 
-    g_app.uboVS.modelMatrix = glm::mat4();
+    // the multiview shader takes the matrices of each view from these
+    for (uint32_t view = 0; view < MULTIVIEW_MAX_VIEWS; view++)
+    {
+        g_app.uboVS.viewMatrices[view] = getViewOffset(view) * g_app.uboVS.viewMatrix;
+        g_app.uboVS.projectionMatrices[view] = g_app.uboVS.projectionMatrix;
+    }
 
-    static float rotAngle = 0.0f;
-    g_app.uboVS.modelMatrix = glm::rotate(g_app.uboVS.modelMatrix, rotAngle, glm::vec3(0.f, 1.f, 0.f));
+    setLocalTransform(g_app.modelEntity, glm::rotate(glm::mat4(), simulationState.rotAngle, glm::vec3(0.f, 1.f, 0.f)));
 
-    rotAngle += 0.0001f;
+    updateScene();
+    g_app.uboVS.modelMatrix = getWorldTransform(g_app.modelEntity);
 
     uint8_t *pData;
 
-    vkMapMemory(g_app.device, g_app.uniformDataVS.memory, 0, sizeof(g_app.uboVS), 0, (void **)&pData);
+    vkMapMemory(g_app.device, g_app.uniformDataVS.memory, g_app.uniformDataVS.descriptors[imageIndex].offset, sizeof(g_app.uboVS), 0, (void **)&pData);
     memcpy(pData, &g_app.uboVS, sizeof(g_app.uboVS));
     vkUnmapMemory(g_app.device, g_app.uniformDataVS.memory);
 }
 
-VkPipelineShaderStageCreateInfo loadShader(std::string filename, VkShaderStageFlagBits shaderStage)
+std::string readTextFile(const char *fileName)
 {
-    VkPipelineShaderStageCreateInfo shaderStageInfo = {};
-    shaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    shaderStageInfo.stage = shaderStage;
-    shaderStageInfo.pName = "main";
-    shaderStageInfo.module = loadShaderGLSL(filename.c_str(), shaderStage);
-    assert(shaderStageInfo.module != nullptr); 
-    g_app.shaderModules.push_back(shaderStageInfo.module);
-
-    return shaderStageInfo;
+    // a file prefetched by init() is taken over here
+    FileDataPtr file = readFileAsync(fileName).get();
+    if (file->missing)
+    {
+        printf("Could not find %s\n", fileName);
+    }
+    if (!file->ok)
+    {
+        return "";
+    }
+
+    return std::string(reinterpret_cast<const char*>(file->data), file->size);
 }
 
-std::string readTextFile(const char *fileName)
+// Runs on an I/O thread
+static void storeShaderSource(const char* path, const FileDataPtr &file, void* userData)
 {
-    std::string fileContent;
-    std::ifstream fileStream(fileName, std::ios::in);
-    if (!fileStream.is_open()) {
-        printf("File %s not found\n", fileName);
-        return "";
+    if (file->missing)
+    {
+        printf("Could not find %s\n", path);
     }
-    std::string line = "";
-    while (!fileStream.eof()) {
-        getline(fileStream, line);
-        fileContent.append(line + "\n");
+    if (!file->ok)
+    {
+        return;
     }
-    fileStream.close();
-    return fileContent;
+
+    std::lock_guard<std::mutex> guard(g_app.shaderSourceLock);
+    g_app.shaderSources[path] = std::string(reinterpret_cast<const char*>(file->data), file->size);
+}
+
+bool initShaderSources()
+{
+    // Read the shader files up front so pipeline creation does not wait on disk
+    const char* shaderFiles[] = { "data/triangle.vert", "data/triangle.frag", "data/bindless.vert", "data/bindless.frag", "data/hud.vert", "data/hud.frag", "data/depthpyramid.comp", "data/skinning.comp", "data/lightbin.comp", "data/deferred.vert", "data/deferred.frag", "data/multiview.vert", "data/world.vert" };
+
+    // All reads go out together, each source is stored as its read completes
+    std::vector<std::shared_future<FileDataPtr>> reads;
+    for (const char* fileName : shaderFiles)
+    {
+        reads.push_back(readFileAsync(fileName, storeShaderSource, nullptr));
+    }
+
+    bool success = true;
+    for (const std::shared_future<FileDataPtr> &read : reads)
+    {
+        success &= (read.get()->ok && read.get()->size > 0);
+    }
+
+    return success;
 }
 
 VkShaderModule loadShaderGLSL(const char *filename, VkShaderStageFlagBits shaderStage)
 {
-    std::string shaderSrc = readTextFile(filename);
+    std::string shaderSrc;
+    {
+        std::lock_guard<std::mutex> guard(g_app.shaderSourceLock);
+        auto preloaded = g_app.shaderSources.find(filename);
+        if (preloaded != g_app.shaderSources.end())
+        {
+            shaderSrc = preloaded->second;
+        }
+    }
+
+    if (shaderSrc.empty())
+    {
+        shaderSrc = readTextFile(filename);
+    }
 
     const char* shaderCode = shaderSrc.c_str();
     size_t codeSize = strlen(shaderCode);
@@ -1059,40 +1533,188 @@ VkShaderModule loadShaderGLSL(const char *filename, VkShaderStageFlagBits shader
     memcpy((uint32_t*)shaderCreateInfo.pCode+3, shaderCode, codeSize + 1);
 
     VkShaderModule shaderModule;
-    vkCreateShaderModule(g_app.device, &shaderCreateInfo, nullptr, &shaderModule);    
+    vkCreateShaderModule(g_app.device, &shaderCreateInfo, getHostAllocator(HOST_OBJECT_SHADER_MODULE), &shaderModule);    
 
     return shaderModule;
 }
 
+bool initTimestampQueries()
+{
+    // timestampValidBits is 0 when the queue can't write timestamps
+    g_app.frameStats.timestampsSupported = g_app.queueProperties[g_app.graphicsQueueFamilyIndex].timestampValidBits > 0;
+    if (!g_app.frameStats.timestampsSupported)
+    {
+        printf("Graphics queue does not support timestamps, GPU time will not be shown\n");
+        return true;
+    }
+
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = 2 * g_app.swapchainImageCount;
+
+    VkResult result = vkCreateQueryPool(g_app.device, &queryPoolInfo, getHostAllocator(HOST_OBJECT_QUERY_POOL), &g_app.frameStats.timestampPool);
+    assert(result == VK_SUCCESS);
+
+    // Queries must be reset before their results can be read, this way
+    // images that were never rendered report VK_NOT_READY
+    VkCommandBuffer setupCmdBuffer = beginSetupCommands();
+    vkCmdResetQueryPool(setupCmdBuffer, g_app.frameStats.timestampPool, 0, queryPoolInfo.queryCount);
+    endSetupCommands();
+
+    return (result == VK_SUCCESS);
+}
+
 bool initVulkan()
 {
-    return  initVKInstance()        &&
-            initVKSurface()         &&
-            initVKDevice()          &&
-            initVKCommandPool()     &&
-            initVKSwapchain()       &&
-            initVKCommandBuffer()   &&            
-            initVKDepthBuffer()     &&
-            initVKRenderPass()      &&
-            initVKFrameBuffer()     &&
-            initSemaphores()        &&
-            initVertexData()        &&
-            initUniformBuffers ()   &&
-            initDescriptorSetLayout() &&
-            initPipelines()         &&
-            initDescriptorPool()    &&
-            initDescriptorSet();     
+    // Steps only wait for the steps whose results they use, independent
+    // steps run at the same time on the init worker threads
+    InitGraph graph;
+
+    int shaderSources   = addInitStep(graph, "shader sources",      initShaderSources);
+    int instance        = addInitStep(graph, "instance",            initVKInstance);
+    int surface         = addInitStep(graph, "surface",             initVKSurface,          { instance });
+    int device          = addInitStep(graph, "device",              initVKDevice,           { surface });
+    int setupCommands   = addInitStep(graph, "setup commands",      initSetupCommands,      { device });
+    int commandPool     = addInitStep(graph, "command pool",        initVKCommandPool,      { device });
+    int swapchain       = addInitStep(graph, "swapchain",           initVKSwapchain,        { device });
+    int commandBuffer   = addInitStep(graph, "command buffers",     initVKCommandBuffer,    { commandPool, swapchain });
+    int depthBuffer     = addInitStep(graph, "depth buffer",        initVKDepthBuffer,      { setupCommands });
+    int renderPass      = addInitStep(graph, "render pass",         initVKRenderPass,       { swapchain, depthBuffer });
+    int gBuffer         = addInitStep(graph, "g-buffer",            initGBuffer,            { depthBuffer });
+    int multiviewTarget = addInitStep(graph, "multiview target",    initMultiviewTarget,    { swapchain });
+    int frameBuffer     = addInitStep(graph, "framebuffers",        initVKFrameBuffer,      { renderPass, gBuffer, multiviewTarget });
+    int frameFences     = addInitStep(graph, "frame fences",        initDeletionQueue,      { swapchain });
+    int semaphores      = addInitStep(graph, "semaphores",          initSemaphores,         { frameFences });
+    int frameCommands   = addInitStep(graph, "frame commands",      initFrameCommands,      { frameFences });
+    int vertexData      = addInitStep(graph, "vertex data",         initVertexData,         { setupCommands, frameFences });
+    int scene           = addInitStep(graph, "scene",               initScene);
+    int sceneModel      = addInitStep(graph, "scene model",         initSceneModel,         { scene });
+    int uniformBuffers  = addInitStep(graph, "uniform buffers",     initUniformBuffers,     { swapchain, sceneModel });
+    int descriptors     = addInitStep(graph, "descriptor allocators", initDescriptorAllocators, { device });
+    int bindless        = addInitStep(graph, "bindless resources",  initBindless,           { device, uniformBuffers });
+    int setLayout       = addInitStep(graph, "descriptor layout",   initDescriptorSetLayout, { descriptors, bindless });
+    int deviceMemory    = addInitStep(graph, "device memory",       initDeviceMemory,       { device });
+    int textures        = addInitStep(graph, "texture streaming",   initTextureStreaming,   { setupCommands, bindless, deviceMemory });
+    int lighting        = addInitStep(graph, "lighting",            initLighting,           { shaderSources, bindless, descriptors, frameFences });
+    int pipelines       = addInitStep(graph, "pipelines",           initPipelines,          { shaderSources, renderPass, setLayout, vertexData, textures, lighting });
+    int descriptorSet   = addInitStep(graph, "descriptor set",      initDescriptorSet,      { setLayout, uniformBuffers, lighting });
+    int timestamps      = addInitStep(graph, "timestamp queries",   initTimestampQueries,   { setupCommands, swapchain });
+    int hud             = addInitStep(graph, "hud",                 initHud,                { shaderSources, setupCommands, renderPass, descriptors, frameFences });
+    int sceneInstances  = addInitStep(graph, "scene instances",     initSceneInstances,     { sceneModel, uniformBuffers, pipelines });
+    int occlusion       = addInitStep(graph, "occlusion culling",   initOcclusionCulling,   { shaderSources, setupCommands, depthBuffer, descriptors, frameFences });
+    int world           = addInitStep(graph, "world streaming",     initWorldStreaming,     { setupCommands, deviceMemory, frameCommands, scene, pipelines });
+    int skinning        = addInitStep(graph, "skinning",            initSkinning,           { shaderSources, vertexData, descriptors, frameFences });
+    int deferred        = addInitStep(graph, "deferred lighting",   initDeferredLighting,   { shaderSources, renderPass, gBuffer, descriptors, lighting });
+    addInitStep(graph, "flush setup commands", flushSetupCommands, { depthBuffer, commandBuffer, frameBuffer, semaphores, frameCommands, pipelines, descriptorSet, timestamps, hud, occlusion, sceneInstances, world, skinning, deferred });
+
+    uint32_t workerCount = std::max(std::min(std::thread::hardware_concurrency(), 8u), 1u);
+
+    bool vulkanInitSuccess = runInitGraph(graph, workerCount);
+
+    printInitReport(graph);
+
+    return vulkanInitSuccess;
 }
 
 bool init()
 {
+    // Files named on the command line start loading now, alongside
+    // window and device setup, and are waited for by their loaders
+    initAsyncIo();
+    if (!g_app.meshPath.empty())
+    {
+        prefetchFile(g_app.meshPath.c_str());
+    }
+    if (!g_app.texturePath.empty())
+    {
+        prefetchFile(g_app.texturePath.c_str());
+    }
+
     return initWindow() && initVulkan();
 }
 
+// Releases what the init steps in this file created, in the reverse order
+// of creation. Everything the deletion queue knows goes through it, the
+// rest is destroyed once the flush has waited for the last frame
+void destroyVulkan()
+{
+    if (g_app.frameStats.timestampsSupported)
+    {
+        vkDestroyQueryPool(g_app.device, g_app.frameStats.timestampPool, getHostAllocator(HOST_OBJECT_QUERY_POOL));
+    }
+
+    // the bindless pipeline layout belongs to the bindless resources
+    if (!g_app.bindless.enabled)
+    {
+        deferDestroyPipelineLayout(g_app.pipelineLayout);
+    }
+
+    for (VkShaderModule module : g_app.shaderModules)
+    {
+        deferDestroyShaderModule(module);
+    }
+    g_app.shaderModules.clear();
+
+    deferDestroyBuffer(g_app.uniformDataVS.buffer);
+    deferFreeMemory(g_app.uniformDataVS.memory);
+    if (g_app.instanceTransforms.buffer != VK_NULL_HANDLE)
+    {
+        vkUnmapMemory(g_app.device, g_app.instanceTransforms.memory);
+        deferDestroyBuffer(g_app.instanceTransforms.buffer);
+        deferFreeMemory(g_app.instanceTransforms.memory);
+    }
+    deferDestroyBuffer(g_app.indices.buffer);
+    deferFreeMemory(g_app.indices.memory);
+    deferDestroyBuffer(g_app.vertices.buffer);
+    deferFreeMemory(g_app.vertices.memory);
+
+    for (VkFramebuffer framebuffer : g_app.framebuffers)
+    {
+        deferDestroyFramebuffer(framebuffer);
+    }
+    g_app.framebuffers.clear();
+
+    deferDestroyImageView(g_app.depth.view);
+    deferDestroyImage(g_app.depth.image);
+    deferFreeMemory(g_app.depth.memory);
+
+    for (const auto &swapBuffer : g_app.swapBuffers)
+    {
+        deferDestroyImageView(swapBuffer.view);
+    }
+
+    // command buffers go with their pools
+    destroyFrameCommands();
+    deferDestroyCommandPool(g_app.cmdPool);
+    deferDestroyCommandPool(g_app.setup.cmdPool);
+
+    flushDeletions();
+    destroyDeletionQueue();
+
+    vkDestroyRenderPass(g_app.device, g_app.renderPass, getHostAllocator(HOST_OBJECT_RENDER_PASS));
+    // the fences are gone already, the slots that were never used are null
+    for (uint32_t slot = 0; slot < MAX_FRAME_FENCES; slot++)
+    {
+        vkDestroySemaphore(g_app.device, g_app.ImageAvailableSemaphores[slot], getHostAllocator(HOST_OBJECT_SEMAPHORE));
+    }
+    for (VkSemaphore semaphore : g_app.RenderingFinishedSemaphores)
+    {
+        vkDestroySemaphore(g_app.device, semaphore, getHostAllocator(HOST_OBJECT_SEMAPHORE));
+    }
+    vkDestroyFence(g_app.device, g_app.setup.fence, getHostAllocator(HOST_OBJECT_FENCE));
+    vkDestroyPipelineCache(g_app.device, g_app.pipelineCache, getHostAllocator(HOST_OBJECT_PIPELINE_CACHE));
+
+    vkDestroySwapchainKHR(g_app.device, g_app.swapchain, getHostAllocator(HOST_OBJECT_SWAPCHAIN));
+    vkDestroyDevice(g_app.device, getHostAllocator(HOST_OBJECT_DEVICE));
+    vkDestroySurfaceKHR(g_app.instance, g_app.renderSurface, getHostAllocator(HOST_OBJECT_SURFACE));
+    vkDestroyInstance(g_app.instance, getHostAllocator(HOST_OBJECT_INSTANCE));
+}
+
 void destroyWindow()
 {
-    vkDestroySurfaceKHR(g_app.instance, g_app.renderSurface, nullptr);
-    vkDestroySwapchainKHR(g_app.device, g_app.swapchain, nullptr);
+    glfwDestroyWindow(g_app.window);
+    glfwTerminate();
 }
 
 void buildCommandBuffers()
@@ -1101,9 +1723,12 @@ void buildCommandBuffers()
     cmdBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     cmdBufferInfo.pNext = nullptr;
 
-    VkClearValue clearValues[2];
+    // the G-buffer albedo is cleared to the background the lighting subpass passes through
+    VkClearValue clearValues[DEFERRED_ATTACHMENT_COUNT];
     clearValues[0].color = clear_color; 
     clearValues[1].depthStencil = {1.0f, 0};
+    clearValues[2].color = clear_color;
+    clearValues[3].color = {{ 0.5f, 0.5f, 1.0f, 0.0f }};
 
     VkRenderPassBeginInfo renderPassBeginInfo = {};
     renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -1113,7 +1738,7 @@ void buildCommandBuffers()
     renderPassBeginInfo.renderArea.offset.y = 0;
     renderPassBeginInfo.renderArea.extent.width = SCREEN_WIDTH;
     renderPassBeginInfo.renderArea.extent.height = SCREEN_HEIGHT;
-    renderPassBeginInfo.clearValueCount = 2;
+    renderPassBeginInfo.clearValueCount = g_app.deferred.enabled ? DEFERRED_ATTACHMENT_COUNT : 2;
     renderPassBeginInfo.pClearValues = clearValues;
 
     for (uint32_t i = 0; i < g_app.drawCmdBuffers.size(); ++i)
@@ -1121,6 +1746,14 @@ void buildCommandBuffers()
         renderPassBeginInfo.framebuffer = g_app.framebuffers[i];
 
         vkBeginCommandBuffer(g_app.drawCmdBuffers[i], &cmdBufferInfo);
+
+        // GPU time of this command buffer, read back by render() before the image is drawn again
+        if (g_app.frameStats.timestampsSupported)
+        {
+            vkCmdResetQueryPool(g_app.drawCmdBuffers[i], g_app.frameStats.timestampPool, i * 2, 2);
+            vkCmdWriteTimestamp(g_app.drawCmdBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, g_app.frameStats.timestampPool, i * 2);
+        }
+
         vkCmdBeginRenderPass(g_app.drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
         VkViewport viewport = {};
@@ -1137,17 +1770,43 @@ void buildCommandBuffers()
         scissor.offset.y = 0;
         vkCmdSetScissor(g_app.drawCmdBuffers[i], 0, 1, &scissor);
 
-        vkCmdBindDescriptorSets(g_app.drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, g_app.pipelineLayout, 0, 1, &g_app.descriptorSet, 0 , nullptr);
-        vkCmdBindPipeline(g_app.drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, g_app.pipeline);
+        // in bindless mode the global set is all a command buffer binds
+        if (g_app.bindless.enabled)
+        {
+            bindBindlessSet(g_app.drawCmdBuffers[i]);
+        }
+        else
+        {
+            vkCmdBindDescriptorSets(g_app.drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, g_app.pipelineLayout, 0, 1, &g_app.descriptorSets[i], 0 , nullptr);
+        }
+        bindMaterial(g_app.drawCmdBuffers[i], g_app.material, i);
 
-        VkDeviceSize offsets[1] = {0};
-        vkCmdBindVertexBuffers(g_app.drawCmdBuffers[i], 0, 1, &g_app.vertices.buffer, offsets);
+        // the instance transforms of the image, cullScene() writes them every frame
+        VkBuffer vertexBuffers[2] = { g_app.vertices.buffer, g_app.instanceTransforms.buffer };
+        VkDeviceSize offsets[2] = { 0, sizeof(glm::mat4) * g_app.material.instanceCount * i };
+        vkCmdBindVertexBuffers(g_app.drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 2, vertexBuffers, offsets);
         vkCmdBindIndexBuffer(g_app.drawCmdBuffers[i], g_app.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 
-        vkCmdDrawIndexed(g_app.drawCmdBuffers[i], g_app.indices.count, 1, 0, 0, 1);
+        // only the instances that survived culling, written every frame
+        recordSceneDraws(g_app.drawCmdBuffers[i], i, SCENE_DRAWS_INSTANCES);
+
+        // every skinned character in one draw, with the same material
+        recordSkinnedDraws(g_app.drawCmdBuffers[i]);
+
+        // the objects of the resident world cells that survived culling
+        recordWorldDraws(g_app.drawCmdBuffers[i], i);
+
+        // in deferred mode every pixel is lit once from the G-buffer
+        recordDeferredLighting(g_app.drawCmdBuffers[i]);
+
+        // the overlay goes last so it is drawn on top of the scene
+        recordHudCommands(g_app.drawCmdBuffers[i], i);
 
         vkCmdEndRenderPass(g_app.drawCmdBuffers[i]);
 
+        // the views are copied to the swapchain image outside of the pass
+        recordMultiviewPresent(g_app.drawCmdBuffers[i], g_app.swapBuffers[i].image);
+
         VkImageMemoryBarrier prePresentBarrier = {};
         prePresentBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
         prePresentBarrier.pNext = nullptr;
@@ -1169,24 +1828,288 @@ void buildCommandBuffers()
             0, nullptr,
             1, &prePresentBarrier);
 
+        if (g_app.frameStats.timestampsSupported)
+        {
+            vkCmdWriteTimestamp(g_app.drawCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, g_app.frameStats.timestampPool, i * 2 + 1);
+        }
+
         vkEndCommandBuffer(g_app.drawCmdBuffers[i]);
     }
+
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Reads the GPU time of the last submission of this image. Only valid
+// once that submission has completed, results that aren't available are skipped
+static void readGpuTimestamps(uint32_t imageIndex)
+{
+    if (!g_app.frameStats.timestampsSupported)
+    {
+        return;
+    }
+
+    uint64_t timestamps[2];
+    VkResult result = vkGetQueryPoolResults(g_app.device, g_app.frameStats.timestampPool, imageIndex * 2, 2,
+                                            sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS)
+    {
+        return;
+    }
+
+    uint32_t validBits = g_app.queueProperties[g_app.graphicsQueueFamilyIndex].timestampValidBits;
+    uint64_t mask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+    uint64_t ticks = (timestamps[1] - timestamps[0]) & mask;
+
+    // timestampPeriod is the number of nanoseconds per tick
+    g_app.frameStats.gpuMs = ticks * g_app.gpuProps.limits.timestampPeriod / 1000000.0;
+}
+
+// The triangle is two units across, its texture wants the level that
+// matches the size it is projected to
+static void updateTexturePriorities()
+{
+    if (g_app.material.texture == INVALID_TEXTURE)
+    {
+        return;
+    }
+
+    float distance = -g_app.uboVS.viewMatrix[3][2];
+    float screenSize = SCREEN_HEIGHT * 2.0f / (2.0f * distance * tanf(glm::radians(30.0f)));
+
+    setTexturePriority(g_app.material.texture, screenSize, distance);
+}
+
+// Bounds of every instance and world object in world space, culled into
+// the indirect draws of the image
+static void cullScene(uint32_t imageIndex, const glm::mat4 &viewProj)
+{
+    // kept between frames so culling doesn't allocate
+    static std::vector<CullBounds> bounds;
+    static std::vector<uint32_t> visible;
+    static std::vector<uint32_t> visibleInstances;
+    static std::vector<uint32_t> visibleObjects;
+    // the level each instance and object was drawn at, so selectMeshLod() can hold it
+    static std::vector<uint32_t> instanceLods;
+    static std::vector<uint32_t> objectLods(WORLD_MAX_CELLS * WORLD_MAX_CELL_OBJECTS, 0);
+    // the world cells the BVH was built with
+    static uint64_t bvhResidencyChanges = 0;
+
+    uint32_t instanceCount = g_app.material.instanceCount;
+    bounds.resize(instanceCount);
+    instanceLods.resize(instanceCount, 0);
+    visible.clear();
+    visibleInstances.clear();
+    visibleObjects.clear();
+
+    const glm::mat4 &model = getWorldTransform(g_app.modelEntity);
+    const glm::mat4 &view = g_app.uboVS.viewMatrix;
+
+    // mesh errors are in model units, the model matrix scales them to the world
+    float modelScale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    float pixelsPerWorldUnit = g_app.uboVS.projectionMatrix[1][1] * SCREEN_HEIGHT * 0.5f;
+
+    const glm::vec3 &localMin = g_app.vertices.boundsMin;
+    const glm::vec3 &localMax = g_app.vertices.boundsMax;
+
+    for (uint32_t instance = 0; instance < g_app.material.instanceCount; instance++)
+    {
+        // updated by updateUniformBuffers() earlier in the frame
+        const glm::mat4 &instanceWorld = getWorldTransform(g_app.instanceEntities[instance]);
+        g_app.instanceTransforms.mapped[imageIndex * instanceCount + instance] = instanceWorld;
+
+        CullBounds &box = bounds[instance];
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec3 corner((i & 1) ? localMax.x : localMin.x, (i & 2) ? localMax.y : localMin.y, (i & 4) ? localMax.z : localMin.z);
+            glm::vec3 world = glm::vec3(instanceWorld * glm::vec4(corner, 1.0f));
+
+            box.min = (i == 0) ? world : glm::min(box.min, world);
+            box.max = (i == 0) ? world : glm::max(box.max, world);
+        }
+    }
+
+    // the objects of the resident cells go after the instances
+    appendWorldCullBounds(bounds);
+
+    Bvh &bvh = g_app.instanceBvh;
+    if (bvh.objectBounds.size() != bounds.size() || bvhResidencyChanges != g_app.world.residencyChanges)
+    {
+        buildBvh(bvh, bounds.data(), static_cast<uint32_t>(bounds.size()));
+        bvhResidencyChanges = g_app.world.residencyChanges;
+    }
+    else
+    {
+        // only moved instances refit their part of the tree
+        for (uint32_t instance = 0; instance < bounds.size(); instance++)
+        {
+            const CullBounds &old = bvh.objectBounds[instance];
+            if (old.min != bounds[instance].min || old.max != bounds[instance].max)
+            {
+                updateBvhObject(bvh, instance, bounds[instance]);
+            }
+        }
+        refitBvh(bvh);
+    }
+
+    cullObjects(bvh, viewProj, visible);
+
+    float localSize = glm::length(localMax - localMin);
+
+    uint64_t triangleCount = 0;
+    for (uint32_t index : visible)
+    {
+        // nearest point of the bounding sphere, in front of the near plane
+        const CullBounds &box = bounds[index];
+        glm::vec3 center = (box.min + box.max) * 0.5f;
+        float radius = glm::length(box.max - center);
+        float distance = std::max(-(view * glm::vec4(center, 1.0f)).z - radius, 0.1f);
+
+        if (index < instanceCount)
+        {
+            instanceLods[index] = selectMeshLod(g_app.indices.lods, pixelsPerWorldUnit * modelScale / distance, instanceLods[index]);
+            triangleCount += g_app.indices.lods[instanceLods[index]].indexCount / 3;
+            visibleInstances.push_back(index);
+            continue;
+        }
+
+        // An object is the mesh scaled without rotation, its box grows by
+        // the scale. The cells are appended in slot order, so the object
+        // buffer instances stay sorted
+        uint32_t object = g_app.world.cullInstances[index - instanceCount];
+        float objectScale = (localSize > 0.0f) ? glm::length(box.max - box.min) / localSize : 1.0f;
+
+        objectLods[object] = selectMeshLod(g_app.indices.lods, pixelsPerWorldUnit * objectScale / distance, objectLods[object]);
+        triangleCount += g_app.indices.lods[objectLods[object]].indexCount / 3;
+        visibleObjects.push_back(object);
+    }
+
+    uint32_t drawCount = writeSceneDraws(imageIndex, SCENE_DRAWS_INSTANCES, visibleInstances, instanceLods);
+    drawCount += writeSceneDraws(imageIndex, SCENE_DRAWS_WORLD, visibleObjects, objectLods);
+
+    // the skinned characters are always drawn whole, in one draw, the
+    // lighting subpass and the overlay are one draw each
+    triangleCount += getSkinnedTriangleCount();
+    drawCount += (g_app.skinning.enabled ? 1 : 0) + (g_app.deferred.enabled ? 1 : 0) + 1;
+
+    g_app.frameStats.drawCount = drawCount;
+    g_app.frameStats.triangleCount = triangleCount;
+}
+
+void pickInstance(float x, float y)
+{
+    // Window position to a ray through the depth range, Vulkan puts the
+    // top of the window at -1
+    glm::mat4 inverseViewProj = glm::inverse(g_app.uboVS.projectionMatrix * g_app.uboVS.viewMatrix);
+    float ndcX = 2.0f * x / SCREEN_WIDTH - 1.0f;
+    float ndcY = 2.0f * y / SCREEN_HEIGHT - 1.0f;
+
+    glm::vec4 nearPoint = inverseViewProj * glm::vec4(ndcX, ndcY, 0.0f, 1.0f);
+    glm::vec4 farPoint = inverseViewProj * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+    glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+
+    float distance;
+    uint32_t instance = queryBvhRay(g_app.instanceBvh, origin, direction, 1.0f, &distance);
+    if (instance == BVH_INVALID)
+    {
+        printf("Picked nothing at %.0f, %.0f\n", x, y);
+        return;
+    }
+
+    // the world objects follow the instances in the BVH
+    if (instance >= g_app.material.instanceCount)
+    {
+        uint32_t object = g_app.world.cullInstances[instance - g_app.material.instanceCount];
+        const WorldCell &cell = g_app.world.cells[object / WORLD_MAX_CELL_OBJECTS];
+        printf("Picked object %u of world cell %d, %d at %.0f, %.0f, %.2f units away\n", object % WORLD_MAX_CELL_OBJECTS,
+            cell.x, cell.z, x, y, distance * glm::length(direction));
+        return;
+    }
+
+    printf("Picked instance %u at %.0f, %.0f, %.2f units away\n", instance, x, y, distance * glm::length(direction));
 }
 
 void render()
 {
-    updateUniformBuffers();
+    std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+    if (g_app.startup.firstFramePresented)
+    {
+        g_app.frameStats.frameMs = std::chrono::duration<double, std::milli>(frameStart - g_app.frameStats.frameStart).count();
+    }
+    g_app.frameStats.frameStart = frameStart;
 
     VkResult result = VK_SUCCESS;
-    
-    result = vkQueueWaitIdle(g_app.queue);
-    assert (result == VK_SUCCESS);
+
+    // time spent blocked on the GPU or the presentation engine
+    std::chrono::steady_clock::time_point stallStart = std::chrono::steady_clock::now();
+
+    // Only the frame that last signalled this frame's fence is waited for,
+    // the frames after it stay queued. Whatever is kept per fence slot, the
+    // acquire semaphore among it, is free again
+    beginFrameRecording();
+    uint32_t frameSlot = getRecordingSlot();
 
     uint32_t image_index;
     
-    result = vkAcquireNextImageKHR( g_app.device, g_app.swapchain, UINT64_MAX, g_app.ImageAvailableSemaphore, VK_NULL_HANDLE, &image_index );
+    result = vkAcquireNextImageKHR( g_app.device, g_app.swapchain, UINT64_MAX, g_app.ImageAvailableSemaphores[frameSlot], VK_NULL_HANDLE, &image_index );
     assert (result == VK_SUCCESS);
 
+    // The draw command buffer, uniform region, indirect draws, overlay and
+    // queries of the image were last used by the frame that drew it. That
+    // frame came before the one waited for above unless the images are
+    // acquired out of order, so this rarely waits
+    waitForFrame(g_app.imageFrames[image_index]);
+
+    double stallMs = millisecondsSince(stallStart);
+
+    // objects released by finished frames, without waiting on the GPU
+    collectDeletions();
+
+    // the pools of the frame that last used this fence are reset in one go
+    beginFrameCommands();
+
+    // the newest depth pyramid that has come back from the GPU
+    updateOcclusionCulling();
+
+    // the previous frame drawn to this image has finished
+    readGpuTimestamps(image_index);
+    updateHud(image_index);
+
+    // Texture and world cell copies are submitted ahead of the frame that
+    // uses them, followed by the defragmenter's copies. Views of retired
+    // images are let go of before the memory manager destroys them. The
+    // camera is where the last frame left it
+    beginFramePhase(FRAME_PHASE_STREAMING);
+    updateTexturePriorities();
+    updateTextureStreaming();
+    updateWorldStreaming(glm::vec3(glm::inverse(g_app.uboVS.viewMatrix)[3]));
+    updateDeviceMemory();
+    endFramePhase(FRAME_PHASE_STREAMING);
+
+    // sampled as late as possible so the interpolated state is close to what gets displayed,
+    // into the region of the image, which its last frame is done with
+    beginFramePhase(FRAME_PHASE_UNIFORMS);
+    updateUniformBuffers(image_index);
+    endFramePhase(FRAME_PHASE_UNIFORMS);
+
+    // the characters are posed and skinned, and the lights binned, ahead
+    // of the frame that draws them
+    beginFramePhase(FRAME_PHASE_ANIMATION);
+    float animationTime = sampleSimulation().animationTime;
+    updateSkinning(animationTime);
+    updateLighting(g_app.uboVS.viewMatrix, g_app.uboVS.projectionMatrix, animationTime);
+    endFramePhase(FRAME_PHASE_ANIMATION);
+
+    // the indirect draws of this image only cover the instances that survive
+    // culling, which in multiview mode takes in every view
+    beginFramePhase(FRAME_PHASE_CULLING);
+    cullScene(image_index, getCullViewProjection(g_app.uboVS.projectionMatrix, g_app.uboVS.viewMatrix));
+    endFramePhase(FRAME_PHASE_CULLING);
+
     // Add a post present image memory barrier
     // This will transform the frame buffer color attachment back
     // to it's initial layout after it has been presented to the
@@ -1203,16 +2126,13 @@ void render()
     postPresentBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
     postPresentBarrier.image = g_app.swapBuffers[image_index].image;
 
-    // Use dedicated command buffer from example base class for submitting the post present barrier
-    VkCommandBufferBeginInfo cmdBufInfo = {};
-    cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-
-    result = vkBeginCommandBuffer(g_app.postPresentCmdBuffer, &cmdBufInfo);
-    assert (result == VK_SUCCESS);
+    // Recorded into a transient command buffer of this frame
+    beginFramePhase(FRAME_PHASE_RECORDING);
+    VkCommandBuffer postPresentCmdBuffer = beginFrameCommandBuffer();
 
     // Put post present barrier into command buffer
     vkCmdPipelineBarrier(
-        g_app.postPresentCmdBuffer,
+        postPresentCmdBuffer,
         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
         0,
@@ -1220,20 +2140,13 @@ void render()
         0, nullptr,
         1, &postPresentBarrier);
 
-    result = vkEndCommandBuffer(g_app.postPresentCmdBuffer);
+    result = vkEndCommandBuffer(postPresentCmdBuffer);
     assert (result == VK_SUCCESS);    
+    endFramePhase(FRAME_PHASE_RECORDING);
 
-    // Submit the image barrier to the current queue
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &g_app.postPresentCmdBuffer;
-
-    result = vkQueueSubmit(g_app.queue, 1, &submitInfo, VK_NULL_HANDLE);
-    assert (result == VK_SUCCESS);
-
-    // Make sure that the image barrier command submitted to the queue 
-    // has finished executing
+    // The image barrier goes in the same batch as the draws, behind the
+    // wait for the presentation engine to give the image back
+    VkCommandBuffer frameCmdBuffers[2] = { postPresentCmdBuffer, g_app.drawCmdBuffers[image_index] };
 
     /* Queue the command buffer for execution */
     VkPipelineStageFlags pipe_stage_flags = VK_PIPELINE_STAGE_TRANSFER_BIT;
@@ -1241,30 +2154,68 @@ void render()
     submit_info[0].pNext = NULL;
     submit_info[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submit_info[0].waitSemaphoreCount = 1;
-    submit_info[0].pWaitSemaphores = &g_app.ImageAvailableSemaphore;
+    submit_info[0].pWaitSemaphores = &g_app.ImageAvailableSemaphores[frameSlot];
     submit_info[0].pWaitDstStageMask = &pipe_stage_flags;
-    submit_info[0].commandBufferCount = 1;
-    submit_info[0].pCommandBuffers = &g_app.drawCmdBuffers[image_index];
+    submit_info[0].commandBufferCount = 2;
+    submit_info[0].pCommandBuffers = frameCmdBuffers;
     submit_info[0].signalSemaphoreCount = 1;
-    submit_info[0].pSignalSemaphores = &g_app.RenderingFinishedSemaphore;
-
-    result = vkQueueSubmit(g_app.queue, 1, submit_info, VK_NULL_HANDLE);
+    submit_info[0].pSignalSemaphores = &g_app.RenderingFinishedSemaphores[image_index];
+
+    // The depth pyramid is built from this frame's depth right after its
+    // draws, the frame fence covers it and the copies submitted ahead. It
+    // is of the first view, the only one with multiview off
+    beginFramePhase(FRAME_PHASE_RECORDING);
+    VkCommandBuffer pyramidCmdBuffer = recordDepthPyramid(g_app.uboVS.projectionMatrices[0] * g_app.uboVS.viewMatrices[0]);
+    endFramePhase(FRAME_PHASE_RECORDING);
+    VkSubmitInfo pyramidSubmitInfo = {};
+    pyramidSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    pyramidSubmitInfo.commandBufferCount = 1;
+    pyramidSubmitInfo.pCommandBuffers = &pyramidCmdBuffer;
+
+    VkSubmitInfo frameSubmits[2] = { submit_info[0], pyramidSubmitInfo };
+    uint32_t frameSubmitCount = (pyramidCmdBuffer != VK_NULL_HANDLE) ? 2 : 1;
+
+    // what the image holds is free again once this frame's fence signals
+    g_app.imageFrames[image_index] = getRecordingFrame();
+
+    beginFramePhase(FRAME_PHASE_SUBMISSION);
+    result = vkQueueSubmit(g_app.queue, frameSubmitCount, frameSubmits, beginFrameSubmit());
     assert(result == VK_SUCCESS);
+    endFramePhase(FRAME_PHASE_SUBMISSION);
 
     // swap buffers
     VkPresentInfoKHR present_info = {}; 
     present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;          
     present_info.pNext = nullptr;
     present_info.waitSemaphoreCount = 1;                                
-    present_info.pWaitSemaphores = &g_app.RenderingFinishedSemaphore;
+    present_info.pWaitSemaphores = &g_app.RenderingFinishedSemaphores[image_index];
     present_info.swapchainCount = 1;                                    
     present_info.pSwapchains = &g_app.swapchain;                     
     present_info.pImageIndices = &image_index;                       
     present_info.pResults = nullptr;                                 
 
+    stallStart = std::chrono::steady_clock::now();
+
+    beginFramePhase(FRAME_PHASE_PRESENT);
     result = vkQueuePresentKHR( g_app.queue, &present_info );
+    endFramePhase(FRAME_PHASE_PRESENT);
 
     assert (result == VK_SUCCESS);
+
+    stallMs += millisecondsSince(stallStart);
+
+    g_app.frameStats.stallMs = stallMs;
+    g_app.frameStats.cpuMs = millisecondsSince(frameStart) - stallMs;
+
+    captureFrame(image_index);
+
+    if (!g_app.startup.firstFramePresented)
+    {
+        g_app.startup.firstFramePresented = true;
+
+        double firstFrameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - g_app.startup.start).count();
+        printf("Time to first frame: %.2f ms\n", firstFrameMs);
+    }
 }
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -1273,19 +2224,144 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     {
         g_app.shouldExit = true;       
     }
+
+    // the HUD and captures belong to the render thread, they are changed through the next frame packet
+    if (key == GLFW_KEY_F1 && action == GLFW_PRESS)
+    {
+        queueRenderCommands(RENDER_COMMAND_TOGGLE_HUD);
+    }
+
+    if (key == GLFW_KEY_F12 && action == GLFW_PRESS)
+    {
+        queueRenderCommands(RENDER_COMMAND_CAPTURE);
+    }
+
+    // P picks what is under the cursor, same as a click
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+    {
+        double x, y;
+        glfwGetCursorPos(window, &x, &y);
+        queueRenderPick(static_cast<float>(x), static_cast<float>(y));
+    }
 } 
 
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+    {
+        double x, y;
+        glfwGetCursorPos(window, &x, &y);
+        queueRenderPick(static_cast<float>(x), static_cast<float>(y));
+    }
+}
+
 void mainloop()
 {
-    glfwPollEvents();
-    
-    render();
+    // Rendering runs on the render thread, this thread only waits for
+    // window events and hands them over
+    glfwWaitEventsTimeout(MAIN_LOOP_EVENT_TIMEOUT);
+
+    if (glfwWindowShouldClose(g_app.window))
+    {
+        g_app.shouldExit = true;
+    }
+
+    postFramePacket();
 }
 
 int main(int argc, char **argv)
 {
+    g_app.startup.start = std::chrono::steady_clock::now();
+
     printf("Entering Vulkan Test program");
+
+    // --capture <file> [frames] writes the first frames for tools/replay
+    // --bindless draws through the global descriptor arrays when the device supports it
+    // --texture-budget <MB> caps the device memory of streamed textures
+    // --texture <file> draws a KTX2 or DDS file in bindless mode
+    // --mesh <file> draws a Wavefront OBJ file instead of the triangle
+    // --world [dir] flies the camera over cells streamed from dir, data/world by default
+    // --skinning <count> draws count animated copies of the mesh, skinned in compute
+    // --lights <count> lights the scene with count point and spot lights
+    // --deferred shades from a G-buffer in a second subpass instead of forward
+    // --views <count> draws count views of the scene in one multiview pass
+    // --system-allocator leaves host allocations to the driver's own allocator
+    // --instances <count> draws count copies of the mesh on a grid, instanced in one draw
+    // --alpha-test <cutoff> discards the fragments whose vertex color is darker than cutoff
+    // --perf-counters reports the render thread's hardware counters per frame phase
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--bindless") == 0)
+        {
+            g_app.bindless.requested = true;
+        }
+        if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+        {
+            g_app.textures.budget = static_cast<VkDeviceSize>(atoi(argv[++i])) * 1024 * 1024;
+        }
+        if (strcmp(argv[i], "--texture") == 0 && i + 1 < argc)
+        {
+            g_app.texturePath = argv[++i];
+        }
+        if (strcmp(argv[i], "--mesh") == 0 && i + 1 < argc)
+        {
+            g_app.meshPath = argv[++i];
+        }
+        if (strcmp(argv[i], "--perf-counters") == 0)
+        {
+            g_app.perfCounters.requested = true;
+        }
+        if (strcmp(argv[i], "--system-allocator") == 0)
+        {
+            g_app.hostAllocator.enabled = false;
+        }
+        if (strcmp(argv[i], "--views") == 0 && i + 1 < argc)
+        {
+            g_app.multiview.viewCount = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        if (strcmp(argv[i], "--deferred") == 0)
+        {
+            g_app.deferred.requested = true;
+        }
+        if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+        {
+            g_app.lighting.lightCount = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        if (strcmp(argv[i], "--skinning") == 0 && i + 1 < argc)
+        {
+            g_app.skinning.characterCount = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+        {
+            g_app.material.features |= MATERIAL_FEATURE_INSTANCED;
+            g_app.material.instanceCount = static_cast<uint32_t>(std::max(atoi(argv[++i]), 1));
+        }
+        if (strcmp(argv[i], "--alpha-test") == 0 && i + 1 < argc)
+        {
+            g_app.material.features |= MATERIAL_FEATURE_ALPHA_TEST;
+            g_app.material.alphaCutoff = static_cast<float>(atof(argv[++i]));
+        }
+        if (strcmp(argv[i], "--world") == 0)
+        {
+            g_app.world.enabled = true;
+            g_app.world.directory = (i + 1 < argc && argv[i + 1][0] != '-') ? argv[++i] : "data/world";
+        }
+
+        if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+        {
+            const char* capturePath = argv[++i];
+            uint32_t captureFrames = 1;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                captureFrames = static_cast<uint32_t>(atoi(argv[++i]));
+            }
+            requestFrameCapture(capturePath, captureFrames);
+        }
+    }
     
+    // the instance is created with the host allocator already
+    initHostAllocator();
+
      // init Vulkan subsystems
     init();
 
@@ -1294,16 +2370,43 @@ int main(int argc, char **argv)
     // record command buffer
     buildCommandBuffers();
 
+    startSimulation();
+    startRenderThread();
+
     do 
     {
         mainloop();
     }
     while(!g_app.shouldExit);
 
-    // Flush device to make sure all resources can be freed 
+    stopRenderThread();
+    stopSimulation();
+
+    // Flush device to make sure all resources can be freed, presentation
+    // isn't covered by the frame fences
     vkDeviceWaitIdle(g_app.device);
-        
+
+    // live host memory is what the driver held while running
+    printHostAllocatorReport();
+    printPerfCounterReport();
+
+    destroyMaterialPipelines();
+    destroyHud();
+    destroyOcclusionCulling();
+    destroySkinning();
+    destroyDeferredShading();
+    destroyMultiviewTarget();
+    destroyLighting();
+    destroyWorldStreaming();
+    destroyScene();
+    destroyTextureStreaming();
+    destroyDeviceMemory();
+    destroyBindless();
+    destroyDescriptorAllocators();
+
+    destroyVulkan();
     destroyWindow();
+    destroyAsyncIo();
 
     printf("Exiting program");
 
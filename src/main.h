@@ -12,6 +12,35 @@
 
 #include <vector>
 #include <memory>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+
+#include "asyncio.h"
+#include "hostallocator.h"
+#include "bindless.h"
+#include "devicememory.h"
+#include "deletionqueue.h"
+#include "framecommands.h"
+#include "occlusion.h"
+#include "scene.h"
+#include "skinning.h"
+#include "world.h"
+#include "textures.h"
+#include "textureloader.h"
+#include "meshloader.h"
+#include "meshlod.h"
+#include "material.h"
+#include "descriptors.h"
+#include "hud.h"
+#include "lighting.h"
+#include "deferred.h"
+#include "multiview.h"
+#include "capture.h"
+#include "simulation.h"
+#include "renderthread.h"
+#include "perfcounters.h"
 
 //Screen dimension constants
 const uint SCREEN_WIDTH = 1280;
@@ -62,27 +91,39 @@ struct VulkanApp
     struct {
 		VkBuffer buffer;
 		VkDeviceMemory memory;
+		VkDeviceSize size;
 		VkPipelineVertexInputStateCreateInfo inputState;
+		// bounds of the positions, for culling
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
 		std::vector<VkVertexInputBindingDescription> bindingDescriptions;
 		std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
 	} vertices;
 
    	struct {
-		int count;
+		int count;              // of the full level
 		VkBuffer buffer;
 		VkDeviceMemory memory;
+		VkDeviceSize size;
+		std::vector<MeshLod> lods;
 	} indices;
 
+    // One region per swapchain image, the draw command buffer of an image
+    // reads its own region while the frames before are still in flight
     struct {
 		VkBuffer buffer;
 		VkDeviceMemory memory;
-		VkDescriptorBufferInfo descriptor;
+		VkDeviceSize regionSize;
+		std::vector<VkDescriptorBufferInfo> descriptors;
 	}  uniformDataVS;
 
     struct {
         glm::mat4 projectionMatrix;
         glm::mat4 modelMatrix;
         glm::mat4 viewMatrix;
+        // per view in multiview mode, the camera above offset for each view
+        glm::mat4 viewMatrices[MULTIVIEW_MAX_VIEWS];
+        glm::mat4 projectionMatrices[MULTIVIEW_MAX_VIEWS];
     } uboVS;
 
    	// The descriptor set layout describes the shader binding points without referencing
@@ -91,13 +132,13 @@ struct VulkanApp
 	// different descriptor sets as long as the binding points (and shaders) match
 	VkDescriptorSetLayout descriptorSetLayout;
 
-   	// Descriptor set pool
-	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+   	// Descriptor pools, set layouts and cached sets
+	DescriptorManager descriptors;
 
    	// The descriptor set stores the resources bound to the binding points in a shader
 	// It connects the binding points of the different shaders with the buffers and images
-	// used for those bindings
-	VkDescriptorSet descriptorSet;
+	// used for those bindings. One per swapchain image, for its uniform region
+	std::vector<VkDescriptorSet> descriptorSets;
 
    	// The pipeline layout defines the resource binding slots to be used with a pipeline
 	// This includes bindings for buffes (ubos, ssbos), images and sampler
@@ -113,8 +154,57 @@ struct VulkanApp
 	// and switch between them
 	// Note that there are a few dynamic states (scissor, viewport, line width) that
 	// can be set from a command buffer and does not have to be part of the pipeline
-	// This basic example only uses one pipeline
-	VkPipeline pipeline;
+	// Pipelines are generated per material feature set and shared through this cache
+	MaterialPipelineCache materialPipelines;
+
+	// The material used to draw the triangle
+	Material material;
+
+    // Global descriptor arrays of the optional bindless mode
+    BindlessResources bindless;
+
+    // Depth pyramid and the visibility of the instances
+    OcclusionCuller occlusion;
+
+    // Entity transforms. The model is a root entity turned by the
+    // simulation, the material instances are its children
+    Scene scene;
+    EntityHandle modelEntity;
+    std::vector<EntityHandle> instanceEntities;
+
+    // World transforms of the instance entities, the per instance vertex
+    // buffer of the material. One region of instanceCount per swapchain
+    // image, written by cullScene() for the image it culls
+    struct {
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+        glm::mat4* mapped;
+    } instanceTransforms;
+
+    // World bounds of the instances, for culling and picking
+    Bvh instanceBvh;
+
+    // Cells of the world around the camera, --world [dir]
+    WorldStreamer world;
+
+    // Animated copies of the mesh, --skinning <count>
+    SkinningStage skinning;
+
+    // Point and spot lights binned into view clusters, --lights <count>
+    ClusteredLighting lighting;
+
+    // G-buffer and lighting subpass of the deferred render pass, --deferred
+    DeferredShading deferred;
+
+    // Array target and view count of the multiview pass, --views <count>
+    MultiviewTarget multiview;
+
+    // Streamed textures, samplers and image views
+    TextureManager textures;
+    // --texture <file>, a KTX2 or DDS file drawn instead of the checker board
+    std::string texturePath;
+    // --mesh <file>, an OBJ file drawn instead of the triangle
+    std::string meshPath;
 
     std::vector<VkShaderModule> shaderModules;
 
@@ -125,19 +215,130 @@ struct VulkanApp
     std::vector<VkQueueFamilyProperties> queueProperties;
     uint32_t graphicsQueueFamilyIndex;
 
+    std::vector<VkExtensionProperties>  deviceExtensions;
+    std::vector<const char*>            enabledDeviceExtensions;
+
     VkPhysicalDeviceProperties          gpuProps;
     VkPhysicalDeviceMemoryProperties    memoryProperties;
+    VkPhysicalDeviceFeatures            enabledFeatures;
 
+    // The draw command buffers are recorded up front and kept, commands
+    // recorded every frame come from frameCommands
     VkCommandPool   cmdPool;
     std::vector<VkCommandBuffer> drawCmdBuffers; // Buffer for initialization commands
-    VkCommandBuffer postPresentCmdBuffer; // Buffer for initialization commands
+    // the frame that last submitted the draw command buffer of each image
+    std::vector<uint64_t> imageFrames;
 
     VkQueue queue;
 
-    VkSemaphore    ImageAvailableSemaphore;
-    VkSemaphore    RenderingFinishedSemaphore;
+    // One time GPU work recorded during init (image layout transitions,
+    // uploads) goes into this command buffer and is submitted in one batch
+    struct {
+        VkCommandPool   cmdPool;
+        VkCommandBuffer cmdBuffer;
+        VkFence         fence;
+        std::mutex      lock;
+        uint32_t        recordCount;
+    } setup;
+
+    // Shader sources are read from disk while the device is being set up
+    std::mutex shaderSourceLock;
+    std::unordered_map<std::string, std::string> shaderSources;
+
+    struct {
+        std::chrono::steady_clock::time_point start;
+        bool firstFramePresented;
+    } startup;
 
+    // Per frame timings and counters, filled in by render() and buildCommandBuffers()
+    struct {
+        double frameMs;
+        double cpuMs;
+        double gpuMs;
+        double stallMs;
+        uint32_t drawCount;
+        uint64_t triangleCount;
+
+        std::chrono::steady_clock::time_point frameStart;
+
+        // two timestamps per swapchain image, around its draw command buffer
+        VkQueryPool timestampPool;
+        bool timestampsSupported;
+    } frameStats;
+
+    // Host memory the driver allocates for the objects it creates
+    HostAllocator hostAllocator;
+
+    // Device memory allocated through allocateDeviceMemory()
+    struct {
+        std::mutex lock;
+        std::unordered_map<VkDeviceMemory, std::pair<VkDeviceSize, uint32_t>> allocations; // size and heap
+        VkDeviceSize heapUsage[VK_MAX_MEMORY_HEAPS];
+    } memoryStats;
+
+    // Blocks of the resources that come and go while running, with the heap budgets
+    DeviceMemoryManager deviceMemory;
+
+    // Frame fences and the objects waiting for them before they are destroyed
+    DeletionQueue deletionQueue;
+
+    // Transient pools for the command buffers recorded each frame
+    FrameCommands frameCommands;
+
+    // File reads of the shader, mesh and texture loaders
+    AsyncIo asyncIo;
+
+    Hud hud;
+
+    FrameCapture capture;
+
+    Simulation simulation;
+
+    RenderThread renderThread;
+
+    // Hardware counters of the render thread per frame phase, --perf-counters
+    PerfCounters perfCounters;
+
+    // Acquires are waited for by the frame's submit, so a fence slot's
+    // semaphore is free again with its fence. A present is only known to be
+    // done once its image is acquired again, so those are per image
+    VkSemaphore    ImageAvailableSemaphores[MAX_FRAME_FENCES];
+    std::vector<VkSemaphore> RenderingFinishedSemaphores;
+
+    // set on the main thread
     bool shouldExit;
 };
 
+extern VulkanApp g_app;
+extern VkClearColorValue clear_color;
+
+/// shared helpers from main.cpp
+bool deviceExtensionSupported(const char* name);
+bool deviceExtensionEnabled(const char* name);
+bool memoryTypeFromProperties(uint32_t typeBits, VkFlags requirements_mask, uint32_t *typeIndex);
+VkShaderModule loadShaderGLSL(const char *filename, VkShaderStageFlagBits shaderStage);
+std::string readTextFile(const char *fileName);
+void setImageLayout(VkCommandBuffer cmdBuffer, VkImage image, VkImageAspectFlags aspectMask, VkImageLayout old_image_layout, VkImageLayout new_image_layout);
+
+// Dependency of the first subpass on the frame before, which may still be
+// drawing to the attachments every frame shares or reading them afterwards
+VkSubpassDependency getPreviousFrameDependency();
+
+// vkAllocateMemory/vkFreeMemory with per heap accounting
+VkResult allocateDeviceMemory(const VkMemoryAllocateInfo *allocateInfo, VkDeviceMemory *memory);
+void freeDeviceMemory(VkDeviceMemory memory);
+
+// The setup command buffer may be recorded from several init threads,
+// beginSetupCommands() locks it until the matching endSetupCommands()
+VkCommandBuffer beginSetupCommands();
+void endSetupCommands();
+bool flushSetupCommands();
+
+// Renders and presents one frame, only called from the render thread
+void render();
+
+// Render thread: reports the instance under a window position
+void pickInstance(float x, float y);
+///
+
 #endif //__MAIN_H__
@@ -0,0 +1,343 @@
+/*
+    Material pipeline variants built from specialization constants
+*/
+
+#include "main.h"
+
+#include <stdio.h>
+#include <assert.h>
+
+void getMaterialConstants(MaterialFeatureFlags features, VkBool32 constants[MATERIAL_CONSTANT_COUNT])
+{
+    constants[MATERIAL_CONSTANT_VERTEX_COLOR] = (features & MATERIAL_FEATURE_VERTEX_COLOR) ? VK_TRUE : VK_FALSE;
+    constants[MATERIAL_CONSTANT_ALPHA_TEST] = (features & MATERIAL_FEATURE_ALPHA_TEST) ? VK_TRUE : VK_FALSE;
+    constants[MATERIAL_CONSTANT_INSTANCED] = (features & MATERIAL_FEATURE_INSTANCED) ? VK_TRUE : VK_FALSE;
+    constants[MATERIAL_CONSTANT_TEXTURED] = (features & MATERIAL_FEATURE_TEXTURED) ? VK_TRUE : VK_FALSE;
+    constants[MATERIAL_CONSTANT_LIT] = (features & MATERIAL_FEATURE_LIT) ? VK_TRUE : VK_FALSE;
+    constants[MATERIAL_CONSTANT_GBUFFER] = (features & MATERIAL_FEATURE_GBUFFER) ? VK_TRUE : VK_FALSE;
+}
+
+VkPipeline createMaterialPipeline(MaterialFeatureFlags features)
+{
+    MaterialPipelineCache &cache = g_app.materialPipelines;
+
+    VkGraphicsPipelineCreateInfo gfxPipelineCreateInfo = {};
+    gfxPipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    gfxPipelineCreateInfo.layout = g_app.pipelineLayout;
+    gfxPipelineCreateInfo.renderPass = g_app.renderPass;
+
+    // primitive topology for the pipeline
+    VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
+    inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    // rasterization state
+    VkPipelineRasterizationStateCreateInfo rasterizationState = {};
+    rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizationState.cullMode = VK_CULL_MODE_NONE;
+    rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizationState.depthClampEnable = VK_FALSE;
+    rasterizationState.rasterizerDiscardEnable = VK_FALSE;
+    rasterizationState.depthBiasEnable = VK_FALSE;
+    rasterizationState.lineWidth = 1.0f;
+
+    // the G-buffer subpass has an albedo and a normal attachment
+    std::vector<VkPipelineColorBlendAttachmentState> blendAttachmentState;
+    blendAttachmentState.resize((features & MATERIAL_FEATURE_GBUFFER) ? 2 : 1);
+    for (auto &attachment : blendAttachmentState)
+    {
+        attachment.colorWriteMask = 0xf;
+        attachment.blendEnable = VK_FALSE;
+    }
+
+    VkPipelineColorBlendStateCreateInfo colorBlendState = {};
+    colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlendState.attachmentCount = static_cast<uint32_t>(blendAttachmentState.size());
+    colorBlendState.pAttachments = blendAttachmentState.data();
+
+    VkPipelineViewportStateCreateInfo viewportState = {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    // enable dynamic states
+    std::vector<VkDynamicState> dynamicStateEnables;
+    dynamicStateEnables.push_back(VK_DYNAMIC_STATE_VIEWPORT);
+    dynamicStateEnables.push_back(VK_DYNAMIC_STATE_SCISSOR);
+
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.pDynamicStates = dynamicStateEnables.data();
+    dynamicState.dynamicStateCount = dynamicStateEnables.size();
+
+    VkPipelineDepthStencilStateCreateInfo depthStencilState = {};
+
+    depthStencilState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencilState.depthTestEnable = VK_TRUE;
+    depthStencilState.depthWriteEnable = VK_TRUE;
+    depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    depthStencilState.depthBoundsTestEnable = VK_FALSE;
+    depthStencilState.back.failOp = VK_STENCIL_OP_KEEP;
+    depthStencilState.back.passOp = VK_STENCIL_OP_KEEP;
+    depthStencilState.stencilTestEnable = VK_FALSE;
+    depthStencilState.front = depthStencilState.back;
+
+    VkPipelineMultisampleStateCreateInfo multisampleState = {};
+    multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampleState.pSampleMask =  nullptr;
+    multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    // One specialization constant per feature bit, shared by both stages.
+    // Constants that a stage does not declare are ignored by that stage
+    VkBool32 featureConstants[MATERIAL_CONSTANT_COUNT];
+    getMaterialConstants(features, featureConstants);
+
+    VkSpecializationMapEntry specializationEntries[MATERIAL_CONSTANT_COUNT];
+    for (uint32_t i = 0; i < MATERIAL_CONSTANT_COUNT; i++)
+    {
+        specializationEntries[i].constantID = i;
+        specializationEntries[i].offset = i * sizeof(VkBool32);
+        specializationEntries[i].size = sizeof(VkBool32);
+    }
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = MATERIAL_CONSTANT_COUNT;
+    specializationInfo.pMapEntries = specializationEntries;
+    specializationInfo.dataSize = sizeof(featureConstants);
+    specializationInfo.pData = featureConstants;
+
+    bool worldObjects = (features & MATERIAL_FEATURE_WORLD_OBJECTS) != 0;
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions;
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+    getMaterialVertexInput(features, bindingDescriptions, attributeDescriptions);
+
+    VkPipelineVertexInputStateCreateInfo inputState = g_app.vertices.inputState;
+    inputState.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+    inputState.pVertexBindingDescriptions = bindingDescriptions.data();
+    inputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+    inputState.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+    shaderStages.resize(2);
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = worldObjects ? cache.worldVertexShader : cache.vertexShader;
+    shaderStages[0].pName = "main";
+    shaderStages[0].pSpecializationInfo = &specializationInfo;
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = cache.fragmentShader;
+    shaderStages[1].pName = "main";
+    shaderStages[1].pSpecializationInfo = &specializationInfo;
+
+    // assign states to pipeline
+    gfxPipelineCreateInfo.stageCount = shaderStages.size();
+    gfxPipelineCreateInfo.pStages = shaderStages.data();
+    gfxPipelineCreateInfo.pVertexInputState = &inputState;
+    gfxPipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+    gfxPipelineCreateInfo.pRasterizationState = &rasterizationState;
+    gfxPipelineCreateInfo.pColorBlendState = &colorBlendState;
+    gfxPipelineCreateInfo.pMultisampleState = &multisampleState;
+    gfxPipelineCreateInfo.pViewportState = &viewportState;
+    gfxPipelineCreateInfo.pDepthStencilState = &depthStencilState;
+    gfxPipelineCreateInfo.renderPass = g_app.renderPass;
+    gfxPipelineCreateInfo.pDynamicState = &dynamicState;
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult result = vkCreateGraphicsPipelines(g_app.device, g_app.pipelineCache, 1, &gfxPipelineCreateInfo, getHostAllocator(HOST_OBJECT_PIPELINE), &pipeline);
+    assert(result == VK_SUCCESS);
+
+    return pipeline;
+}
+
+VkPipeline getMaterialPipeline(MaterialFeatureFlags features)
+{
+    MaterialPipelineCache &cache = g_app.materialPipelines;
+
+    cache.lookups++;
+
+    auto variant = cache.variants.find(features);
+    if (variant != cache.variants.end())
+    {
+        return variant->second;
+    }
+
+    // The shader modules are shared by every variant, only the
+    // specialization constants differ. The bindless shaders take the same
+    // constants but read everything else through the global set, the
+    // multiview vertex shader picks the matrices of each view
+    if (cache.vertexShader == VK_NULL_HANDLE)
+    {
+        bool bindless = g_app.bindless.enabled;
+        const char* vertexShader = bindless ? "data/bindless.vert" : (g_app.multiview.enabled ? "data/multiview.vert" : "data/triangle.vert");
+        cache.vertexShader = loadShaderGLSL(vertexShader, VK_SHADER_STAGE_VERTEX_BIT);
+        cache.fragmentShader = loadShaderGLSL(bindless ? "data/bindless.frag" : "data/triangle.frag", VK_SHADER_STAGE_FRAGMENT_BIT);
+        assert(cache.vertexShader != VK_NULL_HANDLE && cache.fragmentShader != VK_NULL_HANDLE);
+    }
+
+    if ((features & MATERIAL_FEATURE_WORLD_OBJECTS) && cache.worldVertexShader == VK_NULL_HANDLE)
+    {
+        assert(!g_app.bindless.enabled && !g_app.multiview.enabled);
+        cache.worldVertexShader = loadShaderGLSL("data/world.vert", VK_SHADER_STAGE_VERTEX_BIT);
+        assert(cache.worldVertexShader != VK_NULL_HANDLE);
+    }
+
+    cache.misses++;
+
+    VkPipeline pipeline = createMaterialPipeline(features);
+    cache.variants[features] = pipeline;
+
+    printf("Created material pipeline variant 0x%x (%zu variants for %u lookups)\n", features, cache.variants.size(), cache.lookups);
+
+    return pipeline;
+}
+
+static bool writeBindlessMaterial(Material &material)
+{
+    if (material.bindlessIndex == BINDLESS_INVALID_INDEX)
+    {
+        material.bindlessIndex = allocateBindlessMaterial();
+        if (material.bindlessIndex == BINDLESS_INVALID_INDEX)
+        {
+            return false;
+        }
+    }
+
+    BindlessMaterialData &data = g_app.bindless.materialTable.mapped[material.bindlessIndex];
+    data.baseColor = material.baseColor;
+    data.alphaCutoff = material.alphaCutoff;
+    data.texture = (material.features & MATERIAL_FEATURE_TEXTURED) ? getTextureBindlessSlot(material.texture) : BINDLESS_INVALID_INDEX;
+
+    return true;
+}
+
+glm::vec3 getMaterialInstanceOffset(const Material &material, uint32_t instance)
+{
+    if (!(material.features & MATERIAL_FEATURE_INSTANCED))
+    {
+        return glm::vec3(0.0f);
+    }
+
+    // centered on the model origin
+    float center = (MATERIAL_INSTANCE_GRID_WIDTH - 1) * 0.5f;
+    float column = static_cast<float>(instance % MATERIAL_INSTANCE_GRID_WIDTH);
+    float row = static_cast<float>(instance / MATERIAL_INSTANCE_GRID_WIDTH);
+
+    return glm::vec3((column - center) * MATERIAL_INSTANCE_SPACING, (row - center) * MATERIAL_INSTANCE_SPACING, 0.0f);
+}
+
+void getMaterialVertexInput(MaterialFeatureFlags features, std::vector<VkVertexInputBindingDescription> &bindings, std::vector<VkVertexInputAttributeDescription> &attributes)
+{
+    bindings = g_app.vertices.bindingDescriptions;
+    attributes = g_app.vertices.attributeDescriptions;
+
+    // The world objects add a per instance binding for their position
+    // and scale to the mesh's vertex input
+    if (features & MATERIAL_FEATURE_WORLD_OBJECTS)
+    {
+        VkVertexInputBindingDescription objectBinding = {};
+        objectBinding.binding = WORLD_OBJECT_BIND_ID;
+        objectBinding.stride = sizeof(WorldObject);
+        objectBinding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+        bindings.push_back(objectBinding);
+
+        // position and scale, read by data/world.vert at location 3
+        VkVertexInputAttributeDescription objectAttribute = {};
+        objectAttribute.binding = WORLD_OBJECT_BIND_ID;
+        objectAttribute.location = 3;
+        objectAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        objectAttribute.offset = 0;
+        attributes.push_back(objectAttribute);
+        return;
+    }
+
+    // everything else is placed by the world transform of its instance, one
+    // location per column
+    VkVertexInputBindingDescription instanceBinding = {};
+    instanceBinding.binding = MATERIAL_INSTANCE_BIND_ID;
+    instanceBinding.stride = sizeof(glm::mat4);
+    instanceBinding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    bindings.push_back(instanceBinding);
+
+    for (uint32_t column = 0; column < 4; column++)
+    {
+        VkVertexInputAttributeDescription instanceAttribute = {};
+        instanceAttribute.binding = MATERIAL_INSTANCE_BIND_ID;
+        instanceAttribute.location = MATERIAL_INSTANCE_LOCATION + column;
+        instanceAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        instanceAttribute.offset = column * sizeof(glm::vec4);
+        attributes.push_back(instanceAttribute);
+    }
+}
+
+bool initMaterial(Material &material, MaterialFeatureFlags features)
+{
+    material.features = features;
+    material.pipeline = getMaterialPipeline(features);
+
+    if (!(features & MATERIAL_FEATURE_INSTANCED))
+    {
+        material.instanceCount = 1;
+    }
+
+    if (g_app.bindless.enabled && !writeBindlessMaterial(material))
+    {
+        return false;
+    }
+
+    return (material.pipeline != VK_NULL_HANDLE);
+}
+
+MaterialPushConstants getMaterialPushConstants(const Material &material)
+{
+    MaterialPushConstants pushConstants;
+    pushConstants.baseColor = material.baseColor;
+    pushConstants.alphaCutoff = material.alphaCutoff;
+
+    return pushConstants;
+}
+
+void bindMaterial(VkCommandBuffer cmdBuffer, const Material &material, uint32_t imageIndex)
+{
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, material.pipeline);
+
+    if (g_app.bindless.enabled)
+    {
+        BindlessDrawConstants drawConstants;
+        drawConstants.materialIndex = material.bindlessIndex;
+        drawConstants.sceneBuffer = g_app.bindless.sceneBuffers[imageIndex];
+
+        vkCmdPushConstants(cmdBuffer, g_app.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(drawConstants), &drawConstants);
+        return;
+    }
+
+    MaterialPushConstants pushConstants = getMaterialPushConstants(material);
+
+    vkCmdPushConstants(cmdBuffer, g_app.pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+}
+
+void destroyMaterialPipelines()
+{
+    MaterialPipelineCache &cache = g_app.materialPipelines;
+
+    for (auto &variant : cache.variants)
+    {
+        vkDestroyPipeline(g_app.device, variant.second, getHostAllocator(HOST_OBJECT_PIPELINE));
+    }
+    cache.variants.clear();
+
+    if (cache.vertexShader != VK_NULL_HANDLE)
+    {
+        vkDestroyShaderModule(g_app.device, cache.vertexShader, getHostAllocator(HOST_OBJECT_SHADER_MODULE));
+        vkDestroyShaderModule(g_app.device, cache.fragmentShader, getHostAllocator(HOST_OBJECT_SHADER_MODULE));
+        cache.vertexShader = VK_NULL_HANDLE;
+        cache.fragmentShader = VK_NULL_HANDLE;
+    }
+
+    if (cache.worldVertexShader != VK_NULL_HANDLE)
+    {
+        vkDestroyShaderModule(g_app.device, cache.worldVertexShader, getHostAllocator(HOST_OBJECT_SHADER_MODULE));
+        cache.worldVertexShader = VK_NULL_HANDLE;
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef __MATERIAL_H__
+#define __MATERIAL_H__
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <unordered_map>
+#include <vector>
+
+#include "bindless.h"
+#include "textures.h"
+
+// Feature bits of a material. Every bit is fed to the shaders as a
+// specialization constant, so a disabled feature is removed when the
+// pipeline is compiled instead of being branched on for every fragment
+enum MaterialFeatureBits
+{
+    MATERIAL_FEATURE_VERTEX_COLOR = 0x1,
+    MATERIAL_FEATURE_ALPHA_TEST   = 0x2,
+    MATERIAL_FEATURE_INSTANCED    = 0x4,
+    // sampled from the bindless texture array, only drawn in bindless mode
+    MATERIAL_FEATURE_TEXTURED     = 0x8,
+    // shaded by the clustered lights, only drawn outside of bindless mode
+    MATERIAL_FEATURE_LIT          = 0x10,
+    // writes albedo and normal to the G-buffer of the deferred render pass
+    MATERIAL_FEATURE_GBUFFER      = 0x20,
+    // Placed by the world objects of a second vertex buffer, drawn with
+    // data/world.vert. Picks the shader instead of a constant, only drawn
+    // outside of bindless and multiview mode
+    MATERIAL_FEATURE_WORLD_OBJECTS = 0x40,
+};
+typedef uint32_t MaterialFeatureFlags;
+
+// Specialization constant ids, these must match the constant_id
+// layout qualifiers in data/triangle.vert and data/triangle.frag, and
+// their bindless versions
+enum MaterialConstantId
+{
+    MATERIAL_CONSTANT_VERTEX_COLOR = 0,
+    MATERIAL_CONSTANT_ALPHA_TEST   = 1,
+    MATERIAL_CONSTANT_INSTANCED    = 2,    // no shader reads it, the instances have their own transforms
+    MATERIAL_CONSTANT_TEXTURED     = 3,
+    MATERIAL_CONSTANT_LIT          = 4,
+    MATERIAL_CONSTANT_GBUFFER      = 5,
+    MATERIAL_CONSTANT_COUNT
+};
+
+// Grid the instances of an instanced material are laid out on, as child
+// entities of the model. The shaders read the world transforms of the
+// instances from the vertex buffer at MATERIAL_INSTANCE_BIND_ID
+const uint32_t MATERIAL_INSTANCE_GRID_WIDTH = 8;
+const float MATERIAL_INSTANCE_SPACING = 2.5f;
+
+// Vertex buffer binding of the instance transforms, next to the mesh's at 0.
+// Read as a mat4 from location 3 on, the world objects have the binding
+// to themselves in their own pipeline
+const uint32_t MATERIAL_INSTANCE_BIND_ID = 1;
+const uint32_t MATERIAL_INSTANCE_LOCATION = 3;
+
+// Per material values that do not change the generated code are
+// pushed as constants, matching the MaterialParams block in triangle.frag
+struct MaterialPushConstants
+{
+    glm::vec4 baseColor;
+    float alphaCutoff;
+};
+
+struct Material
+{
+    MaterialFeatureFlags features = MATERIAL_FEATURE_VERTEX_COLOR;
+
+    // used when MATERIAL_FEATURE_VERTEX_COLOR is not set
+    glm::vec4 baseColor = glm::vec4(1.0f);
+    // used when MATERIAL_FEATURE_ALPHA_TEST is set
+    float alphaCutoff = 0.5f;
+    // used when MATERIAL_FEATURE_INSTANCED is set
+    uint32_t instanceCount = 1;
+    // used when MATERIAL_FEATURE_TEXTURED is set
+    TextureHandle texture = INVALID_TEXTURE;
+
+    // The pipeline variant is owned by the pipeline cache and shared
+    // between all materials with the same feature set
+    VkPipeline pipeline = VK_NULL_HANDLE;
+
+    // entry in the bindless material table, only used in bindless mode
+    uint32_t bindlessIndex = BINDLESS_INVALID_INDEX;
+};
+
+// Pipeline variants keyed by the material feature set
+struct MaterialPipelineCache
+{
+    VkShaderModule vertexShader = VK_NULL_HANDLE;
+    VkShaderModule fragmentShader = VK_NULL_HANDLE;
+    // loaded with the first variant for the world objects
+    VkShaderModule worldVertexShader = VK_NULL_HANDLE;
+
+    std::unordered_map<MaterialFeatureFlags, VkPipeline> variants;
+
+    uint32_t lookups = 0;
+    uint32_t misses = 0;
+};
+
+// Specialization constant values for a feature set, indexed by MaterialConstantId
+void getMaterialConstants(MaterialFeatureFlags features, VkBool32 constants[MATERIAL_CONSTANT_COUNT]);
+
+// Returns the pipeline variant for the given feature set, creating it on first use
+VkPipeline getMaterialPipeline(MaterialFeatureFlags features);
+
+// Fills in the material and resolves its pipeline variant
+bool initMaterial(Material &material, MaterialFeatureFlags features);
+
+MaterialPushConstants getMaterialPushConstants(const Material &material);
+
+// Model space offset of an instance of an instanced material, its local transform below the model
+glm::vec3 getMaterialInstanceOffset(const Material &material, uint32_t instance);
+
+// Vertex input of the pipeline variant: the mesh's binding, followed by the
+// instance transforms or the world objects
+void getMaterialVertexInput(MaterialFeatureFlags features, std::vector<VkVertexInputBindingDescription> &bindings, std::vector<VkVertexInputAttributeDescription> &attributes);
+
+// Binds the material pipeline and pushes its constants, in bindless mode
+// the constants are only the index of its material table entry and the
+// scene uniforms of the image the command buffer draws
+void bindMaterial(VkCommandBuffer cmdBuffer, const Material &material, uint32_t imageIndex);
+
+void destroyMaterialPipelines();
+
+#endif //__MATERIAL_H__
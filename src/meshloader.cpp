@@ -0,0 +1,187 @@
+/*
+    Wavefront OBJ reader for the scene geometry
+*/
+
+#include "main.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+// OBJ indices start at 1, negative ones count back from the last element read
+static bool resolveObjIndex(long index, size_t count, uint32_t &resolved)
+{
+    if (index > 0 && static_cast<size_t>(index) <= count)
+    {
+        resolved = static_cast<uint32_t>(index - 1);
+        return true;
+    }
+    if (index < 0 && static_cast<size_t>(-index) <= count)
+    {
+        resolved = static_cast<uint32_t>(count + index);
+        return true;
+    }
+    return false;
+}
+
+bool loadMeshFile(const char* path, MeshData &mesh)
+{
+    std::string text = readTextFile(path);
+    if (text.empty())
+    {
+        printf("Could not read mesh %s\n", path);
+        return false;
+    }
+
+    std::vector<float> positions;
+    std::vector<float> uvs;
+
+    // one vertex per distinct position and texture coordinate pair
+    std::unordered_map<uint64_t, uint32_t> vertexMap;
+    std::vector<uint32_t> polygon;
+
+    mesh.vertices.clear();
+    mesh.indices.clear();
+
+    const char* line = text.c_str();
+    uint32_t lineNumber = 0;
+
+    while (*line != '\0')
+    {
+        const char* lineEnd = strchr(line, '\n');
+        if (lineEnd == nullptr)
+        {
+            lineEnd = line + strlen(line);
+        }
+        lineNumber++;
+
+        if (line[0] == 'v' && line[1] == ' ')
+        {
+            char* end;
+            float x = strtof(line + 2, &end);
+            float y = strtof(end, &end);
+            float z = strtof(end, &end);
+            positions.push_back(x);
+            positions.push_back(y);
+            positions.push_back(z);
+        }
+        else if (line[0] == 'v' && line[1] == 't' && line[2] == ' ')
+        {
+            char* end;
+            float u = strtof(line + 3, &end);
+            float v = strtof(end, &end);
+            uvs.push_back(u);
+            uvs.push_back(v);
+        }
+        else if (line[0] == 'f' && line[1] == ' ')
+        {
+            polygon.clear();
+
+            const char* cursor = line + 2;
+            while (cursor < lineEnd)
+            {
+                char* end;
+                long positionIndex = strtol(cursor, &end, 10);
+                if (end == cursor)
+                {
+                    break;
+                }
+                cursor = end;
+
+                // v, v/vt, v//vn or v/vt/vn, normals are not used
+                long uvIndex = 0;
+                if (*cursor == '/')
+                {
+                    cursor++;
+                    if (*cursor != '/')
+                    {
+                        uvIndex = strtol(cursor, &end, 10);
+                        cursor = end;
+                    }
+                    if (*cursor == '/')
+                    {
+                        cursor++;
+                        strtol(cursor, &end, 10);
+                        cursor = end;
+                    }
+                }
+
+                uint32_t position;
+                if (!resolveObjIndex(positionIndex, positions.size() / 3, position))
+                {
+                    printf("%s:%u: bad vertex index\n", path, lineNumber);
+                    return false;
+                }
+
+                uint32_t uv = 0xffffffff;
+                if (uvIndex != 0 && !resolveObjIndex(uvIndex, uvs.size() / 2, uv))
+                {
+                    printf("%s:%u: bad texture coordinate index\n", path, lineNumber);
+                    return false;
+                }
+
+                uint64_t key = (static_cast<uint64_t>(position) << 32) | uv;
+                auto found = vertexMap.find(key);
+                if (found == vertexMap.end())
+                {
+                    MeshVertex vertex = {};
+                    memcpy(vertex.position, &positions[position * 3], sizeof(vertex.position));
+                    if (uv != 0xffffffff)
+                    {
+                        vertex.uv[0] = uvs[uv * 2];
+                        vertex.uv[1] = uvs[uv * 2 + 1];
+                    }
+
+                    found = vertexMap.insert(std::make_pair(key, static_cast<uint32_t>(mesh.vertices.size()))).first;
+                    mesh.vertices.push_back(vertex);
+                }
+                polygon.push_back(found->second);
+
+                while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')
+                {
+                    cursor++;
+                }
+            }
+
+            for (size_t i = 2; i < polygon.size(); i++)
+            {
+                mesh.indices.push_back(polygon[0]);
+                mesh.indices.push_back(polygon[i - 1]);
+                mesh.indices.push_back(polygon[i]);
+            }
+        }
+
+        line = (*lineEnd == '\n') ? lineEnd + 1 : lineEnd;
+    }
+
+    if (mesh.indices.empty())
+    {
+        printf("Mesh %s has no faces\n", path);
+        return false;
+    }
+
+    // without materials the vertex colors show the shape
+    float boundsMin[3] = { mesh.vertices[0].position[0], mesh.vertices[0].position[1], mesh.vertices[0].position[2] };
+    float boundsMax[3] = { boundsMin[0], boundsMin[1], boundsMin[2] };
+    for (const MeshVertex &vertex : mesh.vertices)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            boundsMin[i] = std::min(boundsMin[i], vertex.position[i]);
+            boundsMax[i] = std::max(boundsMax[i], vertex.position[i]);
+        }
+    }
+    for (MeshVertex &vertex : mesh.vertices)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            float extent = boundsMax[i] - boundsMin[i];
+            vertex.color[i] = extent > 0.0f ? (vertex.position[i] - boundsMin[i]) / extent : 1.0f;
+        }
+    }
+
+    printf("Mesh %s: %u vertices, %u triangles\n", path, (uint32_t)mesh.vertices.size(), (uint32_t)mesh.indices.size() / 3);
+
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef __MESHLOADER_H__
+#define __MESHLOADER_H__
+
+#include <stdint.h>
+
+#include <vector>
+
+// Vertex layout of the scene geometry, matching the attributes set up by initVertexData()
+struct MeshVertex
+{
+    float position[3];
+    float color[3];
+    float uv[2];
+};
+
+struct MeshData
+{
+    std::vector<MeshVertex> vertices;
+    std::vector<uint32_t> indices;
+};
+
+// Reads the positions, texture coordinates and faces of a Wavefront OBJ
+// file. Polygons are fanned into triangles, vertices that share a position
+// and texture coordinate are shared. The colors are a gradient over the bounds
+bool loadMeshFile(const char* path, MeshData &mesh);
+
+#endif //__MESHLOADER_H__
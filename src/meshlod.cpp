@@ -0,0 +1,459 @@
+/*
+    Level of detail chains from quadric error metric simplification, and picking a level by its error on screen
+*/
+
+#include "meshlod.h"
+
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+
+// Border planes count this much more than face planes, so open edges stay in place
+static const double BORDER_WEIGHT = 10.0;
+
+struct SimplifyPosition
+{
+    float x, y, z;
+};
+
+// Sum of squared distances to a set of planes, the symmetric 4x4 matrix of Garland and Heckbert
+struct Quadric
+{
+    double a2, ab, ac, ad;
+    double b2, bc, bd;
+    double c2, cd;
+    double d2;
+};
+
+struct CollapseCandidate
+{
+    double cost;
+    uint32_t from;
+    uint32_t to;
+    uint32_t fromStamp;
+    uint32_t toStamp;
+
+    bool operator<(const CollapseCandidate &other) const
+    {
+        // cheapest on top of the priority queue
+        return cost > other.cost;
+    }
+};
+
+static void addPlane(Quadric &q, double a, double b, double c, double d, double weight)
+{
+    q.a2 += weight * a * a; q.ab += weight * a * b; q.ac += weight * a * c; q.ad += weight * a * d;
+    q.b2 += weight * b * b; q.bc += weight * b * c; q.bd += weight * b * d;
+    q.c2 += weight * c * c; q.cd += weight * c * d;
+    q.d2 += weight * d * d;
+}
+
+static void addQuadric(Quadric &q, const Quadric &other)
+{
+    q.a2 += other.a2; q.ab += other.ab; q.ac += other.ac; q.ad += other.ad;
+    q.b2 += other.b2; q.bc += other.bc; q.bd += other.bd;
+    q.c2 += other.c2; q.cd += other.cd;
+    q.d2 += other.d2;
+}
+
+static double evaluateQuadric(const Quadric &q, const SimplifyPosition &p)
+{
+    double x = p.x, y = p.y, z = p.z;
+    double error = q.a2 * x * x + 2.0 * q.ab * x * y + 2.0 * q.ac * x * z + 2.0 * q.ad * x
+                 + q.b2 * y * y + 2.0 * q.bc * y * z + 2.0 * q.bd * y
+                 + q.c2 * z * z + 2.0 * q.cd * z
+                 + q.d2;
+
+    // rounding can take it a little below zero
+    return std::max(error, 0.0);
+}
+
+static void triangleNormal(const SimplifyPosition &p0, const SimplifyPosition &p1, const SimplifyPosition &p2, double n[3])
+{
+    double e1[3] = { p1.x - p0.x, p1.y - p0.y, p1.z - p0.z };
+    double e2[3] = { p2.x - p0.x, p2.y - p0.y, p2.z - p0.z };
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static uint64_t edgeKey(uint32_t a, uint32_t b)
+{
+    return (a < b) ? ((static_cast<uint64_t>(a) << 32) | b) : ((static_cast<uint64_t>(b) << 32) | a);
+}
+
+std::vector<uint32_t> simplifyMesh(const float *positions, size_t positionStride, size_t vertexCount,
+                                   const uint32_t *indices, size_t indexCount, size_t targetIndexCount, float *resultError)
+{
+    assert(indexCount % 3 == 0);
+    assert(positionStride >= sizeof(float) * 3);
+
+    std::vector<SimplifyPosition> points(vertexCount);
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        const float *p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + i * positionStride);
+        points[i] = { p[0], p[1], p[2] };
+    }
+
+    // Vertices that share a position but not their other attributes sit on
+    // a seam. They are locked, and edges are matched by position so a seam
+    // isn't taken for a border
+    std::vector<uint32_t> canonical(vertexCount);
+    std::vector<uint8_t> locked(vertexCount, 0);
+    {
+        std::unordered_map<uint64_t, uint32_t> firstAtPosition;
+        for (size_t i = 0; i < vertexCount; i++)
+        {
+            uint32_t bits[3];
+            memcpy(bits, &points[i], sizeof(bits));
+            uint64_t key = (static_cast<uint64_t>(bits[0]) * 73856093u) ^ (static_cast<uint64_t>(bits[1]) * 19349663u << 16) ^ (static_cast<uint64_t>(bits[2]) << 32);
+
+            auto found = firstAtPosition.find(key);
+            if (found != firstAtPosition.end() && memcmp(&points[found->second], &points[i], sizeof(SimplifyPosition)) == 0)
+            {
+                canonical[i] = found->second;
+                locked[i] = 1;
+                locked[found->second] = 1;
+            }
+            else
+            {
+                canonical[i] = static_cast<uint32_t>(i);
+                firstAtPosition[key] = static_cast<uint32_t>(i);
+            }
+        }
+    }
+
+    std::vector<uint32_t> triangles(indices, indices + indexCount);
+    size_t triangleCount = indexCount / 3;
+    size_t liveTriangles = triangleCount;
+    std::vector<uint8_t> triangleRemoved(triangleCount, 0);
+
+    std::vector<std::vector<uint32_t>> vertexTriangles(vertexCount);
+    std::vector<Quadric> quadrics(vertexCount);
+    memset(quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+
+    std::unordered_map<uint64_t, uint32_t> edgeUses;
+
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        const uint32_t *tri = &triangles[t * 3];
+
+        double n[3];
+        triangleNormal(points[tri[0]], points[tri[1]], points[tri[2]], n);
+        double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+        for (int i = 0; i < 3; i++)
+        {
+            vertexTriangles[tri[i]].push_back(static_cast<uint32_t>(t));
+
+            if (length > 0.0)
+            {
+                const SimplifyPosition &p = points[tri[0]];
+                double d = -(n[0] * p.x + n[1] * p.y + n[2] * p.z) / length;
+                addPlane(quadrics[tri[i]], n[0] / length, n[1] / length, n[2] / length, d, 1.0);
+            }
+
+            edgeUses[edgeKey(canonical[tri[i]], canonical[tri[(i + 1) % 3]])]++;
+        }
+    }
+
+    // A border edge gets a plane through it at right angles to its face
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        const uint32_t *tri = &triangles[t * 3];
+
+        double n[3];
+        triangleNormal(points[tri[0]], points[tri[1]], points[tri[2]], n);
+
+        for (int i = 0; i < 3; i++)
+        {
+            uint32_t a = tri[i];
+            uint32_t b = tri[(i + 1) % 3];
+            if (edgeUses[edgeKey(canonical[a], canonical[b])] != 1)
+            {
+                continue;
+            }
+
+            double e[3] = { points[b].x - points[a].x, points[b].y - points[a].y, points[b].z - points[a].z };
+            double bn[3] = { e[1] * n[2] - e[2] * n[1], e[2] * n[0] - e[0] * n[2], e[0] * n[1] - e[1] * n[0] };
+            double length = sqrt(bn[0] * bn[0] + bn[1] * bn[1] + bn[2] * bn[2]);
+            if (length == 0.0)
+            {
+                continue;
+            }
+
+            bn[0] /= length; bn[1] /= length; bn[2] /= length;
+            double d = -(bn[0] * points[a].x + bn[1] * points[a].y + bn[2] * points[a].z);
+            addPlane(quadrics[a], bn[0], bn[1], bn[2], d, BORDER_WEIGHT);
+            addPlane(quadrics[b], bn[0], bn[1], bn[2], d, BORDER_WEIGHT);
+        }
+    }
+
+    // bumped whenever a vertex's quadric changes, older candidates are skipped
+    std::vector<uint32_t> stamps(vertexCount, 0);
+    std::vector<uint8_t> removed(vertexCount, 0);
+    std::priority_queue<CollapseCandidate> candidates;
+
+    auto pushCandidate = [&](uint32_t from, uint32_t to)
+    {
+        if (locked[from])
+        {
+            return;
+        }
+
+        Quadric q = quadrics[from];
+        addQuadric(q, quadrics[to]);
+
+        CollapseCandidate candidate;
+        candidate.cost = evaluateQuadric(q, points[to]);
+        candidate.from = from;
+        candidate.to = to;
+        candidate.fromStamp = stamps[from];
+        candidate.toStamp = stamps[to];
+        candidates.push(candidate);
+    };
+
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        const uint32_t *tri = &triangles[t * 3];
+        for (int i = 0; i < 3; i++)
+        {
+            pushCandidate(tri[i], tri[(i + 1) % 3]);
+            pushCandidate(tri[(i + 1) % 3], tri[i]);
+        }
+    }
+
+    double maxCost = 0.0;
+    std::vector<uint32_t> fromNeighbours;
+    std::vector<uint32_t> toNeighbours;
+
+    while (liveTriangles * 3 > targetIndexCount && !candidates.empty())
+    {
+        CollapseCandidate candidate = candidates.top();
+        candidates.pop();
+
+        uint32_t from = candidate.from;
+        uint32_t to = candidate.to;
+        if (removed[from] || removed[to] || stamps[from] != candidate.fromStamp || stamps[to] != candidate.toStamp)
+        {
+            continue;
+        }
+
+        // The edge has to still exist, and the vertices may only share the
+        // neighbours of the triangles on it, or the surface pinches
+        uint32_t sharedTriangles = 0;
+        fromNeighbours.clear();
+        toNeighbours.clear();
+        for (uint32_t t : vertexTriangles[from])
+        {
+            if (triangleRemoved[t])
+            {
+                continue;
+            }
+            const uint32_t *tri = &triangles[t * 3];
+            bool hasTo = (tri[0] == to || tri[1] == to || tri[2] == to);
+            sharedTriangles += hasTo ? 1 : 0;
+            for (int i = 0; i < 3; i++)
+            {
+                if (tri[i] != from && tri[i] != to)
+                {
+                    fromNeighbours.push_back(tri[i]);
+                }
+            }
+        }
+        if (sharedTriangles == 0)
+        {
+            continue;
+        }
+        for (uint32_t t : vertexTriangles[to])
+        {
+            if (triangleRemoved[t])
+            {
+                continue;
+            }
+            const uint32_t *tri = &triangles[t * 3];
+            for (int i = 0; i < 3; i++)
+            {
+                if (tri[i] != from && tri[i] != to)
+                {
+                    toNeighbours.push_back(tri[i]);
+                }
+            }
+        }
+
+        std::sort(fromNeighbours.begin(), fromNeighbours.end());
+        fromNeighbours.erase(std::unique(fromNeighbours.begin(), fromNeighbours.end()), fromNeighbours.end());
+        std::sort(toNeighbours.begin(), toNeighbours.end());
+        toNeighbours.erase(std::unique(toNeighbours.begin(), toNeighbours.end()), toNeighbours.end());
+
+        uint32_t sharedNeighbours = 0;
+        for (uint32_t neighbour : fromNeighbours)
+        {
+            sharedNeighbours += std::binary_search(toNeighbours.begin(), toNeighbours.end(), neighbour) ? 1 : 0;
+        }
+        if (sharedNeighbours > sharedTriangles)
+        {
+            continue;
+        }
+
+        // no remaining triangle may flip over or collapse to a line
+        bool flips = false;
+        for (uint32_t t : vertexTriangles[from])
+        {
+            const uint32_t *tri = &triangles[t * 3];
+            if (triangleRemoved[t] || tri[0] == to || tri[1] == to || tri[2] == to)
+            {
+                continue;
+            }
+
+            SimplifyPosition moved[3] = { points[tri[0]], points[tri[1]], points[tri[2]] };
+            for (int i = 0; i < 3; i++)
+            {
+                if (tri[i] == from)
+                {
+                    moved[i] = points[to];
+                }
+            }
+
+            double before[3], after[3];
+            triangleNormal(points[tri[0]], points[tri[1]], points[tri[2]], before);
+            triangleNormal(moved[0], moved[1], moved[2], after);
+
+            double afterLength = after[0] * after[0] + after[1] * after[1] + after[2] * after[2];
+            if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0 || afterLength == 0.0)
+            {
+                flips = true;
+                break;
+            }
+        }
+        if (flips)
+        {
+            continue;
+        }
+
+        // collapse, the triangles on the edge go and the rest move over to the other vertex
+        for (uint32_t t : vertexTriangles[from])
+        {
+            if (triangleRemoved[t])
+            {
+                continue;
+            }
+
+            uint32_t *tri = &triangles[t * 3];
+            if (tri[0] == to || tri[1] == to || tri[2] == to)
+            {
+                triangleRemoved[t] = 1;
+                liveTriangles--;
+                continue;
+            }
+
+            for (int i = 0; i < 3; i++)
+            {
+                if (tri[i] == from)
+                {
+                    tri[i] = to;
+                }
+            }
+            vertexTriangles[to].push_back(t);
+        }
+
+        removed[from] = 1;
+        vertexTriangles[from].clear();
+        addQuadric(quadrics[to], quadrics[from]);
+        stamps[to]++;
+        maxCost = std::max(maxCost, candidate.cost);
+
+        // drop the triangles that went, then queue the new edges of the vertex
+        std::vector<uint32_t> &toTriangles = vertexTriangles[to];
+        toTriangles.erase(std::remove_if(toTriangles.begin(), toTriangles.end(), [&](uint32_t t) { return triangleRemoved[t] != 0; }), toTriangles.end());
+
+        for (uint32_t t : toTriangles)
+        {
+            const uint32_t *tri = &triangles[t * 3];
+            for (int i = 0; i < 3; i++)
+            {
+                if (tri[i] != to)
+                {
+                    pushCandidate(to, tri[i]);
+                    pushCandidate(tri[i], to);
+                }
+            }
+        }
+    }
+
+    std::vector<uint32_t> result;
+    result.reserve(liveTriangles * 3);
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        if (!triangleRemoved[t])
+        {
+            result.insert(result.end(), &triangles[t * 3], &triangles[t * 3] + 3);
+        }
+    }
+
+    if (resultError != nullptr)
+    {
+        *resultError = static_cast<float>(sqrt(maxCost));
+    }
+
+    return result;
+}
+
+void buildMeshLods(const float *positions, size_t positionStride, size_t vertexCount,
+                   std::vector<uint32_t> &indices, std::vector<MeshLod> &lods)
+{
+    lods.clear();
+
+    MeshLod full = { 0, static_cast<uint32_t>(indices.size()), 0.0f };
+    lods.push_back(full);
+
+    std::vector<uint32_t> current(indices);
+    float error = 0.0f;
+
+    while (lods.size() < MESH_MAX_LODS)
+    {
+        size_t targetTriangles = static_cast<size_t>(current.size() / 3 * MESH_LOD_REDUCTION);
+        if (targetTriangles < MESH_LOD_MIN_TRIANGLES)
+        {
+            break;
+        }
+
+        float levelError = 0.0f;
+        std::vector<uint32_t> next = simplifyMesh(positions, positionStride, vertexCount, current.data(), current.size(), targetTriangles * 3, &levelError);
+        if (next.size() > current.size() * MESH_LOD_MIN_PROGRESS)
+        {
+            break;
+        }
+
+        // each level is measured against the one before, the errors add up
+        error += levelError;
+
+        MeshLod lod = { static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(next.size()), error };
+        lods.push_back(lod);
+        indices.insert(indices.end(), next.begin(), next.end());
+
+        current.swap(next);
+    }
+}
+
+uint32_t selectMeshLod(const std::vector<MeshLod> &lods, float pixelsPerUnit, uint32_t currentLod)
+{
+    assert(!lods.empty());
+
+    uint32_t lod = std::min(currentLod, static_cast<uint32_t>(lods.size() - 1));
+
+    while (lod > 0 && lods[lod].error * pixelsPerUnit > MESH_LOD_PIXEL_ERROR)
+    {
+        lod--;
+    }
+
+    while (lod + 1 < lods.size() && lods[lod + 1].error * pixelsPerUnit <= MESH_LOD_PIXEL_ERROR * MESH_LOD_HYSTERESIS)
+    {
+        lod++;
+    }
+
+    return lod;
+}
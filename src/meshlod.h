@@ -0,0 +1,52 @@
+#ifndef __MESHLOD_H__
+#define __MESHLOD_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Levels of detail per mesh, including the full one
+const uint32_t MESH_MAX_LODS = 8;
+
+// Every level aims for this share of the triangles of the one before
+const float MESH_LOD_REDUCTION = 0.5f;
+
+// Levels stop when they get smaller than this, or shrink less than MESH_LOD_MIN_PROGRESS
+const uint32_t MESH_LOD_MIN_TRIANGLES = 64;
+const float MESH_LOD_MIN_PROGRESS = 0.9f;
+
+// Largest error of the drawn level, in pixels on screen
+const float MESH_LOD_PIXEL_ERROR = 1.0f;
+
+// A coarser level is only picked once its error is this far below the limit,
+// so an object sitting at the boundary doesn't switch every frame
+const float MESH_LOD_HYSTERESIS = 0.75f;
+
+// One level in the shared index buffer. The error is the distance in model
+// units the simplified surface may be off the full one
+struct MeshLod
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+};
+
+// Quadric error metric edge collapse. Collapses vertices into their
+// neighbours until the triangle list is down to targetIndexCount indices or
+// no collapse is left that keeps the surface from folding over. Vertices on
+// UV seams stay where they are, open borders are kept by extra quadrics.
+// Returns the remaining indices, the vertices themselves are not changed
+std::vector<uint32_t> simplifyMesh(const float *positions, size_t positionStride, size_t vertexCount,
+                                   const uint32_t *indices, size_t indexCount, size_t targetIndexCount, float *resultError);
+
+// Appends the chain of levels to the index list, level 0 being the indices
+// already in it. Each level is simplified from the one before
+void buildMeshLods(const float *positions, size_t positionStride, size_t vertexCount,
+                   std::vector<uint32_t> &indices, std::vector<MeshLod> &lods);
+
+// Level to draw for an object whose error of one model unit covers
+// pixelsPerUnit pixels, given the level drawn last frame
+uint32_t selectMeshLod(const std::vector<MeshLod> &lods, float pixelsPerUnit, uint32_t currentLod);
+
+#endif //__MESHLOD_H__
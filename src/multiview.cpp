@@ -0,0 +1,306 @@
+/*
+    Single pass rendering of several views through VK_KHR_multiview
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+
+bool getMultiviewFeatures(VkPhysicalDevice gpu, uint32_t viewCount, VkPhysicalDeviceMultiviewFeaturesKHR &enabledFeatures)
+{
+    if (!deviceExtensionEnabled(VK_KHR_MULTIVIEW_EXTENSION_NAME))
+    {
+        return false;
+    }
+
+    // only there when initVKInstance() could enable VK_KHR_get_physical_device_properties2
+    PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(g_app.instance, "vkGetPhysicalDeviceFeatures2KHR");
+    PFN_vkGetPhysicalDeviceProperties2KHR getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(g_app.instance, "vkGetPhysicalDeviceProperties2KHR");
+    if (getFeatures2 == nullptr || getProperties2 == nullptr)
+    {
+        return false;
+    }
+
+    VkPhysicalDeviceMultiviewFeaturesKHR supported = {};
+    supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES_KHR;
+
+    VkPhysicalDeviceFeatures2KHR features = {};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &supported;
+    getFeatures2(gpu, &features);
+
+    VkPhysicalDeviceMultiviewPropertiesKHR limits = {};
+    limits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_PROPERTIES_KHR;
+
+    VkPhysicalDeviceProperties2KHR properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &limits;
+    getProperties2(gpu, &properties);
+
+    if (!supported.multiview || limits.maxMultiviewViewCount < viewCount)
+    {
+        return false;
+    }
+
+    memset(&enabledFeatures, 0, sizeof(enabledFeatures));
+    enabledFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES_KHR;
+    enabledFeatures.multiview = VK_TRUE;
+
+    return true;
+}
+
+bool initMultiviewTarget()
+{
+    MultiviewTarget &multiview = g_app.multiview;
+
+    if (!multiview.enabled)
+    {
+        return true;
+    }
+
+    // the views are blitted into the swapchain image
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(g_app.gpu[0], g_app.colorFormat, &props);
+    if (!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT))
+    {
+        printf("Multiview: the swapchain format can't be blitted from\n");
+        return false;
+    }
+    multiview.blitFilter = (props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = g_app.colorFormat;
+    imageInfo.extent = { SCREEN_WIDTH, SCREEN_HEIGHT, 1 };
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = multiview.viewCount;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkResult result = vkCreateImage(g_app.device, &imageInfo, getHostAllocator(HOST_OBJECT_IMAGE), &multiview.colorImage);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(g_app.device, multiview.colorImage, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memAllocInfo.memoryTypeIndex))
+    {
+        printf("Multiview: no device local memory for the view layers\n");
+        return false;
+    }
+
+    result = allocateDeviceMemory(&memAllocInfo, &multiview.colorMemory);
+    assert(result == VK_SUCCESS);
+
+    result = vkBindImageMemory(g_app.device, multiview.colorImage, multiview.colorMemory, 0);
+    assert(result == VK_SUCCESS);
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = multiview.colorImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.format = g_app.colorFormat;
+    viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, multiview.viewCount };
+
+    result = vkCreateImageView(g_app.device, &viewInfo, getHostAllocator(HOST_OBJECT_IMAGE_VIEW), &multiview.colorView);
+    assert(result == VK_SUCCESS);
+
+    printf("Multiview: %u views drawn in one pass\n", multiview.viewCount);
+
+    return (result == VK_SUCCESS);
+}
+
+bool createMultiviewRenderPass(VkFormat colorFormat, VkFormat depthFormat, VkRenderPass *renderPass)
+{
+    VkAttachmentDescription attachmentDescription[2] = {};
+
+    // cleared every frame and read by the blits into the swapchain image
+    attachmentDescription[0].format = colorFormat;
+    attachmentDescription[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachmentDescription[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachmentDescription[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachmentDescription[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachmentDescription[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachmentDescription[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachmentDescription[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+    // kept for the depth pyramid, which is built from the first view
+    attachmentDescription[1].format = depthFormat;
+    attachmentDescription[1].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachmentDescription[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachmentDescription[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachmentDescription[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachmentDescription[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachmentDescription[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    attachmentDescription[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+    VkAttachmentReference depthReference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+    VkSubpassDescription subpassDescription = {};
+    subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpassDescription.colorAttachmentCount = 1;
+    subpassDescription.pColorAttachments = &colorReference;
+    subpassDescription.pDepthStencilAttachment = &depthReference;
+
+    // the blits read the layers once the pass is done with them, and the
+    // blits of the frame before have to be done before they are cleared
+    VkSubpassDependency dependencies[2] = {};
+    dependencies[0].srcSubpass = 0;
+    dependencies[0].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    dependencies[1] = getPreviousFrameDependency();
+
+    // Every view of the mask is drawn by each draw. The views are close
+    // together, so they are marked as correlated for implementations that
+    // can share work between them
+    uint32_t viewMask = (1u << g_app.multiview.viewCount) - 1;
+
+    VkRenderPassMultiviewCreateInfoKHR multiviewInfo = {};
+    multiviewInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO_KHR;
+    multiviewInfo.subpassCount = 1;
+    multiviewInfo.pViewMasks = &viewMask;
+    multiviewInfo.correlationMaskCount = 1;
+    multiviewInfo.pCorrelationMasks = &viewMask;
+
+    VkRenderPassCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    info.pNext = &multiviewInfo;
+    info.attachmentCount = 2;
+    info.pAttachments = attachmentDescription;
+    info.subpassCount = 1;
+    info.pSubpasses = &subpassDescription;
+    info.dependencyCount = 2;
+    info.pDependencies = dependencies;
+
+    return (vkCreateRenderPass(g_app.device, &info, getHostAllocator(HOST_OBJECT_RENDER_PASS), renderPass) == VK_SUCCESS);
+}
+
+// Distance of the view from the camera along its x axis
+static float getViewSpread(uint32_t view)
+{
+    return (static_cast<float>(view) - (g_app.multiview.viewCount - 1) * 0.5f) * MULTIVIEW_VIEW_SPACING;
+}
+
+glm::mat4 getViewOffset(uint32_t view)
+{
+    if (!g_app.multiview.enabled || view >= g_app.multiview.viewCount)
+    {
+        return glm::mat4();
+    }
+
+    return glm::translate(glm::mat4(), glm::vec3(-getViewSpread(view), 0.0f, 0.0f));
+}
+
+glm::mat4 getCullViewProjection(const glm::mat4 &projectionMatrix, const glm::mat4 &viewMatrix)
+{
+    if (!g_app.multiview.enabled)
+    {
+        return projectionMatrix * viewMatrix;
+    }
+
+    // The views look the same way from a row of points. Pulled back until
+    // its frustum takes in the outermost views, the camera sees all of them
+    float pullBack = getViewSpread(g_app.multiview.viewCount - 1) * projectionMatrix[0][0];
+
+    return projectionMatrix * glm::translate(glm::mat4(), glm::vec3(0.0f, 0.0f, -pullBack)) * viewMatrix;
+}
+
+void recordMultiviewPresent(VkCommandBuffer cmdBuffer, VkImage swapchainImage)
+{
+    MultiviewTarget &multiview = g_app.multiview;
+
+    if (!multiview.enabled)
+    {
+        return;
+    }
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = swapchainImage;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    // the tiles keep the aspect of the views, the space around them is background
+    VkImageSubresourceRange colorRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    vkCmdClearColorImage(cmdBuffer, swapchainImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clear_color, 1, &colorRange);
+
+    VkMemoryBarrier clearBarrier = {};
+    clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clearBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+    // as square a grid of tiles as the views fill
+    uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(multiview.viewCount))));
+    uint32_t rows = (multiview.viewCount + columns - 1) / columns;
+
+    float tileWidth = static_cast<float>(SCREEN_WIDTH) / columns;
+    float tileHeight = static_cast<float>(SCREEN_HEIGHT) / rows;
+    float scale = std::min(tileWidth / SCREEN_WIDTH, tileHeight / SCREEN_HEIGHT);
+    int32_t width = static_cast<int32_t>(SCREEN_WIDTH * scale);
+    int32_t height = static_cast<int32_t>(SCREEN_HEIGHT * scale);
+
+    for (uint32_t view = 0; view < multiview.viewCount; view++)
+    {
+        int32_t x = static_cast<int32_t>((view % columns) * tileWidth + (tileWidth - width) * 0.5f);
+        int32_t y = static_cast<int32_t>((view / columns) * tileHeight + (tileHeight - height) * 0.5f);
+
+        VkImageBlit blit = {};
+        blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, view, 1 };
+        blit.srcOffsets[1] = { static_cast<int32_t>(SCREEN_WIDTH), static_cast<int32_t>(SCREEN_HEIGHT), 1 };
+        blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        blit.dstOffsets[0] = { x, y, 0 };
+        blit.dstOffsets[1] = { x + width, y + height, 1 };
+
+        vkCmdBlitImage(cmdBuffer, multiview.colorImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       swapchainImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, multiview.blitFilter);
+    }
+
+    // back to where the pre present barrier expects it
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void destroyMultiviewTarget()
+{
+    MultiviewTarget &multiview = g_app.multiview;
+
+    if (multiview.colorImage == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    vkDestroyImageView(g_app.device, multiview.colorView, getHostAllocator(HOST_OBJECT_IMAGE_VIEW));
+    vkDestroyImage(g_app.device, multiview.colorImage, getHostAllocator(HOST_OBJECT_IMAGE));
+    freeDeviceMemory(multiview.colorMemory);
+
+    multiview.colorImage = VK_NULL_HANDLE;
+    multiview.colorView = VK_NULL_HANDLE;
+    multiview.colorMemory = VK_NULL_HANDLE;
+}
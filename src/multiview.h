@@ -0,0 +1,59 @@
+#ifndef __MULTIVIEW_H__
+#define __MULTIVIEW_H__
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+
+// Views one pass can draw, enough for the six faces of a cube map. The
+// uniform buffer always holds this many matrices, see data/multiview.vert
+const uint32_t MULTIVIEW_MAX_VIEWS = 6;
+
+// The views are a row of cameras this far apart, centered on the camera
+const float MULTIVIEW_VIEW_SPACING = 0.5f;
+
+// Single pass multiview rendering through VK_KHR_multiview. The render
+// pass has a view mask with a bit per view, so every draw is recorded and
+// submitted once and the device runs the vertex shader for each view,
+// which picks its matrices with gl_ViewIndex. The views go to the layers
+// of an array target, and are copied side by side into the swapchain
+// image to be shown
+struct MultiviewTarget
+{
+    // --views <count>, a single view is drawn without it
+    uint32_t viewCount = 0;
+    bool enabled = false;
+
+    // one layer per view, the depth buffer has as many layers
+    VkImage colorImage = VK_NULL_HANDLE;
+    VkDeviceMemory colorMemory = VK_NULL_HANDLE;
+    VkImageView colorView = VK_NULL_HANDLE;
+
+    // linear where the color format can be filtered when blitted
+    VkFilter blitFilter = VK_FILTER_NEAREST;
+};
+
+// Fills in the features to enable when the device can draw viewCount views in one pass
+bool getMultiviewFeatures(VkPhysicalDevice gpu, uint32_t viewCount, VkPhysicalDeviceMultiviewFeaturesKHR &enabledFeatures);
+
+// Creates the layered color target, before the framebuffers that use it
+bool initMultiviewTarget();
+
+// The render pass drawing every view of the layered target at once
+bool createMultiviewRenderPass(VkFormat colorFormat, VkFormat depthFormat, VkRenderPass *renderPass);
+
+// Eye space offset of a view from the camera, identity for a single view
+glm::mat4 getViewOffset(uint32_t view);
+
+// View projection that sees everything any of the views sees, for culling
+glm::mat4 getCullViewProjection(const glm::mat4 &projectionMatrix, const glm::mat4 &viewMatrix);
+
+// Copies every view into its tile of the swapchain image, after the scene
+// render pass. The image is left as a color attachment, as it was found
+void recordMultiviewPresent(VkCommandBuffer cmdBuffer, VkImage swapchainImage);
+
+void destroyMultiviewTarget();
+
+#endif //__MULTIVIEW_H__
@@ -0,0 +1,734 @@
+/*
+    Frustum and hierarchical Z culling against a depth pyramid built in compute and read back a few frames later
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+
+static bool createHostBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer *buffer, VkDeviceMemory *memory, void **mapped)
+{
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+
+    VkResult result = vkCreateBuffer(g_app.device, &bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), buffer);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_app.device, *buffer, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memAllocInfo.memoryTypeIndex))
+    {
+        return false;
+    }
+
+    result = allocateDeviceMemory(&memAllocInfo, memory);
+    assert(result == VK_SUCCESS);
+
+    vkBindBufferMemory(g_app.device, *buffer, *memory, 0);
+
+    // stays mapped for the lifetime of the buffer
+    result = vkMapMemory(g_app.device, *memory, 0, size, 0, mapped);
+
+    return (result == VK_SUCCESS);
+}
+
+static bool initDepthPyramidImage()
+{
+    OcclusionCuller &occlusion = g_app.occlusion;
+
+    // the first level is half the depth buffer, every level halves it again down to 1x1
+    uint32_t width = std::max(SCREEN_WIDTH / 2, 1u);
+    uint32_t height = std::max(SCREEN_HEIGHT / 2, 1u);
+    occlusion.levelCount = 0;
+
+    while (occlusion.levelCount < OCCLUSION_MAX_LEVELS)
+    {
+        occlusion.levelSizes[occlusion.levelCount] = { width, height };
+        occlusion.levelCount++;
+
+        if (width == 1 && height == 1)
+        {
+            break;
+        }
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+    }
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = VK_FORMAT_R32_SFLOAT;
+    imageInfo.extent.width = occlusion.levelSizes[0].width;
+    imageInfo.extent.height = occlusion.levelSizes[0].height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = occlusion.levelCount;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkResult result = vkCreateImage(g_app.device, &imageInfo, getHostAllocator(HOST_OBJECT_IMAGE), &occlusion.pyramid);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(g_app.device, occlusion.pyramid, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memAllocInfo.memoryTypeIndex))
+    {
+        return false;
+    }
+
+    result = allocateDeviceMemory(&memAllocInfo, &occlusion.pyramidMemory);
+    assert(result == VK_SUCCESS);
+
+    vkBindImageMemory(g_app.device, occlusion.pyramid, occlusion.pyramidMemory, 0);
+
+    // every level is written, sampled and copied in the general layout
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = occlusion.pyramid;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, occlusion.levelCount, 0, 1 };
+
+    VkCommandBuffer setupCmdBuffer = beginSetupCommands();
+    vkCmdPipelineBarrier(setupCmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    endSetupCommands();
+
+    for (uint32_t level = 0; level < occlusion.levelCount; level++)
+    {
+        occlusion.levelViews[level] = getImageView(occlusion.pyramid, VK_FORMAT_R32_SFLOAT, level, 1);
+    }
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = g_app.depth.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = g_app.depth.format;
+    viewInfo.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+    result = vkCreateImageView(g_app.device, &viewInfo, getHostAllocator(HOST_OBJECT_IMAGE_VIEW), &occlusion.depthView);
+    assert(result == VK_SUCCESS);
+
+    return (result == VK_SUCCESS);
+}
+
+static bool initDepthPyramidPipeline()
+{
+    OcclusionCuller &occlusion = g_app.occlusion;
+
+    VkDescriptorSetLayoutBinding bindings[2] = {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    occlusion.descriptorSetLayout = createDescriptorSetLayout(bindings, 2);
+
+    // texels are fetched, the sampler is only there for the binding
+    SamplerDesc samplerDesc = { VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE };
+    occlusion.sampler = getSampler(samplerDesc);
+
+    for (uint32_t level = 0; level < occlusion.levelCount; level++)
+    {
+        DescriptorResource resources[2];
+        memset(resources, 0, sizeof(resources));
+
+        resources[0].image.sampler = occlusion.sampler;
+        if (level == 0)
+        {
+            resources[0].image.imageView = occlusion.depthView;
+            resources[0].image.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+        }
+        else
+        {
+            resources[0].image.imageView = occlusion.levelViews[level - 1];
+            resources[0].image.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        }
+
+        resources[1].image.imageView = occlusion.levelViews[level];
+        resources[1].image.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        occlusion.levelSets[level] = getCachedDescriptorSet(occlusion.descriptorSetLayout, resources);
+        if (occlusion.levelSets[level] == VK_NULL_HANDLE)
+        {
+            return false;
+        }
+    }
+
+    // source and destination sizes, matching the PyramidLevel block in depthpyramid.comp
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(int32_t) * 4;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &occlusion.descriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    VkResult result = vkCreatePipelineLayout(g_app.device, &pipelineLayoutCreateInfo, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT), &occlusion.pipelineLayout);
+    assert(result == VK_SUCCESS);
+
+    occlusion.shader = loadShaderGLSL("data/depthpyramid.comp", VK_SHADER_STAGE_COMPUTE_BIT);
+
+    VkComputePipelineCreateInfo pipelineCreateInfo = {};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCreateInfo.stage.module = occlusion.shader;
+    pipelineCreateInfo.stage.pName = "main";
+    pipelineCreateInfo.layout = occlusion.pipelineLayout;
+
+    result = vkCreateComputePipelines(g_app.device, g_app.pipelineCache, 1, &pipelineCreateInfo, getHostAllocator(HOST_OBJECT_PIPELINE), &occlusion.pipeline);
+    assert(result == VK_SUCCESS);
+
+    return (result == VK_SUCCESS);
+}
+
+static bool initDepthPyramidReadbacks()
+{
+    OcclusionCuller &occlusion = g_app.occlusion;
+
+    // the coarse levels are all the CPU reads, a few thousand texels at most
+    occlusion.readbackLevel = 0;
+    while (occlusion.readbackLevel + 1 < occlusion.levelCount && occlusion.levelSizes[occlusion.readbackLevel].width > OCCLUSION_READBACK_WIDTH)
+    {
+        occlusion.readbackLevel++;
+    }
+
+    occlusion.readbackTexels = 0;
+    for (uint32_t level = occlusion.readbackLevel; level < occlusion.levelCount; level++)
+    {
+        occlusion.readbackOffsets[level] = occlusion.readbackTexels;
+        occlusion.readbackTexels += occlusion.levelSizes[level].width * occlusion.levelSizes[level].height;
+    }
+
+    for (uint32_t i = 0; i < g_app.deletionQueue.fenceCount; i++)
+    {
+        DepthPyramidReadback &readback = occlusion.readbacks[i];
+
+        void *mapped;
+        if (!createHostBuffer(occlusion.readbackTexels * sizeof(float), VK_BUFFER_USAGE_TRANSFER_DST_BIT, &readback.buffer, &readback.memory, &mapped))
+        {
+            return false;
+        }
+        readback.mapped = static_cast<float*>(mapped);
+        readback.frame = 0;
+    }
+
+    occlusion.depth.assign(occlusion.readbackTexels, 1.0f);
+    occlusion.depthFrame = 0;
+
+    return true;
+}
+
+bool initOcclusionCulling()
+{
+    OcclusionCuller &occlusion = g_app.occlusion;
+
+    // the scene is drawn through the indirect buffer with or without the pyramid
+    void *mapped;
+    VkDeviceSize indirectBufferSize = sizeof(VkDrawIndexedIndirectCommand) * OCCLUSION_MAX_DRAWS * SCENE_DRAW_LIST_COUNT * g_app.swapchainImageCount;
+    if (!createHostBuffer(indirectBufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, &occlusion.indirect.buffer, &occlusion.indirect.memory, &mapped))
+    {
+        return false;
+    }
+    occlusion.indirect.mapped = static_cast<VkDrawIndexedIndirectCommand*>(mapped);
+    memset(occlusion.indirect.mapped, 0, indirectBufferSize);
+
+    occlusion.multiDraw = (g_app.enabledFeatures.multiDrawIndirect == VK_TRUE);
+    occlusion.firstInstance = (g_app.enabledFeatures.drawIndirectFirstInstance == VK_TRUE);
+
+    memset(&occlusion.stats, 0, sizeof(occlusion.stats));
+
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(g_app.gpu[0], g_app.depth.format, &props);
+    if (!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+    {
+        printf("Occlusion culling: the depth format can't be sampled, frustum culling only\n");
+        return true;
+    }
+
+    if (!initDepthPyramidImage() || !initDepthPyramidPipeline() || !initDepthPyramidReadbacks())
+    {
+        return false;
+    }
+
+    occlusion.enabled = true;
+
+    printf("Occlusion culling: %u pyramid levels, %u read back from level %u\n",
+           occlusion.levelCount, occlusion.levelCount - occlusion.readbackLevel, occlusion.readbackLevel);
+
+    return true;
+}
+
+// Where the camera of a perspective view projection is, the point whose
+// clip position has x, y and w at zero
+static glm::vec3 eyePosition(const glm::mat4 &viewProj)
+{
+    glm::vec4 eye = glm::inverse(viewProj) * glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+    return glm::vec3(eye) / eye.w;
+}
+
+void updateOcclusionCulling()
+{
+    OcclusionCuller &occlusion = g_app.occlusion;
+
+    memset(&occlusion.stats, 0, sizeof(occlusion.stats));
+
+    if (!occlusion.enabled)
+    {
+        return;
+    }
+
+    const DepthPyramidReadback *newest = nullptr;
+    for (uint32_t i = 0; i < g_app.deletionQueue.fenceCount; i++)
+    {
+        const DepthPyramidReadback &readback = occlusion.readbacks[i];
+        if (readback.frame > occlusion.depthFrame && isFrameComplete(readback.frame) &&
+            (newest == nullptr || readback.frame > newest->frame))
+        {
+            newest = &readback;
+        }
+    }
+
+    // copied out, recordDepthPyramid() writes the buffer again once the slot comes around
+    if (newest != nullptr)
+    {
+        memcpy(occlusion.depth.data(), newest->mapped, occlusion.readbackTexels * sizeof(float));
+        occlusion.depthViewProj = newest->viewProj;
+        occlusion.depthEye = eyePosition(newest->viewProj);
+        occlusion.depthFrame = newest->frame;
+    }
+}
+
+static glm::vec4 matrixRow(const glm::mat4 &m, int row)
+{
+    return glm::vec4(m[0][row], m[1][row], m[2][row], m[3][row]);
+}
+
+static bool isSameView(const glm::mat4 &a, const glm::mat4 &b)
+{
+    for (int column = 0; column < 4; column++)
+    {
+        for (int row = 0; row < 4; row++)
+        {
+            if (std::abs(a[column][row] - b[column][row]) > OCCLUSION_VIEW_TOLERANCE)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// True when the box, grown on every side, is behind the farthest depth of
+// every pyramid texel it covers. The parts of it outside the pyramid's view
+// are only left out when that is the current view, which doesn't see them
+static bool isOccluded(const CullBounds &bounds, float grow, bool sameView)
+{
+    const OcclusionCuller &occlusion = g_app.occlusion;
+
+    glm::vec3 boundsMin = bounds.min - glm::vec3(grow);
+    glm::vec3 boundsMax = bounds.max + glm::vec3(grow);
+
+    float nearest = 1.0f;
+    float minX = 1.0f, minY = 1.0f;
+    float maxX = -1.0f, maxY = -1.0f;
+
+    for (int i = 0; i < 8; i++)
+    {
+        glm::vec4 corner((i & 1) ? boundsMax.x : boundsMin.x,
+                         (i & 2) ? boundsMax.y : boundsMin.y,
+                         (i & 4) ? boundsMax.z : boundsMin.z, 1.0f);
+
+        glm::vec4 clip = occlusion.depthViewProj * corner;
+
+        // crosses the near plane, it covers the view
+        if (clip.w <= 1e-5f)
+        {
+            return false;
+        }
+
+        float x = clip.x / clip.w;
+        float y = clip.y / clip.w;
+        nearest = std::min(nearest, clip.z / clip.w);
+        minX = std::min(minX, x);
+        minY = std::min(minY, y);
+        maxX = std::max(maxX, x);
+        maxY = std::max(maxY, y);
+    }
+
+    // the depth attachment clamps to the viewport depth range
+    nearest = std::max(nearest, 0.0f);
+
+    // the pyramid knows nothing of what the current view sees past its edges
+    if (!sameView && (minX < -1.0f || minY < -1.0f || maxX > 1.0f || maxY > 1.0f))
+    {
+        return false;
+    }
+
+    // the depth buffer pixels the box covers
+    minX = (std::max(minX, -1.0f) * 0.5f + 0.5f) * SCREEN_WIDTH;
+    maxX = (std::min(maxX, 1.0f) * 0.5f + 0.5f) * SCREEN_WIDTH;
+    minY = (std::max(minY, -1.0f) * 0.5f + 0.5f) * SCREEN_HEIGHT;
+    maxY = (std::min(maxY, 1.0f) * 0.5f + 0.5f) * SCREEN_HEIGHT;
+
+    // go down the readback levels until the box covers no more than 2x2 texels
+    uint32_t level = occlusion.readbackLevel;
+    uint32_t x0, x1, y0, y1;
+    while (true)
+    {
+        const VkExtent2D &size = occlusion.levelSizes[level];
+        float scale = 1.0f / static_cast<float>(2u << level);
+
+        // the last texel of a level also covers the pixels left over by odd sizes
+        x0 = std::min(static_cast<uint32_t>(minX * scale), size.width - 1);
+        x1 = std::min(static_cast<uint32_t>(maxX * scale), size.width - 1);
+        y0 = std::min(static_cast<uint32_t>(minY * scale), size.height - 1);
+        y1 = std::min(static_cast<uint32_t>(maxY * scale), size.height - 1);
+
+        if ((x1 - x0 <= 1 && y1 - y0 <= 1) || level + 1 == occlusion.levelCount)
+        {
+            break;
+        }
+        level++;
+    }
+
+    const float *texels = &occlusion.depth[occlusion.readbackOffsets[level]];
+    uint32_t width = occlusion.levelSizes[level].width;
+
+    float farthest = 0.0f;
+    for (uint32_t y = y0; y <= y1; y++)
+    {
+        for (uint32_t x = x0; x <= x1; x++)
+        {
+            farthest = std::max(farthest, texels[y * width + x]);
+        }
+    }
+
+    return nearest > farthest;
+}
+
+void cullObjects(Bvh &bvh, const glm::mat4 &viewProj, std::vector<uint32_t> &visible)
+{
+    OcclusionCuller &occlusion = g_app.occlusion;
+
+    // Planes of the clip volume, pointing inwards. Depth is clipped to
+    // 0 <= z <= w as in Vulkan
+    glm::vec4 row0 = matrixRow(viewProj, 0);
+    glm::vec4 row1 = matrixRow(viewProj, 1);
+    glm::vec4 row2 = matrixRow(viewProj, 2);
+    glm::vec4 row3 = matrixRow(viewProj, 3);
+
+    glm::vec4 planes[6] = { row3 + row0, row3 - row0, row3 + row1, row3 - row1, row2, row3 - row2 };
+
+    // The pyramid can't tell what was hidden behind its occluders, which a
+    // camera that has moved may see. The boxes are tested from the pyramid's
+    // view, grown by the distance, so objects by an occluder's edge stay
+    // drawn. Anything that still shows up late comes back with the next
+    // pyramid. After a jump, and in multiview mode, whose other views look
+    // around the first one's occluders, only the frustum is tested
+    float motion = glm::length(eyePosition(viewProj) - occlusion.depthEye);
+    bool sameView = isSameView(occlusion.depthViewProj, viewProj);
+    bool testOcclusion = occlusion.enabled && occlusion.depthFrame > 0 && !g_app.multiview.enabled &&
+                         (sameView || motion <= OCCLUSION_MAX_CAMERA_MOTION);
+
+    uint32_t count = static_cast<uint32_t>(bvh.objectBounds.size());
+    if (occlusion.visibleCulls.size() != count)
+    {
+        // everything counts as drawn before the first cull
+        occlusion.visibleCulls.assign(count, occlusion.cullCount);
+    }
+    occlusion.cullCount++;
+
+    // the draws are built from runs of consecutive objects
+    occlusion.inFrustum.clear();
+    queryBvhFrustum(bvh, planes, occlusion.inFrustum);
+    std::sort(occlusion.inFrustum.begin(), occlusion.inFrustum.end());
+
+    occlusion.stats.tested += count;
+    occlusion.stats.frustumRejected += count - static_cast<uint32_t>(occlusion.inFrustum.size());
+
+    for (uint32_t i : occlusion.inFrustum)
+    {
+        bool occluded = testOcclusion && isOccluded(bvh.objectBounds[i], sameView ? 0.0f : motion, sameView);
+        bool wasVisible = occlusion.visibleCulls[i] == occlusion.cullCount - 1;
+
+        // the pyramid is a few frames old, what was drawn last frame stays
+        // for one more so the occluders themselves don't flicker
+        if (!occluded || wasVisible)
+        {
+            visible.push_back(i);
+            occlusion.stats.visible++;
+        }
+        else
+        {
+            occlusion.stats.occlusionRejected++;
+        }
+
+        if (!occluded)
+        {
+            occlusion.visibleCulls[i] = occlusion.cullCount;
+        }
+    }
+}
+
+uint32_t writeSceneDraws(uint32_t imageIndex, SceneDrawList list, const std::vector<uint32_t> &visibleInstances, const std::vector<uint32_t> &instanceLods)
+{
+    OcclusionCuller &occlusion = g_app.occlusion;
+
+    VkDrawIndexedIndirectCommand *draws = &occlusion.indirect.mapped[(imageIndex * SCENE_DRAW_LIST_COUNT + list) * OCCLUSION_MAX_DRAWS];
+    uint32_t drawCount = 0;
+
+    // Without drawIndirectFirstInstance every draw starts at instance 0,
+    // one draw at the finest level picked then covers everything up to the
+    // last visible instance
+    if (!occlusion.firstInstance && !visibleInstances.empty())
+    {
+        uint32_t lod = instanceLods[visibleInstances[0]];
+        for (uint32_t instance : visibleInstances)
+        {
+            lod = std::min(lod, instanceLods[instance]);
+        }
+
+        const MeshLod &level = g_app.indices.lods[lod];
+        VkDrawIndexedIndirectCommand &draw = draws[drawCount++];
+        draw.indexCount = level.indexCount;
+        draw.firstIndex = level.firstIndex;
+        draw.vertexOffset = 0;
+        draw.firstInstance = 0;
+        draw.instanceCount = visibleInstances.back() + 1;
+    }
+
+    for (uint32_t i = 0; i < visibleInstances.size() && occlusion.firstInstance; i++)
+    {
+        uint32_t instance = visibleInstances[i];
+        const MeshLod &level = g_app.indices.lods[instanceLods[instance]];
+
+        // a run goes on while the instances follow each other at the same level
+        if (drawCount > 0 && draws[drawCount - 1].firstIndex == level.firstIndex &&
+            draws[drawCount - 1].firstInstance + draws[drawCount - 1].instanceCount == instance)
+        {
+            draws[drawCount - 1].instanceCount++;
+            continue;
+        }
+
+        // Past the last draw the rest is merged into it at the finer of the
+        // two levels, drawing some hidden instances along
+        if (drawCount == OCCLUSION_MAX_DRAWS)
+        {
+            VkDrawIndexedIndirectCommand &last = draws[drawCount - 1];
+            if (level.indexCount > last.indexCount)
+            {
+                last.indexCount = level.indexCount;
+                last.firstIndex = level.firstIndex;
+            }
+            last.instanceCount = instance - last.firstInstance + 1;
+            continue;
+        }
+
+        VkDrawIndexedIndirectCommand &draw = draws[drawCount++];
+        draw.indexCount = level.indexCount;
+        draw.firstIndex = level.firstIndex;
+        draw.vertexOffset = 0;
+        draw.firstInstance = instance;
+        draw.instanceCount = 1;
+    }
+
+    for (uint32_t i = drawCount; i < OCCLUSION_MAX_DRAWS; i++)
+    {
+        draws[i].instanceCount = 0;
+    }
+
+    return drawCount;
+}
+
+void recordSceneDraws(VkCommandBuffer cmdBuffer, uint32_t imageIndex, SceneDrawList list)
+{
+    OcclusionCuller &occlusion = g_app.occlusion;
+
+    // The draws are written by writeSceneDraws() every frame, so the
+    // command buffer can be recorded once and still only draw what is visible
+    VkDeviceSize offset = (imageIndex * SCENE_DRAW_LIST_COUNT + list) * OCCLUSION_MAX_DRAWS * sizeof(VkDrawIndexedIndirectCommand);
+
+    if (occlusion.multiDraw)
+    {
+        vkCmdDrawIndexedIndirect(cmdBuffer, occlusion.indirect.buffer, offset, OCCLUSION_MAX_DRAWS, sizeof(VkDrawIndexedIndirectCommand));
+        return;
+    }
+
+    for (uint32_t i = 0; i < OCCLUSION_MAX_DRAWS; i++)
+    {
+        vkCmdDrawIndexedIndirect(cmdBuffer, occlusion.indirect.buffer, offset + i * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+    }
+}
+
+VkCommandBuffer recordDepthPyramid(const glm::mat4 &viewProj)
+{
+    OcclusionCuller &occlusion = g_app.occlusion;
+
+    if (!occlusion.enabled)
+    {
+        return VK_NULL_HANDLE;
+    }
+
+    // same slot as the frame fence, the frame that used it last has been read by updateOcclusionCulling()
+    uint64_t frame = getRecordingFrame();
+    DepthPyramidReadback &readback = occlusion.readbacks[frame % g_app.deletionQueue.fenceCount];
+
+    VkCommandBuffer cmdBuffer = beginFrameCommandBuffer();
+
+    // the depth attachment is sampled by the first level, the pyramid of the
+    // last frame may still be copied out
+    VkImageMemoryBarrier barriers[2] = {};
+    barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].image = g_app.depth.image;
+    barriers[0].subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+    barriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[1].srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[1].image = occlusion.pyramid;
+    barriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, occlusion.levelCount, 0, 1 };
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, occlusion.pipeline);
+
+    for (uint32_t level = 0; level < occlusion.levelCount; level++)
+    {
+        const VkExtent2D &size = occlusion.levelSizes[level];
+        int32_t sizes[4] = {
+            static_cast<int32_t>(level == 0 ? SCREEN_WIDTH : occlusion.levelSizes[level - 1].width),
+            static_cast<int32_t>(level == 0 ? SCREEN_HEIGHT : occlusion.levelSizes[level - 1].height),
+            static_cast<int32_t>(size.width),
+            static_cast<int32_t>(size.height) };
+
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, occlusion.pipelineLayout, 0, 1, &occlusion.levelSets[level], 0, nullptr);
+        vkCmdPushConstants(cmdBuffer, occlusion.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sizes), sizes);
+        vkCmdDispatch(cmdBuffer, (size.width + 7) / 8, (size.height + 7) / 8, 1);
+
+        // the next level reads this one, the readback copies it
+        VkImageMemoryBarrier levelBarrier = barriers[1];
+        levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+        levelBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, nullptr, 0, nullptr, 1, &levelBarrier);
+    }
+
+    // the next frame's render pass clears the depth attachment again
+    VkImageMemoryBarrier depthBarrier = barriers[0];
+    depthBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    depthBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+
+    VkBufferImageCopy copyRegions[OCCLUSION_MAX_LEVELS] = {};
+    uint32_t regionCount = 0;
+    for (uint32_t level = occlusion.readbackLevel; level < occlusion.levelCount; level++)
+    {
+        VkBufferImageCopy &region = copyRegions[regionCount++];
+        region.bufferOffset = occlusion.readbackOffsets[level] * sizeof(float);
+        region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+        region.imageExtent = { occlusion.levelSizes[level].width, occlusion.levelSizes[level].height, 1 };
+    }
+
+    vkCmdCopyImageToBuffer(cmdBuffer, occlusion.pyramid, VK_IMAGE_LAYOUT_GENERAL, readback.buffer, regionCount, copyRegions);
+
+    VkBufferMemoryBarrier hostBarrier = {};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.buffer = readback.buffer;
+    hostBarrier.offset = 0;
+    hostBarrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &hostBarrier, 0, nullptr);
+
+    VkResult result = vkEndCommandBuffer(cmdBuffer);
+    assert(result == VK_SUCCESS);
+    (void)result;
+
+    readback.viewProj = viewProj;
+    readback.frame = frame;
+
+    return cmdBuffer;
+}
+
+void destroyOcclusionCulling()
+{
+    OcclusionCuller &occlusion = g_app.occlusion;
+
+    vkUnmapMemory(g_app.device, occlusion.indirect.memory);
+    vkDestroyBuffer(g_app.device, occlusion.indirect.buffer, getHostAllocator(HOST_OBJECT_BUFFER));
+    freeDeviceMemory(occlusion.indirect.memory);
+
+    if (!occlusion.enabled)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < g_app.deletionQueue.fenceCount; i++)
+    {
+        vkUnmapMemory(g_app.device, occlusion.readbacks[i].memory);
+        vkDestroyBuffer(g_app.device, occlusion.readbacks[i].buffer, getHostAllocator(HOST_OBJECT_BUFFER));
+        freeDeviceMemory(occlusion.readbacks[i].memory);
+    }
+
+    vkDestroyPipeline(g_app.device, occlusion.pipeline, getHostAllocator(HOST_OBJECT_PIPELINE));
+    vkDestroyPipelineLayout(g_app.device, occlusion.pipelineLayout, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT));
+    vkDestroyShaderModule(g_app.device, occlusion.shader, getHostAllocator(HOST_OBJECT_SHADER_MODULE));
+
+    evictCachedDescriptorSets((uint64_t)occlusion.depthView);
+    vkDestroyImageView(g_app.device, occlusion.depthView, getHostAllocator(HOST_OBJECT_IMAGE_VIEW));
+    releaseImageViews(occlusion.pyramid);
+    vkDestroyImage(g_app.device, occlusion.pyramid, getHostAllocator(HOST_OBJECT_IMAGE));
+    freeDeviceMemory(occlusion.pyramidMemory);
+
+    occlusion.enabled = false;
+}
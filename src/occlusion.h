@@ -0,0 +1,142 @@
+#ifndef __OCCLUSION_H__
+#define __OCCLUSION_H__
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "deletionqueue.h"
+#include "bvh.h"
+
+// Upper bound of pyramid levels, enough for a 64k wide depth buffer
+const uint32_t OCCLUSION_MAX_LEVELS = 16;
+
+// Levels this wide and smaller are copied back for the CPU tests
+const uint32_t OCCLUSION_READBACK_WIDTH = 64;
+
+// Indirect draws of a draw list per swapchain image, one per run of visible instances
+const uint32_t OCCLUSION_MAX_DRAWS = 64;
+
+// The culled parts of the scene, each drawn from instances of its own
+enum SceneDrawList
+{
+    SCENE_DRAWS_INSTANCES = 0,  // instances of the material
+    SCENE_DRAWS_WORLD,          // objects of the resident world cells
+    SCENE_DRAW_LIST_COUNT
+};
+
+// A pyramid drawn from a view this close to the current one covers the same screen
+const float OCCLUSION_VIEW_TOLERANCE = 1e-4f;
+
+// Boxes are tested against an older pyramid grown by how far the camera
+// has moved since it was drawn, up to this far in world units. Past that
+// only the frustum is tested
+const float OCCLUSION_MAX_CAMERA_MOTION = 2.0f;
+
+// World space bounds of one object, as the BVH keeps them
+typedef BvhBounds CullBounds;
+
+struct CullStats
+{
+    uint32_t tested;
+    uint32_t frustumRejected;
+    uint32_t occlusionRejected;
+    uint32_t visible;
+};
+
+// Coarse pyramid levels of one frame, copied into a host visible buffer
+// by the frame's last submit and read once its fence has signalled
+struct DepthPyramidReadback
+{
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    float* mapped;
+    glm::mat4 viewProj;
+    uint64_t frame;
+};
+
+// Hierarchical Z culling. Every frame the depth attachment is reduced into
+// a pyramid of farthest depths in compute, and the coarse end of it goes
+// back to the CPU. Objects are tested against the frustum, then against
+// the latest pyramid that has arrived, which lags a few frames behind. A
+// moving camera sees around the occluders of the pyramid's view, so the
+// boxes grow by the distance it has moved for the test
+struct OcclusionCuller
+{
+    // the depth format has to be sampled, or only the frustum is tested
+    bool enabled = false;
+
+    // depth aspect of the depth attachment, sampled by the first level
+    VkImageView depthView;
+
+    VkImage pyramid;
+    VkDeviceMemory pyramidMemory;
+    VkImageView levelViews[OCCLUSION_MAX_LEVELS];  // from the image view cache
+    VkExtent2D levelSizes[OCCLUSION_MAX_LEVELS];
+    uint32_t levelCount = 0;
+
+    VkSampler sampler;                              // from the sampler cache
+    VkDescriptorSetLayout descriptorSetLayout;      // the layout and sets belong to the descriptor allocator
+    VkDescriptorSet levelSets[OCCLUSION_MAX_LEVELS];
+    VkPipelineLayout pipelineLayout;
+    VkShaderModule shader;
+    VkPipeline pipeline;
+
+    // first level that is read back, and where every level starts in the readback
+    uint32_t readbackLevel = 0;
+    uint32_t readbackOffsets[OCCLUSION_MAX_LEVELS];
+    uint32_t readbackTexels = 0;
+    DepthPyramidReadback readbacks[MAX_FRAME_FENCES];
+
+    // the latest readback that has arrived
+    std::vector<float> depth;
+    glm::mat4 depthViewProj;
+    glm::vec3 depthEye;
+    uint64_t depthFrame = 0;
+
+    // Objects drawn last frame are drawn again as long as they are in the
+    // frustum, the pyramid they went into decides whether they stay. Hidden
+    // objects come back as soon as a pyramid shows them. Objects outside
+    // the frustum are never visited, so the cull that last saw each one is
+    // kept instead of a flag
+    std::vector<uint64_t> visibleCulls;
+    uint64_t cullCount = 0;
+    std::vector<uint32_t> inFrustum;
+
+    // runs of visible instances for each swapchain image and draw list
+    struct {
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+        VkDrawIndexedIndirectCommand* mapped;
+    } indirect;
+    bool multiDraw = false;
+    bool firstInstance = false;
+
+    CullStats stats;
+};
+
+bool initOcclusionCulling();
+
+// Picks up the newest pyramid whose frame has finished, called by render()
+// after collectDeletions()
+void updateOcclusionCulling();
+
+// Appends the sorted indices of the BVH objects that pass the frustum of
+// viewProj and are not behind the latest depth pyramid
+void cullObjects(Bvh &bvh, const glm::mat4 &viewProj, std::vector<uint32_t> &visible);
+
+// Writes the indirect draws of a draw list for the image from a sorted list
+// of visible instances, drawn at the mesh level instanceLods has for them.
+// Returns the number of draws that draw anything
+uint32_t writeSceneDraws(uint32_t imageIndex, SceneDrawList list, const std::vector<uint32_t> &visibleInstances, const std::vector<uint32_t> &instanceLods);
+void recordSceneDraws(VkCommandBuffer cmdBuffer, uint32_t imageIndex, SceneDrawList list);
+
+// Records the pyramid of the depth the frame is drawing, to be submitted
+// after its draws. Returns VK_NULL_HANDLE when occlusion culling is off
+VkCommandBuffer recordDepthPyramid(const glm::mat4 &viewProj);
+
+void destroyOcclusionCulling();
+
+#endif //__OCCLUSION_H__
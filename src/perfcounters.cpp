@@ -0,0 +1,318 @@
+/*
+    Hardware performance counters of the render thread per frame phase, read through perf_event_open
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__NR_perf_event_open)
+#include <linux/perf_event.h>
+#define PERF_COUNTERS_HAVE_EVENTS 1
+#endif
+
+static const char* const s_phaseNames[FRAME_PHASE_COUNT] =
+{
+    "streaming", "uniforms", "animation", "culling", "recording", "submission", "present"
+};
+
+static const char* const s_counterNames[PERF_COUNTER_COUNT] = { "cycles", "instructions", "cache misses", "branch misses" };
+
+#ifdef PERF_COUNTERS_HAVE_EVENTS
+
+static const uint64_t s_counterConfigs[PERF_COUNTER_COUNT] =
+{
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static int openCounter(uint64_t config, int groupFd)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    // enabled with the group once every counter is in it
+    attr.disabled = (groupFd < 0) ? 1 : 0;
+    // user space alone needs no privileges up to perf_event_paranoid 2
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // the calling thread on whichever CPU it runs
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+
+static int readParanoidLevel()
+{
+    int level = -1;
+
+    FILE* file = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+    if (file != nullptr)
+    {
+        if (fscanf(file, "%d", &level) != 1)
+        {
+            level = -1;
+        }
+        fclose(file);
+    }
+
+    return level;
+}
+
+static bool readGroup(PerfGroupReading &reading)
+{
+    PerfCounters &counters = g_app.perfCounters;
+
+    // nr, time enabled, time running, then the values in the order the counters joined
+    uint64_t data[3 + PERF_COUNTER_COUNT];
+    ssize_t size = read(counters.leaderFd, data, sizeof(data));
+    if (size < static_cast<ssize_t>((3 + counters.groupSize) * sizeof(uint64_t)))
+    {
+        return false;
+    }
+
+    reading.timeEnabled = data[1];
+    reading.timeRunning = data[2];
+    for (uint32_t i = 0; i < PERF_COUNTER_COUNT; i++)
+    {
+        reading.values[i] = (counters.groupIndex[i] >= 0) ? data[3 + counters.groupIndex[i]] : 0;
+    }
+
+    return true;
+}
+
+#endif // PERF_COUNTERS_HAVE_EVENTS
+
+bool initPerfCounters()
+{
+    PerfCounters &counters = g_app.perfCounters;
+
+    if (!counters.requested)
+    {
+        return true;
+    }
+
+#ifdef PERF_COUNTERS_HAVE_EVENTS
+    int errors[PERF_COUNTER_COUNT] = {};
+    for (uint32_t i = 0; i < PERF_COUNTER_COUNT; i++)
+    {
+        int fd = openCounter(s_counterConfigs[i], counters.leaderFd);
+        if (fd < 0)
+        {
+            errors[i] = errno;
+            continue;
+        }
+
+        if (counters.leaderFd < 0)
+        {
+            counters.leaderFd = fd;
+        }
+        counters.fds[i] = fd;
+        counters.groupIndex[i] = static_cast<int>(counters.groupSize++);
+    }
+
+    if (counters.leaderFd < 0)
+    {
+        if (errors[0] == EACCES || errors[0] == EPERM)
+        {
+            printf("Perf counters: not permitted, perf_event_paranoid is %d, counting user space needs 2 or less\n", readParanoidLevel());
+        }
+        else
+        {
+            printf("Perf counters: no hardware counters on this system, phases are not measured\n");
+        }
+        return false;
+    }
+
+    ioctl(counters.leaderFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    if (ioctl(counters.leaderFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) != 0)
+    {
+        printf("Perf counters: could not enable the counters (%s)\n", strerror(errno));
+        destroyPerfCounters();
+        return false;
+    }
+
+    // the phases are still measured with the counters that are there
+    for (uint32_t i = 0; i < PERF_COUNTER_COUNT; i++)
+    {
+        if (errors[i] != 0)
+        {
+            printf("Perf counters: no %s counter (%s)\n", s_counterNames[i], strerror(errors[i]));
+        }
+    }
+
+    counters.enabled = true;
+    printf("Perf counters: %u of %u counters on the render thread\n", counters.groupSize, PERF_COUNTER_COUNT);
+
+    return true;
+#else
+    printf("Perf counters: perf_event is not available on this platform\n");
+    return false;
+#endif
+}
+
+void beginFramePhase(FramePhase phase)
+{
+    PerfCounters &counters = g_app.perfCounters;
+
+    if (!counters.enabled)
+    {
+        return;
+    }
+
+#ifdef PERF_COUNTERS_HAVE_EVENTS
+    assert(!counters.inPhase);
+
+    counters.inPhase = readGroup(counters.phaseStart);
+    counters.phase = phase;
+#else
+    (void)phase;
+#endif
+}
+
+void endFramePhase(FramePhase phase)
+{
+    PerfCounters &counters = g_app.perfCounters;
+
+    if (!counters.enabled)
+    {
+        return;
+    }
+
+    if (phase == FRAME_PHASE_PRESENT)
+    {
+        counters.frames++;
+    }
+
+#ifdef PERF_COUNTERS_HAVE_EVENTS
+    if (!counters.inPhase)
+    {
+        return;
+    }
+
+    assert(counters.phase == phase);
+    counters.inPhase = false;
+
+    PerfGroupReading end;
+    if (!readGroup(end))
+    {
+        return;
+    }
+
+    // When the PMU has more groups than counters, the group is switched in
+    // and out and only counts part of the time, scaled up to all of it
+    uint64_t enabled = end.timeEnabled - counters.phaseStart.timeEnabled;
+    uint64_t running = end.timeRunning - counters.phaseStart.timeRunning;
+    if (running == 0)
+    {
+        counters.unscheduledPhases++;
+        return;
+    }
+
+    double scale = static_cast<double>(enabled) / static_cast<double>(running);
+
+    FramePhaseCounters &phaseCounters = counters.phases[phase];
+    phaseCounters.samples++;
+    for (uint32_t i = 0; i < PERF_COUNTER_COUNT; i++)
+    {
+        phaseCounters.values[i] += static_cast<double>(end.values[i] - counters.phaseStart.values[i]) * scale;
+    }
+#endif
+}
+
+// a dash for what the missing counters would have been needed for
+static void formatColumn(char (&text)[16], bool available, const char* format, double value)
+{
+    if (available)
+    {
+        snprintf(text, sizeof(text), format, value);
+    }
+    else
+    {
+        snprintf(text, sizeof(text), "-");
+    }
+}
+
+void printPerfCounterReport()
+{
+    PerfCounters &counters = g_app.perfCounters;
+
+    if (!counters.requested || counters.frames == 0)
+    {
+        return;
+    }
+
+    double frames = static_cast<double>(counters.frames);
+    bool haveCycles = counters.groupIndex[PERF_COUNTER_CYCLES] >= 0;
+    bool haveInstructions = counters.groupIndex[PERF_COUNTER_INSTRUCTIONS] >= 0;
+
+    double totalCycles = 0.0;
+    for (uint32_t phase = 0; phase < FRAME_PHASE_COUNT; phase++)
+    {
+        totalCycles += counters.phases[phase].values[PERF_COUNTER_CYCLES];
+    }
+
+    printf("Render thread counters per frame phase (%llu frames, user space)\n", static_cast<unsigned long long>(counters.frames));
+    printf("    %-12s %12s %12s %8s %8s %12s %12s\n", "phase", "Kcycles", "Kinstr", "cycles%", "IPC", "cache MPKI", "branch MPKI");
+
+    for (uint32_t phase = 0; phase < FRAME_PHASE_COUNT; phase++)
+    {
+        const FramePhaseCounters &phaseCounters = counters.phases[phase];
+        if (phaseCounters.samples == 0)
+        {
+            continue;
+        }
+
+        double cycles = phaseCounters.values[PERF_COUNTER_CYCLES];
+        double instructions = phaseCounters.values[PERF_COUNTER_INSTRUCTIONS];
+
+        char columns[PERF_COUNTER_COUNT + 2][16];
+        formatColumn(columns[0], haveCycles, "%.1f", cycles / frames / 1000.0);
+        formatColumn(columns[1], haveInstructions, "%.1f", instructions / frames / 1000.0);
+        formatColumn(columns[2], haveCycles && totalCycles > 0.0, "%.1f", 100.0 * cycles / totalCycles);
+        formatColumn(columns[3], haveCycles && haveInstructions && cycles > 0.0, "%.2f", instructions / cycles);
+
+        // misses per thousand instructions
+        for (uint32_t i = PERF_COUNTER_CACHE_MISSES; i < PERF_COUNTER_COUNT; i++)
+        {
+            bool available = haveInstructions && counters.groupIndex[i] >= 0 && instructions > 0.0;
+            formatColumn(columns[2 + i], available, "%.2f", 1000.0 * phaseCounters.values[i] / instructions);
+        }
+
+        printf("    %-12s %12s %12s %8s %8s %12s %12s\n", s_phaseNames[phase],
+            columns[0], columns[1], columns[2], columns[3], columns[4], columns[5]);
+    }
+
+    if (counters.unscheduledPhases > 0)
+    {
+        printf("    %llu phases not counted, the group was multiplexed out\n", static_cast<unsigned long long>(counters.unscheduledPhases));
+    }
+}
+
+void destroyPerfCounters()
+{
+    PerfCounters &counters = g_app.perfCounters;
+
+    for (uint32_t i = 0; i < PERF_COUNTER_COUNT; i++)
+    {
+        if (counters.fds[i] >= 0)
+        {
+            close(counters.fds[i]);
+            counters.fds[i] = -1;
+        }
+    }
+
+    counters.leaderFd = -1;
+    counters.enabled = false;
+    counters.inPhase = false;
+}
@@ -0,0 +1,83 @@
+#ifndef __PERFCOUNTERS_H__
+#define __PERFCOUNTERS_H__
+
+#include <stdint.h>
+
+// Hardware events counted around each phase, as one perf_event group so
+// they are scheduled on the PMU together
+enum PerfCounter
+{
+    PERF_COUNTER_CYCLES = 0,
+    PERF_COUNTER_INSTRUCTIONS,
+    PERF_COUNTER_CACHE_MISSES,
+    PERF_COUNTER_BRANCH_MISSES,
+    PERF_COUNTER_COUNT
+};
+
+// The parts of render() the counters are attributed to, in frame order
+enum FramePhase
+{
+    FRAME_PHASE_STREAMING = 0,      // texture, world and device memory updates
+    FRAME_PHASE_UNIFORMS,
+    FRAME_PHASE_ANIMATION,          // skinning and light binning
+    FRAME_PHASE_CULLING,
+    FRAME_PHASE_RECORDING,          // the per frame command buffers
+    FRAME_PHASE_SUBMISSION,
+    FRAME_PHASE_PRESENT,            // the last phase, ends the frame
+    FRAME_PHASE_COUNT
+};
+
+// Values of the group read at the start of a phase
+struct PerfGroupReading
+{
+    uint64_t timeEnabled;
+    uint64_t timeRunning;
+    uint64_t values[PERF_COUNTER_COUNT];
+};
+
+struct FramePhaseCounters
+{
+    uint64_t samples = 0;
+    double values[PERF_COUNTER_COUNT] = {};
+};
+
+// Cycles, instructions, cache and branch misses of the render thread per
+// frame phase, through perf_event_open. User space only, which is what
+// perf_event_paranoid 2 allows without privileges. Counters the CPU or
+// the hypervisor doesn't have are left out, without any counters the
+// phases are not measured
+struct PerfCounters
+{
+    // --perf-counters
+    bool requested = false;
+    bool enabled = false;
+
+    // the leader is the first counter that opened, the group is read at once
+    int fds[PERF_COUNTER_COUNT] = { -1, -1, -1, -1 };
+    int groupIndex[PERF_COUNTER_COUNT] = { -1, -1, -1, -1 };
+    int leaderFd = -1;
+    uint32_t groupSize = 0;
+
+    bool inPhase = false;
+    FramePhase phase = FRAME_PHASE_STREAMING;
+    PerfGroupReading phaseStart;
+
+    FramePhaseCounters phases[FRAME_PHASE_COUNT];
+    uint64_t frames = 0;
+    // phases the group was never on the PMU for, multiplexed out
+    uint64_t unscheduledPhases = 0;
+};
+
+// Opens the counters for the calling thread, which then calls the phase functions
+bool initPerfCounters();
+
+// Phases follow each other, the same phase may be measured more than once a frame
+void beginFramePhase(FramePhase phase);
+void endFramePhase(FramePhase phase);
+
+// Per frame cycles and instructions, IPC and misses per thousand instructions of each phase
+void printPerfCounterReport();
+
+void destroyPerfCounters();
+
+#endif //__PERFCOUNTERS_H__
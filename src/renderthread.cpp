@@ -0,0 +1,138 @@
+/*
+    Render thread fed by the main thread through a single producer ring
+*/
+
+#include "main.h"
+
+#include <assert.h>
+
+// returns false once the exit command was received
+static bool applyFramePackets()
+{
+    RenderThread &renderThread = g_app.renderThread;
+
+    FramePacket packet;
+    bool keepRunning = true;
+
+    while (renderThread.packets.pop(packet))
+    {
+        if (packet.commands & RENDER_COMMAND_TOGGLE_HUD)
+        {
+            toggleHud();
+        }
+
+        if (packet.commands & RENDER_COMMAND_CAPTURE)
+        {
+            requestFrameCapture("capture.vcap", 1);
+        }
+
+        if (packet.commands & RENDER_COMMAND_PICK)
+        {
+            pickInstance(packet.pickX, packet.pickY);
+        }
+
+        if (packet.commands & RENDER_COMMAND_EXIT)
+        {
+            keepRunning = false;
+        }
+
+        renderThread.lastSequence = packet.sequence;
+        renderThread.inputLatencyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - packet.inputTime).count();
+    }
+
+    return keepRunning;
+}
+
+static void renderThreadMain()
+{
+    // the counters count the thread that opens them
+    initPerfCounters();
+
+    // Frames are rendered back to back whether or not a packet arrived,
+    // blocking in acquire or present only holds up this thread
+    while (applyFramePackets())
+    {
+        render();
+    }
+
+    destroyPerfCounters();
+}
+
+void startRenderThread()
+{
+    RenderThread &renderThread = g_app.renderThread;
+
+    assert(!renderThread.thread.joinable());
+
+    renderThread.pendingCommands = 0;
+    renderThread.pendingPickX = 0.0f;
+    renderThread.pendingPickY = 0.0f;
+    renderThread.nextSequence = 0;
+    renderThread.ringFullCount = 0;
+    renderThread.lastSequence = 0;
+
+    renderThread.thread = std::thread(renderThreadMain);
+}
+
+void queueRenderCommands(RenderCommandFlags commands)
+{
+    g_app.renderThread.pendingCommands |= commands;
+}
+
+void queueRenderPick(float x, float y)
+{
+    RenderThread &renderThread = g_app.renderThread;
+
+    renderThread.pendingPickX = x;
+    renderThread.pendingPickY = y;
+    renderThread.pendingCommands |= RENDER_COMMAND_PICK;
+}
+
+void postFramePacket()
+{
+    RenderThread &renderThread = g_app.renderThread;
+
+    FramePacket packet;
+    packet.sequence = renderThread.nextSequence;
+    packet.inputTime = std::chrono::steady_clock::now();
+    packet.commands = renderThread.pendingCommands;
+    packet.pickX = renderThread.pendingPickX;
+    packet.pickY = renderThread.pendingPickY;
+
+    if (!renderThread.packets.push(packet))
+    {
+        // the render thread is behind, try again with the next packet
+        renderThread.ringFullCount++;
+        return;
+    }
+
+    renderThread.nextSequence++;
+    renderThread.pendingCommands = 0;
+}
+
+void stopRenderThread()
+{
+    RenderThread &renderThread = g_app.renderThread;
+
+    if (!renderThread.thread.joinable())
+    {
+        return;
+    }
+
+    queueRenderCommands(RENDER_COMMAND_EXIT);
+
+    // the exit command must not be dropped, wait for room in the ring
+    while (renderThread.pendingCommands != 0)
+    {
+        postFramePacket();
+        if (renderThread.pendingCommands != 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    renderThread.thread.join();
+
+    printf("Render thread stopped, %llu packets posted, ring full %llu times\n",
+        (unsigned long long)renderThread.nextSequence, (unsigned long long)renderThread.ringFullCount);
+}
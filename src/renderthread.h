@@ -0,0 +1,73 @@
+#ifndef __RENDERTHREAD_H__
+#define __RENDERTHREAD_H__
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "spscring.h"
+
+const uint32_t RENDER_PACKET_RING_SIZE = 64;
+
+// How long the main thread waits for window events before it posts a packet anyway
+const double MAIN_LOOP_EVENT_TIMEOUT = 0.004;
+
+// Work the main thread asks the render thread to do, the render thread
+// owns everything these touch
+enum RenderCommandBits
+{
+    RENDER_COMMAND_TOGGLE_HUD = 0x1,
+    RENDER_COMMAND_CAPTURE    = 0x2,
+    RENDER_COMMAND_EXIT       = 0x4,
+    RENDER_COMMAND_PICK       = 0x8,
+};
+typedef uint32_t RenderCommandFlags;
+
+struct FramePacket
+{
+    uint64_t sequence;
+    std::chrono::steady_clock::time_point inputTime;
+    RenderCommandFlags commands;
+    // window position of RENDER_COMMAND_PICK
+    float pickX;
+    float pickY;
+};
+
+// After init, the render thread is the only one to use g_app.queue: it
+// acquires, submits and presents. The main thread only handles window
+// events and posts their results as FramePackets, so neither thread
+// waits on the other
+struct RenderThread
+{
+    std::thread thread;
+    SpscRing<FramePacket, RENDER_PACKET_RING_SIZE> packets;
+
+    // main thread side. Commands stay pending until a packet carrying them fits in the ring
+    RenderCommandFlags pendingCommands;
+    float pendingPickX;
+    float pendingPickY;
+    uint64_t nextSequence;
+    uint64_t ringFullCount;
+
+    // render thread side
+    uint64_t lastSequence;
+    double inputLatencyMs;
+};
+
+void startRenderThread();
+
+// Main thread: adds commands to the next packet
+void queueRenderCommands(RenderCommandFlags commands);
+
+// Main thread: asks for the instance under a window position, a later pick replaces an earlier pending one
+void queueRenderPick(float x, float y);
+
+// Main thread: posts the pending commands, never blocks
+void postFramePacket();
+
+// Main thread: asks the render thread to exit and waits for it
+void stopRenderThread();
+
+#endif //__RENDERTHREAD_H__
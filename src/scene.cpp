@@ -0,0 +1,378 @@
+/*
+    Entity transforms in dense arrays with the hierarchy beside them, updated only where they changed
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <algorithm>
+
+// Dense index of a destroyed entity's slot
+static const uint32_t SCENE_REMOVED = 0xffffffff;
+
+// End of a list of children
+static const uint32_t SCENE_NO_SLOT = 0xffffffff;
+
+static uint32_t getEntitySlot(EntityHandle entity)
+{
+    return static_cast<uint32_t>(entity & 0xffffffff);
+}
+
+static uint32_t getEntityGeneration(EntityHandle entity)
+{
+    return static_cast<uint32_t>(entity >> 32);
+}
+
+static EntityHandle makeEntityHandle(uint32_t slot, uint32_t generation)
+{
+    return (static_cast<EntityHandle>(generation) << 32) | slot;
+}
+
+static void runSceneBatches(SceneWorkers &workers, const std::function<void(uint32_t, uint32_t)> &function, uint32_t count, uint32_t batch)
+{
+    for (;;)
+    {
+        uint32_t begin = workers.cursor.fetch_add(batch);
+        if (begin >= count)
+        {
+            return;
+        }
+        function(begin, std::min(begin + batch, count));
+    }
+}
+
+static void sceneWorker()
+{
+    SceneWorkers &workers = g_app.scene.workers;
+    uint64_t lastJob = 0;
+
+    for (;;)
+    {
+        const std::function<void(uint32_t, uint32_t)> *function;
+        uint32_t count;
+        uint32_t batch;
+        {
+            std::unique_lock<std::mutex> guard(workers.lock);
+            workers.wake.wait(guard, [&] { return workers.stop || workers.job != lastJob; });
+            if (workers.stop)
+            {
+                return;
+            }
+
+            // A worker that wakes after parallelFor() returned skips the
+            // ended job. Joining a job that is still running holds up its
+            // parallelFor() until the worker is done, so function stays valid
+            lastJob = workers.job;
+            if (workers.function == nullptr)
+            {
+                continue;
+            }
+            function = workers.function;
+            count = workers.count;
+            batch = workers.batch;
+            workers.busyWorkers++;
+        }
+
+        runSceneBatches(workers, *function, count, batch);
+
+        {
+            std::lock_guard<std::mutex> guard(workers.lock);
+            if (--workers.busyWorkers == 0)
+            {
+                workers.done.notify_all();
+            }
+        }
+    }
+}
+
+void parallelFor(uint32_t count, uint32_t batch, const std::function<void(uint32_t, uint32_t)> &function)
+{
+    SceneWorkers &workers = g_app.scene.workers;
+
+    if (count <= batch || workers.threads.empty())
+    {
+        function(0, count);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(workers.lock);
+        workers.function = &function;
+        workers.count = count;
+        workers.batch = batch;
+        workers.cursor = 0;
+        workers.job++;
+    }
+    workers.wake.notify_all();
+
+    runSceneBatches(workers, function, count, batch);
+
+    std::unique_lock<std::mutex> guard(workers.lock);
+    workers.done.wait(guard, [&] { return workers.busyWorkers == 0; });
+    workers.function = nullptr;
+}
+
+static void markDirty(Scene &scene, uint32_t slot)
+{
+    if (scene.dirty[slot])
+    {
+        return;
+    }
+
+    uint32_t depth = scene.depths[slot];
+    if (depth >= scene.dirtyLevels.size())
+    {
+        scene.dirtyLevels.resize(depth + 1);
+    }
+
+    scene.dirty[slot] = 1;
+    scene.dirtyLevels[depth].push_back(slot);
+}
+
+// Fills the hole of a destroyed entity with the last dense element
+static void removeDenseElement(Scene &scene, uint32_t index)
+{
+    uint32_t last = static_cast<uint32_t>(scene.slots.size()) - 1;
+    if (index != last)
+    {
+        scene.localTransforms[index] = scene.localTransforms[last];
+        scene.worldTransforms[index] = scene.worldTransforms[last];
+        scene.slots[index] = scene.slots[last];
+        scene.denseIndices[scene.slots[index]] = index;
+    }
+
+    scene.localTransforms.pop_back();
+    scene.worldTransforms.pop_back();
+    scene.slots.pop_back();
+}
+
+bool initScene()
+{
+    SceneWorkers &workers = g_app.scene.workers;
+
+    workers.cursor = 0;
+
+    uint32_t workerCount = std::min(std::max(std::thread::hardware_concurrency(), 1u) - 1, SCENE_MAX_WORKERS);
+    for (uint32_t i = 0; i < workerCount; i++)
+    {
+        workers.threads.push_back(std::thread(sceneWorker));
+    }
+
+    printf("Scene: %u transform workers\n", workerCount);
+
+    return true;
+}
+
+EntityHandle createEntity(EntityHandle parent, const glm::mat4 &localTransform)
+{
+    Scene &scene = g_app.scene;
+
+    uint32_t parentSlot = SCENE_NO_PARENT;
+    if (parent != INVALID_ENTITY)
+    {
+        assert(isEntityAlive(parent));
+        parentSlot = getEntitySlot(parent);
+    }
+
+    uint32_t slot;
+    if (!scene.freeSlots.empty())
+    {
+        slot = scene.freeSlots.back();
+        scene.freeSlots.pop_back();
+    }
+    else
+    {
+        slot = static_cast<uint32_t>(scene.generations.size());
+        scene.generations.push_back(0);
+        scene.denseIndices.push_back(SCENE_REMOVED);
+        scene.parents.push_back(SCENE_NO_PARENT);
+        scene.firstChildren.push_back(SCENE_NO_SLOT);
+        scene.nextSiblings.push_back(SCENE_NO_SLOT);
+        scene.previousSiblings.push_back(SCENE_NO_SLOT);
+        scene.depths.push_back(0);
+        scene.dirty.push_back(0);
+    }
+
+    uint32_t index = static_cast<uint32_t>(scene.slots.size());
+    scene.denseIndices[slot] = index;
+
+    scene.localTransforms.push_back(localTransform);
+    scene.worldTransforms.push_back(localTransform);
+    scene.slots.push_back(slot);
+
+    // first in the list of children of the parent
+    scene.parents[slot] = parentSlot;
+    scene.firstChildren[slot] = SCENE_NO_SLOT;
+    scene.previousSiblings[slot] = SCENE_NO_SLOT;
+    scene.nextSiblings[slot] = SCENE_NO_SLOT;
+    scene.depths[slot] = 0;
+    if (parentSlot != SCENE_NO_PARENT)
+    {
+        uint32_t next = scene.firstChildren[parentSlot];
+        scene.nextSiblings[slot] = next;
+        if (next != SCENE_NO_SLOT)
+        {
+            scene.previousSiblings[next] = slot;
+        }
+        scene.firstChildren[parentSlot] = slot;
+        scene.depths[slot] = scene.depths[parentSlot] + 1;
+    }
+
+    scene.dirty[slot] = 0;
+    markDirty(scene, slot);
+
+    scene.entityCount++;
+
+    return makeEntityHandle(slot, scene.generations[slot]);
+}
+
+void destroyEntity(EntityHandle entity)
+{
+    Scene &scene = g_app.scene;
+
+    if (!isEntityAlive(entity))
+    {
+        return;
+    }
+
+    uint32_t slot = getEntitySlot(entity);
+
+    // out of the list of children of its parent
+    uint32_t parent = scene.parents[slot];
+    uint32_t previous = scene.previousSiblings[slot];
+    uint32_t next = scene.nextSiblings[slot];
+    if (previous != SCENE_NO_SLOT)
+    {
+        scene.nextSiblings[previous] = next;
+    }
+    else if (parent != SCENE_NO_PARENT)
+    {
+        scene.firstChildren[parent] = next;
+    }
+    if (next != SCENE_NO_SLOT)
+    {
+        scene.previousSiblings[next] = previous;
+    }
+
+    // everything below goes with it, the entries the subtree still has in
+    // the dirty lists are skipped by updateScene()
+    std::vector<uint32_t> &stack = scene.retiredSlots;
+    size_t first = stack.size();
+    stack.push_back(slot);
+    for (size_t i = first; i < stack.size(); i++)
+    {
+        uint32_t removed = stack[i];
+        for (uint32_t child = scene.firstChildren[removed]; child != SCENE_NO_SLOT; child = scene.nextSiblings[child])
+        {
+            stack.push_back(child);
+        }
+
+        removeDenseElement(scene, scene.denseIndices[removed]);
+        scene.denseIndices[removed] = SCENE_REMOVED;
+        scene.generations[removed]++;
+        scene.entityCount--;
+    }
+}
+
+bool isEntityAlive(EntityHandle entity)
+{
+    const Scene &scene = g_app.scene;
+
+    uint32_t slot = getEntitySlot(entity);
+    return entity != INVALID_ENTITY && slot < scene.generations.size() &&
+           scene.generations[slot] == getEntityGeneration(entity) && scene.denseIndices[slot] != SCENE_REMOVED;
+}
+
+void setLocalTransform(EntityHandle entity, const glm::mat4 &localTransform)
+{
+    Scene &scene = g_app.scene;
+
+    assert(isEntityAlive(entity));
+    uint32_t slot = getEntitySlot(entity);
+
+    scene.localTransforms[scene.denseIndices[slot]] = localTransform;
+    markDirty(scene, slot);
+}
+
+const glm::mat4 &getWorldTransform(EntityHandle entity)
+{
+    const Scene &scene = g_app.scene;
+
+    assert(isEntityAlive(entity));
+    return scene.worldTransforms[scene.denseIndices[getEntitySlot(entity)]];
+}
+
+void updateScene()
+{
+    Scene &scene = g_app.scene;
+
+    scene.updatedLastFrame = 0;
+
+    // Each depth only reads the world transforms of the one before, so
+    // the entities within a depth are independent of each other. Children
+    // are marked into the next depth while a depth is walked
+    for (uint32_t depth = 0; depth < scene.dirtyLevels.size(); depth++)
+    {
+        std::vector<uint32_t> &level = scene.dirtyLevels[depth];
+        if (level.empty())
+        {
+            continue;
+        }
+
+        parallelFor(static_cast<uint32_t>(level.size()), SCENE_PARALLEL_BATCH, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; i++)
+            {
+                uint32_t slot = level[i];
+                uint32_t index = scene.denseIndices[slot];
+                if (index == SCENE_REMOVED)
+                {
+                    continue;
+                }
+
+                uint32_t parent = scene.parents[slot];
+                scene.worldTransforms[index] = (parent == SCENE_NO_PARENT)
+                    ? scene.localTransforms[index]
+                    : scene.worldTransforms[scene.denseIndices[parent]] * scene.localTransforms[index];
+            }
+        });
+
+        for (uint32_t slot : level)
+        {
+            scene.dirty[slot] = 0;
+            if (scene.denseIndices[slot] == SCENE_REMOVED)
+            {
+                continue;
+            }
+
+            for (uint32_t child = scene.firstChildren[slot]; child != SCENE_NO_SLOT; child = scene.nextSiblings[child])
+            {
+                markDirty(scene, child);
+            }
+            scene.updatedLastFrame++;
+        }
+
+        level.clear();
+    }
+
+    // no dirty list refers to the destroyed entities anymore
+    scene.freeSlots.insert(scene.freeSlots.end(), scene.retiredSlots.begin(), scene.retiredSlots.end());
+    scene.retiredSlots.clear();
+}
+
+void destroyScene()
+{
+    SceneWorkers &workers = g_app.scene.workers;
+
+    {
+        std::lock_guard<std::mutex> guard(workers.lock);
+        workers.stop = true;
+    }
+    workers.wake.notify_all();
+
+    for (std::thread &thread : workers.threads)
+    {
+        thread.join();
+    }
+    workers.threads.clear();
+}
@@ -0,0 +1,116 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Slot in the low 32 bits, the generation of the slot in the high ones.
+// A handle kept after its entity was destroyed no longer matches the slot
+typedef uint64_t EntityHandle;
+const EntityHandle INVALID_ENTITY = 0xffffffffffffffffull;
+
+// Parent slot of an entity without a parent
+const uint32_t SCENE_NO_PARENT = 0xffffffff;
+
+// Worker threads for the transform update, besides the calling one
+const uint32_t SCENE_MAX_WORKERS = 7;
+
+// Entities per job, levels with fewer dirty ones are updated on the calling thread
+const uint32_t SCENE_PARALLEL_BATCH = 4096;
+
+// Runs function(begin, end) over batches of [0, count) on the scene workers
+// and the calling thread, returns once all batches are done. Other per
+// frame work of the render thread borrows them through parallelFor()
+struct SceneWorkers
+{
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stop = false;
+
+    // the job being run, workers take batches until the cursor passes count
+    const std::function<void(uint32_t, uint32_t)> *function = nullptr;
+    uint32_t count = 0;
+    uint32_t batch = 0;
+    uint64_t job = 0;
+    std::atomic<uint32_t> cursor;
+    uint32_t busyWorkers = 0;
+};
+
+// Transforms of all entities in dense arrays, one element per entity,
+// kept dense by moving the last element into the place of a destroyed one.
+// The hierarchy is kept per slot, so moving an element only updates the
+// dense index of its slot: parents, lists of siblings and the depth.
+// Creating an entity is constant time and destroying one visits what is
+// below it, nothing is rebuilt for the rest of the scene
+struct Scene
+{
+    // indexed by dense index
+    std::vector<glm::mat4> localTransforms;
+    std::vector<glm::mat4> worldTransforms;
+    std::vector<uint32_t> slots;
+
+    // indexed by slot
+    std::vector<uint32_t> generations;
+    std::vector<uint32_t> denseIndices;
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> firstChildren;
+    std::vector<uint32_t> nextSiblings;
+    std::vector<uint32_t> previousSiblings;
+    std::vector<uint32_t> depths;
+    // set while the entity waits in a dirty list
+    std::vector<uint8_t> dirty;
+    std::vector<uint32_t> freeSlots;
+
+    // Slots of the entities destroyed since the last updateScene(). They
+    // may still be in a dirty list and are only reused once the lists
+    // are empty
+    std::vector<uint32_t> retiredSlots;
+
+    // slots of the entities whose world transform is out of date, per depth
+    std::vector<std::vector<uint32_t>> dirtyLevels;
+
+    SceneWorkers workers;
+
+    uint32_t entityCount = 0;
+    uint32_t updatedLastFrame = 0;
+};
+
+bool initScene();
+
+// The new entity is a child of parent, or a root for INVALID_ENTITY
+EntityHandle createEntity(EntityHandle parent, const glm::mat4 &localTransform);
+
+// Destroys the entity together with everything below it
+void destroyEntity(EntityHandle entity);
+
+bool isEntityAlive(EntityHandle entity);
+
+// Marks the entity and everything below it for the next updateScene()
+void setLocalTransform(EntityHandle entity, const glm::mat4 &localTransform);
+
+// As of the last updateScene()
+const glm::mat4 &getWorldTransform(EntityHandle entity);
+
+// Recomputes the world transforms of the dirty entities and their children
+// one depth at a time. The work follows the number of changed entities,
+// not the size of the scene
+void updateScene();
+
+// Runs function over batches of at most batch items of [0, count) on the
+// scene workers and the calling thread. Only for the render thread, which
+// also runs updateScene()
+void parallelFor(uint32_t count, uint32_t batch, const std::function<void(uint32_t, uint32_t)> &function);
+
+void destroyScene();
+
+#endif //__SCENE_H__
@@ -0,0 +1,121 @@
+/*
+    Fixed timestep simulation on its own thread
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <algorithm>
+
+typedef std::chrono::duration<double> SimulationSeconds;
+
+static const double SIMULATION_TICK_SECONDS = 1.0 / SIMULATION_TICK_RATE;
+
+static void stepSimulation(SimulationState &state, float flySpeed)
+{
+    // the step only depends on the previous state, never on wall time
+    state.rotAngle += SIMULATION_ROTATION_SPEED * static_cast<float>(SIMULATION_TICK_SECONDS);
+    state.cameraTravel += flySpeed * static_cast<float>(SIMULATION_TICK_SECONDS);
+    state.animationTime += static_cast<float>(SIMULATION_TICK_SECONDS);
+}
+
+static void simulationThread()
+{
+    Simulation &simulation = g_app.simulation;
+
+    std::chrono::steady_clock::time_point nextTick = simulation.start;
+
+    while (simulation.running.load(std::memory_order_relaxed))
+    {
+        uint32_t ticksRun = 0;
+
+        while (std::chrono::steady_clock::now() >= nextTick && ticksRun < SIMULATION_MAX_CATCHUP_TICKS)
+        {
+            SimulationSnapshot &snapshot = simulation.snapshots.writeSlot();
+            snapshot.previous = simulation.state;
+
+            stepSimulation(simulation.state, simulation.flySpeed);
+            simulation.tick++;
+
+            snapshot.tick = simulation.tick;
+            snapshot.time = SimulationSeconds(nextTick - simulation.start).count();
+            snapshot.current = simulation.state;
+            simulation.snapshots.publish();
+
+            nextTick += std::chrono::duration_cast<std::chrono::steady_clock::duration>(SimulationSeconds(SIMULATION_TICK_SECONDS));
+            ticksRun++;
+        }
+
+        // After a long stall don't try to catch up, carry on from now.
+        // The time base moves with it so the render side stays in step
+        if (ticksRun == SIMULATION_MAX_CATCHUP_TICKS && std::chrono::steady_clock::now() >= nextTick)
+        {
+            std::chrono::steady_clock::duration behind = std::chrono::steady_clock::now() - nextTick;
+            uint64_t dropped = static_cast<uint64_t>(SimulationSeconds(behind).count() / SIMULATION_TICK_SECONDS) + 1;
+
+            simulation.droppedTicks += dropped;
+            nextTick += std::chrono::duration_cast<std::chrono::steady_clock::duration>(SimulationSeconds(dropped * SIMULATION_TICK_SECONDS));
+        }
+
+        std::this_thread::sleep_until(nextTick);
+    }
+}
+
+void startSimulation()
+{
+    Simulation &simulation = g_app.simulation;
+
+    assert(!simulation.thread.joinable());
+
+    simulation.state.rotAngle = 0.0f;
+    simulation.state.cameraTravel = 0.0f;
+    simulation.state.animationTime = 0.0f;
+    simulation.flySpeed = g_app.world.enabled ? WORLD_FLY_SPEED : 0.0f;
+    simulation.tick = 0;
+    simulation.droppedTicks = 0;
+
+    // tick 0 is published up front so the first frame has something to draw
+    SimulationSnapshot &snapshot = simulation.snapshots.writeSlot();
+    snapshot.tick = 0;
+    snapshot.time = 0.0;
+    snapshot.previous = simulation.state;
+    snapshot.current = simulation.state;
+    simulation.snapshots.publish();
+
+    simulation.start = std::chrono::steady_clock::now();
+    simulation.running = true;
+    simulation.thread = std::thread(simulationThread);
+}
+
+void stopSimulation()
+{
+    Simulation &simulation = g_app.simulation;
+
+    simulation.running = false;
+    if (simulation.thread.joinable())
+    {
+        simulation.thread.join();
+    }
+
+    printf("Simulation ran %llu ticks, %llu dropped\n", (unsigned long long)simulation.tick, (unsigned long long)simulation.droppedTicks);
+}
+
+SimulationState sampleSimulation()
+{
+    Simulation &simulation = g_app.simulation;
+
+    simulation.snapshots.acquire();
+    const SimulationSnapshot &snapshot = simulation.snapshots.readSlot();
+
+    // Render up to one tick behind the simulation: over the tick after the
+    // snapshot was due, move from the previous state to the current one
+    double now = SimulationSeconds(std::chrono::steady_clock::now() - simulation.start).count();
+    float alpha = static_cast<float>(std::min(std::max((now - snapshot.time) / SIMULATION_TICK_SECONDS, 0.0), 1.0));
+
+    SimulationState state;
+    state.rotAngle = snapshot.previous.rotAngle + (snapshot.current.rotAngle - snapshot.previous.rotAngle) * alpha;
+    state.cameraTravel = snapshot.previous.cameraTravel + (snapshot.current.cameraTravel - snapshot.previous.cameraTravel) * alpha;
+    state.animationTime = snapshot.previous.animationTime + (snapshot.current.animationTime - snapshot.previous.animationTime) * alpha;
+
+    return state;
+}
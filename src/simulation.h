@@ -0,0 +1,69 @@
+#ifndef __SIMULATION_H__
+#define __SIMULATION_H__
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "triplebuffer.h"
+
+// Simulation ticks per second. Every tick advances the state by the same
+// amount, so the results don't depend on the frame rate
+const uint32_t SIMULATION_TICK_RATE = 60;
+
+// At most this many ticks are run to catch up after a stall, later ticks are dropped
+const uint32_t SIMULATION_MAX_CATCHUP_TICKS = 5;
+
+// Rotation of the model around the y axis, in radians per second
+const float SIMULATION_ROTATION_SPEED = 0.5f;
+
+struct SimulationState
+{
+    float rotAngle;
+    // how far the camera has flown along x, only moves with --world
+    float cameraTravel;
+    // seconds of animation, drives the skinned characters
+    float animationTime;
+};
+
+// The state before and after one tick. Publishing both lets the render
+// thread interpolate even when it missed some of the snapshots
+struct SimulationSnapshot
+{
+    uint64_t tick;
+    // when the tick was due, in seconds from Simulation::start
+    double time;
+    SimulationState previous;
+    SimulationState current;
+};
+
+struct Simulation
+{
+    std::thread thread;
+    std::atomic<bool> running;
+
+    // Simulation time is measured from here, by both threads
+    std::chrono::steady_clock::time_point start;
+
+    // owned by the simulation thread
+    SimulationState state;
+    uint64_t tick;
+    uint64_t droppedTicks;
+
+    // camera speed in units per second, set once before the thread starts
+    float flySpeed;
+
+    TripleBuffer<SimulationSnapshot> snapshots;
+};
+
+void startSimulation();
+
+void stopSimulation();
+
+// The simulation state at the current time, interpolated between the
+// last two ticks. Never blocks on the simulation thread
+SimulationState sampleSimulation();
+
+#endif //__SIMULATION_H__
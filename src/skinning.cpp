@@ -0,0 +1,553 @@
+/*
+    Characters posed in SIMD batches on the scene workers and skinned in compute
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SKINNING_SSE 1
+#endif
+
+// Lanes of SKINNING_BATCH characters, the same value of each of them
+#ifdef SKINNING_SSE
+typedef __m128 SkinLanes;
+
+static inline SkinLanes lanesSet(float value) { return _mm_set1_ps(value); }
+static inline SkinLanes lanesLoad(const float *values) { return _mm_loadu_ps(values); }
+static inline SkinLanes lanesAdd(SkinLanes a, SkinLanes b) { return _mm_add_ps(a, b); }
+static inline SkinLanes lanesSub(SkinLanes a, SkinLanes b) { return _mm_sub_ps(a, b); }
+static inline SkinLanes lanesMul(SkinLanes a, SkinLanes b) { return _mm_mul_ps(a, b); }
+static inline SkinLanes lanesAbs(SkinLanes a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+static inline SkinLanes lanesRound(SkinLanes a) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a)); }
+#else
+struct SkinLanes
+{
+    float lane[SKINNING_BATCH];
+};
+
+#define SKIN_LANES_OP(expression) SkinLanes r; for (uint32_t i = 0; i < SKINNING_BATCH; i++) { r.lane[i] = expression; } return r;
+
+static inline SkinLanes lanesSet(float value) { SKIN_LANES_OP(value) }
+static inline SkinLanes lanesLoad(const float *values) { SKIN_LANES_OP(values[i]) }
+static inline SkinLanes lanesAdd(SkinLanes a, SkinLanes b) { SKIN_LANES_OP(a.lane[i] + b.lane[i]) }
+static inline SkinLanes lanesSub(SkinLanes a, SkinLanes b) { SKIN_LANES_OP(a.lane[i] - b.lane[i]) }
+static inline SkinLanes lanesMul(SkinLanes a, SkinLanes b) { SKIN_LANES_OP(a.lane[i] * b.lane[i]) }
+static inline SkinLanes lanesAbs(SkinLanes a) { SKIN_LANES_OP(std::fabs(a.lane[i])) }
+static inline SkinLanes lanesRound(SkinLanes a) { SKIN_LANES_OP(std::nearbyint(a.lane[i])) }
+#endif
+
+static const float SKIN_PI = 3.14159265f;
+
+// The angle is wrapped to [-pi, pi], then the sine is a parabola refined
+// once, within about 0.001. Plenty for the sway of a joint
+static SkinLanes lanesSin(SkinLanes x)
+{
+    x = lanesSub(x, lanesMul(lanesSet(2.0f * SKIN_PI), lanesRound(lanesMul(x, lanesSet(0.5f / SKIN_PI)))));
+
+    SkinLanes y = lanesAdd(lanesMul(lanesSet(4.0f / SKIN_PI), x), lanesMul(lanesMul(lanesSet(-4.0f / (SKIN_PI * SKIN_PI)), x), lanesAbs(x)));
+    return lanesAdd(lanesMul(lanesSet(0.225f), lanesSub(lanesMul(y, lanesAbs(y)), y)), y);
+}
+
+static SkinLanes lanesCos(SkinLanes x)
+{
+    return lanesSin(lanesAdd(x, lanesSet(0.5f * SKIN_PI)));
+}
+
+// Writes the row of each lane's matrix into that lane's character
+static inline void storeRows(SkinJointMatrix *first, uint32_t stride, uint32_t row, SkinLanes x, SkinLanes y, SkinLanes z, SkinLanes w)
+{
+#ifdef SKINNING_SSE
+    // the lanes become the rows of four characters
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(first[0].rows[row], x);
+    _mm_storeu_ps(first[stride].rows[row], y);
+    _mm_storeu_ps(first[stride * 2].rows[row], z);
+    _mm_storeu_ps(first[stride * 3].rows[row], w);
+#else
+    for (uint32_t i = 0; i < SKINNING_BATCH; i++)
+    {
+        float *values = first[stride * i].rows[row];
+        values[0] = x.lane[i];
+        values[1] = y.lane[i];
+        values[2] = z.lane[i];
+        values[3] = w.lane[i];
+    }
+#endif
+}
+
+// Poses the joints of the batch's characters, parents first. Every joint
+// bends around z and x by its own sway, which runs behind the one of its
+// parent, so the motion travels up the chain
+static void poseBatch(const SkinningStage &skinning, uint32_t batch, float time, SkinJointMatrix *palette)
+{
+    uint32_t firstCharacter = batch * SKINNING_BATCH;
+
+    SkinLanes phase = lanesAdd(lanesSet(time * SKINNING_SWAY_SPEED), lanesLoad(&skinning.phases[firstCharacter]));
+    SkinLanes segment = lanesSet(skinning.segmentLength);
+    SkinLanes zero = lanesSet(0.0f);
+
+    // rotation and translation of the joint, bind pose to posed space
+    SkinLanes r[9] = { lanesSet(1.0f), zero, zero, zero, lanesSet(1.0f), zero, zero, zero, lanesSet(1.0f) };
+    SkinLanes t[3] = {
+        lanesAdd(lanesLoad(&skinning.originsX[firstCharacter]), lanesSet(skinning.rootPosition.x)),
+        lanesSet(skinning.rootPosition.y),
+        lanesAdd(lanesLoad(&skinning.originsZ[firstCharacter]), lanesSet(skinning.rootPosition.z)) };
+
+    for (uint32_t joint = 0; joint < SKINNING_JOINTS; joint++)
+    {
+        // the joint sits at the end of its parent's segment
+        if (joint > 0)
+        {
+            t[0] = lanesAdd(t[0], lanesMul(segment, r[1]));
+            t[1] = lanesAdd(t[1], lanesMul(segment, r[4]));
+            t[2] = lanesAdd(t[2], lanesMul(segment, r[7]));
+        }
+
+        SkinLanes jointPhase = lanesSub(phase, lanesSet(joint * SKINNING_JOINT_DELAY));
+        SkinLanes bendZ = lanesMul(lanesSet(SKINNING_SWAY_ANGLE), lanesSin(jointPhase));
+        SkinLanes bendX = lanesMul(lanesSet(SKINNING_SWAY_ANGLE * 0.5f), lanesCos(jointPhase));
+
+        SkinLanes sz = lanesSin(bendZ), cz = lanesCos(bendZ);
+        SkinLanes sx = lanesSin(bendX), cx = lanesCos(bendX);
+
+        // rotation about z then x:
+        //   cz  -sz*cx   sz*sx
+        //   sz   cz*cx  -cz*sx
+        //   0    sx      cx
+        SkinLanes l01 = lanesSub(zero, lanesMul(sz, cx));
+        SkinLanes l02 = lanesMul(sz, sx);
+        SkinLanes l11 = lanesMul(cz, cx);
+        SkinLanes l12 = lanesSub(zero, lanesMul(cz, sx));
+
+        SkinLanes rotated[9];
+        for (uint32_t row = 0; row < 3; row++)
+        {
+            SkinLanes a = r[row * 3], b = r[row * 3 + 1], c = r[row * 3 + 2];
+            rotated[row * 3]     = lanesAdd(lanesMul(a, cz), lanesMul(b, sz));
+            rotated[row * 3 + 1] = lanesAdd(lanesAdd(lanesMul(a, l01), lanesMul(b, l11)), lanesMul(c, sx));
+            rotated[row * 3 + 2] = lanesAdd(lanesAdd(lanesMul(a, l02), lanesMul(b, l12)), lanesMul(c, cx));
+        }
+        memcpy(r, rotated, sizeof(r));
+
+        // the bind pose of the joint has no rotation, undoing it is
+        // taking its position off
+        float bindY = skinning.rootPosition.y + joint * skinning.segmentLength;
+        SkinLanes bindX = lanesSet(skinning.rootPosition.x);
+        SkinLanes bindYLanes = lanesSet(bindY);
+        SkinLanes bindZ = lanesSet(skinning.rootPosition.z);
+
+        SkinJointMatrix *first = palette + firstCharacter * SKINNING_JOINTS + joint;
+        for (uint32_t row = 0; row < 3; row++)
+        {
+            SkinLanes offset = lanesAdd(lanesAdd(lanesMul(r[row * 3], bindX), lanesMul(r[row * 3 + 1], bindYLanes)), lanesMul(r[row * 3 + 2], bindZ));
+            storeRows(first, SKINNING_JOINTS, row, r[row * 3], r[row * 3 + 1], r[row * 3 + 2], lanesSub(t[row], offset));
+        }
+    }
+}
+
+static bool createSkinningBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, SkinningBuffer &buffer)
+{
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+
+    VkResult result = vkCreateBuffer(g_app.device, &bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), &buffer.buffer);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_app.device, buffer.buffer, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, properties, &memAllocInfo.memoryTypeIndex))
+    {
+        return false;
+    }
+
+    result = allocateDeviceMemory(&memAllocInfo, &buffer.memory);
+    assert(result == VK_SUCCESS);
+
+    vkBindBufferMemory(g_app.device, buffer.buffer, buffer.memory, 0);
+
+    // host visible buffers stay mapped for their lifetime
+    if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        result = vkMapMemory(g_app.device, buffer.memory, 0, size, 0, &buffer.mapped);
+    }
+
+    return (result == VK_SUCCESS);
+}
+
+static void destroySkinningBuffer(SkinningBuffer &buffer)
+{
+    if (buffer.buffer == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    if (buffer.mapped != nullptr)
+    {
+        vkUnmapMemory(g_app.device, buffer.memory);
+    }
+    evictCachedDescriptorSets((uint64_t)buffer.buffer);
+    vkDestroyBuffer(g_app.device, buffer.buffer, getHostAllocator(HOST_OBJECT_BUFFER));
+    freeDeviceMemory(buffer.memory);
+
+    buffer = SkinningBuffer();
+}
+
+// The skeleton is a chain of joints from the bottom of the mesh to its top,
+// every vertex is weighted between the two joints around its height
+static bool initSkinningMesh()
+{
+    SkinningStage &skinning = g_app.skinning;
+
+    const MeshData &mesh = skinning.mesh;
+    skinning.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+    skinning.indexCount = static_cast<uint32_t>(mesh.indices.size());
+
+    glm::vec3 boundsMin = g_app.vertices.boundsMin;
+    glm::vec3 boundsMax = g_app.vertices.boundsMax;
+    float height = boundsMax.y - boundsMin.y;
+
+    skinning.rootPosition = glm::vec3((boundsMin.x + boundsMax.x) * 0.5f, boundsMin.y, (boundsMin.z + boundsMax.z) * 0.5f);
+    skinning.segmentLength = height > 0.0f ? height / (SKINNING_JOINTS - 1) : 1.0f;
+
+    if (!createSkinningBuffer(skinning.vertexCount * sizeof(MeshVertex), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, skinning.bindPose) ||
+        !createSkinningBuffer(skinning.vertexCount * sizeof(SkinInfluence), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, skinning.influences) ||
+        !createSkinningBuffer(static_cast<VkDeviceSize>(skinning.indexCount) * skinning.characterCount * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, skinning.indices))
+    {
+        printf("Skinning: could not allocate the mesh buffers\n");
+        return false;
+    }
+
+    memcpy(skinning.bindPose.mapped, mesh.vertices.data(), skinning.vertexCount * sizeof(MeshVertex));
+
+    SkinInfluence *influences = static_cast<SkinInfluence*>(skinning.influences.mapped);
+    for (uint32_t i = 0; i < skinning.vertexCount; i++)
+    {
+        float along = (mesh.vertices[i].position[1] - skinning.rootPosition.y) / skinning.segmentLength;
+        along = std::min(std::max(along, 0.0f), static_cast<float>(SKINNING_JOINTS - 1));
+
+        uint32_t lower = std::min(static_cast<uint32_t>(along), SKINNING_JOINTS - 2);
+        float upperWeight = along - lower;
+
+        SkinInfluence influence = {};
+        influence.joints[0] = lower;
+        influence.joints[1] = lower + 1;
+        influence.weights[0] = 1.0f - upperWeight;
+        influence.weights[1] = upperWeight;
+        influences[i] = influence;
+    }
+
+    // one draw covers every character, each index points into its own copy
+    uint32_t *indices = static_cast<uint32_t*>(skinning.indices.mapped);
+    for (uint32_t character = 0; character < skinning.characterCount; character++)
+    {
+        uint32_t base = character * skinning.vertexCount;
+        for (uint32_t i = 0; i < skinning.indexCount; i++)
+        {
+            *indices++ = base + mesh.indices[i];
+        }
+    }
+
+    // the characters stand on a square grid, a little more than a mesh apart
+    float spacing = std::max(std::max(boundsMax.x - boundsMin.x, boundsMax.z - boundsMin.z), height) * 1.5f;
+    uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(skinning.characterCount))));
+    uint32_t paddedCount = (skinning.characterCount + SKINNING_BATCH - 1) / SKINNING_BATCH * SKINNING_BATCH;
+
+    skinning.originsX.assign(paddedCount, 0.0f);
+    skinning.originsZ.assign(paddedCount, 0.0f);
+    skinning.phases.assign(paddedCount, 0.0f);
+    for (uint32_t character = 0; character < skinning.characterCount; character++)
+    {
+        skinning.originsX[character] = (static_cast<float>(character % columns) - (columns - 1) * 0.5f) * spacing;
+        skinning.originsZ[character] = -static_cast<float>(character / columns) * spacing;
+        skinning.phases[character] = static_cast<float>(character) * 0.37f;
+    }
+
+    // the mesh isn't needed once it is in the buffers
+    skinning.mesh = MeshData();
+
+    return true;
+}
+
+static bool initSkinningPipeline()
+{
+    SkinningStage &skinning = g_app.skinning;
+
+    VkDescriptorSetLayoutBinding bindings[4] = {};
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    skinning.descriptorSetLayout = createDescriptorSetLayout(bindings, 4);
+
+    // the palette is the only binding that changes, one set per frame fence
+    for (uint32_t i = 0; i < g_app.deletionQueue.fenceCount; i++)
+    {
+        DescriptorResource resources[4];
+        memset(resources, 0, sizeof(resources));
+
+        resources[0].buffer = { skinning.bindPose.buffer, 0, VK_WHOLE_SIZE };
+        resources[1].buffer = { skinning.influences.buffer, 0, VK_WHOLE_SIZE };
+        resources[2].buffer = { skinning.palettes[i].buffer, 0, VK_WHOLE_SIZE };
+        resources[3].buffer = { skinning.output, 0, VK_WHOLE_SIZE };
+
+        skinning.sets[i] = getCachedDescriptorSet(skinning.descriptorSetLayout, resources);
+        if (skinning.sets[i] == VK_NULL_HANDLE)
+        {
+            return false;
+        }
+    }
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(SkinningPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &skinning.descriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    VkResult result = vkCreatePipelineLayout(g_app.device, &pipelineLayoutCreateInfo, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT), &skinning.pipelineLayout);
+    assert(result == VK_SUCCESS);
+
+    skinning.shader = loadShaderGLSL("data/skinning.comp", VK_SHADER_STAGE_COMPUTE_BIT);
+
+    VkComputePipelineCreateInfo pipelineCreateInfo = {};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCreateInfo.stage.module = skinning.shader;
+    pipelineCreateInfo.stage.pName = "main";
+    pipelineCreateInfo.layout = skinning.pipelineLayout;
+
+    result = vkCreateComputePipelines(g_app.device, g_app.pipelineCache, 1, &pipelineCreateInfo, getHostAllocator(HOST_OBJECT_PIPELINE), &skinning.pipeline);
+    assert(result == VK_SUCCESS);
+
+    return (result == VK_SUCCESS);
+}
+
+bool initSkinning()
+{
+    SkinningStage &skinning = g_app.skinning;
+
+    if (skinning.characterCount == 0)
+    {
+        return true;
+    }
+
+    uint32_t vertexCount = static_cast<uint32_t>(skinning.mesh.vertices.size());
+    uint32_t indexCount = static_cast<uint32_t>(skinning.mesh.indices.size());
+    uint32_t fitting = std::min(SKINNING_MAX_VERTICES / std::max(vertexCount, 1u), SKINNING_MAX_INDICES / std::max(indexCount, 1u));
+    if (skinning.characterCount > fitting)
+    {
+        printf("Skinning: %u characters of %u vertices don't fit, skinning %u\n", skinning.characterCount, vertexCount, fitting);
+        skinning.characterCount = fitting;
+    }
+    if (skinning.characterCount == 0)
+    {
+        return true;
+    }
+
+    if (!initSkinningMesh())
+    {
+        return false;
+    }
+
+    skinning.paletteSize = static_cast<VkDeviceSize>(skinning.originsX.size()) * SKINNING_JOINTS * sizeof(SkinJointMatrix);
+    for (uint32_t i = 0; i < g_app.deletionQueue.fenceCount; i++)
+    {
+        if (!createSkinningBuffer(skinning.paletteSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, skinning.palettes[i]))
+        {
+            printf("Skinning: could not allocate the palettes\n");
+            return false;
+        }
+    }
+
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = static_cast<VkDeviceSize>(skinning.vertexCount) * skinning.characterCount * sizeof(MeshVertex);
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+
+    VkResult result = vkCreateBuffer(g_app.device, &bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), &skinning.output);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_app.device, skinning.output, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memAllocInfo.memoryTypeIndex) ||
+        allocateDeviceMemory(&memAllocInfo, &skinning.outputMemory) != VK_SUCCESS)
+    {
+        printf("Skinning: could not allocate the skinned vertices\n");
+        return false;
+    }
+
+    vkBindBufferMemory(g_app.device, skinning.output, skinning.outputMemory, 0);
+
+    if (!initSkinningPipeline())
+    {
+        return false;
+    }
+
+    skinning.enabled = true;
+
+    printf("Skinning: %u characters, %u joints, %u skinned vertices\n", skinning.characterCount, SKINNING_JOINTS, skinning.vertexCount * skinning.characterCount);
+
+    return true;
+}
+
+void updateSkinning(float time)
+{
+    SkinningStage &skinning = g_app.skinning;
+
+    if (!skinning.enabled)
+    {
+        return;
+    }
+
+    // the palette of this fence slot was last read by the frame beginFrameCommands() waited for
+    uint32_t slot = g_app.frameCommands.slot;
+    SkinJointMatrix *palette = static_cast<SkinJointMatrix*>(skinning.palettes[slot].mapped);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    uint32_t batchCount = static_cast<uint32_t>(skinning.originsX.size()) / SKINNING_BATCH;
+    parallelFor(batchCount, SKINNING_BATCHES_PER_JOB, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t batch = begin; batch < end; batch++)
+        {
+            poseBatch(skinning, batch, time, palette);
+        }
+    });
+
+    skinning.poseMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    VkCommandBuffer cmdBuffer = beginFrameCommandBuffer();
+
+    SkinningPushConstants pushConstants;
+    pushConstants.vertexCount = skinning.vertexCount;
+    pushConstants.characterCount = skinning.characterCount;
+    pushConstants.jointCount = SKINNING_JOINTS;
+
+    // one invocation per skinned vertex, the work follows the vertices of
+    // all characters and nothing else
+    uint32_t invocations = skinning.vertexCount * skinning.characterCount;
+
+    // The draws of the frames still in flight read the vertices this
+    // overwrites, the skinning waits for them on the GPU only
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skinning.pipeline);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skinning.pipelineLayout, 0, 1, &skinning.sets[slot], 0, nullptr);
+    vkCmdPushConstants(cmdBuffer, skinning.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+    vkCmdDispatch(cmdBuffer, (invocations + SKINNING_GROUP_SIZE - 1) / SKINNING_GROUP_SIZE, 1, 1);
+
+    // The frame's draws read the vertices in a later submission
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = skinning.output;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    VkResult result = vkEndCommandBuffer(cmdBuffer);
+    assert(result == VK_SUCCESS);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmdBuffer;
+
+    result = vkQueueSubmit(g_app.queue, 1, &submitInfo, VK_NULL_HANDLE);
+    assert(result == VK_SUCCESS);
+    (void)result;
+}
+
+void recordSkinnedDraws(VkCommandBuffer cmdBuffer)
+{
+    SkinningStage &skinning = g_app.skinning;
+
+    if (!skinning.enabled)
+    {
+        return;
+    }
+
+    VkDeviceSize offsets[1] = {0};
+    vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &skinning.output, offsets);
+    vkCmdBindIndexBuffer(cmdBuffer, skinning.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+    // drawn as the first material instance, whose transforms the scene draws left bound
+    vkCmdDrawIndexed(cmdBuffer, skinning.indexCount * skinning.characterCount, 1, 0, 0, 0);
+}
+
+uint64_t getSkinnedTriangleCount()
+{
+    SkinningStage &skinning = g_app.skinning;
+
+    if (!skinning.enabled)
+    {
+        return 0;
+    }
+
+    return static_cast<uint64_t>(skinning.indexCount / 3) * skinning.characterCount;
+}
+
+void destroySkinning()
+{
+    SkinningStage &skinning = g_app.skinning;
+
+    if (skinning.pipeline != VK_NULL_HANDLE)
+    {
+        vkDestroyPipeline(g_app.device, skinning.pipeline, getHostAllocator(HOST_OBJECT_PIPELINE));
+        vkDestroyPipelineLayout(g_app.device, skinning.pipelineLayout, getHostAllocator(HOST_OBJECT_PIPELINE_LAYOUT));
+        vkDestroyShaderModule(g_app.device, skinning.shader, getHostAllocator(HOST_OBJECT_SHADER_MODULE));
+        skinning.pipeline = VK_NULL_HANDLE;
+    }
+
+    if (skinning.output != VK_NULL_HANDLE)
+    {
+        evictCachedDescriptorSets((uint64_t)skinning.output);
+        vkDestroyBuffer(g_app.device, skinning.output, getHostAllocator(HOST_OBJECT_BUFFER));
+        freeDeviceMemory(skinning.outputMemory);
+        skinning.output = VK_NULL_HANDLE;
+    }
+
+    for (SkinningBuffer &palette : skinning.palettes)
+    {
+        destroySkinningBuffer(palette);
+    }
+    destroySkinningBuffer(skinning.indices);
+    destroySkinningBuffer(skinning.influences);
+    destroySkinningBuffer(skinning.bindPose);
+
+    skinning.enabled = false;
+}
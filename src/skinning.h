@@ -0,0 +1,128 @@
+#ifndef __SKINNING_H__
+#define __SKINNING_H__
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "deletionqueue.h"
+#include "meshloader.h"
+
+// Joints of the skeleton every character shares, a chain up the mesh
+const uint32_t SKINNING_JOINTS = 8;
+
+// Every joint sways around z and x by up to this angle in radians, at this
+// many radians of phase per second. A joint lags its parent by the delay
+const float SKINNING_SWAY_ANGLE = 0.25f;
+const float SKINNING_SWAY_SPEED = 2.0f;
+const float SKINNING_JOINT_DELAY = 0.5f;
+
+// Characters posed together, one per SIMD lane
+const uint32_t SKINNING_BATCH = 4;
+
+// Batches of characters a worker takes at a time
+const uint32_t SKINNING_BATCHES_PER_JOB = 16;
+
+// Skinned vertices and indices of all characters together. Larger counts
+// of characters are cut down to fit
+const uint32_t SKINNING_MAX_VERTICES = 2 * 1024 * 1024;
+const uint32_t SKINNING_MAX_INDICES = 6 * 1024 * 1024;
+
+// Invocations per work group, this must match local_size_x in data/skinning.comp
+const uint32_t SKINNING_GROUP_SIZE = 64;
+
+// Joints and weights of one bind pose vertex, the Influence struct in skinning.comp
+struct SkinInfluence
+{
+    uint32_t joints[4];
+    float weights[4];
+};
+
+// Bind pose to posed space of one joint of one character, the top three
+// rows of the matrix. Three vec4s of the palette in skinning.comp
+struct SkinJointMatrix
+{
+    float rows[3][4];
+};
+
+// Matching the SkinningParams block in skinning.comp
+struct SkinningPushConstants
+{
+    uint32_t vertexCount;
+    uint32_t characterCount;
+    uint32_t jointCount;
+};
+
+struct SkinningBuffer
+{
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    void* mapped = nullptr;
+};
+
+// Characters sharing the scene mesh, each posed on its own. The CPU poses
+// the joints of four characters at a time in SIMD lanes, spread over the
+// scene workers, into a palette per frame fence. A compute pass skins the
+// bind pose of every character with its palette into one vertex buffer,
+// which the material pipeline draws in a single indexed draw
+struct SkinningStage
+{
+    // --skinning <count>, nothing is skinned without it
+    uint32_t characterCount = 0;
+    bool enabled = false;
+
+    // full level of the scene mesh, handed over by initVertexData() and
+    // released once the buffers are filled
+    MeshData mesh;
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+
+    // bind pose of the skeleton: the root joint, then joints straight up
+    glm::vec3 rootPosition;
+    float segmentLength = 0.0f;
+
+    // where each character stands and where its animation starts, padded
+    // to a whole number of batches
+    std::vector<float> originsX;
+    std::vector<float> originsZ;
+    std::vector<float> phases;
+
+    SkinningBuffer bindPose;
+    SkinningBuffer influences;
+    SkinningBuffer indices;       // the mesh indices of every character, offset to its vertices
+    SkinningBuffer palettes[MAX_FRAME_FENCES];
+    VkDeviceSize paletteSize = 0;
+
+    // written by the compute pass, read as the vertex buffer of the draw
+    VkBuffer output = VK_NULL_HANDLE;
+    VkDeviceMemory outputMemory = VK_NULL_HANDLE;
+
+    VkDescriptorSetLayout descriptorSetLayout;      // the layout and sets belong to the descriptor allocator
+    VkDescriptorSet sets[MAX_FRAME_FENCES];
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkShaderModule shader = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+
+    double poseMs = 0.0;
+};
+
+bool initSkinning();
+
+// Poses every character at the given animation time and submits the
+// compute pass that skins them, ahead of the frame that draws them
+void updateSkinning(float time);
+
+// Draws all skinned characters, inside the scene render pass with the
+// material pipeline bound
+void recordSkinnedDraws(VkCommandBuffer cmdBuffer);
+
+// Triangles of that draw, none when nothing is skinned
+uint64_t getSkinnedTriangleCount();
+
+void destroySkinning();
+
+#endif //__SKINNING_H__
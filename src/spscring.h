@@ -0,0 +1,54 @@
+#ifndef __SPSCRING_H__
+#define __SPSCRING_H__
+
+#include <stdint.h>
+
+#include <atomic>
+
+// Bounded lock free queue for exactly one producer thread and one
+// consumer thread. push() fails instead of waiting when the ring is full
+template <typename T, uint32_t Capacity>
+struct SpscRing
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+    SpscRing() : head(0), tail(0) {}
+
+    // producer side
+    bool push(const T &item)
+    {
+        uint32_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail - head.load(std::memory_order_acquire) == Capacity)
+        {
+            return false;
+        }
+
+        items[currentTail & (Capacity - 1)] = item;
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side
+    bool pop(T &item)
+    {
+        uint32_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        item = items[currentHead & (Capacity - 1)];
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T items[Capacity];
+
+    // Free running counters, on their own cache lines so the two threads
+    // don't invalidate each other's line on every operation
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+};
+
+#endif //__SPSCRING_H__
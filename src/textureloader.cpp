@@ -0,0 +1,419 @@
+/*
+    KTX2 and DDS texture files, read or mapped by the async I/O service and copied level by level by the streaming threads
+*/
+
+#include "main.h"
+#include "textureloader.h"
+#include "blockdecode.h"
+
+#include <assert.h>
+#include <cstring>
+#include <algorithm>
+
+#include <sys/mman.h>
+
+struct MappedTextureFile
+{
+    // from the async I/O service, mapped when the file is large
+    FileDataPtr contents;
+    const uint8_t* data;
+    size_t size;
+
+    // format of the levels in the file, the source format differs when they are decoded
+    VkFormat fileFormat;
+    bool decode;
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    size_t levelOffsets[TEXTURE_MAX_MIPS];
+    size_t levelSizes[TEXTURE_MAX_MIPS];
+};
+
+static inline uint32_t readU32(const uint8_t* bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static inline uint64_t readU64(const uint8_t* bytes)
+{
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static inline uint32_t fourCC(char a, char b, char c, char d)
+{
+    return static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) | (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
+}
+
+// Runs on a streaming thread, the mapping is read only and shared by all of them
+static bool readMappedMip(void* userData, uint32_t level, void* dst, VkDeviceSize size)
+{
+    const MappedTextureFile *file = static_cast<const MappedTextureFile*>(userData);
+    const uint8_t *levelData = file->data + file->levelOffsets[level];
+
+    uint32_t levelWidth = std::max(file->width >> level, 1u);
+    uint32_t levelHeight = std::max(file->height >> level, 1u);
+
+    if (file->decode)
+    {
+        assert(size == static_cast<VkDeviceSize>(levelWidth) * levelHeight * 4);
+        return decodeBlockTexture(file->fileFormat, levelData, levelWidth, levelHeight, static_cast<uint8_t*>(dst));
+    }
+
+    assert(size == file->levelSizes[level]);
+    memcpy(dst, levelData, static_cast<size_t>(size));
+    return true;
+}
+
+static void releaseMappedFile(void* userData)
+{
+    MappedTextureFile *file = static_cast<MappedTextureFile*>(userData);
+    delete file;
+}
+
+static bool parseKTX2(MappedTextureFile &file, const char* path)
+{
+    static const uint8_t identifier[12] = { 0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n' };
+
+    // identifier, nine header fields and the index up to the level index
+    const size_t levelIndexOffset = 80;
+    const size_t levelIndexEntrySize = 24;
+
+    const uint8_t *header = file.data;
+    if (memcmp(header, identifier, sizeof(identifier)) != 0)
+    {
+        printf("%s: broken KTX2 identifier\n", path);
+        return false;
+    }
+
+    file.fileFormat = static_cast<VkFormat>(readU32(header + 12));
+    file.width = readU32(header + 20);
+    file.height = readU32(header + 24);
+
+    uint32_t depth = readU32(header + 28);
+    uint32_t layerCount = readU32(header + 32);
+    uint32_t faceCount = readU32(header + 36);
+    uint32_t levelCount = readU32(header + 40);
+    uint32_t supercompression = readU32(header + 44);
+
+    if (file.fileFormat == VK_FORMAT_UNDEFINED || supercompression != 0)
+    {
+        printf("%s: supercompressed and Basis KTX2 files are not supported\n", path);
+        return false;
+    }
+
+    if (depth > 1 || layerCount > 1 || faceCount != 1)
+    {
+        printf("%s: only plain 2D KTX2 textures are supported\n", path);
+        return false;
+    }
+
+    // a level count of 0 asks for the mips to be generated
+    file.levelCount = std::max(levelCount, 1u);
+    if (file.levelCount > TEXTURE_MAX_MIPS || file.size < levelIndexOffset + file.levelCount * levelIndexEntrySize)
+    {
+        printf("%s: broken KTX2 level index\n", path);
+        return false;
+    }
+
+    for (uint32_t level = 0; level < file.levelCount; level++)
+    {
+        const uint8_t *entry = header + levelIndexOffset + level * levelIndexEntrySize;
+        uint64_t offset = readU64(entry);
+        uint64_t length = readU64(entry + 8);
+
+        if (offset > file.size || length > file.size - offset)
+        {
+            printf("%s: level %u is outside of the file\n", path, level);
+            return false;
+        }
+
+        file.levelOffsets[level] = static_cast<size_t>(offset);
+        file.levelSizes[level] = static_cast<size_t>(length);
+    }
+
+    return true;
+}
+
+static VkFormat ddsFormatFromDXGI(uint32_t dxgiFormat)
+{
+    switch (dxgiFormat)
+    {
+        case 28: return VK_FORMAT_R8G8B8A8_UNORM;
+        case 29: return VK_FORMAT_R8G8B8A8_SRGB;
+        case 49: return VK_FORMAT_R8G8_UNORM;
+        case 61: return VK_FORMAT_R8_UNORM;
+        case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+        case 74: return VK_FORMAT_BC2_UNORM_BLOCK;
+        case 75: return VK_FORMAT_BC2_SRGB_BLOCK;
+        case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+        case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+        case 80: return VK_FORMAT_BC4_UNORM_BLOCK;
+        case 81: return VK_FORMAT_BC4_SNORM_BLOCK;
+        case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+        case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+        case 87: return VK_FORMAT_B8G8R8A8_UNORM;
+        case 91: return VK_FORMAT_B8G8R8A8_SRGB;
+        case 95: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+        case 96: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+        case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+        case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+        default: return VK_FORMAT_UNDEFINED;
+    }
+}
+
+static bool parseDDS(MappedTextureFile &file, const char* path)
+{
+    const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+    const uint32_t DDSD_DEPTH = 0x800000;
+    const uint32_t DDPF_FOURCC = 0x4;
+    const uint32_t DDPF_RGB = 0x40;
+    const uint32_t DDPF_LUMINANCE = 0x20000;
+    const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+    const uint32_t DX10_MISC_TEXTURECUBE = 0x4;
+
+    // the magic number is followed by a 124 byte header, DX10 files have 20 bytes more
+    const uint8_t *header = file.data + 4;
+    size_t dataOffset = 128;
+
+    uint32_t flags = readU32(header + 4);
+    file.height = readU32(header + 8);
+    file.width = readU32(header + 12);
+    uint32_t depth = readU32(header + 20);
+    uint32_t mipMapCount = readU32(header + 24);
+    uint32_t caps2 = readU32(header + 108);
+
+    const uint8_t *pixelFormat = header + 72;
+    uint32_t pixelFlags = readU32(pixelFormat + 4);
+    uint32_t pixelFourCC = readU32(pixelFormat + 8);
+    uint32_t bitCount = readU32(pixelFormat + 12);
+    uint32_t redMask = readU32(pixelFormat + 16);
+    uint32_t blueMask = readU32(pixelFormat + 24);
+
+    if (((flags & DDSD_DEPTH) && depth > 1) || (caps2 & DDSCAPS2_CUBEMAP))
+    {
+        printf("%s: only plain 2D DDS textures are supported\n", path);
+        return false;
+    }
+
+    file.fileFormat = VK_FORMAT_UNDEFINED;
+
+    if (pixelFlags & DDPF_FOURCC)
+    {
+        if (pixelFourCC == fourCC('D', 'X', '1', '0'))
+        {
+            if (file.size < dataOffset + 20)
+            {
+                printf("%s: truncated DDS header\n", path);
+                return false;
+            }
+
+            const uint8_t *dx10 = file.data + dataOffset;
+            if ((readU32(dx10 + 8) & DX10_MISC_TEXTURECUBE) || readU32(dx10 + 12) > 1)
+            {
+                printf("%s: only plain 2D DDS textures are supported\n", path);
+                return false;
+            }
+
+            file.fileFormat = ddsFormatFromDXGI(readU32(dx10));
+            dataOffset += 20;
+        }
+        else if (pixelFourCC == fourCC('D', 'X', 'T', '1'))
+        {
+            file.fileFormat = VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        }
+        else if (pixelFourCC == fourCC('D', 'X', 'T', '3'))
+        {
+            file.fileFormat = VK_FORMAT_BC2_UNORM_BLOCK;
+        }
+        else if (pixelFourCC == fourCC('D', 'X', 'T', '5'))
+        {
+            file.fileFormat = VK_FORMAT_BC3_UNORM_BLOCK;
+        }
+        else if (pixelFourCC == fourCC('A', 'T', 'I', '1') || pixelFourCC == fourCC('B', 'C', '4', 'U'))
+        {
+            file.fileFormat = VK_FORMAT_BC4_UNORM_BLOCK;
+        }
+        else if (pixelFourCC == fourCC('A', 'T', 'I', '2') || pixelFourCC == fourCC('B', 'C', '5', 'U'))
+        {
+            file.fileFormat = VK_FORMAT_BC5_UNORM_BLOCK;
+        }
+    }
+    else if ((pixelFlags & DDPF_RGB) && bitCount == 32)
+    {
+        if (redMask == 0x000000ff && blueMask == 0x00ff0000)
+        {
+            file.fileFormat = VK_FORMAT_R8G8B8A8_UNORM;
+        }
+        else if (redMask == 0x00ff0000 && blueMask == 0x000000ff)
+        {
+            file.fileFormat = VK_FORMAT_B8G8R8A8_UNORM;
+        }
+    }
+    else if ((pixelFlags & DDPF_LUMINANCE) && bitCount == 8)
+    {
+        file.fileFormat = VK_FORMAT_R8_UNORM;
+    }
+
+    if (file.fileFormat == VK_FORMAT_UNDEFINED)
+    {
+        printf("%s: unsupported DDS pixel format\n", path);
+        return false;
+    }
+
+    file.levelCount = ((flags & DDSD_MIPMAPCOUNT) && mipMapCount > 0) ? mipMapCount : 1;
+    if (file.levelCount > TEXTURE_MAX_MIPS)
+    {
+        printf("%s: too many DDS levels\n", path);
+        return false;
+    }
+
+    // levels follow each other tightly packed, the largest first
+    size_t offset = dataOffset;
+    for (uint32_t level = 0; level < file.levelCount; level++)
+    {
+        size_t levelSize = static_cast<size_t>(textureLevelSize(file.fileFormat, file.width, file.height, level));
+        if (offset + levelSize > file.size)
+        {
+            printf("%s: level %u is outside of the file\n", path, level);
+            return false;
+        }
+
+        file.levelOffsets[level] = offset;
+        file.levelSizes[level] = levelSize;
+        offset += levelSize;
+    }
+
+    return true;
+}
+
+static VkFormatFeatureFlags getOptimalFormatFeatures(VkFormat format)
+{
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(g_app.gpu[0], format, &formatProperties);
+    return formatProperties.optimalTilingFeatures;
+}
+
+// Picks what the texture is uploaded as and checks the levels in the file are complete
+static bool chooseUploadFormat(MappedTextureFile &file, const char* path, VkFormat *format)
+{
+    if (!isTextureFormatSupported(file.fileFormat))
+    {
+        printf("%s: unsupported format %d\n", path, file.fileFormat);
+        return false;
+    }
+
+    if (!isBlockCompressedFormat(file.fileFormat) || (getOptimalFormatFeatures(file.fileFormat) & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+    {
+        *format = file.fileFormat;
+        file.decode = false;
+    }
+    else if (canDecodeBlockFormat(file.fileFormat))
+    {
+        *format = blockDecodeFormat(file.fileFormat);
+        file.decode = true;
+        printf("%s: format %d is not supported by the device, decoding it on the CPU\n", path, file.fileFormat);
+    }
+    else
+    {
+        printf("%s: format %d is neither supported by the device nor decodable\n", path, file.fileFormat);
+        return false;
+    }
+
+    // KTX2 level lengths aren't checked by the parser, readMappedMip relies on them
+    for (uint32_t level = 0; level < file.levelCount; level++)
+    {
+        VkDeviceSize expected = textureLevelSize(file.fileFormat, file.width, file.height, level);
+        if (file.levelSizes[level] < expected)
+        {
+            printf("%s: level %u is %zu bytes, expected %llu\n", path, level, file.levelSizes[level], static_cast<unsigned long long>(expected));
+            return false;
+        }
+        file.levelSizes[level] = static_cast<size_t>(expected);
+    }
+
+    return true;
+}
+
+bool loadTextureFile(const char* path, TextureSource &source)
+{
+    // usually prefetched by init() while the device was set up
+    FileDataPtr contents = readFileAsync(path).get();
+    if (!contents->ok)
+    {
+        printf("Could not open texture %s\n", path);
+        return false;
+    }
+
+    if (contents->size < 128)
+    {
+        printf("%s is not a texture file\n", path);
+        return false;
+    }
+
+    MappedTextureFile *file = new MappedTextureFile();
+    file->contents = contents;
+    file->data = contents->data;
+    file->size = contents->size;
+
+    static const uint8_t ktx2Identifier[4] = { 0xab, 'K', 'T', 'X' };
+
+    bool parsed = false;
+    if (memcmp(file->data, ktx2Identifier, sizeof(ktx2Identifier)) == 0)
+    {
+        parsed = parseKTX2(*file, path);
+    }
+    else if (memcmp(file->data, "DDS ", 4) == 0)
+    {
+        parsed = parseDDS(*file, path);
+    }
+    else
+    {
+        printf("%s is neither a KTX2 nor a DDS file\n", path);
+    }
+
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    if (!parsed || file->width == 0 || file->height == 0 || !chooseUploadFormat(*file, path, &format))
+    {
+        releaseMappedFile(file);
+        return false;
+    }
+
+    // levels are read in the order the streaming threads want them
+    if (contents->mapping != nullptr)
+    {
+        madvise(contents->mapping, contents->size, MADV_RANDOM);
+    }
+
+    memset(&source, 0, sizeof(source));
+    source.width = file->width;
+    source.height = file->height;
+    source.mipCount = file->levelCount;
+    source.format = format;
+    source.readMip = readMappedMip;
+    source.release = releaseMappedFile;
+    source.userData = file;
+
+    // A single uncompressed level gets its mip chain from blits, when the
+    // format can be blitted. Decoded levels are uncompressed by then
+    const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+    if (file->levelCount == 1 && !isBlockCompressedFormat(format) && (getOptimalFormatFeatures(format) & blitFeatures) == blitFeatures)
+    {
+        uint32_t size = std::max(file->width, file->height);
+        while ((size >> source.mipCount) > 0 && source.mipCount < TEXTURE_MAX_MIPS)
+        {
+            source.mipCount++;
+        }
+        source.generateMips = (source.mipCount > 1);
+    }
+
+    printf("Loaded texture %s: %ux%u, %u levels%s\n", path, source.width, source.height, source.mipCount,
+           source.generateMips ? " generated on the GPU" : "");
+
+    return true;
+}
@@ -0,0 +1,12 @@
+#ifndef __TEXTURELOADER_H__
+#define __TEXTURELOADER_H__
+
+#include "textures.h"
+
+// Maps a KTX2 or DDS file and describes it as a texture source. Levels are
+// read straight from the mapping, block compressed formats the device
+// cannot sample are decoded to RGBA8 on the way. A single uncompressed
+// level gets the rest of its mip chain generated on the GPU
+bool loadTextureFile(const char* path, TextureSource &source);
+
+#endif //__TEXTURELOADER_H__
@@ -0,0 +1,1032 @@
+/*
+    Texture streaming under a memory budget, with the sampler and image view caches
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+// Staging offsets of the levels of a load are aligned to this
+static const VkDeviceSize TEXTURE_STAGING_ALIGNMENT = 16;
+
+static uint32_t formatTexelSize(VkFormat format)
+{
+    switch (format)
+    {
+        case VK_FORMAT_R8_UNORM:
+            return 1;
+        case VK_FORMAT_R8G8_UNORM:
+            return 2;
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+            return 4;
+        default:
+            printf("Unsupported texture format %d\n", format);
+            assert(false);
+            return 4;
+    }
+}
+
+// Bytes of a 4x4 block, 0 for formats that aren't block compressed
+static uint32_t formatBlockSize(VkFormat format)
+{
+    switch (format)
+    {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+        case VK_FORMAT_BC4_SNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+            return 8;
+        case VK_FORMAT_BC2_UNORM_BLOCK:
+        case VK_FORMAT_BC2_SRGB_BLOCK:
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+        case VK_FORMAT_BC5_SNORM_BLOCK:
+        case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+        case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+        case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+bool isBlockCompressedFormat(VkFormat format)
+{
+    return formatBlockSize(format) > 0;
+}
+
+bool isTextureFormatSupported(VkFormat format)
+{
+    switch (format)
+    {
+        case VK_FORMAT_R8_UNORM:
+        case VK_FORMAT_R8G8_UNORM:
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+            return true;
+        default:
+            return isBlockCompressedFormat(format);
+    }
+}
+
+VkDeviceSize textureLevelSize(VkFormat format, uint32_t width, uint32_t height, uint32_t level)
+{
+    VkDeviceSize levelWidth = std::max(width >> level, 1u);
+    VkDeviceSize levelHeight = std::max(height >> level, 1u);
+
+    uint32_t blockSize = formatBlockSize(format);
+    if (blockSize > 0)
+    {
+        return ((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * blockSize;
+    }
+
+    return levelWidth * levelHeight * formatTexelSize(format);
+}
+
+static VkDeviceSize textureRangeSize(const TextureSource &source, uint32_t firstMip, uint32_t lastMip)
+{
+    VkDeviceSize size = 0;
+    for (uint32_t level = firstMip; level < lastMip; level++)
+    {
+        size += textureLevelSize(source.format, source.width, source.height, level);
+    }
+    return size;
+}
+
+static VkExtent3D textureLevelExtent(const TextureSource &source, uint32_t level)
+{
+    VkExtent3D extent;
+    extent.width = std::max(source.width >> level, 1u);
+    extent.height = std::max(source.height >> level, 1u);
+    extent.depth = 1;
+    return extent;
+}
+
+VkSampler getSampler(const SamplerDesc &desc)
+{
+    TextureManager &textures = g_app.textures;
+
+    uint32_t key = static_cast<uint32_t>(desc.filter) | (static_cast<uint32_t>(desc.mipmapMode) << 8) | (static_cast<uint32_t>(desc.addressMode) << 16);
+
+    std::lock_guard<std::mutex> guard(textures.cacheLock);
+
+    auto cached = textures.samplers.find(key);
+    if (cached != textures.samplers.end())
+    {
+        return cached->second;
+    }
+
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = desc.filter;
+    samplerInfo.minFilter = desc.filter;
+    samplerInfo.mipmapMode = desc.mipmapMode;
+    samplerInfo.addressModeU = desc.addressMode;
+    samplerInfo.addressModeV = desc.addressMode;
+    samplerInfo.addressModeW = desc.addressMode;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+
+    VkSampler sampler = VK_NULL_HANDLE;
+    VkResult result = vkCreateSampler(g_app.device, &samplerInfo, getHostAllocator(HOST_OBJECT_SAMPLER), &sampler);
+    assert(result == VK_SUCCESS);
+
+    textures.samplers[key] = sampler;
+
+    return sampler;
+}
+
+VkImageView getImageView(VkImage image, VkFormat format, uint32_t baseMip, uint32_t mipCount)
+{
+    TextureManager &textures = g_app.textures;
+    std::lock_guard<std::mutex> guard(textures.cacheLock);
+
+    std::vector<CachedImageView> &imageViews = textures.views[image];
+    for (const CachedImageView &cached : imageViews)
+    {
+        if (cached.format == format && cached.baseMip == baseMip && cached.mipCount == mipCount)
+        {
+            return cached.view;
+        }
+    }
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
+    viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, baseMip, mipCount, 0, 1 };
+
+    CachedImageView cached;
+    cached.format = format;
+    cached.baseMip = baseMip;
+    cached.mipCount = mipCount;
+
+    VkResult result = vkCreateImageView(g_app.device, &viewInfo, getHostAllocator(HOST_OBJECT_IMAGE_VIEW), &cached.view);
+    assert(result == VK_SUCCESS);
+
+    imageViews.push_back(cached);
+
+    return cached.view;
+}
+
+void releaseImageViews(VkImage image)
+{
+    TextureManager &textures = g_app.textures;
+    std::lock_guard<std::mutex> guard(textures.cacheLock);
+
+    auto imageViews = textures.views.find(image);
+    if (imageViews == textures.views.end())
+    {
+        return;
+    }
+
+    for (const CachedImageView &cached : imageViews->second)
+    {
+        evictCachedDescriptorSets((uint64_t)cached.view);
+        vkDestroyImageView(g_app.device, cached.view, getHostAllocator(HOST_OBJECT_IMAGE_VIEW));
+    }
+    textures.views.erase(imageViews);
+}
+
+static bool createStagingBuffer(VkDeviceSize size, VkBuffer *buffer, VkDeviceMemory *memory, void **mapped)
+{
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VkResult result = vkCreateBuffer(g_app.device, &bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), buffer);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_app.device, *buffer, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memAllocInfo.memoryTypeIndex) ||
+        allocateDeviceMemory(&memAllocInfo, memory) != VK_SUCCESS)
+    {
+        vkDestroyBuffer(g_app.device, *buffer, getHostAllocator(HOST_OBJECT_BUFFER));
+        *buffer = VK_NULL_HANDLE;
+        *memory = VK_NULL_HANDLE;
+        return false;
+    }
+
+    vkBindBufferMemory(g_app.device, *buffer, *memory, 0);
+
+    result = vkMapMemory(g_app.device, *memory, 0, VK_WHOLE_SIZE, 0, mapped);
+    assert(result == VK_SUCCESS);
+
+    return true;
+}
+
+// Levels of a load that come from its source, the others are generated
+static uint32_t textureLoadReadEnd(const TextureLoad &load)
+{
+    return load.source.generateMips ? load.firstMip + 1 : load.lastMip;
+}
+
+// Runs on a streaming thread, everything it needs is in the load
+static void readTextureLoad(TextureLoad &load)
+{
+    const TextureSource &source = load.source;
+    uint32_t readEnd = textureLoadReadEnd(load);
+
+    load.size = 0;
+    for (uint32_t level = load.firstMip; level < readEnd; level++)
+    {
+        load.offsets[level] = load.size;
+        VkDeviceSize levelSize = textureLevelSize(source.format, source.width, source.height, level);
+        load.size += (levelSize + TEXTURE_STAGING_ALIGNMENT - 1) & ~(TEXTURE_STAGING_ALIGNMENT - 1);
+    }
+
+    uint8_t *mapped;
+    load.succeeded = createStagingBuffer(load.size, &load.stagingBuffer, &load.stagingMemory, (void **)&mapped);
+    if (!load.succeeded)
+    {
+        printf("Could not allocate %llu bytes of texture staging memory\n", static_cast<unsigned long long>(load.size));
+        return;
+    }
+
+    for (uint32_t level = load.firstMip; level < readEnd && load.succeeded; level++)
+    {
+        VkDeviceSize levelSize = textureLevelSize(source.format, source.width, source.height, level);
+        load.succeeded = source.readMip(source.userData, level, mapped + load.offsets[level], levelSize);
+    }
+
+    vkUnmapMemory(g_app.device, load.stagingMemory);
+}
+
+static void streamingThread()
+{
+    TextureManager &textures = g_app.textures;
+
+    for (;;)
+    {
+        TextureLoad load;
+        {
+            std::unique_lock<std::mutex> guard(textures.lock);
+            textures.wake.wait(guard, [&textures]() { return textures.stop || !textures.requests.empty(); });
+
+            if (textures.stop)
+            {
+                return;
+            }
+
+            // the most important load first, priorities are from when the load was queued
+            auto next = std::max_element(textures.requests.begin(), textures.requests.end(),
+                                         [](const TextureLoad &a, const TextureLoad &b) { return a.priority < b.priority; });
+            load = *next;
+            textures.requests.erase(next);
+        }
+
+        readTextureLoad(load);
+
+        std::lock_guard<std::mutex> guard(textures.lock);
+        textures.completed.push_back(load);
+    }
+}
+
+static void queueTextureLoad(TextureHandle handle, uint32_t firstMip, uint32_t lastMip, float priority)
+{
+    TextureManager &textures = g_app.textures;
+    StreamedTexture &texture = textures.textures[handle];
+
+    TextureLoad load = {};
+    load.texture = handle;
+    load.source = texture.source;
+    load.firstMip = firstMip;
+    load.lastMip = lastMip;
+    load.priority = priority;
+
+    texture.loading = true;
+
+    {
+        std::lock_guard<std::mutex> guard(textures.lock);
+        textures.requests.push_back(load);
+    }
+    textures.wake.notify_one();
+}
+
+static VkCommandBuffer beginStreamingCommands()
+{
+    TextureManager &textures = g_app.textures;
+
+    if (!textures.recording)
+    {
+        textures.cmdBuffer = beginFrameCommandBuffer();
+        textures.recording = true;
+    }
+
+    return textures.cmdBuffer;
+}
+
+static void textureLevelsBarrier(VkCommandBuffer cmdBuffer, VkImage image, uint32_t baseMip, uint32_t mipCount,
+                                 VkImageLayout oldLayout, VkImageLayout newLayout,
+                                 VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+                                 VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages)
+{
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, baseMip, mipCount, 0, 1 };
+
+    vkCmdPipelineBarrier(cmdBuffer, srcStages, dstStages, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+// The defragmenter copied the image of a texture into another block
+static void textureMoved(AllocationHandle allocation, void* userData)
+{
+    TextureManager &textures = g_app.textures;
+    TextureHandle handle = static_cast<TextureHandle>(reinterpret_cast<uintptr_t>(userData));
+    StreamedTexture &texture = textures.textures[handle];
+
+    assert(texture.allocation == allocation);
+
+    RetiredTextureObjects retired = {};
+    retired.image = texture.image;
+    retired.frame = getRecordingFrame();
+    textures.retired.push_back(retired);
+
+    texture.image = getManagedImage(allocation);
+    texture.view = getImageView(texture.image, texture.source.format, 0, texture.source.mipCount - texture.residentMip);
+
+    if (texture.bindlessSlot != BINDLESS_INVALID_INDEX)
+    {
+        updateBindlessTexture(texture.bindlessSlot, getTextureDescriptor(handle));
+    }
+}
+
+// Moves a texture to a new image with the levels topMip to mipCount - 1.
+// Levels the current image already has are copied on the GPU, the others
+// come from the staging buffer of the load
+static bool resizeTexture(TextureHandle handle, uint32_t topMip, const TextureLoad *load)
+{
+    TextureManager &textures = g_app.textures;
+    StreamedTexture &texture = textures.textures[handle];
+    const TextureSource &source = texture.source;
+
+    uint32_t levelCount = source.mipCount - topMip;
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = source.format;
+    imageInfo.extent = textureLevelExtent(source, topMip);
+    imageInfo.mipLevels = levelCount;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    // textures are resized all the time, their images live in memory blocks the defragmenter keeps compact
+    AllocationHandle allocation = createManagedImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                                     textureMoved, reinterpret_cast<void*>(static_cast<uintptr_t>(handle)));
+    if (allocation == INVALID_ALLOCATION)
+    {
+        printf("Could not allocate a %ux%u texture\n", imageInfo.extent.width, imageInfo.extent.height);
+        return false;
+    }
+
+    VkImage image = getManagedImage(allocation);
+    VkDeviceSize memorySize = getManagedAllocationSize(allocation);
+
+    VkCommandBuffer cmdBuffer = beginStreamingCommands();
+
+    textureLevelsBarrier(cmdBuffer, image, 0, levelCount,
+                         VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    if (texture.image != VK_NULL_HANDLE)
+    {
+        // the old image is thrown away afterwards, it is left in the transfer layout
+        textureLevelsBarrier(cmdBuffer, texture.image, 0, source.mipCount - texture.residentMip,
+                             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        std::vector<VkImageCopy> copyRegions;
+        for (uint32_t level = std::max(topMip, texture.residentMip); level < source.mipCount; level++)
+        {
+            VkImageCopy copyRegion = {};
+            copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - texture.residentMip, 0, 1 };
+            copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - topMip, 0, 1 };
+            copyRegion.extent = textureLevelExtent(source, level);
+            copyRegions.push_back(copyRegion);
+        }
+
+        vkCmdCopyImage(cmdBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+    }
+
+    if (load != nullptr)
+    {
+        assert(load->firstMip == topMip);
+
+        std::vector<VkBufferImageCopy> copyRegions;
+        for (uint32_t level = load->firstMip; level < textureLoadReadEnd(*load); level++)
+        {
+            VkBufferImageCopy copyRegion = {};
+            copyRegion.bufferOffset = load->offsets[level];
+            copyRegion.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - topMip, 0, 1 };
+            copyRegion.imageExtent = textureLevelExtent(source, level);
+            copyRegions.push_back(copyRegion);
+        }
+
+        vkCmdCopyBufferToImage(cmdBuffer, load->stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+
+        // Every generated level is blitted from the one above it, which is
+        // moved to the transfer source layout first. They stay there until
+        // the whole chain is done
+        for (uint32_t level = textureLoadReadEnd(*load); level < load->lastMip; level++)
+        {
+            textureLevelsBarrier(cmdBuffer, image, level - 1 - topMip, 1,
+                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                 VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+            VkExtent3D srcExtent = textureLevelExtent(source, level - 1);
+            VkExtent3D dstExtent = textureLevelExtent(source, level);
+
+            VkImageBlit blit = {};
+            blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1 - topMip, 0, 1 };
+            blit.srcOffsets[1] = { static_cast<int32_t>(srcExtent.width), static_cast<int32_t>(srcExtent.height), 1 };
+            blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - topMip, 0, 1 };
+            blit.dstOffsets[1] = { static_cast<int32_t>(dstExtent.width), static_cast<int32_t>(dstExtent.height), 1 };
+
+            vkCmdBlitImage(cmdBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           1, &blit, texture.mipFilter);
+        }
+
+        uint32_t blitSources = load->lastMip - textureLoadReadEnd(*load);
+        if (blitSources > 0)
+        {
+            textureLevelsBarrier(cmdBuffer, image, load->firstMip - topMip, blitSources,
+                                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                 VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+        }
+    }
+
+    // the levels the blits read from are already in the shader layout
+    uint32_t readyLevels = (load != nullptr) ? load->lastMip - textureLoadReadEnd(*load) : 0;
+
+    textureLevelsBarrier(cmdBuffer, image, readyLevels, levelCount - readyLevels,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                         VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+    if (texture.image != VK_NULL_HANDLE)
+    {
+        // the copies above still read the old image, the memory manager keeps it for another frame
+        RetiredTextureObjects retired = {};
+        retired.image = texture.image;
+        retired.frame = getRecordingFrame();
+        textures.retired.push_back(retired);
+        destroyManagedAllocation(texture.allocation);
+
+        textures.residentBytes -= texture.memorySize;
+    }
+
+    texture.image = image;
+    texture.allocation = allocation;
+    texture.memorySize = memorySize;
+    texture.residentMip = topMip;
+    texture.view = getImageView(image, source.format, 0, levelCount);
+
+    textures.residentBytes += memorySize;
+
+    if (texture.bindlessSlot != BINDLESS_INVALID_INDEX)
+    {
+        updateBindlessTexture(texture.bindlessSlot, getTextureDescriptor(handle));
+    }
+
+    return true;
+}
+
+// Drops the top levels of textures with a lower priority until the needed
+// bytes fit the budget. Nothing is evicted when that isn't enough
+static bool makeTextureRoom(TextureHandle requester, VkDeviceSize neededBytes, float priority)
+{
+    TextureManager &textures = g_app.textures;
+
+    VkDeviceSize budget = std::min(textures.budget, textures.pressureBudget);
+
+    if (textures.residentBytes + neededBytes <= budget)
+    {
+        return true;
+    }
+
+    VkDeviceSize excessBytes = textures.residentBytes + neededBytes - budget;
+
+    std::vector<TextureHandle> candidates;
+    for (TextureHandle handle = 0; handle < textures.textures.size(); handle++)
+    {
+        const StreamedTexture &texture = textures.textures[handle];
+        if (handle != requester && texture.image != VK_NULL_HANDLE && texture.residentMip < texture.tailMip && texture.priority < priority)
+        {
+            candidates.push_back(handle);
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [&textures](TextureHandle a, TextureHandle b) {
+        return textures.textures[a].priority < textures.textures[b].priority;
+    });
+
+    // work out the new top level of every texture before touching any of them
+    std::vector<std::pair<TextureHandle, uint32_t>> evictions;
+    VkDeviceSize freedBytes = 0;
+
+    for (TextureHandle handle : candidates)
+    {
+        if (freedBytes >= excessBytes)
+        {
+            break;
+        }
+
+        const StreamedTexture &texture = textures.textures[handle];
+
+        uint32_t topMip = texture.residentMip;
+        while (topMip < texture.tailMip && freedBytes < excessBytes)
+        {
+            freedBytes += textureLevelSize(texture.source.format, texture.source.width, texture.source.height, topMip);
+            topMip++;
+        }
+
+        evictions.push_back(std::make_pair(handle, topMip));
+    }
+
+    if (freedBytes < excessBytes)
+    {
+        return false;
+    }
+
+    for (const auto &eviction : evictions)
+    {
+        if (resizeTexture(eviction.first, eviction.second, nullptr))
+        {
+            textures.evictions++;
+        }
+    }
+
+    return true;
+}
+
+void updateTextureStreaming()
+{
+    TextureManager &textures = g_app.textures;
+
+    // Views of images whose frames have finished. The images are destroyed
+    // by updateDeviceMemory() after this, their views have to go first
+    auto released = std::stable_partition(textures.retired.begin(), textures.retired.end(),
+                                          [](const RetiredTextureObjects &retired) { return !isFrameComplete(retired.frame); });
+    for (auto retired = released; retired != textures.retired.end(); ++retired)
+    {
+        releaseImageViews(retired->image);
+    }
+    textures.retired.erase(released, textures.retired.end());
+
+    // memory pressure may have lowered the budget below what is resident
+    if (textures.residentBytes > std::min(textures.budget, textures.pressureBudget))
+    {
+        makeTextureRoom(INVALID_TEXTURE, 0, FLT_MAX);
+    }
+
+    std::vector<TextureLoad> completed;
+    {
+        std::lock_guard<std::mutex> guard(textures.lock);
+        completed.swap(textures.completed);
+    }
+
+    // most important first, loads past this frame's upload limit wait for the next one
+    std::sort(completed.begin(), completed.end(), [](const TextureLoad &a, const TextureLoad &b) { return a.priority > b.priority; });
+
+    std::vector<TextureLoad> deferred;
+    VkDeviceSize uploadBytes = 0;
+
+    for (const TextureLoad &load : completed)
+    {
+        if (uploadBytes > 0 && uploadBytes + load.size > TEXTURE_UPLOAD_BYTES_PER_FRAME)
+        {
+            deferred.push_back(load);
+            continue;
+        }
+
+        StreamedTexture &texture = textures.textures[load.texture];
+
+        // Levels may have been evicted since the load was queued, then it
+        // no longer sits on top of the resident levels and is dropped
+        if (load.succeeded && load.lastMip == texture.residentMip)
+        {
+            // the tail always fits, only the levels above it count against the budget
+            bool tail = (load.lastMip == texture.source.mipCount);
+            VkDeviceSize neededBytes = textureRangeSize(texture.source, load.firstMip, load.lastMip);
+
+            if (tail || makeTextureRoom(load.texture, neededBytes, load.priority))
+            {
+                if (resizeTexture(load.texture, load.firstMip, &load))
+                {
+                    uploadBytes += load.size;
+                    textures.uploadedBytes += load.size;
+                    textures.loadsCompleted++;
+                }
+            }
+            else
+            {
+                texture.deniedPriority = texture.priority;
+            }
+        }
+
+        texture.loading = false;
+
+        deferDestroyBuffer(load.stagingBuffer);
+        deferFreeMemory(load.stagingMemory);
+    }
+
+    if (!deferred.empty())
+    {
+        std::lock_guard<std::mutex> guard(textures.lock);
+        textures.completed.insert(textures.completed.end(), deferred.begin(), deferred.end());
+    }
+
+    // One level at a time, so detail keeps improving while the larger
+    // levels are read. A texture that was refused by the budget only
+    // asks again once it has become more important
+    for (TextureHandle handle = 0; handle < textures.textures.size(); handle++)
+    {
+        const StreamedTexture &texture = textures.textures[handle];
+        if (!texture.loading && texture.image != VK_NULL_HANDLE && texture.wantedMip < texture.residentMip && texture.priority > texture.deniedPriority)
+        {
+            queueTextureLoad(handle, texture.residentMip - 1, texture.residentMip, texture.priority);
+        }
+    }
+
+    if (textures.recording)
+    {
+        VkResult result = vkEndCommandBuffer(textures.cmdBuffer);
+        assert(result == VK_SUCCESS);
+
+        // Same queue as the frame, the barriers at the end of the copies
+        // order them before the draws that sample the textures
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &textures.cmdBuffer;
+
+        result = vkQueueSubmit(g_app.queue, 1, &submitInfo, VK_NULL_HANDLE);
+        assert(result == VK_SUCCESS);
+
+        textures.recording = false;
+    }
+}
+
+TextureHandle createStreamedTexture(const TextureSource &source, const SamplerDesc &samplerDesc)
+{
+    TextureManager &textures = g_app.textures;
+
+    assert(source.mipCount > 0 && source.mipCount <= TEXTURE_MAX_MIPS);
+
+    StreamedTexture texture;
+    texture.source = source;
+    texture.sampler = getSampler(samplerDesc);
+    texture.residentMip = source.mipCount;
+
+    // The first level that fits the tail size, or the smallest level there
+    // is. Generated mips need level 0, so such textures are all tail
+    texture.tailMip = 0;
+    while (!source.generateMips && texture.tailMip + 1 < source.mipCount && std::max(source.width >> texture.tailMip, source.height >> texture.tailMip) > TEXTURE_TAIL_SIZE)
+    {
+        texture.tailMip++;
+    }
+    texture.wantedMip = texture.tailMip;
+
+    if (source.generateMips)
+    {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(g_app.gpu[0], source.format, &formatProperties);
+
+        const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+        assert((formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures);
+
+        if (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)
+        {
+            texture.mipFilter = VK_FILTER_LINEAR;
+        }
+    }
+
+    TextureHandle handle = static_cast<TextureHandle>(textures.textures.size());
+
+    if (g_app.bindless.enabled)
+    {
+        VkDescriptorImageInfo fallbackInfo = {};
+        fallbackInfo.sampler = texture.sampler;
+        fallbackInfo.imageView = textures.fallback.view;
+        fallbackInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        texture.bindlessSlot = registerBindlessTexture(fallbackInfo);
+    }
+
+    textures.textures.push_back(texture);
+
+    // the tail goes ahead of every other load, higher levels follow once the texture has a priority
+    queueTextureLoad(handle, textures.textures[handle].tailMip, source.mipCount, FLT_MAX);
+
+    return handle;
+}
+
+void setTexturePriority(TextureHandle handle, float screenSize, float distance)
+{
+    StreamedTexture &texture = g_app.textures.textures[handle];
+
+    // the level with about as many texels as the texture covers pixels
+    float texels = static_cast<float>(std::max(texture.source.width, texture.source.height));
+    float level = std::log2(std::max(texels / std::max(screenSize, 1.0f), 1.0f));
+
+    texture.wantedMip = std::min(static_cast<uint32_t>(level), texture.tailMip);
+    texture.priority = screenSize / std::max(distance, 1.0f);
+}
+
+VkDescriptorImageInfo getTextureDescriptor(TextureHandle handle)
+{
+    const TextureManager &textures = g_app.textures;
+    const StreamedTexture &texture = textures.textures[handle];
+
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.sampler = texture.sampler;
+    imageInfo.imageView = (texture.view != VK_NULL_HANDLE) ? texture.view : textures.fallback.view;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    return imageInfo;
+}
+
+uint32_t getTextureBindlessSlot(TextureHandle handle)
+{
+    return g_app.textures.textures[handle].bindlessSlot;
+}
+
+struct CheckerTexture
+{
+    uint32_t size;
+    uint32_t colors[2];
+};
+
+static bool readCheckerMip(void* userData, uint32_t level, void* dst, VkDeviceSize size)
+{
+    const CheckerTexture *checker = static_cast<const CheckerTexture*>(userData);
+
+    const uint32_t squares = 8;
+    uint32_t levelSize = std::max(checker->size >> level, 1u);
+    assert(size == static_cast<VkDeviceSize>(levelSize) * levelSize * 4);
+
+    uint32_t *texels = static_cast<uint32_t*>(dst);
+
+    // below one texel per square the level is the average of both colors
+    if (levelSize < squares)
+    {
+        uint32_t average = 0;
+        for (uint32_t channel = 0; channel < 32; channel += 8)
+        {
+            uint32_t sum = ((checker->colors[0] >> channel) & 0xff) + ((checker->colors[1] >> channel) & 0xff);
+            average |= (sum / 2) << channel;
+        }
+
+        std::fill(texels, texels + levelSize * levelSize, average);
+        return true;
+    }
+
+    uint32_t squareSize = levelSize / squares;
+    for (uint32_t y = 0; y < levelSize; y++)
+    {
+        for (uint32_t x = 0; x < levelSize; x++)
+        {
+            texels[y * levelSize + x] = checker->colors[((x / squareSize) + (y / squareSize)) & 1];
+        }
+    }
+
+    return true;
+}
+
+static void releaseChecker(void* userData)
+{
+    delete static_cast<CheckerTexture*>(userData);
+}
+
+TextureSource createCheckerTextureSource(uint32_t size, uint32_t color0, uint32_t color1)
+{
+    CheckerTexture *checker = new CheckerTexture;
+    checker->size = size;
+    checker->colors[0] = color0;
+    checker->colors[1] = color1;
+
+    TextureSource source = {};
+    source.width = size;
+    source.height = size;
+    source.format = VK_FORMAT_R8G8B8A8_UNORM;
+    source.readMip = readCheckerMip;
+    source.release = releaseChecker;
+    source.userData = checker;
+
+    source.mipCount = 1;
+    while ((size >> source.mipCount) > 0)
+    {
+        source.mipCount++;
+    }
+
+    return source;
+}
+
+static bool initFallbackTexture()
+{
+    TextureManager &textures = g_app.textures;
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    imageInfo.extent = { 1, 1, 1 };
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkResult result = vkCreateImage(g_app.device, &imageInfo, getHostAllocator(HOST_OBJECT_IMAGE), &textures.fallback.image);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(g_app.device, textures.fallback.image, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    bool pass = memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memAllocInfo.memoryTypeIndex);
+    assert(pass);
+
+    result = allocateDeviceMemory(&memAllocInfo, &textures.fallback.memory);
+    assert(result == VK_SUCCESS);
+
+    vkBindImageMemory(g_app.device, textures.fallback.image, textures.fallback.memory, 0);
+
+    // a single white texel, cleared instead of uploaded
+    VkCommandBuffer setupCmdBuffer = beginSetupCommands();
+
+    setImageLayout(setupCmdBuffer, textures.fallback.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    VkClearColorValue white = { { 1.0f, 1.0f, 1.0f, 1.0f } };
+    VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    vkCmdClearColorImage(setupCmdBuffer, textures.fallback.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &white, 1, &range);
+
+    setImageLayout(setupCmdBuffer, textures.fallback.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    endSetupCommands();
+
+    textures.fallback.view = getImageView(textures.fallback.image, VK_FORMAT_R8G8B8A8_UNORM, 0, 1);
+
+    SamplerDesc samplerDesc = { VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST, VK_SAMPLER_ADDRESS_MODE_REPEAT };
+    textures.fallback.sampler = getSampler(samplerDesc);
+
+    return true;
+}
+
+// Textures stop growing while a device local heap is under pressure and
+// give back a quarter of their levels when it gets critical. The eviction
+// happens at the next updateTextureStreaming()
+static void textureMemoryPressure(uint32_t heapIndex, MemoryPressure pressure, void* userData)
+{
+    TextureManager &textures = g_app.textures;
+
+    if (!(g_app.memoryProperties.memoryHeaps[heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+    {
+        return;
+    }
+
+    switch (pressure)
+    {
+        case MEMORY_PRESSURE_NONE:
+            textures.pressureBudget = ~0ull;
+            break;
+        case MEMORY_PRESSURE_WARNING:
+            textures.pressureBudget = textures.residentBytes;
+            break;
+        case MEMORY_PRESSURE_CRITICAL:
+            textures.pressureBudget = textures.residentBytes / 4 * 3;
+            break;
+    }
+}
+
+bool initTextureStreaming()
+{
+    TextureManager &textures = g_app.textures;
+
+    registerMemoryPressureCallback(textureMemoryPressure, nullptr);
+
+    if (!initFallbackTexture())
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < TEXTURE_STREAMING_THREADS; i++)
+    {
+        textures.threads.push_back(std::thread(streamingThread));
+    }
+
+    printf("Texture streaming: %llu MB budget, %u threads\n", static_cast<unsigned long long>(textures.budget / (1024 * 1024)), TEXTURE_STREAMING_THREADS);
+
+    return true;
+}
+
+void destroyTextureStreaming()
+{
+    TextureManager &textures = g_app.textures;
+
+    {
+        std::lock_guard<std::mutex> guard(textures.lock);
+        textures.stop = true;
+    }
+    textures.wake.notify_all();
+
+    for (std::thread &thread : textures.threads)
+    {
+        thread.join();
+    }
+    textures.threads.clear();
+
+    // loads that finished after the last frame still hold their staging buffers
+    for (const TextureLoad &load : textures.completed)
+    {
+        if (load.stagingBuffer != VK_NULL_HANDLE)
+        {
+            vkDestroyBuffer(g_app.device, load.stagingBuffer, getHostAllocator(HOST_OBJECT_BUFFER));
+            freeDeviceMemory(load.stagingMemory);
+        }
+    }
+    textures.completed.clear();
+    textures.requests.clear();
+
+    for (const RetiredTextureObjects &retired : textures.retired)
+    {
+        releaseImageViews(retired.image);
+    }
+    textures.retired.clear();
+
+    for (StreamedTexture &texture : textures.textures)
+    {
+        if (texture.image != VK_NULL_HANDLE)
+        {
+            releaseImageViews(texture.image);
+            destroyManagedAllocation(texture.allocation);
+        }
+        if (texture.source.release != nullptr)
+        {
+            texture.source.release(texture.source.userData);
+        }
+    }
+    textures.textures.clear();
+    textures.residentBytes = 0;
+
+    releaseImageViews(textures.fallback.image);
+    vkDestroyImage(g_app.device, textures.fallback.image, getHostAllocator(HOST_OBJECT_IMAGE));
+    freeDeviceMemory(textures.fallback.memory);
+
+    for (auto &sampler : textures.samplers)
+    {
+        vkDestroySampler(g_app.device, sampler.second, getHostAllocator(HOST_OBJECT_SAMPLER));
+    }
+    textures.samplers.clear();
+}
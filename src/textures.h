@@ -0,0 +1,198 @@
+#ifndef __TEXTURES_H__
+#define __TEXTURES_H__
+
+#include <vulkan/vulkan.h>
+
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+#include <unordered_map>
+
+#include "bindless.h"
+#include "devicememory.h"
+
+const uint32_t TEXTURE_MAX_MIPS = 16;
+
+// Levels no larger than this are the mip tail. The tail is the first thing
+// loaded for a texture and is never evicted
+const uint32_t TEXTURE_TAIL_SIZE = 64;
+
+// Device memory of all streamed textures together, --texture-budget <MB> overrides it
+const VkDeviceSize TEXTURE_DEFAULT_BUDGET = 64 * 1024 * 1024;
+
+// Staged bytes copied into textures per frame, the rest waits for the next frame
+const VkDeviceSize TEXTURE_UPLOAD_BYTES_PER_FRAME = 8 * 1024 * 1024;
+
+const uint32_t TEXTURE_STREAMING_THREADS = 2;
+
+typedef uint32_t TextureHandle;
+const TextureHandle INVALID_TEXTURE = 0xffffffff;
+
+// Where the texels of a texture come from. readMip() runs on the streaming
+// threads and writes one tightly packed level of textureLevelSize() bytes.
+// With generateMips only level 0 is read, the other levels are blitted
+// from it on the GPU and the texture is loaded as a whole
+struct TextureSource
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipCount;
+    VkFormat format;
+    bool generateMips;
+
+    bool (*readMip)(void* userData, uint32_t level, void* dst, VkDeviceSize size);
+    void (*release)(void* userData);
+    void* userData;
+};
+
+struct SamplerDesc
+{
+    VkFilter filter;
+    VkSamplerMipmapMode mipmapMode;
+    VkSamplerAddressMode addressMode;
+};
+
+struct StreamedTexture
+{
+    TextureSource source;
+    VkSampler sampler;
+
+    // The image only holds the levels residentMip to mipCount - 1. It is
+    // replaced by a larger or smaller image whenever that range changes
+    VkImage image = VK_NULL_HANDLE;
+    AllocationHandle allocation = INVALID_ALLOCATION;
+    VkDeviceSize memorySize = 0;
+    VkImageView view = VK_NULL_HANDLE;
+
+    uint32_t residentMip;   // mipCount while nothing is resident
+    uint32_t tailMip;
+    uint32_t wantedMip;
+
+    // screen size over distance, from setTexturePriority()
+    float priority = 0.0f;
+    // priority of the last load that did not fit the budget
+    float deniedPriority = 0.0f;
+    bool loading = false;
+    // blit filter for generated mips, linear where the format supports it
+    VkFilter mipFilter = VK_FILTER_NEAREST;
+
+    uint32_t bindlessSlot = BINDLESS_INVALID_INDEX;
+};
+
+// Levels firstMip to lastMip - 1 of a texture, read by a streaming thread
+// into a staging buffer of their own
+struct TextureLoad
+{
+    TextureHandle texture;
+    TextureSource source;
+    uint32_t firstMip;
+    uint32_t lastMip;
+    float priority;
+
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingMemory;
+    VkDeviceSize offsets[TEXTURE_MAX_MIPS];
+    VkDeviceSize size;
+    bool succeeded;
+};
+
+struct CachedImageView
+{
+    VkFormat format;
+    uint32_t baseMip;
+    uint32_t mipCount;
+    VkImageView view;
+};
+
+// Views of an image the GPU may still use, released once its frame has
+// finished. The memory manager destroys the image itself
+struct RetiredTextureObjects
+{
+    VkImage image;
+    uint64_t frame;
+};
+
+// Streams texture mips from the smallest up. A texture starts out with
+// only its mip tail, higher levels are read by the streaming threads in
+// order of priority and copied into the texture through staging buffers.
+// When the textures would outgrow the budget, the lowest priority ones
+// drop their top levels again
+struct TextureManager
+{
+    VkDeviceSize budget = TEXTURE_DEFAULT_BUDGET;
+    // lowered while device memory is under pressure
+    VkDeviceSize pressureBudget = ~0ull;
+    VkDeviceSize residentBytes = 0;
+
+    // Created on the init threads before rendering starts, afterwards only
+    // touched by the render thread. The streaming threads only see loads
+    std::vector<StreamedTexture> textures;
+
+    // Sampled in place of a texture until its tail has arrived
+    struct {
+        VkImage image;
+        VkDeviceMemory memory;
+        VkImageView view;
+        VkSampler sampler;
+    } fallback;
+
+    // guards requests, completed and stop
+    std::mutex lock;
+    std::condition_variable wake;
+    std::vector<TextureLoad> requests;
+    std::vector<TextureLoad> completed;
+    std::vector<std::thread> threads;
+    bool stop = false;
+
+    // copies of the current frame, submitted ahead of its draws
+    VkCommandBuffer cmdBuffer;
+    bool recording = false;
+
+    std::vector<RetiredTextureObjects> retired;
+
+    // Samplers and views are shared by everything that asks for the same one
+    std::mutex cacheLock;
+    std::unordered_map<uint32_t, VkSampler> samplers;
+    std::unordered_map<VkImage, std::vector<CachedImageView>> views;
+
+    uint32_t loadsCompleted = 0;
+    uint32_t evictions = 0;
+    VkDeviceSize uploadedBytes = 0;
+};
+
+bool initTextureStreaming();
+
+// R8, RG8, RGBA8, BGRA8 and the BC and ETC2 block formats
+bool isTextureFormatSupported(VkFormat format);
+bool isBlockCompressedFormat(VkFormat format);
+
+// Bytes of one tightly packed level, block compressed levels are whole 4x4 blocks
+VkDeviceSize textureLevelSize(VkFormat format, uint32_t width, uint32_t height, uint32_t level);
+
+// Returns right away, the texture is sampled as the fallback until its tail is loaded
+TextureHandle createStreamedTexture(const TextureSource &source, const SamplerDesc &samplerDesc);
+
+// Screen size in pixels of the surface the texture is drawn on and its distance to the camera
+void setTexturePriority(TextureHandle texture, float screenSize, float distance);
+
+VkDescriptorImageInfo getTextureDescriptor(TextureHandle texture);
+uint32_t getTextureBindlessSlot(TextureHandle texture);
+
+// Called by render() once per frame. Frees what the finished frames
+// retired, applies finished loads, evicts for the budget and queues new
+// loads. Copies are submitted to the queue ahead of the frame
+void updateTextureStreaming();
+
+// A checker board of 8x8 squares generated for every level
+TextureSource createCheckerTextureSource(uint32_t size, uint32_t color0, uint32_t color1);
+
+VkSampler getSampler(const SamplerDesc &desc);
+VkImageView getImageView(VkImage image, VkFormat format, uint32_t baseMip, uint32_t mipCount);
+
+// Destroys the cached views of an image, call before destroying the image
+void releaseImageViews(VkImage image);
+
+void destroyTextureStreaming();
+
+#endif //__TEXTURES_H__
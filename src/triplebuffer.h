@@ -0,0 +1,60 @@
+#ifndef __TRIPLEBUFFER_H__
+#define __TRIPLEBUFFER_H__
+
+#include <stdint.h>
+
+#include <atomic>
+
+// Lock free single producer, single consumer triple buffer. The writer
+// always has a slot to write into and the reader always has the latest
+// complete value, neither side ever waits for the other. Values the
+// reader doesn't pick up in time are overwritten
+template <typename T>
+struct TripleBuffer
+{
+    T slots[3];
+
+    TripleBuffer() : shared(1), writeIndex(0), readIndex(2) {}
+
+    // writer side
+    T& writeSlot()
+    {
+        return slots[writeIndex];
+    }
+
+    // Hands the write slot to the reader and takes back the slot the reader isn't using
+    void publish()
+    {
+        writeIndex = shared.exchange(writeIndex | FRESH_BIT, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // reader side, returns true when a value was published since the last call
+    bool acquire()
+    {
+        if (!(shared.load(std::memory_order_relaxed) & FRESH_BIT))
+        {
+            return false;
+        }
+
+        readIndex = shared.exchange(readIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    const T& readSlot() const
+    {
+        return slots[readIndex];
+    }
+
+private:
+    static const uint32_t INDEX_MASK = 0x3;
+    static const uint32_t FRESH_BIT = 0x4;
+
+    // index of the slot in between writer and reader, with FRESH_BIT set
+    // when it holds a value the reader hasn't seen
+    std::atomic<uint32_t> shared;
+
+    uint32_t writeIndex;
+    uint32_t readIndex;
+};
+
+#endif //__TRIPLEBUFFER_H__
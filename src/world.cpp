@@ -0,0 +1,576 @@
+/*
+    World cells streamed in and out around the camera
+*/
+
+#include "main.h"
+
+#include <assert.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+
+static const VkDeviceSize WORLD_SLOT_BYTES = WORLD_MAX_CELL_OBJECTS * sizeof(WorldObject);
+
+static uint32_t cellSlot(const WorldCell &cell)
+{
+    return static_cast<uint32_t>(&cell - g_app.world.cells);
+}
+
+static uint32_t hashCell(int32_t x, int32_t z)
+{
+    uint32_t hash = static_cast<uint32_t>(x) * 0x9e3779b1u ^ static_cast<uint32_t>(z) * 0x85ebca77u;
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6du;
+    hash ^= hash >> 12;
+    return hash;
+}
+
+// Cells without a file get scattered objects, the same ones every time
+static void generateCell(WorldCell &cell)
+{
+    uint32_t state = hashCell(cell.x, cell.z) | 1;
+    auto next = [&state]()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return static_cast<float>(state & 0xffffff) / static_cast<float>(0x1000000);
+    };
+
+    uint32_t count = WORLD_MAX_CELL_OBJECTS / 4 + static_cast<uint32_t>(next() * (WORLD_MAX_CELL_OBJECTS * 3 / 4));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        WorldObject object;
+        object.position[0] = (cell.x + next()) * WORLD_CELL_SIZE;
+        object.position[1] = 0.0f;
+        object.position[2] = (cell.z + next()) * WORLD_CELL_SIZE;
+        object.scale = 0.5f + next() * 1.5f;
+        cell.objects.push_back(object);
+    }
+}
+
+static bool parseCell(WorldCell &cell, const FileData &file)
+{
+    WorldCellHeader header;
+    if (!file.ok || file.size < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, file.data, sizeof(header));
+
+    if (header.magic != WORLD_CELL_MAGIC || header.objectCount > WORLD_MAX_CELL_OBJECTS ||
+        file.size < sizeof(header) + header.objectCount * sizeof(WorldObject))
+    {
+        printf("World cell %d, %d has a bad header\n", cell.x, cell.z);
+        return false;
+    }
+
+    cell.objects.resize(header.objectCount);
+    memcpy(cell.objects.data(), file.data + sizeof(header), header.objectCount * sizeof(WorldObject));
+    return true;
+}
+
+// Runs on an I/O thread
+static void cellLoaded(const char* path, const FileDataPtr &file, void* userData)
+{
+    WorldStreamer &world = g_app.world;
+    WorldCell &cell = *static_cast<WorldCell*>(userData);
+
+    cell.objects.clear();
+    if (!parseCell(cell, *file))
+    {
+        cell.objects.clear();
+        generateCell(cell);
+    }
+
+    world.ioBytesInFlight -= cell.loadBytes;
+
+    // the render thread looks at the objects once it sees the new state
+    cell.state.store(WORLD_CELL_LOADED, std::memory_order_release);
+}
+
+static int32_t cellDistance(const WorldCell &cell, int32_t x, int32_t z)
+{
+    return std::max(std::abs(cell.x - x), std::abs(cell.z - z));
+}
+
+// Run by the deletion queue once the frames that may have drawn the cell are done
+static void retireCell(void* userData)
+{
+    WorldCell &cell = *static_cast<WorldCell*>(userData);
+
+    cell.state.store(WORLD_CELL_FREE, std::memory_order_relaxed);
+}
+
+static void freeCell(WorldCell &cell)
+{
+    WorldStreamer &world = g_app.world;
+
+    bool resident = cell.state.load(std::memory_order_relaxed) == WORLD_CELL_RESIDENT;
+    if (resident)
+    {
+        destroyEntity(cell.root);
+
+        world.residentCells--;
+        world.cellsReleased++;
+        world.residencyChanges++;
+    }
+
+    cell.root = INVALID_ENTITY;
+    cell.entities.clear();
+    cell.objects.clear();
+    cell.released = false;
+
+    // The frames in flight may still draw the objects in the slot, nothing
+    // is uploaded into it before they are done
+    if (resident)
+    {
+        cell.state.store(WORLD_CELL_RETIRING, std::memory_order_relaxed);
+        deferCallback(retireCell, &cell);
+    }
+    else
+    {
+        cell.state.store(WORLD_CELL_FREE, std::memory_order_relaxed);
+    }
+}
+
+static void loadCell(WorldCell &cell, int32_t x, int32_t z)
+{
+    WorldStreamer &world = g_app.world;
+
+    cell.x = x;
+    cell.z = z;
+    cell.released = false;
+
+    // the most a cell file can hold, whether or not it turns out to be there
+    cell.loadBytes = sizeof(WorldCellHeader) + WORLD_MAX_CELL_OBJECTS * sizeof(WorldObject);
+    world.ioBytesInFlight += cell.loadBytes;
+
+    cell.state.store(WORLD_CELL_LOADING, std::memory_order_relaxed);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/cell_%d_%d.bin", world.directory.c_str(), x, z);
+    readFileAsync(path, cellLoaded, &cell);
+}
+
+// Copies the objects into the cell's slot of the object buffer through
+// this frame's staging slice, and adds them to the scene
+static void uploadCell(WorldCell &cell, VkCommandBuffer cmdBuffer, VkDeviceSize stagingOffset)
+{
+    WorldStreamer &world = g_app.world;
+
+    uint32_t slot = cellSlot(cell);
+    VkDeviceSize slotOffset = slot * WORLD_SLOT_BYTES;
+    VkDeviceSize size = cell.objects.size() * sizeof(WorldObject);
+
+    if (size > 0)
+    {
+        memcpy(world.stagingMapped + stagingOffset, cell.objects.data(), static_cast<size_t>(size));
+
+        VkBufferCopy region = {};
+        region.srcOffset = stagingOffset;
+        region.dstOffset = slotOffset;
+        region.size = size;
+        vkCmdCopyBuffer(cmdBuffer, world.stagingBuffer, world.objectBuffer, 1, &region);
+    }
+
+    // what a cell released from the slot before left past the objects
+    if (size < WORLD_SLOT_BYTES)
+    {
+        vkCmdFillBuffer(cmdBuffer, world.objectBuffer, slotOffset + size, WORLD_SLOT_BYTES - size, 0);
+    }
+
+    glm::vec3 origin(cell.x * WORLD_CELL_SIZE, 0.0f, cell.z * WORLD_CELL_SIZE);
+    cell.root = createEntity(INVALID_ENTITY, glm::translate(glm::mat4(), origin));
+    for (const WorldObject &object : cell.objects)
+    {
+        glm::vec3 position(object.position[0], object.position[1], object.position[2]);
+        glm::mat4 local = glm::scale(glm::translate(glm::mat4(), position - origin), glm::vec3(object.scale));
+        cell.entities.push_back(createEntity(cell.root, local));
+    }
+
+    cell.state.store(WORLD_CELL_RESIDENT, std::memory_order_relaxed);
+
+    world.residentCells++;
+    world.residencyChanges++;
+    world.cellsLoaded++;
+    world.uploadedBytes += size;
+}
+
+// One slot of objects per cell, zeroed so that no slot draws anything
+// before a cell is uploaded into it
+static bool initObjectBuffer()
+{
+    WorldStreamer &world = g_app.world;
+
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = WORLD_MAX_CELLS * WORLD_SLOT_BYTES;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+
+    VkResult result = vkCreateBuffer(g_app.device, &bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), &world.objectBuffer);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_app.device, world.objectBuffer, &memReqs);
+
+    // Not a managed buffer, the draw command buffers are recorded once
+    // and the defragmenter would move it away from under them
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memAllocInfo.memoryTypeIndex) ||
+        allocateDeviceMemory(&memAllocInfo, &world.objectMemory) != VK_SUCCESS)
+    {
+        printf("Could not allocate the world object buffer\n");
+        return false;
+    }
+
+    vkBindBufferMemory(g_app.device, world.objectBuffer, world.objectMemory, 0);
+
+    VkCommandBuffer setupCmdBuffer = beginSetupCommands();
+
+    vkCmdFillBuffer(setupCmdBuffer, world.objectBuffer, 0, VK_WHOLE_SIZE, 0);
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = world.objectBuffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(setupCmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    endSetupCommands();
+
+    return true;
+}
+
+bool initWorldStreaming()
+{
+    WorldStreamer &world = g_app.world;
+
+    world.ioBytesInFlight = 0;
+
+    for (WorldCell &cell : world.cells)
+    {
+        cell.state = WORLD_CELL_FREE;
+        cell.released = false;
+        cell.root = INVALID_ENTITY;
+
+        // all the memory a cell will ever need, up front
+        cell.objects.reserve(WORLD_MAX_CELL_OBJECTS);
+        cell.entities.reserve(WORLD_MAX_CELL_OBJECTS);
+    }
+
+    if (!world.enabled)
+    {
+        return true;
+    }
+
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = static_cast<VkDeviceSize>(WORLD_UPLOAD_BYTES_PER_FRAME) * MAX_FRAME_FENCES;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VkResult result = vkCreateBuffer(g_app.device, &bufferInfo, getHostAllocator(HOST_OBJECT_BUFFER), &world.stagingBuffer);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_app.device, world.stagingBuffer, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memAllocInfo.memoryTypeIndex) ||
+        allocateDeviceMemory(&memAllocInfo, &world.stagingMemory) != VK_SUCCESS)
+    {
+        printf("Could not allocate the world staging buffer\n");
+        return false;
+    }
+
+    vkBindBufferMemory(g_app.device, world.stagingBuffer, world.stagingMemory, 0);
+
+    result = vkMapMemory(g_app.device, world.stagingMemory, 0, VK_WHOLE_SIZE, 0, (void **)&world.stagingMapped);
+    assert(result == VK_SUCCESS);
+
+    if (!initObjectBuffer())
+    {
+        return false;
+    }
+
+    // The objects are drawn with the default material, through a vertex
+    // shader that places them. Bindless and multiview mode have vertex
+    // shaders of their own, there the cells are streamed but not drawn
+    world.drawn = !g_app.bindless.enabled && !g_app.multiview.enabled;
+    if (world.drawn)
+    {
+        MaterialFeatureFlags features = (g_app.material.features & ~MATERIAL_FEATURE_INSTANCED) | MATERIAL_FEATURE_WORLD_OBJECTS;
+        world.pipeline = getMaterialPipeline(features);
+        if (world.pipeline == VK_NULL_HANDLE)
+        {
+            return false;
+        }
+    }
+
+    printf("World streaming from %s: %u cell slots, %.0f unit cells\n", world.directory.c_str(), WORLD_MAX_CELLS, WORLD_CELL_SIZE);
+
+    return true;
+}
+
+void updateWorldStreaming(const glm::vec3 &cameraPosition)
+{
+    WorldStreamer &world = g_app.world;
+
+    if (!world.enabled)
+    {
+        return;
+    }
+
+    world.cameraX = static_cast<int32_t>(std::floor(cameraPosition.x / WORLD_CELL_SIZE));
+    world.cameraZ = static_cast<int32_t>(std::floor(cameraPosition.z / WORLD_CELL_SIZE));
+
+    // Cells the camera has left. Loads still running are only marked,
+    // their slot is freed once the I/O thread is done with it
+    for (WorldCell &cell : world.cells)
+    {
+        uint32_t state = cell.state.load(std::memory_order_acquire);
+        if (state == WORLD_CELL_FREE || state == WORLD_CELL_RETIRING)
+        {
+            continue;
+        }
+
+        bool outside = cellDistance(cell, world.cameraX, world.cameraZ) > WORLD_UNLOAD_RADIUS;
+        if (state == WORLD_CELL_LOADING)
+        {
+            cell.released |= outside;
+        }
+        else if (outside || cell.released)
+        {
+            freeCell(cell);
+        }
+    }
+
+    // Cells the camera is near, closest first, as long as the I/O budget allows
+    std::vector<std::pair<int32_t, int32_t>> wanted;
+    for (int32_t z = world.cameraZ - WORLD_LOAD_RADIUS; z <= world.cameraZ + WORLD_LOAD_RADIUS; z++)
+    {
+        for (int32_t x = world.cameraX - WORLD_LOAD_RADIUS; x <= world.cameraX + WORLD_LOAD_RADIUS; x++)
+        {
+            bool present = false;
+            for (const WorldCell &cell : world.cells)
+            {
+                uint32_t state = cell.state.load(std::memory_order_relaxed);
+                if (state != WORLD_CELL_FREE && state != WORLD_CELL_RETIRING && !cell.released && cell.x == x && cell.z == z)
+                {
+                    present = true;
+                    break;
+                }
+            }
+            if (!present)
+            {
+                wanted.push_back(std::make_pair(x, z));
+            }
+        }
+    }
+
+    std::sort(wanted.begin(), wanted.end(), [&world](const std::pair<int32_t, int32_t> &a, const std::pair<int32_t, int32_t> &b)
+    {
+        int32_t distanceA = std::abs(a.first - world.cameraX) + std::abs(a.second - world.cameraZ);
+        int32_t distanceB = std::abs(b.first - world.cameraX) + std::abs(b.second - world.cameraZ);
+        return distanceA < distanceB;
+    });
+
+    const uint32_t loadBytes = sizeof(WorldCellHeader) + WORLD_MAX_CELL_OBJECTS * sizeof(WorldObject);
+    for (const std::pair<int32_t, int32_t> &position : wanted)
+    {
+        if (world.ioBytesInFlight.load() + loadBytes > WORLD_IO_BYTES_IN_FLIGHT)
+        {
+            break;
+        }
+
+        WorldCell *slot = nullptr;
+        for (WorldCell &cell : world.cells)
+        {
+            if (cell.state.load(std::memory_order_relaxed) == WORLD_CELL_FREE)
+            {
+                slot = &cell;
+                break;
+            }
+        }
+        if (slot == nullptr)
+        {
+            break;
+        }
+
+        loadCell(*slot, position.first, position.second);
+    }
+
+    // Loaded cells go up closest first, within this frame's staging slice.
+    // The slice was last used by the frame beginFrameCommands() waited for
+    std::vector<WorldCell*> loaded;
+    for (WorldCell &cell : world.cells)
+    {
+        if (cell.state.load(std::memory_order_acquire) == WORLD_CELL_LOADED && !cell.released)
+        {
+            loaded.push_back(&cell);
+        }
+    }
+
+    std::sort(loaded.begin(), loaded.end(), [&world](const WorldCell *a, const WorldCell *b)
+    {
+        return cellDistance(*a, world.cameraX, world.cameraZ) < cellDistance(*b, world.cameraX, world.cameraZ);
+    });
+
+    VkDeviceSize sliceStart = static_cast<VkDeviceSize>(g_app.frameCommands.slot) * WORLD_UPLOAD_BYTES_PER_FRAME;
+    VkDeviceSize uploadBytes = 0;
+    VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+
+    for (WorldCell *cell : loaded)
+    {
+        VkDeviceSize size = cell->objects.size() * sizeof(WorldObject);
+        if (uploadBytes + size > WORLD_UPLOAD_BYTES_PER_FRAME)
+        {
+            break;
+        }
+
+        if (cmdBuffer == VK_NULL_HANDLE)
+        {
+            cmdBuffer = beginFrameCommandBuffer();
+        }
+
+        uploadCell(*cell, cmdBuffer, sliceStart + uploadBytes);
+        uploadBytes += size;
+    }
+
+    if (cmdBuffer != VK_NULL_HANDLE)
+    {
+        // the copies land before anything of this frame reads the object buffer
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        VkResult result = vkEndCommandBuffer(cmdBuffer);
+        assert(result == VK_SUCCESS);
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &cmdBuffer;
+
+        result = vkQueueSubmit(g_app.queue, 1, &submitInfo, VK_NULL_HANDLE);
+        assert(result == VK_SUCCESS);
+    }
+}
+
+void appendWorldCullBounds(std::vector<CullBounds> &bounds)
+{
+    WorldStreamer &world = g_app.world;
+
+    world.cullInstances.clear();
+
+    if (!world.drawn)
+    {
+        return;
+    }
+
+    const glm::vec3 &localMin = g_app.vertices.boundsMin;
+    const glm::vec3 &localMax = g_app.vertices.boundsMax;
+
+    for (uint32_t slot = 0; slot < WORLD_MAX_CELLS; slot++)
+    {
+        const WorldCell &cell = world.cells[slot];
+        if (cell.state.load(std::memory_order_relaxed) != WORLD_CELL_RESIDENT)
+        {
+            continue;
+        }
+
+        for (uint32_t object = 0; object < cell.entities.size(); object++)
+        {
+            // the entity has the object's place in the buffer, data/world.vert
+            // puts the mesh there the same way
+            const glm::mat4 &objectWorld = getWorldTransform(cell.entities[object]);
+
+            CullBounds box;
+            for (int i = 0; i < 8; i++)
+            {
+                glm::vec3 corner((i & 1) ? localMax.x : localMin.x, (i & 2) ? localMax.y : localMin.y, (i & 4) ? localMax.z : localMin.z);
+                glm::vec3 position = glm::vec3(objectWorld * glm::vec4(corner, 1.0f));
+
+                box.min = (i == 0) ? position : glm::min(box.min, position);
+                box.max = (i == 0) ? position : glm::max(box.max, position);
+            }
+
+            bounds.push_back(box);
+            world.cullInstances.push_back(slot * WORLD_MAX_CELL_OBJECTS + object);
+        }
+    }
+}
+
+void recordWorldDraws(VkCommandBuffer cmdBuffer, uint32_t imageIndex)
+{
+    WorldStreamer &world = g_app.world;
+
+    if (!world.drawn)
+    {
+        return;
+    }
+
+    // the material's push constants stay, the pipeline layout is the same
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, world.pipeline);
+
+    VkBuffer buffers[2] = { g_app.vertices.buffer, world.objectBuffer };
+    VkDeviceSize offsets[2] = { 0, 0 };
+    vkCmdBindVertexBuffers(cmdBuffer, 0, 2, buffers, offsets);
+    vkCmdBindIndexBuffer(cmdBuffer, g_app.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+    // the instance of a draw is the object's place in the object buffer
+    recordSceneDraws(cmdBuffer, imageIndex, SCENE_DRAWS_WORLD);
+}
+
+void destroyWorldStreaming()
+{
+    WorldStreamer &world = g_app.world;
+
+    if (!world.enabled)
+    {
+        return;
+    }
+
+    // the I/O threads still write into cells that are loading
+    for (WorldCell &cell : world.cells)
+    {
+        while (cell.state.load(std::memory_order_acquire) == WORLD_CELL_LOADING)
+        {
+            std::this_thread::yield();
+        }
+        uint32_t state = cell.state.load(std::memory_order_relaxed);
+        if (state != WORLD_CELL_FREE && state != WORLD_CELL_RETIRING)
+        {
+            freeCell(cell);
+        }
+    }
+
+    vkUnmapMemory(g_app.device, world.stagingMemory);
+    deferDestroyBuffer(world.stagingBuffer);
+    deferFreeMemory(world.stagingMemory);
+    world.stagingBuffer = VK_NULL_HANDLE;
+    world.stagingMemory = VK_NULL_HANDLE;
+
+    // the pipeline belongs to the material pipeline cache
+    deferDestroyBuffer(world.objectBuffer);
+    deferFreeMemory(world.objectMemory);
+    world.objectBuffer = VK_NULL_HANDLE;
+    world.objectMemory = VK_NULL_HANDLE;
+    world.pipeline = VK_NULL_HANDLE;
+
+    printf("World: %llu cells loaded, %llu released, %llu KB uploaded\n", (unsigned long long)world.cellsLoaded,
+        (unsigned long long)world.cellsReleased, (unsigned long long)(world.uploadedBytes / 1024));
+}
@@ -0,0 +1,146 @@
+#ifndef __WORLD_H__
+#define __WORLD_H__
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "occlusion.h"
+#include "scene.h"
+
+// Width of a cell on the ground plane, in world units
+const float WORLD_CELL_SIZE = 32.0f;
+
+// Cells within this many cells of the camera's cell are loaded, cells
+// farther than WORLD_UNLOAD_RADIUS are released. The gap keeps cells at
+// the edge from being loaded and released over and over
+const int32_t WORLD_LOAD_RADIUS = 2;
+const int32_t WORLD_UNLOAD_RADIUS = 3;
+
+// Every cell that can be inside the unload radius at once has a slot, the
+// slots are all there is, so memory stays the same however large the world
+const uint32_t WORLD_MAX_CELLS = (2 * WORLD_UNLOAD_RADIUS + 1) * (2 * WORLD_UNLOAD_RADIUS + 1);
+
+const uint32_t WORLD_MAX_CELL_OBJECTS = 256;
+
+// Vertex buffer binding of the object buffer, next to the mesh's at 0
+const uint32_t WORLD_OBJECT_BIND_ID = 1;
+
+// Cell bytes being read or generated at once, and copied to the GPU per frame
+const uint32_t WORLD_IO_BYTES_IN_FLIGHT = 64 * 1024;
+const uint32_t WORLD_UPLOAD_BYTES_PER_FRAME = 16 * 1024;
+
+// How fast the camera flies over the world with --world, in units per second
+const float WORLD_FLY_SPEED = 12.0f;
+
+// One object of a cell, also its layout in the object buffer, where
+// data/world.vert reads it per instance
+struct WorldObject
+{
+    float position[3];
+    float scale;
+};
+
+// Layout of <world dir>/cell_<x>_<z>.bin, followed by objectCount WorldObjects
+struct WorldCellHeader
+{
+    uint32_t magic;        // WORLD_CELL_MAGIC
+    uint32_t objectCount;
+};
+const uint32_t WORLD_CELL_MAGIC = 0x4c4c4543; // "CELL"
+
+enum WorldCellState
+{
+    WORLD_CELL_FREE,
+    WORLD_CELL_LOADING,   // read or generated on an I/O thread
+    WORLD_CELL_LOADED,    // waiting for its upload
+    WORLD_CELL_RESIDENT,
+    WORLD_CELL_RETIRING,  // released, free once the frames that drew it are done
+};
+
+struct WorldCell
+{
+    // written by the I/O thread while loading, then only by the render thread
+    std::atomic<uint32_t> state;
+    int32_t x;
+    int32_t z;
+
+    // cancelled loads finish on their I/O thread, the slot is free after that
+    bool released;
+
+    std::vector<WorldObject> objects;     // capacity WORLD_MAX_CELL_OBJECTS
+    uint32_t loadBytes;
+
+    // entities of the objects under the cell's root, the objects are copied
+    // to the cell's slot of the object buffer
+    EntityHandle root;
+    std::vector<EntityHandle> entities;
+};
+
+// The world is cut into square cells around the camera. Cells near it are
+// read from the world directory, or generated when there is no file, on the
+// async I/O threads. The render thread copies loaded cells into their slot
+// of a device local object buffer through a staging buffer of one slice
+// per frame fence, and releases cells the camera has left. The objects are
+// culled with the scene instances and drawn instanced from the object buffer
+struct WorldStreamer
+{
+    bool enabled = false;
+    std::string directory;    // --world <dir>, may have no cell files at all
+
+    WorldCell cells[WORLD_MAX_CELLS];
+
+    // one slice of WORLD_UPLOAD_BYTES_PER_FRAME per frame fence
+    VkBuffer stagingBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+    uint8_t* stagingMapped = nullptr;
+
+    std::atomic<uint32_t> ioBytesInFlight;
+
+    // WORLD_MAX_CELL_OBJECTS objects per slot, objects past the end of a
+    // cell are zero. Only the objects of resident cells are drawn
+    VkBuffer objectBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory objectMemory = VK_NULL_HANDLE;
+
+    // The objects are drawn with the material's pipeline variant for them,
+    // not in bindless or multiview mode, which have vertex shaders of their own
+    bool drawn = false;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+
+    // counts cells becoming resident or released, the BVH is rebuilt when it changes
+    uint64_t residencyChanges = 0;
+    // object buffer instance of each world object culled after the scene instances
+    std::vector<uint32_t> cullInstances;
+
+    int32_t cameraX = 0;
+    int32_t cameraZ = 0;
+
+    uint32_t residentCells = 0;
+    uint64_t cellsLoaded = 0;
+    uint64_t cellsReleased = 0;
+    uint64_t uploadedBytes = 0;
+};
+
+bool initWorldStreaming();
+
+// Called by render() once the frame's command pools are reset. Releases
+// cells the camera has left, queues loads of the ones it approaches and
+// uploads loaded cells within the frame's budget
+void updateWorldStreaming(const glm::vec3 &cameraPosition);
+
+// Appends the world space bounds of the objects of the resident cells,
+// and lists their object buffer instances in cullInstances
+void appendWorldCullBounds(std::vector<CullBounds> &bounds);
+
+// Binds the objects' pipeline and buffers and records their indirect draws
+void recordWorldDraws(VkCommandBuffer cmdBuffer, uint32_t imageIndex);
+
+void destroyWorldStreaming();
+
+#endif //__WORLD_H__
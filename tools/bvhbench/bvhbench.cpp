@@ -0,0 +1,379 @@
+/*
+    Compares the scene BVH against testing every object, for frustum, ray
+    and sphere queries over random boxes. Also times the build and the
+    refit of a frame in which some of the objects move.
+
+    usage: bvhbench [--queries N] [--moving PERCENT] [--seed N] [counts...]
+
+    The counts default to 10000 100000 1000000. The first queries are
+    checked against brute force again after the refit of every frame.
+
+    Build it from the repository root with src/bvh.cpp and glm, optimized
+    or the timings mean little. The bvhbench task in .vscode/tasks.json does:
+        g++ -Wall -O2 -std=c++11 -Isrc tools/bvhbench/bvhbench.cpp src/bvh.cpp -o bvhbench
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include "bvh.h"
+
+// Objects are spread over a cube this wide, their sizes up to BENCH_MAX_SIZE
+const float BENCH_WORLD_SIZE = 1000.0f;
+const float BENCH_MAX_SIZE = 4.0f;
+
+// Moving objects travel up to this far per frame
+const float BENCH_MOVE_DISTANCE = 1.0f;
+
+// Queries of each kind checked against brute force after every refit, all
+// of them would take longer than the refits themselves
+const uint32_t BENCH_CHECKED_QUERIES = 16;
+
+struct BenchFrustum
+{
+    glm::vec4 planes[6];
+};
+
+static double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// An axis aligned box seen as six inward planes, enough to exercise the
+// plane tests the same way a perspective frustum does
+static BenchFrustum makeFrustum(const glm::vec3 &center, float halfSize)
+{
+    BenchFrustum frustum;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        glm::vec4 plane(0.0f);
+        plane[axis] = 1.0f;
+        plane.w = halfSize - center[axis];
+        frustum.planes[axis * 2] = plane;
+
+        plane[axis] = -1.0f;
+        plane.w = halfSize + center[axis];
+        frustum.planes[axis * 2 + 1] = plane;
+    }
+    return frustum;
+}
+
+static bool bruteInFrustum(const BvhBounds &bounds, const glm::vec4 planes[6])
+{
+    for (int i = 0; i < 6; i++)
+    {
+        glm::vec3 corner(planes[i].x > 0.0f ? bounds.max.x : bounds.min.x,
+                         planes[i].y > 0.0f ? bounds.max.y : bounds.min.y,
+                         planes[i].z > 0.0f ? bounds.max.z : bounds.min.z);
+
+        if (planes[i].x * corner.x + planes[i].y * corner.y + planes[i].z * corner.z + planes[i].w < 0.0f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool bruteTouchesSphere(const BvhBounds &bounds, const glm::vec3 &center, float radius)
+{
+    glm::vec3 offset = glm::max(bounds.min - center, glm::vec3(0.0f)) + glm::max(center - bounds.max, glm::vec3(0.0f));
+    return glm::dot(offset, offset) <= radius * radius;
+}
+
+static float bruteRayDistance(const BvhBounds &bounds, const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance)
+{
+    glm::vec3 t0 = (bounds.min - origin) * inverseDirection;
+    glm::vec3 t1 = (bounds.max - origin) * inverseDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+
+    return enter <= exit ? enter : FLT_MAX;
+}
+
+struct BenchQueries
+{
+    std::vector<BenchFrustum> frustums;
+    std::vector<glm::vec3> sphereCenters;
+    float sphereRadius;
+    std::vector<glm::vec3> rayOrigins, rayDirections;
+};
+
+// Runs the first queries of each kind through the BVH and against every
+// object, returns how many of them found different objects
+static uint32_t checkQueries(Bvh &bvh, const std::vector<BvhBounds> &bounds, const BenchQueries &queries, uint32_t checked)
+{
+    uint32_t count = static_cast<uint32_t>(bounds.size());
+    uint32_t mismatches = 0;
+    std::vector<uint32_t> results, expected;
+
+    for (uint32_t i = 0; i < std::min(checked, static_cast<uint32_t>(queries.frustums.size())); i++)
+    {
+        expected.clear();
+        for (uint32_t object = 0; object < count; object++)
+        {
+            if (bruteInFrustum(bounds[object], queries.frustums[i].planes))
+            {
+                expected.push_back(object);
+            }
+        }
+
+        results.clear();
+        queryBvhFrustum(bvh, queries.frustums[i].planes, results);
+        std::sort(results.begin(), results.end());
+        mismatches += (results != expected) ? 1 : 0;
+    }
+
+    for (uint32_t i = 0; i < std::min(checked, static_cast<uint32_t>(queries.sphereCenters.size())); i++)
+    {
+        expected.clear();
+        for (uint32_t object = 0; object < count; object++)
+        {
+            if (bruteTouchesSphere(bounds[object], queries.sphereCenters[i], queries.sphereRadius))
+            {
+                expected.push_back(object);
+            }
+        }
+
+        results.clear();
+        queryBvhSphere(bvh, queries.sphereCenters[i], queries.sphereRadius, results);
+        std::sort(results.begin(), results.end());
+        mismatches += (results != expected) ? 1 : 0;
+    }
+
+    for (uint32_t i = 0; i < std::min(checked, static_cast<uint32_t>(queries.rayOrigins.size())); i++)
+    {
+        const glm::vec3 &direction = queries.rayDirections[i];
+        glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        float nearest = FLT_MAX;
+        for (uint32_t object = 0; object < count; object++)
+        {
+            nearest = std::min(nearest, bruteRayDistance(bounds[object], queries.rayOrigins[i], inverseDirection, BENCH_WORLD_SIZE));
+        }
+
+        float distance = FLT_MAX;
+        queryBvhRay(bvh, queries.rayOrigins[i], direction, BENCH_WORLD_SIZE, &distance);
+        mismatches += (distance != nearest) ? 1 : 0;
+    }
+
+    return mismatches;
+}
+
+static void runBenchmark(uint32_t count, uint32_t queries, float movingPercent, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> position(0.0f, BENCH_WORLD_SIZE);
+    std::uniform_real_distribution<float> size(0.1f, BENCH_MAX_SIZE);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    std::vector<BvhBounds> bounds(count);
+    for (BvhBounds &box : bounds)
+    {
+        box.min = glm::vec3(position(random), position(random), position(random));
+        box.max = box.min + glm::vec3(size(random), size(random), size(random));
+    }
+
+    printf("%u objects\n", count);
+
+    Bvh bvh;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    buildBvh(bvh, bounds.data(), count);
+    printf("  build         %9.2f ms, %u nodes, SAH cost %.1f\n", elapsedMs(start), (uint32_t)bvh.nodes.size(), getBvhCost(bvh));
+
+    // frustums a tenth of the world wide see about a thousandth of it
+    BenchQueries benchQueries;
+    benchQueries.sphereRadius = BENCH_WORLD_SIZE * 0.02f;
+    for (uint32_t i = 0; i < queries; i++)
+    {
+        glm::vec3 center(position(random), position(random), position(random));
+        benchQueries.frustums.push_back(makeFrustum(center, BENCH_WORLD_SIZE * 0.05f));
+        benchQueries.rayOrigins.push_back(glm::vec3(position(random), position(random), position(random)));
+        benchQueries.rayDirections.push_back(glm::vec3(unit(random), unit(random), unit(random)));
+        benchQueries.sphereCenters.push_back(center);
+    }
+
+    std::vector<uint32_t> results;
+    uint64_t bruteFound = 0, bvhFound = 0;
+    uint32_t mismatches = 0;
+
+    start = std::chrono::steady_clock::now();
+    for (const BenchFrustum &frustum : benchQueries.frustums)
+    {
+        for (uint32_t object = 0; object < count; object++)
+        {
+            bruteFound += bruteInFrustum(bounds[object], frustum.planes) ? 1 : 0;
+        }
+    }
+    double bruteMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    for (const BenchFrustum &frustum : benchQueries.frustums)
+    {
+        results.clear();
+        queryBvhFrustum(bvh, frustum.planes, results);
+        bvhFound += results.size();
+    }
+    double bvhMs = elapsedMs(start);
+    mismatches += (bruteFound != bvhFound) ? 1 : 0;
+    printf("  frustum       %9.3f ms brute, %9.3f ms BVH per query, %.1fx, %.1f found\n",
+        bruteMs / queries, bvhMs / queries, bruteMs / std::max(bvhMs, 1e-6), (double)bvhFound / queries);
+
+    float radius = benchQueries.sphereRadius;
+    bruteFound = bvhFound = 0;
+    start = std::chrono::steady_clock::now();
+    for (const glm::vec3 &center : benchQueries.sphereCenters)
+    {
+        for (uint32_t object = 0; object < count; object++)
+        {
+            bruteFound += bruteTouchesSphere(bounds[object], center, radius) ? 1 : 0;
+        }
+    }
+    bruteMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    for (const glm::vec3 &center : benchQueries.sphereCenters)
+    {
+        results.clear();
+        queryBvhSphere(bvh, center, radius, results);
+        bvhFound += results.size();
+    }
+    bvhMs = elapsedMs(start);
+    mismatches += (bruteFound != bvhFound) ? 1 : 0;
+    printf("  sphere        %9.3f ms brute, %9.3f ms BVH per query, %.1fx, %.1f found\n",
+        bruteMs / queries, bvhMs / queries, bruteMs / std::max(bvhMs, 1e-6), (double)bvhFound / queries);
+
+    std::vector<float> bruteHits(queries);
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < queries; i++)
+    {
+        const glm::vec3 &direction = benchQueries.rayDirections[i];
+        glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        float nearest = FLT_MAX;
+        for (uint32_t object = 0; object < count; object++)
+        {
+            nearest = std::min(nearest, bruteRayDistance(bounds[object], benchQueries.rayOrigins[i], inverseDirection, BENCH_WORLD_SIZE));
+        }
+        bruteHits[i] = nearest;
+    }
+    bruteMs = elapsedMs(start);
+
+    uint32_t hits = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < queries; i++)
+    {
+        float distance = FLT_MAX;
+        if (queryBvhRay(bvh, benchQueries.rayOrigins[i], benchQueries.rayDirections[i], BENCH_WORLD_SIZE, &distance) != BVH_INVALID)
+        {
+            hits++;
+        }
+        mismatches += (distance != bruteHits[i]) ? 1 : 0;
+    }
+    bvhMs = elapsedMs(start);
+    printf("  ray           %9.3f ms brute, %9.3f ms BVH per query, %.1fx, %u of %u hit\n",
+        bruteMs / queries, bvhMs / queries, bruteMs / std::max(bvhMs, 1e-6), hits, queries);
+
+    // a frame in which some objects move, then refit against a rebuild. The
+    // refit moves bounds up the tree and rotates nodes, either may lose an
+    // object, so every frame is checked outside of the timing
+    uint32_t movingCount = static_cast<uint32_t>(count * movingPercent / 100.0f);
+    std::uniform_int_distribution<uint32_t> pick(0, count - 1);
+    double refitMs = 0.0;
+    uint32_t refitMismatches = 0;
+    const uint32_t frames = 10;
+    for (uint32_t frame = 0; frame < frames; frame++)
+    {
+        for (uint32_t i = 0; i < movingCount; i++)
+        {
+            uint32_t object = pick(random);
+            glm::vec3 move = glm::vec3(unit(random), unit(random), unit(random)) * BENCH_MOVE_DISTANCE;
+            bounds[object].min = bounds[object].min + move;
+            bounds[object].max = bounds[object].max + move;
+        }
+
+        start = std::chrono::steady_clock::now();
+        for (uint32_t object = 0; object < count; object++)
+        {
+            const BvhBounds &old = bvh.objectBounds[object];
+            if (old.min != bounds[object].min || old.max != bounds[object].max)
+            {
+                updateBvhObject(bvh, object, bounds[object]);
+            }
+        }
+        refitBvh(bvh);
+        refitMs += elapsedMs(start);
+
+        refitMismatches += checkQueries(bvh, bounds, benchQueries, BENCH_CHECKED_QUERIES);
+    }
+    float refitCost = getBvhCost(bvh);
+
+    Bvh rebuilt;
+    start = std::chrono::steady_clock::now();
+    buildBvh(rebuilt, bounds.data(), count);
+    double rebuildMs = elapsedMs(start);
+
+    printf("  refit %4.1f%%   %9.3f ms per frame, %u rotations, SAH cost %.1f, rebuild %.2f ms at %.1f\n",
+        movingPercent, refitMs / frames, bvh.rotations, refitCost, rebuildMs, getBvhCost(rebuilt));
+
+    if (mismatches != 0)
+    {
+        printf("  %u queries disagree with brute force\n", mismatches);
+    }
+    if (refitMismatches != 0)
+    {
+        printf("  %u queries disagree with brute force after a refit\n", refitMismatches);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t queries = 100;
+    float movingPercent = 1.0f;
+    uint32_t seed = 1;
+    std::vector<uint32_t> counts;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc)
+        {
+            queries = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--moving") == 0 && i + 1 < argc)
+        {
+            movingPercent = static_cast<float>(atof(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            seed = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        else
+        {
+            counts.push_back(static_cast<uint32_t>(atoi(argv[i])));
+        }
+    }
+
+    if (counts.empty())
+    {
+        counts.push_back(10000);
+        counts.push_back(100000);
+        counts.push_back(1000000);
+    }
+
+    for (uint32_t count : counts)
+    {
+        if (count > 0)
+        {
+            runBenchmark(count, std::max(queries, 1u), movingPercent, seed);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,1127 @@
+/*
+    Replays a frame capture written by the app (--capture or F12) without a
+    window and reports the per frame timings. Runs on any Vulkan device,
+    including software rasterizers such as lavapipe.
+
+    usage: replay <capture.vcap> [--loops N] [--warmup N] [--device N] [--shaders DIR]
+
+    --shaders loads DIR/<shader>.spv in place of the captured GLSL, for
+    drivers that only accept SPIR-V, e.g.
+        glslangValidator -V data/triangle.vert -o spv/triangle.vert.spv
+*/
+
+#include <vulkan/vulkan.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <cstring>
+
+#include <vector>
+#include <string>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+
+#include "captureformat.h"
+
+struct ReplayShader
+{
+    CaptureShader info;
+    std::string name;
+    std::vector<uint8_t> code;
+    VkShaderModule module = VK_NULL_HANDLE;
+};
+
+struct ReplayBuffer
+{
+    CaptureBuffer info;
+    std::vector<uint8_t> initialData;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    void* mapped = nullptr;
+
+    // only for uniform buffers
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+};
+
+struct ReplayPipeline
+{
+    CapturePipeline info;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+};
+
+struct ReplayUpdate
+{
+    CaptureBufferUpdate info;
+    std::vector<uint8_t> data;
+};
+
+struct ReplayFrame
+{
+    CaptureFrameBegin info;
+    std::vector<ReplayUpdate> updates;
+    std::vector<CaptureDraw> draws;
+};
+
+struct ReplayApp
+{
+    CaptureFileHeader header;
+    std::map<uint32_t, ReplayShader> shaders;
+    std::map<uint32_t, ReplayBuffer> buffers;
+    std::map<uint32_t, ReplayPipeline> pipelines;
+    std::vector<ReplayFrame> frames;
+
+    VkInstance instance;
+    VkPhysicalDevice gpu;
+    VkPhysicalDeviceProperties gpuProps;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    VkDevice device;
+    VkQueue queue;
+    uint32_t queueFamilyIndex;
+    uint32_t timestampValidBits;
+
+    // offscreen render target in place of the swapchain
+    struct {
+        VkImage image;
+        VkDeviceMemory memory;
+        VkImageView view;
+    } color, depth;
+
+    VkRenderPass renderPass;
+    VkFramebuffer framebuffer;
+
+    VkCommandPool cmdPool;
+    VkCommandBuffer cmdBuffer;
+    VkFence fence;
+    VkQueryPool timestampPool = VK_NULL_HANDLE;
+
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorPool descriptorPool;
+    VkPipelineLayout pipelineLayout;
+    uint32_t pushConstantSize;
+};
+
+static ReplayApp g_replay;
+
+template <typename T>
+static bool readValue(const std::vector<uint8_t> &file, size_t &cursor, size_t end, T &value)
+{
+    if (cursor + sizeof(T) > end)
+    {
+        return false;
+    }
+    memcpy(&value, file.data() + cursor, sizeof(T));
+    cursor += sizeof(T);
+    return true;
+}
+
+static bool readBytes(const std::vector<uint8_t> &file, size_t &cursor, size_t end, size_t size, std::vector<uint8_t> &bytes)
+{
+    if (cursor + size > end)
+    {
+        return false;
+    }
+    bytes.assign(file.begin() + cursor, file.begin() + cursor + size);
+    cursor += size;
+    return true;
+}
+
+static bool loadCapture(const char* path)
+{
+    std::ifstream fileStream(path, std::ios::binary);
+    if (!fileStream.is_open())
+    {
+        printf("Could not open %s\n", path);
+        return false;
+    }
+
+    std::vector<uint8_t> file((std::istreambuf_iterator<char>(fileStream)), std::istreambuf_iterator<char>());
+
+    size_t cursor = 0;
+    if (!readValue(file, cursor, file.size(), g_replay.header) ||
+        g_replay.header.magic != CAPTURE_MAGIC || g_replay.header.version != CAPTURE_VERSION)
+    {
+        printf("%s is not a version %u capture\n", path, CAPTURE_VERSION);
+        return false;
+    }
+
+    ReplayFrame* frame = nullptr;
+
+    while (cursor < file.size())
+    {
+        CaptureChunkHeader chunk;
+        if (!readValue(file, cursor, file.size(), chunk) || cursor + chunk.size > file.size())
+        {
+            printf("Truncated chunk at offset %zu\n", cursor);
+            return false;
+        }
+
+        size_t end = cursor + chunk.size;
+        bool valid = true;
+
+        switch (chunk.type)
+        {
+        case CAPTURE_CHUNK_SHADER:
+        {
+            ReplayShader shader;
+            std::vector<uint8_t> name;
+            valid = readValue(file, cursor, end, shader.info) &&
+                    readBytes(file, cursor, end, shader.info.nameLength, name) &&
+                    readBytes(file, cursor, end, shader.info.codeSize, shader.code);
+            shader.name.assign(name.begin(), name.end());
+            g_replay.shaders[shader.info.id] = shader;
+            break;
+        }
+        case CAPTURE_CHUNK_BUFFER:
+        {
+            ReplayBuffer buffer;
+            valid = readValue(file, cursor, end, buffer.info) &&
+                    readBytes(file, cursor, end, static_cast<size_t>(buffer.info.size), buffer.initialData);
+            g_replay.buffers[buffer.info.id] = buffer;
+            break;
+        }
+        case CAPTURE_CHUNK_PIPELINE:
+        {
+            ReplayPipeline pipeline;
+            valid = readValue(file, cursor, end, pipeline.info);
+            g_replay.pipelines[pipeline.info.id] = pipeline;
+            break;
+        }
+        case CAPTURE_CHUNK_FRAME_BEGIN:
+        {
+            g_replay.frames.push_back(ReplayFrame());
+            frame = &g_replay.frames.back();
+            valid = readValue(file, cursor, end, frame->info);
+            break;
+        }
+        case CAPTURE_CHUNK_BUFFER_UPDATE:
+        {
+            ReplayUpdate update;
+            valid = frame != nullptr &&
+                    readValue(file, cursor, end, update.info) &&
+                    readBytes(file, cursor, end, static_cast<size_t>(update.info.size), update.data);
+            if (valid)
+            {
+                frame->updates.push_back(update);
+            }
+            break;
+        }
+        case CAPTURE_CHUNK_DRAW:
+        {
+            CaptureDraw draw;
+            valid = frame != nullptr && readValue(file, cursor, end, draw);
+            if (valid)
+            {
+                frame->draws.push_back(draw);
+            }
+            break;
+        }
+        case CAPTURE_CHUNK_FRAME_END:
+            frame = nullptr;
+            break;
+        default:
+            // unknown chunks are skipped, newer captures stay readable
+            break;
+        }
+
+        if (!valid)
+        {
+            printf("Malformed chunk of type %u\n", chunk.type);
+            return false;
+        }
+
+        cursor = end;
+    }
+
+    printf("Loaded %s: %zu frames, %zu shaders, %zu buffers, %zu pipelines, %ux%u\n", path,
+        g_replay.frames.size(), g_replay.shaders.size(), g_replay.buffers.size(), g_replay.pipelines.size(),
+        g_replay.header.width, g_replay.header.height);
+
+    return !g_replay.frames.empty();
+}
+
+static bool memoryTypeFromProperties(uint32_t typeBits, VkFlags requirements_mask, uint32_t *typeIndex)
+{
+    for (uint32_t i = 0; i < g_replay.memoryProperties.memoryTypeCount; i++)
+    {
+        if ((typeBits & (1 << i)) && (g_replay.memoryProperties.memoryTypes[i].propertyFlags & requirements_mask) == requirements_mask)
+        {
+            *typeIndex = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool initDevice(uint32_t deviceIndex)
+{
+    VkApplicationInfo appInfo = {};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = "Vulkan Test Replay";
+    appInfo.pEngineName = "Vulkan Test Replay";
+    appInfo.apiVersion = VK_API_VERSION_1_0;
+
+    // headless, so no surface extensions
+    VkInstanceCreateInfo instanceInfo = {};
+    instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instanceInfo.pApplicationInfo = &appInfo;
+
+    VkResult result = vkCreateInstance(&instanceInfo, nullptr, &g_replay.instance);
+    if (result != VK_SUCCESS)
+    {
+        printf("vkCreateInstance failed (%d)\n", result);
+        return false;
+    }
+
+    uint32_t gpuCount = 0;
+    vkEnumeratePhysicalDevices(g_replay.instance, &gpuCount, nullptr);
+    if (deviceIndex >= gpuCount)
+    {
+        printf("Device %u not found, %u devices available\n", deviceIndex, gpuCount);
+        return false;
+    }
+
+    std::vector<VkPhysicalDevice> gpus(gpuCount);
+    vkEnumeratePhysicalDevices(g_replay.instance, &gpuCount, gpus.data());
+    g_replay.gpu = gpus[deviceIndex];
+
+    vkGetPhysicalDeviceProperties(g_replay.gpu, &g_replay.gpuProps);
+    vkGetPhysicalDeviceMemoryProperties(g_replay.gpu, &g_replay.memoryProperties);
+
+    uint32_t queueCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(g_replay.gpu, &queueCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueProperties(queueCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(g_replay.gpu, &queueCount, queueProperties.data());
+
+    g_replay.queueFamilyIndex = UINT32_MAX;
+    for (uint32_t i = 0; i < queueCount; i++)
+    {
+        if (queueProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+        {
+            g_replay.queueFamilyIndex = i;
+            g_replay.timestampValidBits = queueProperties[i].timestampValidBits;
+            break;
+        }
+    }
+
+    if (g_replay.queueFamilyIndex == UINT32_MAX)
+    {
+        printf("%s has no graphics queue\n", g_replay.gpuProps.deviceName);
+        return false;
+    }
+
+    float queuePriority = 1.0f;
+
+    VkDeviceQueueCreateInfo queueCreateInfo = {};
+    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfo.queueFamilyIndex = g_replay.queueFamilyIndex;
+    queueCreateInfo.queueCount = 1;
+    queueCreateInfo.pQueuePriorities = &queuePriority;
+
+    VkDeviceCreateInfo deviceCreateInfo = {};
+    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.queueCreateInfoCount = 1;
+    deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+
+    result = vkCreateDevice(g_replay.gpu, &deviceCreateInfo, nullptr, &g_replay.device);
+    if (result != VK_SUCCESS)
+    {
+        printf("vkCreateDevice failed (%d)\n", result);
+        return false;
+    }
+
+    vkGetDeviceQueue(g_replay.device, g_replay.queueFamilyIndex, 0, &g_replay.queue);
+
+    printf("Replaying on %s\n", g_replay.gpuProps.deviceName);
+
+    return true;
+}
+
+static bool createAttachment(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, VkImage *image, VkDeviceMemory *memory, VkImageView *view)
+{
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = format;
+    imageInfo.extent.width = g_replay.header.width;
+    imageInfo.extent.height = g_replay.header.height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = usage;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkResult result = vkCreateImage(g_replay.device, &imageInfo, nullptr, image);
+    if (result != VK_SUCCESS)
+    {
+        printf("Could not create a %ux%u attachment of format %d\n", imageInfo.extent.width, imageInfo.extent.height, format);
+        return false;
+    }
+
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(g_replay.device, *image, &memReqs);
+
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memAllocInfo.memoryTypeIndex))
+    {
+        return false;
+    }
+
+    result = vkAllocateMemory(g_replay.device, &memAllocInfo, nullptr, memory);
+    assert(result == VK_SUCCESS);
+    vkBindImageMemory(g_replay.device, *image, *memory, 0);
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = *image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange = { aspect, 0, 1, 0, 1 };
+
+    result = vkCreateImageView(g_replay.device, &viewInfo, nullptr, view);
+
+    return (result == VK_SUCCESS);
+}
+
+static bool initRenderTarget()
+{
+    VkFormat colorFormat = static_cast<VkFormat>(g_replay.header.colorFormat);
+    VkFormat depthFormat = static_cast<VkFormat>(g_replay.header.depthFormat);
+
+    VkImageAspectFlags depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (depthFormat == VK_FORMAT_D16_UNORM_S8_UINT || depthFormat == VK_FORMAT_D24_UNORM_S8_UINT || depthFormat == VK_FORMAT_D32_SFLOAT_S8_UINT)
+    {
+        depthAspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+
+    if (!createAttachment(colorFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+                          &g_replay.color.image, &g_replay.color.memory, &g_replay.color.view) ||
+        !createAttachment(depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthAspect,
+                          &g_replay.depth.image, &g_replay.depth.memory, &g_replay.depth.view))
+    {
+        return false;
+    }
+
+    // Both attachments are cleared every frame, so no layout transitions are
+    // needed outside the render pass
+    VkAttachmentDescription attachments[2] = {};
+    attachments[0].format = colorFormat;
+    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    attachments[1].format = depthFormat;
+    attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+    VkAttachmentReference depthReference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorReference;
+    subpass.pDepthStencilAttachment = &depthReference;
+
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 2;
+    renderPassInfo.pAttachments = attachments;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+
+    VkResult result = vkCreateRenderPass(g_replay.device, &renderPassInfo, nullptr, &g_replay.renderPass);
+    assert(result == VK_SUCCESS);
+
+    VkImageView views[2] = { g_replay.color.view, g_replay.depth.view };
+
+    VkFramebufferCreateInfo framebufferInfo = {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = g_replay.renderPass;
+    framebufferInfo.attachmentCount = 2;
+    framebufferInfo.pAttachments = views;
+    framebufferInfo.width = g_replay.header.width;
+    framebufferInfo.height = g_replay.header.height;
+    framebufferInfo.layers = 1;
+
+    result = vkCreateFramebuffer(g_replay.device, &framebufferInfo, nullptr, &g_replay.framebuffer);
+
+    return (result == VK_SUCCESS);
+}
+
+static bool initCommands()
+{
+    VkCommandPoolCreateInfo cmdPoolInfo = {};
+    cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    cmdPoolInfo.queueFamilyIndex = g_replay.queueFamilyIndex;
+
+    VkResult result = vkCreateCommandPool(g_replay.device, &cmdPoolInfo, nullptr, &g_replay.cmdPool);
+    assert(result == VK_SUCCESS);
+
+    VkCommandBufferAllocateInfo cmdBufferInfo = {};
+    cmdBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmdBufferInfo.commandPool = g_replay.cmdPool;
+    cmdBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdBufferInfo.commandBufferCount = 1;
+
+    result = vkAllocateCommandBuffers(g_replay.device, &cmdBufferInfo, &g_replay.cmdBuffer);
+    assert(result == VK_SUCCESS);
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    result = vkCreateFence(g_replay.device, &fenceInfo, nullptr, &g_replay.fence);
+    assert(result == VK_SUCCESS);
+
+    if (g_replay.timestampValidBits > 0)
+    {
+        VkQueryPoolCreateInfo queryPoolInfo = {};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = 2;
+
+        result = vkCreateQueryPool(g_replay.device, &queryPoolInfo, nullptr, &g_replay.timestampPool);
+        assert(result == VK_SUCCESS);
+    }
+
+    return (result == VK_SUCCESS);
+}
+
+static bool loadShaderModule(ReplayShader &shader, const char* shaderDir)
+{
+    std::vector<uint32_t> code;
+
+    if (shaderDir != nullptr)
+    {
+        std::string baseName = shader.name.substr(shader.name.find_last_of('/') + 1);
+        std::string path = std::string(shaderDir) + "/" + baseName + ".spv";
+
+        std::ifstream fileStream(path.c_str(), std::ios::binary | std::ios::ate);
+        if (!fileStream.is_open())
+        {
+            printf("Could not open %s\n", path.c_str());
+            return false;
+        }
+
+        size_t size = static_cast<size_t>(fileStream.tellg());
+        fileStream.seekg(0);
+        code.resize((size + 3) / 4);
+        fileStream.read(reinterpret_cast<char*>(code.data()), size);
+    }
+    else if (shader.info.format == CAPTURE_SHADER_GLSL)
+    {
+        // same wrapping as loadShaderGLSL() in the app, needs a driver that accepts GLSL
+        code.resize(3 + (shader.code.size() + 1 + 3) / 4, 0);
+        code[0] = 0x07230203;
+        code[1] = 0;
+        code[2] = shader.info.stage;
+        memcpy(&code[3], shader.code.data(), shader.code.size());
+    }
+    else
+    {
+        code.resize((shader.code.size() + 3) / 4);
+        memcpy(code.data(), shader.code.data(), shader.code.size());
+    }
+
+    VkShaderModuleCreateInfo shaderCreateInfo = {};
+    shaderCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderCreateInfo.codeSize = code.size() * sizeof(uint32_t);
+    shaderCreateInfo.pCode = code.data();
+
+    VkResult result = vkCreateShaderModule(g_replay.device, &shaderCreateInfo, nullptr, &shader.module);
+    if (result != VK_SUCCESS)
+    {
+        printf("Could not create shader module for %s, try --shaders with SPIR-V builds of the shaders\n", shader.name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool createBuffer(ReplayBuffer &buffer)
+{
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = buffer.info.size;
+    bufferInfo.usage = buffer.info.usage;
+
+    VkResult result = vkCreateBuffer(g_replay.device, &bufferInfo, nullptr, &buffer.buffer);
+    assert(result == VK_SUCCESS);
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(g_replay.device, buffer.buffer, &memReqs);
+
+    // coherent so per frame updates need no flush
+    VkMemoryAllocateInfo memAllocInfo = {};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memReqs.size;
+    if (!memoryTypeFromProperties(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memAllocInfo.memoryTypeIndex))
+    {
+        return false;
+    }
+
+    result = vkAllocateMemory(g_replay.device, &memAllocInfo, nullptr, &buffer.memory);
+    assert(result == VK_SUCCESS);
+    vkBindBufferMemory(g_replay.device, buffer.buffer, buffer.memory, 0);
+
+    result = vkMapMemory(g_replay.device, buffer.memory, 0, VK_WHOLE_SIZE, 0, &buffer.mapped);
+    assert(result == VK_SUCCESS);
+
+    memcpy(buffer.mapped, buffer.initialData.data(), buffer.initialData.size());
+
+    return true;
+}
+
+static bool createPipeline(ReplayPipeline &pipeline)
+{
+    const CapturePipeline &info = pipeline.info;
+
+    if (g_replay.shaders.count(info.vertexShader) == 0 || g_replay.shaders.count(info.fragmentShader) == 0 ||
+        info.attributeCount > CAPTURE_MAX_VERTEX_ATTRIBUTES || info.specConstantCount > CAPTURE_MAX_SPEC_CONSTANTS)
+    {
+        printf("Pipeline %u is invalid\n", info.id);
+        return false;
+    }
+
+    // the mesh's vertices and the world transforms of the instances
+    VkVertexInputBindingDescription bindingDescriptions[2] = {};
+    bindingDescriptions[0].binding = 0;
+    bindingDescriptions[0].stride = info.vertexStride;
+    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    bindingDescriptions[1].binding = 1;
+    bindingDescriptions[1].stride = info.instanceStride;
+    bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    VkVertexInputAttributeDescription attributeDescriptions[CAPTURE_MAX_VERTEX_ATTRIBUTES];
+    for (uint32_t i = 0; i < info.attributeCount; i++)
+    {
+        if (info.attributes[i].binding > 1 || (info.attributes[i].binding == 1 && info.instanceStride == 0))
+        {
+            printf("Pipeline %u is invalid\n", info.id);
+            return false;
+        }
+        attributeDescriptions[i].binding = info.attributes[i].binding;
+        attributeDescriptions[i].location = info.attributes[i].location;
+        attributeDescriptions[i].format = static_cast<VkFormat>(info.attributes[i].format);
+        attributeDescriptions[i].offset = info.attributes[i].offset;
+    }
+
+    VkPipelineVertexInputStateCreateInfo inputState = {};
+    inputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    inputState.vertexBindingDescriptionCount = (info.instanceStride > 0) ? 2 : 1;
+    inputState.pVertexBindingDescriptions = bindingDescriptions;
+    inputState.vertexAttributeDescriptionCount = info.attributeCount;
+    inputState.pVertexAttributeDescriptions = attributeDescriptions;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
+    inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssemblyState.topology = static_cast<VkPrimitiveTopology>(info.topology);
+
+    VkPipelineRasterizationStateCreateInfo rasterizationState = {};
+    rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizationState.cullMode = info.cullMode;
+    rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizationState.lineWidth = 1.0f;
+
+    VkPipelineColorBlendAttachmentState blendAttachmentState = {};
+    blendAttachmentState.colorWriteMask = 0xf;
+
+    VkPipelineColorBlendStateCreateInfo colorBlendState = {};
+    colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlendState.attachmentCount = 1;
+    colorBlendState.pAttachments = &blendAttachmentState;
+
+    VkPipelineViewportStateCreateInfo viewportState = {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    VkDynamicState dynamicStateEnables[2] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStateEnables;
+
+    VkPipelineDepthStencilStateCreateInfo depthStencilState = {};
+    depthStencilState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencilState.depthTestEnable = info.depthTest ? VK_TRUE : VK_FALSE;
+    depthStencilState.depthWriteEnable = info.depthTest ? VK_TRUE : VK_FALSE;
+    depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+    VkPipelineMultisampleStateCreateInfo multisampleState = {};
+    multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkSpecializationMapEntry specializationEntries[CAPTURE_MAX_SPEC_CONSTANTS];
+    for (uint32_t i = 0; i < info.specConstantCount; i++)
+    {
+        specializationEntries[i].constantID = i;
+        specializationEntries[i].offset = i * sizeof(uint32_t);
+        specializationEntries[i].size = sizeof(uint32_t);
+    }
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = info.specConstantCount;
+    specializationInfo.pMapEntries = specializationEntries;
+    specializationInfo.dataSize = info.specConstantCount * sizeof(uint32_t);
+    specializationInfo.pData = info.specConstants;
+
+    VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = g_replay.shaders[info.vertexShader].module;
+    shaderStages[0].pName = "main";
+    shaderStages[0].pSpecializationInfo = &specializationInfo;
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = g_replay.shaders[info.fragmentShader].module;
+    shaderStages[1].pName = "main";
+    shaderStages[1].pSpecializationInfo = &specializationInfo;
+
+    VkGraphicsPipelineCreateInfo gfxPipelineCreateInfo = {};
+    gfxPipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    gfxPipelineCreateInfo.layout = g_replay.pipelineLayout;
+    gfxPipelineCreateInfo.renderPass = g_replay.renderPass;
+    gfxPipelineCreateInfo.stageCount = 2;
+    gfxPipelineCreateInfo.pStages = shaderStages;
+    gfxPipelineCreateInfo.pVertexInputState = &inputState;
+    gfxPipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+    gfxPipelineCreateInfo.pRasterizationState = &rasterizationState;
+    gfxPipelineCreateInfo.pColorBlendState = &colorBlendState;
+    gfxPipelineCreateInfo.pMultisampleState = &multisampleState;
+    gfxPipelineCreateInfo.pViewportState = &viewportState;
+    gfxPipelineCreateInfo.pDepthStencilState = &depthStencilState;
+    gfxPipelineCreateInfo.pDynamicState = &dynamicState;
+
+    VkResult result = vkCreateGraphicsPipelines(g_replay.device, VK_NULL_HANDLE, 1, &gfxPipelineCreateInfo, nullptr, &pipeline.pipeline);
+
+    return (result == VK_SUCCESS);
+}
+
+static bool initResources(const char* shaderDir)
+{
+    // one layout for every captured pipeline, see CapturePipeline
+    g_replay.pushConstantSize = 0;
+    for (auto &pipeline : g_replay.pipelines)
+    {
+        g_replay.pushConstantSize = std::max(g_replay.pushConstantSize, pipeline.second.info.pushConstantSize);
+    }
+
+    VkDescriptorSetLayoutBinding layoutBinding = {};
+    layoutBinding.binding = 0;
+    layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    layoutBinding.descriptorCount = 1;
+    layoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    VkDescriptorSetLayoutCreateInfo descSetCreateInfo = {};
+    descSetCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descSetCreateInfo.bindingCount = 1;
+    descSetCreateInfo.pBindings = &layoutBinding;
+
+    vkCreateDescriptorSetLayout(g_replay.device, &descSetCreateInfo, nullptr, &g_replay.descriptorSetLayout);
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = g_replay.pushConstantSize;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &g_replay.descriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = g_replay.pushConstantSize > 0 ? 1 : 0;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    vkCreatePipelineLayout(g_replay.device, &pipelineLayoutCreateInfo, nullptr, &g_replay.pipelineLayout);
+
+    for (auto &shader : g_replay.shaders)
+    {
+        if (!loadShaderModule(shader.second, shaderDir))
+        {
+            return false;
+        }
+    }
+
+    uint32_t uniformBufferCount = 0;
+    for (auto &buffer : g_replay.buffers)
+    {
+        if (!createBuffer(buffer.second))
+        {
+            return false;
+        }
+        if (buffer.second.info.usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+        {
+            uniformBufferCount++;
+        }
+    }
+
+    for (auto &pipeline : g_replay.pipelines)
+    {
+        if (!createPipeline(pipeline.second))
+        {
+            printf("Could not create pipeline %u\n", pipeline.first);
+            return false;
+        }
+    }
+
+    if (uniformBufferCount == 0)
+    {
+        return true;
+    }
+
+    // one descriptor set per uniform buffer
+    VkDescriptorPoolSize poolSize = {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSize.descriptorCount = uniformBufferCount;
+
+    VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+    descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolInfo.maxSets = uniformBufferCount;
+    descriptorPoolInfo.poolSizeCount = 1;
+    descriptorPoolInfo.pPoolSizes = &poolSize;
+
+    vkCreateDescriptorPool(g_replay.device, &descriptorPoolInfo, nullptr, &g_replay.descriptorPool);
+
+    for (auto &buffer : g_replay.buffers)
+    {
+        if (!(buffer.second.info.usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT))
+        {
+            continue;
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = g_replay.descriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &g_replay.descriptorSetLayout;
+
+        VkResult result = vkAllocateDescriptorSets(g_replay.device, &allocInfo, &buffer.second.descriptorSet);
+        assert(result == VK_SUCCESS);
+
+        VkDescriptorBufferInfo bufferDescriptor = {};
+        bufferDescriptor.buffer = buffer.second.buffer;
+        bufferDescriptor.offset = 0;
+        bufferDescriptor.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet writeDescriptorSet = {};
+        writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeDescriptorSet.dstSet = buffer.second.descriptorSet;
+        writeDescriptorSet.dstBinding = 0;
+        writeDescriptorSet.descriptorCount = 1;
+        writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        writeDescriptorSet.pBufferInfo = &bufferDescriptor;
+
+        vkUpdateDescriptorSets(g_replay.device, 1, &writeDescriptorSet, 0, nullptr);
+    }
+
+    return true;
+}
+
+static bool validateFrame(const ReplayFrame &frame)
+{
+    for (const ReplayUpdate &update : frame.updates)
+    {
+        auto buffer = g_replay.buffers.find(update.info.id);
+        if (buffer == g_replay.buffers.end() || update.info.offset + update.info.size > buffer->second.info.size)
+        {
+            printf("Frame %u updates an unknown buffer or writes out of bounds\n", frame.info.frameIndex);
+            return false;
+        }
+    }
+
+    for (const CaptureDraw &draw : frame.draws)
+    {
+        if (g_replay.pipelines.count(draw.pipeline) == 0 || g_replay.buffers.count(draw.vertexBuffer) == 0 ||
+            g_replay.buffers.count(draw.instanceBuffer) == 0 ||
+            g_replay.buffers.count(draw.indexBuffer) == 0 || g_replay.buffers.count(draw.uniformBuffer) == 0 ||
+            g_replay.buffers[draw.uniformBuffer].descriptorSet == VK_NULL_HANDLE ||
+            draw.pushConstantSize > g_replay.pushConstantSize)
+        {
+            printf("Frame %u has a draw with unknown resources\n", frame.info.frameIndex);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+struct FrameTiming
+{
+    double cpuMs;
+    double gpuMs;
+};
+
+static FrameTiming replayFrame(const ReplayFrame &frame)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (const ReplayUpdate &update : frame.updates)
+    {
+        ReplayBuffer &buffer = g_replay.buffers[update.info.id];
+        memcpy(static_cast<uint8_t*>(buffer.mapped) + update.info.offset, update.data.data(), update.data.size());
+    }
+
+    vkResetCommandPool(g_replay.device, g_replay.cmdPool, 0);
+
+    VkCommandBufferBeginInfo cmdBufferInfo = {};
+    cmdBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cmdBufferInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VkCommandBuffer cmd = g_replay.cmdBuffer;
+    vkBeginCommandBuffer(cmd, &cmdBufferInfo);
+
+    if (g_replay.timestampPool != VK_NULL_HANDLE)
+    {
+        vkCmdResetQueryPool(cmd, g_replay.timestampPool, 0, 2);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, g_replay.timestampPool, 0);
+    }
+
+    VkClearValue clearValues[2];
+    memcpy(clearValues[0].color.float32, g_replay.header.clearColor, sizeof(g_replay.header.clearColor));
+    clearValues[1].depthStencil = { 1.0f, 0 };
+
+    VkRenderPassBeginInfo renderPassBeginInfo = {};
+    renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassBeginInfo.renderPass = g_replay.renderPass;
+    renderPassBeginInfo.framebuffer = g_replay.framebuffer;
+    renderPassBeginInfo.renderArea.extent.width = g_replay.header.width;
+    renderPassBeginInfo.renderArea.extent.height = g_replay.header.height;
+    renderPassBeginInfo.clearValueCount = 2;
+    renderPassBeginInfo.pClearValues = clearValues;
+
+    vkCmdBeginRenderPass(cmd, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+    VkViewport viewport = {};
+    viewport.width = (float)g_replay.header.width;
+    viewport.height = (float)g_replay.header.height;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+    VkRect2D scissor = {};
+    scissor.extent.width = g_replay.header.width;
+    scissor.extent.height = g_replay.header.height;
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+    uint32_t boundPipeline = 0;
+    for (const CaptureDraw &draw : frame.draws)
+    {
+        if (draw.pipeline != boundPipeline)
+        {
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, g_replay.pipelines[draw.pipeline].pipeline);
+            boundPipeline = draw.pipeline;
+        }
+
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, g_replay.pipelineLayout, 0, 1, &g_replay.buffers[draw.uniformBuffer].descriptorSet, 0, nullptr);
+
+        if (draw.pushConstantSize > 0)
+        {
+            vkCmdPushConstants(cmd, g_replay.pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, draw.pushConstantSize, draw.pushConstants);
+        }
+
+        VkBuffer vertexBuffers[2] = { g_replay.buffers[draw.vertexBuffer].buffer, g_replay.buffers[draw.instanceBuffer].buffer };
+        VkDeviceSize offsets[2] = {0, 0};
+        vkCmdBindVertexBuffers(cmd, 0, 2, vertexBuffers, offsets);
+        vkCmdBindIndexBuffer(cmd, g_replay.buffers[draw.indexBuffer].buffer, 0, VK_INDEX_TYPE_UINT32);
+
+        vkCmdDrawIndexed(cmd, draw.indexCount, draw.instanceCount, draw.firstIndex, draw.vertexOffset, draw.firstInstance);
+    }
+
+    vkCmdEndRenderPass(cmd);
+
+    if (g_replay.timestampPool != VK_NULL_HANDLE)
+    {
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, g_replay.timestampPool, 1);
+    }
+
+    vkEndCommandBuffer(cmd);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+
+    VkResult result = vkQueueSubmit(g_replay.queue, 1, &submitInfo, g_replay.fence);
+    assert(result == VK_SUCCESS);
+
+    // every frame runs to completion, so frames don't overlap and the timings are stable
+    do
+    {
+        result = vkWaitForFences(g_replay.device, 1, &g_replay.fence, VK_TRUE, 100000000);
+    } while (result == VK_TIMEOUT);
+    vkResetFences(g_replay.device, 1, &g_replay.fence);
+
+    FrameTiming timing;
+    timing.cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    timing.gpuMs = 0.0;
+
+    if (g_replay.timestampPool != VK_NULL_HANDLE)
+    {
+        uint64_t timestamps[2];
+        result = vkGetQueryPoolResults(g_replay.device, g_replay.timestampPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+                                       VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        if (result == VK_SUCCESS)
+        {
+            uint64_t mask = g_replay.timestampValidBits >= 64 ? ~0ull : ((1ull << g_replay.timestampValidBits) - 1);
+            timing.gpuMs = ((timestamps[1] - timestamps[0]) & mask) * g_replay.gpuProps.limits.timestampPeriod / 1000000.0;
+        }
+    }
+
+    return timing;
+}
+
+static void printStats(const char* name, std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+
+    double sum = 0.0;
+    for (double sample : samples)
+    {
+        sum += sample;
+    }
+
+    size_t count = samples.size();
+    printf("    %-8s min %8.3f  avg %8.3f  median %8.3f  p95 %8.3f  max %8.3f ms\n", name,
+        samples[0], sum / count, samples[count / 2], samples[std::min(count - 1, count * 95 / 100)], samples[count - 1]);
+}
+
+static void destroyReplay()
+{
+    vkDeviceWaitIdle(g_replay.device);
+
+    for (auto &pipeline : g_replay.pipelines)
+    {
+        vkDestroyPipeline(g_replay.device, pipeline.second.pipeline, nullptr);
+    }
+    for (auto &shader : g_replay.shaders)
+    {
+        vkDestroyShaderModule(g_replay.device, shader.second.module, nullptr);
+    }
+    for (auto &buffer : g_replay.buffers)
+    {
+        vkDestroyBuffer(g_replay.device, buffer.second.buffer, nullptr);
+        vkFreeMemory(g_replay.device, buffer.second.memory, nullptr);
+    }
+
+    vkDestroyDescriptorPool(g_replay.device, g_replay.descriptorPool, nullptr);
+    vkDestroyPipelineLayout(g_replay.device, g_replay.pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(g_replay.device, g_replay.descriptorSetLayout, nullptr);
+    vkDestroyQueryPool(g_replay.device, g_replay.timestampPool, nullptr);
+    vkDestroyFence(g_replay.device, g_replay.fence, nullptr);
+    vkDestroyCommandPool(g_replay.device, g_replay.cmdPool, nullptr);
+    vkDestroyFramebuffer(g_replay.device, g_replay.framebuffer, nullptr);
+    vkDestroyRenderPass(g_replay.device, g_replay.renderPass, nullptr);
+
+    vkDestroyImageView(g_replay.device, g_replay.color.view, nullptr);
+    vkDestroyImage(g_replay.device, g_replay.color.image, nullptr);
+    vkFreeMemory(g_replay.device, g_replay.color.memory, nullptr);
+    vkDestroyImageView(g_replay.device, g_replay.depth.view, nullptr);
+    vkDestroyImage(g_replay.device, g_replay.depth.image, nullptr);
+    vkFreeMemory(g_replay.device, g_replay.depth.memory, nullptr);
+
+    vkDestroyDevice(g_replay.device, nullptr);
+    vkDestroyInstance(g_replay.instance, nullptr);
+}
+
+int main(int argc, char **argv)
+{
+    const char* capturePath = nullptr;
+    const char* shaderDir = nullptr;
+    uint32_t loops = 100;
+    uint32_t warmup = 10;
+    uint32_t deviceIndex = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--loops") == 0 && i + 1 < argc)
+        {
+            loops = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+        {
+            warmup = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc)
+        {
+            deviceIndex = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--shaders") == 0 && i + 1 < argc)
+        {
+            shaderDir = argv[++i];
+        }
+        else
+        {
+            capturePath = argv[i];
+        }
+    }
+
+    if (capturePath == nullptr || loops == 0)
+    {
+        printf("usage: %s <capture.vcap> [--loops N] [--warmup N] [--device N] [--shaders DIR]\n", argv[0]);
+        return 1;
+    }
+
+    if (!loadCapture(capturePath) || !initDevice(deviceIndex) || !initRenderTarget() || !initCommands() || !initResources(shaderDir))
+    {
+        return 1;
+    }
+
+    for (const ReplayFrame &frame : g_replay.frames)
+    {
+        if (!validateFrame(frame))
+        {
+            return 1;
+        }
+    }
+
+    // the warmup loops are not measured, they take pipeline compilation and first use costs out of the results
+    for (uint32_t loop = 0; loop < warmup; loop++)
+    {
+        for (const ReplayFrame &frame : g_replay.frames)
+        {
+            replayFrame(frame);
+        }
+    }
+
+    std::vector<double> cpuSamples;
+    std::vector<double> gpuSamples;
+
+    for (uint32_t loop = 0; loop < loops; loop++)
+    {
+        for (const ReplayFrame &frame : g_replay.frames)
+        {
+            FrameTiming timing = replayFrame(frame);
+            cpuSamples.push_back(timing.cpuMs);
+            gpuSamples.push_back(timing.gpuMs);
+        }
+    }
+
+    printf("Replayed %zu frames %u times\n", g_replay.frames.size(), loops);
+    printStats("frame", cpuSamples);
+    if (g_replay.timestampPool != VK_NULL_HANDLE)
+    {
+        printStats("gpu", gpuSamples);
+    }
+
+    destroyReplay();
+
+    return 0;
+}
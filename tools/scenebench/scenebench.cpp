@@ -0,0 +1,238 @@
+/*
+    Times the scene transforms of frames in which a small part of a large
+    scene changes: some entities move, some are destroyed and as many are
+    created. The cost of a frame should follow what changed, not the size
+    of the scene, which the update of a frame where every entity moves is
+    printed against.
+
+    usage: scenebench [--changed PERCENT] [--frames N] [--seed N] [counts...]
+
+    The counts default to 1000000, the changed entities to 1% per frame. The
+    world transforms of every entity are checked against their parent's
+    after the last frame.
+
+    Build it from the repository root with src/scene.cpp, the Vulkan and
+    GLFW headers and glm, optimized or the timings mean little. The
+    scenebench task in .vscode/tasks.json does:
+        g++ -Wall -O2 -std=c++11 -Isrc tools/scenebench/scenebench.cpp src/scene.cpp -lpthread -DVK_USE_PLATFORM_XLIB_KHR -o scenebench
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include "main.h"
+
+// scene.cpp keeps its state in the application, nothing else of it is used
+VulkanApp g_app;
+
+// Entities are laid out like the streamed world, a root per cell and its objects below it
+const uint32_t BENCH_CELL_OBJECTS = 255;
+const float BENCH_WORLD_SIZE = 1000.0f;
+
+static double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static glm::mat4 randomTransform(std::mt19937 &random, float range)
+{
+    std::uniform_real_distribution<float> position(-range, range);
+    return glm::translate(glm::mat4(), glm::vec3(position(random), position(random), position(random)));
+}
+
+// The world transform of every object is its cell's times its own local
+// transform, which the benchmark keeps a copy of
+static uint32_t checkTransforms(const std::vector<EntityHandle> &cells, const std::vector<EntityHandle> &objects,
+                                const std::vector<uint32_t> &objectCells, const std::vector<glm::mat4> &objectLocals)
+{
+    uint32_t mismatches = 0;
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+        glm::mat4 expected = getWorldTransform(cells[objectCells[i]]) * objectLocals[i];
+        mismatches += (getWorldTransform(objects[i]) != expected) ? 1 : 0;
+    }
+    return mismatches;
+}
+
+static void runBenchmark(uint32_t count, float changedPercent, uint32_t frames, uint32_t seed)
+{
+    std::mt19937 random(seed);
+
+    uint32_t cellCount = std::max(count / (BENCH_CELL_OBJECTS + 1), 1u);
+
+    std::vector<EntityHandle> cells;
+    std::vector<EntityHandle> objects;
+    std::vector<uint32_t> objectCells;
+    std::vector<glm::mat4> objectLocals;
+
+    printf("%u entities\n", count);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t cell = 0; cell < cellCount; cell++)
+    {
+        cells.push_back(createEntity(INVALID_ENTITY, randomTransform(random, BENCH_WORLD_SIZE)));
+
+        // created one cell after the other, the way the world streams them in
+        uint64_t cellEnd = static_cast<uint64_t>(count - cellCount) * (cell + 1) / cellCount;
+        while (objects.size() < cellEnd)
+        {
+            objectLocals.push_back(randomTransform(random, 10.0f));
+            objectCells.push_back(cell);
+            objects.push_back(createEntity(cells[cell], objectLocals.back()));
+        }
+    }
+    double createMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    updateScene();
+    printf("  create        %9.2f ms, first update %.2f ms\n", createMs, elapsedMs(start));
+
+    // every entity moves, what a frame would cost if it touched the whole scene
+    for (EntityHandle cell : cells)
+    {
+        setLocalTransform(cell, randomTransform(random, BENCH_WORLD_SIZE));
+    }
+    start = std::chrono::steady_clock::now();
+    updateScene();
+    double fullMs = elapsedMs(start);
+    uint32_t fullUpdated = g_app.scene.updatedLastFrame;
+
+    // Half of the changed entities move, a quarter is destroyed and a
+    // quarter created. Objects move, cells stay, or everything in them moves
+    uint32_t changed = static_cast<uint32_t>(count * changedPercent / 100.0f);
+    uint32_t moving = changed / 2;
+    uint32_t replaced = changed / 4;
+
+    double changeMs = 0.0;
+    double updateMs = 0.0;
+    uint64_t updated = 0;
+
+    std::vector<uint32_t> picks(moving + replaced * 2);
+    std::vector<glm::mat4> transforms(moving + replaced);
+
+    for (uint32_t frame = 0; frame < frames; frame++)
+    {
+        // drawn ahead so the random numbers are not timed. The list of
+        // objects shrinks by one with every destroyed object
+        for (uint32_t i = 0; i < moving + replaced * 2; i++)
+        {
+            uint32_t range = (i < moving + replaced) ? static_cast<uint32_t>(objects.size()) - (i < moving ? 0 : i - moving) : cellCount;
+            picks[i] = std::uniform_int_distribution<uint32_t>(0, range - 1)(random);
+        }
+        for (glm::mat4 &transform : transforms)
+        {
+            transform = randomTransform(random, 10.0f);
+        }
+
+        // the lists the check goes through are kept along, which is cheap next to the scene
+        start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < moving; i++)
+        {
+            setLocalTransform(objects[picks[i]], transforms[i]);
+            objectLocals[picks[i]] = transforms[i];
+        }
+        for (uint32_t i = 0; i < replaced; i++)
+        {
+            uint32_t object = picks[moving + i];
+            destroyEntity(objects[object]);
+
+            objects[object] = objects.back();
+            objectCells[object] = objectCells.back();
+            objectLocals[object] = objectLocals.back();
+            objects.pop_back();
+            objectCells.pop_back();
+            objectLocals.pop_back();
+        }
+        for (uint32_t i = 0; i < replaced; i++)
+        {
+            uint32_t cell = picks[moving + replaced + i];
+            objects.push_back(createEntity(cells[cell], transforms[moving + i]));
+            objectCells.push_back(cell);
+            objectLocals.push_back(transforms[moving + i]);
+        }
+        changeMs += elapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        updateScene();
+        updateMs += elapsedMs(start);
+        updated += g_app.scene.updatedLastFrame;
+    }
+
+    printf("  all moved     %9.3f ms, %u updated\n", fullMs, fullUpdated);
+    printf("  %4.1f%% changed %9.3f ms per frame, %.3f ms of it creating, destroying and moving, %.0f updated, %.1fx\n",
+        changedPercent, (changeMs + updateMs) / frames, changeMs / frames, (double)updated / frames,
+        fullMs / std::max((changeMs + updateMs) / frames, 1e-6));
+
+    uint32_t mismatches = checkTransforms(cells, objects, objectCells, objectLocals);
+    if (mismatches != 0)
+    {
+        printf("  %u world transforms disagree with their parent's\n", mismatches);
+    }
+    if (g_app.scene.entityCount != cells.size() + objects.size())
+    {
+        printf("  the scene has %u entities, %u were created and not destroyed\n",
+            g_app.scene.entityCount, static_cast<uint32_t>(cells.size() + objects.size()));
+    }
+
+    // the cells take their objects with them
+    start = std::chrono::steady_clock::now();
+    for (EntityHandle cell : cells)
+    {
+        destroyEntity(cell);
+    }
+    updateScene();
+    printf("  destroy       %9.2f ms\n", elapsedMs(start));
+}
+
+int main(int argc, char **argv)
+{
+    float changedPercent = 1.0f;
+    uint32_t frames = 10;
+    uint32_t seed = 1;
+    std::vector<uint32_t> counts;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--changed") == 0 && i + 1 < argc)
+        {
+            changedPercent = static_cast<float>(atof(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            frames = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            seed = static_cast<uint32_t>(atoi(argv[++i]));
+        }
+        else
+        {
+            counts.push_back(static_cast<uint32_t>(atoi(argv[i])));
+        }
+    }
+
+    if (counts.empty())
+    {
+        counts.push_back(1000000);
+    }
+
+    initScene();
+
+    for (uint32_t count : counts)
+    {
+        if (count > 0)
+        {
+            runBenchmark(count, changedPercent, std::max(frames, 1u), seed);
+        }
+    }
+
+    destroyScene();
+
+    return 0;
+}